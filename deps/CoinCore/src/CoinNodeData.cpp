@@ -23,12 +23,122 @@
 
 #include <iomanip>
 #include <algorithm>
+#include <memory>
 
 #include <assert.h>
 
 using namespace Coin;
 using namespace std;
 
+// Number of bytes left to parse in a buffer of len bytes.
+static inline std::size_t remaining(std::size_t len, std::size_t pos)
+{
+    return pos < len ? len - pos : 0;
+}
+
+namespace
+{
+
+// Feeds serialized fields straight into a double SHA256 so transactions and sighash preimages never get built in memory.
+class HashWriter
+{
+public:
+    HashWriter() { SHA256_Init(&ctx_); }
+    HashWriter(const SHA256_CTX& ctx) : ctx_(ctx) { }
+
+    const SHA256_CTX& getContext() const { return ctx_; }
+
+    void write(const unsigned char* data, std::size_t len) { if (len) SHA256_Update(&ctx_, data, len); }
+    void write(const uchar_vector& data) { write(data.data(), data.size()); }
+
+    template<typename T>
+    void writeUint(T n)
+    {
+        unsigned char bytes[sizeof(T)];
+        for (std::size_t i = 0; i < sizeof(T); i++) { bytes[i] = (n >> (8 * i)) & 0xff; }
+        write(bytes, sizeof(T));
+    }
+
+    void writeVarInt(uint64_t n)
+    {
+        if (n < 0xfd)               { writeUint<uint8_t>(n); }
+        else if (n <= 0xffff)       { writeUint<uint8_t>(0xfd); writeUint<uint16_t>(n); }
+        else if (n <= 0xffffffff)   { writeUint<uint8_t>(0xfe); writeUint<uint32_t>(n); }
+        else                        { writeUint<uint8_t>(0xff); writeUint<uint64_t>(n); }
+    }
+
+    void writeScript(const uchar_vector& script) { writeVarInt(script.size()); write(script); }
+
+    void writeOutPoint(const OutPoint& outPoint)
+    {
+        unsigned char hash[32];
+        std::reverse_copy(outPoint.hash, outPoint.hash + 32, hash); // to big endian
+        write(hash, 32);
+        writeUint<uint32_t>(outPoint.index);
+    }
+
+    void writeTxIn(const TxIn& txIn)
+    {
+        writeOutPoint(txIn.previousOut);
+        writeScript(txIn.scriptSig);
+        writeUint<uint32_t>(txIn.sequence);
+    }
+
+    void writeTxOut(const TxOut& txOut)
+    {
+        writeUint<uint64_t>(txOut.value);
+        writeScript(txOut.scriptPubKey);
+    }
+
+    void writeScriptWitness(const ScriptWitness& scriptWitness)
+    {
+        writeVarInt(scriptWitness.stack.size());
+        for (auto& item: scriptWitness.stack) { writeScript(item); }
+    }
+
+    // Same bytes as Transaction::getSerialized(bWithWitness).
+    void writeTransaction(const Transaction& tx, bool bWithWitness)
+    {
+        bWithWitness = bWithWitness && tx.hasWitness();
+
+        writeUint<uint32_t>(tx.version);
+        if (bWithWitness) { writeUint<uint8_t>(0x00); writeUint<uint8_t>(0x01); } // mask + flags
+
+        writeVarInt(tx.inputs.size());
+        for (auto& input: tx.inputs) { writeTxIn(input); }
+
+        writeVarInt(tx.outputs.size());
+        for (auto& output: tx.outputs) { writeTxOut(output); }
+
+        if (bWithWitness)
+        {
+            for (auto& input: tx.inputs) { writeScriptWitness(input.scriptWitness); }
+        }
+
+        writeUint<uint32_t>(tx.lockTime);
+    }
+
+    void getHash(unsigned char hash[SHA256_DIGEST_LENGTH])
+    {
+        SHA256_Final(hash, &ctx_);
+        SHA256_Init(&ctx_);
+        SHA256_Update(&ctx_, hash, SHA256_DIGEST_LENGTH);
+        SHA256_Final(hash, &ctx_);
+    }
+
+    uchar_vector getHash()
+    {
+        uchar_vector hash(SHA256_DIGEST_LENGTH);
+        getHash(&hash[0]);
+        return hash;
+    }
+
+private:
+    SHA256_CTX ctx_;
+};
+
+}
+
 uchar_vector g_zero32bytes("0000000000000000000000000000000000000000000000000000000000000000");
 
 // Globals
@@ -124,6 +234,12 @@ uint32_t CoinNodeStructure::getChecksum() const
     return vch_to_uint<uint32_t>(uchar_vector(hash_.begin(), hash_.begin() + 4), LITTLE_ENDIAN_);
 }
 
+void CoinNodeStructure::setSerialized(const uchar_vector& bytes)
+{
+    std::size_t pos = 0;
+    setSerialized(bytes.data(), bytes.size(), pos);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // class VarInt implementation
@@ -158,19 +274,28 @@ uchar_vector VarInt::getSerialized() const
     return rval;
 }
 
-void VarInt::setSerialized(const uchar_vector& bytes)
+void VarInt::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_VAR_INT_SIZE)
+    std::size_t size = remaining(len, pos);
+    if (size < MIN_VAR_INT_SIZE)
         throw runtime_error("Invalid data - VarInt too small.");
 
-    if (bytes[0] < 0xfd)
-        this->value = bytes[0];
-    else if ((bytes[0] == 0xfd) && (bytes.size() >= 3))
-        this->value = vch_to_uint<uint16_t>(uchar_vector(bytes.begin() + 1, bytes.begin() + 3), LITTLE_ENDIAN_);
-    else if ((bytes[0] == 0xfe) && (bytes.size() >= 5))
-        this->value = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + 1, bytes.begin() + 5), LITTLE_ENDIAN_);
-    else if (bytes.size() >= 9)
-        this->value = vch_to_uint<uint64_t>(uchar_vector(bytes.begin() + 1, bytes.begin() + 9), LITTLE_ENDIAN_);
+    if (data[pos] < 0xfd) {
+        this->value = data[pos];
+        pos += 1;
+    }
+    else if ((data[pos] == 0xfd) && (size >= 3)) {
+        this->value = vch_to_uint<uint16_t>(data + pos + 1, LITTLE_ENDIAN_);
+        pos += 3;
+    }
+    else if ((data[pos] == 0xfe) && (size >= 5)) {
+        this->value = vch_to_uint<uint32_t>(data + pos + 1, LITTLE_ENDIAN_);
+        pos += 5;
+    }
+    else if ((data[pos] == 0xff) && (size >= 9)) {
+        this->value = vch_to_uint<uint64_t>(data + pos + 1, LITTLE_ENDIAN_);
+        pos += 9;
+    }
     else
         throw runtime_error("Invalid data - VarInt length is wrong.");
 }
@@ -194,13 +319,15 @@ uchar_vector VarString::getSerialized() const
     return rval;
 }
 
-void VarString::setSerialized(const uchar_vector& bytes)
+void VarString::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    VarInt length(bytes);
-    if (bytes.size() < length.getSize() + length.value)
+    VarInt length;
+    length.setSerialized(data, len, pos);
+    if (remaining(len, pos) < length.value)
         throw runtime_error("Invalid data - VarString too small.");
 
-    value = string(bytes.begin() + length.getSize(), bytes.begin() + length.getSize() + length.value);
+    value.assign((const char*)data + pos, length.value);
+    pos += length.value;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -253,24 +380,23 @@ void NetworkAddress::set(uint64_t services, const unsigned char ipv6_bytes[], ui
     this->hasTime = false;
 }
 
-void NetworkAddress::setSerialized(const uchar_vector& bytes)
+void NetworkAddress::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_NETWORK_ADDRESS_SIZE)
+    std::size_t size = remaining(len, pos);
+    if (size < MIN_NETWORK_ADDRESS_SIZE)
         throw runtime_error("Invalid data - NetworkAddress too small.");
 
-    uint pos = 0;
-    this->hasTime = (bytes.size() >= 30);
+    this->hasTime = (size >= 30);
     if (this->hasTime) {
-        this->time = vch_to_uint<uint32_t>(bytes, LITTLE_ENDIAN_);
+        this->time = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_);
         pos += sizeof(uint32_t);
     }
-    this->services = vch_to_uint<uint64_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + sizeof(uint64_t)), LITTLE_ENDIAN_);
+    this->services = vch_to_uint<uint64_t>(data + pos, LITTLE_ENDIAN_);
     pos += sizeof(uint64_t);
-    unsigned char ipv6_bytes[16];
-    uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 16).copyToArray(ipv6_bytes);
-    this->ipv6 = ipv6_bytes;
+    this->ipv6 = data + pos;
     pos += 16;
-    this->port = vch_to_uint<uint16_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + sizeof(uint16_t)), BIG_ENDIAN_);
+    this->port = vch_to_uint<uint16_t>(data + pos, BIG_ENDIAN_);
+    pos += sizeof(uint16_t);
 }
 
 string NetworkAddress::getName() const
@@ -342,17 +468,19 @@ uchar_vector MessageHeader::getSerialized() const
     return rval;
 }
 
-void MessageHeader::setSerialized(const uchar_vector& bytes)
+void MessageHeader::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_MESSAGE_HEADER_SIZE)
+    std::size_t size = remaining(len, pos);
+    if (size < MIN_MESSAGE_HEADER_SIZE)
         throw runtime_error("Invalid data - MessageHeader too small.");
 
-    this->magic = vch_to_uint<uint32_t>(bytes, LITTLE_ENDIAN_);
-    uchar_vector(bytes.begin() + 4, bytes.begin() + 16).copyToArray((unsigned char*)this->command);
-    this->length = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + 16, bytes.begin() + 20), LITTLE_ENDIAN_);
-    this->hasChecksum = (bytes.size() >= 24);
+    this->magic = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_);
+    memcpy(this->command, data + pos + 4, 12);
+    this->length = vch_to_uint<uint32_t>(data + pos + 16, LITTLE_ENDIAN_);
+    this->hasChecksum = (size >= 24);
     if (this->hasChecksum)
-        this->checksum = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + 20, bytes.begin() + 24), LITTLE_ENDIAN_);
+        this->checksum = vch_to_uint<uint32_t>(data + pos + 20, LITTLE_ENDIAN_);
+    pos += this->getSize();
 }
 
 string MessageHeader::toString() const
@@ -499,102 +627,109 @@ uchar_vector CoinNodeMessage::getSerialized() const
     return rval;
 }
 
-void CoinNodeMessage::setSerialized(const uchar_vector& bytes)
+CoinNodeMessage::CoinNodeMessage(const MessageHeader& header, const unsigned char* payload)
+    : header(header), pPayload(NULL)
+{
+    std::size_t pos = 0;
+    setSerializedPayload(payload, header.length, pos);
+}
+
+void CoinNodeMessage::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    this->header.setSerialized(bytes);
-    string command = this->header.command;
+    this->header.setSerialized(data, len, pos);
 //      if ((command == "version") || (command == "verack"))
 // VERSION_CHECKSUM_CHANGE
 /*      if (command == "verack")
             this->header.removeChecksum();
 */
-    if (bytes.size() < header.getSize() + header.length)
+    if (remaining(len, pos) < header.length)
         throw runtime_error("Invalid data - CoinNodeMessage too small.");
 
+    // The payload only sees its own bytes and the message ends where the header says it does.
+    std::size_t end = pos + header.length;
+    setSerializedPayload(data, end, pos);
+    pos = end;
+}
+
+void CoinNodeMessage::setSerializedPayload(const unsigned char* data, std::size_t len, std::size_t& pos)
+{
+    // The command is only null terminated if it is shorter than 12 characters.
+    string command(this->header.command, strnlen(this->header.command, 12));
+
     if (pPayload) {
         delete pPayload;
         pPayload = NULL;
     }
 
+    std::unique_ptr<CoinNodeStructure> payload;
     if (command == "version") {
-        this->pPayload =
-        new VersionMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new VersionMessage());
     }
     else if (command == "verack") {
-        this->pPayload = new BlankMessage("verack");
+        payload.reset(new BlankMessage("verack"));
     }
     else if (command == "mempool") {
-        this->pPayload = new BlankMessage("mempool");
+        payload.reset(new BlankMessage("mempool"));
     }
     else if (command == "addr") {
-        this->pPayload =
-            new AddrMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new AddrMessage());
     }
     else if (command == "inv") {
-        this->pPayload =
-            new Inventory(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new Inventory());
     }
     else if (command == "getdata") {
-        this->pPayload =
-            new GetDataMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new GetDataMessage());
     }
     else if (command == "notfound") {
-        this->pPayload =
-            new NotFoundMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new NotFoundMessage());
     }
     else if (command == "getblocks") {
-        this->pPayload =
-            new GetBlocksMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new GetBlocksMessage());
     }
     else if (command == "getheaders") {
-        this->pPayload =
-            new GetHeadersMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new GetHeadersMessage());
     }
     else if (command == "tx") {
-        this->pPayload =
-            new Transaction(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new Transaction());
     }
     else if (command == "block") {
-        this->pPayload =
-            new CoinBlock(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new CoinBlock());
     }
     else if (command == "merkleblock") {
-        this->pPayload =
-            new MerkleBlock(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new MerkleBlock());
     }
     else if (command == "headers") {
-        this->pPayload =
-            new HeadersMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new HeadersMessage());
     }
     else if (command == "getaddr") {
-        this->pPayload = new GetAddrMessage();
+        payload.reset(new GetAddrMessage());
     }
     else if (command == "filterload") {
-        this->pPayload =
-            new FilterLoadMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new FilterLoadMessage());
     }
     else if (command == "filteradd") {
-        this->pPayload =
-            new FilterAddMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new FilterAddMessage());
     }
     else if (command == "filterclear") {
-        this->pPayload = new BlankMessage("filterclear");
+        payload.reset(new BlankMessage("filterclear"));
     }
     else if (command == "ping") {
-        this->pPayload =
-            new PingMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new PingMessage());
     }
     else if (command == "pong") {
-        this->pPayload =
-            new PongMessage(uchar_vector(bytes.begin() + header.getSize(), bytes.begin() + header.getSize() + header.length));
+        payload.reset(new PongMessage());
     }
     else {
         string error_msg = "Unrecognized command: ";
         error_msg += command;
         throw runtime_error(error_msg.c_str());
     }
+
+    payload->setSerialized(data, len, pos);
+    this->pPayload = payload.release();
 }
 
+
 bool CoinNodeMessage::isChecksumValid() const
 {
     if (!this->pPayload) throw runtime_error("Message not initialized.");
@@ -677,39 +812,35 @@ uchar_vector VersionMessage::getSerialized() const
     return rval;
 }
 
-void VersionMessage::setSerialized(const uchar_vector& bytes)
+void VersionMessage::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_VERSION_MESSAGE_SIZE)
+    std::size_t size = remaining(len, pos);
+    if (size < MIN_VERSION_MESSAGE_SIZE)
         throw runtime_error("Invalid data - VersionMessage too small.");
 
-    version_ = vch_to_uint<uint32_t>(bytes, LITTLE_ENDIAN_);
-    if (version_ >= 70001 && bytes.size() < MIN_VERSION_MESSAGE_SIZE + 1)
+    version_ = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_);
+    if (version_ >= 70001 && size < MIN_VERSION_MESSAGE_SIZE + 1)
         throw runtime_error("Invalid data - VersionMessage is too small for version >= 70001.");
 
-    uint pos = 4;
-    services_ = vch_to_uint<uint64_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 8), LITTLE_ENDIAN_);
+    pos += 4;
+    services_ = vch_to_uint<uint64_t>(data + pos, LITTLE_ENDIAN_);
     pos += 8;
-    timestamp_ = vch_to_uint<uint64_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 8), LITTLE_ENDIAN_);
+    timestamp_ = vch_to_uint<uint64_t>(data + pos, LITTLE_ENDIAN_);
     pos += 8;
-    recipientAddress_ = NetworkAddress(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 26));
-    pos += 26;
-    senderAddress_ = NetworkAddress(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 26));
-    pos += 26;
-    nonce_ = vch_to_uint<uint64_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 8), LITTLE_ENDIAN_);
+    recipientAddress_.setSerialized(data, pos + 26, pos);
+    senderAddress_.setSerialized(data, pos + 26, pos);
+    nonce_ = vch_to_uint<uint64_t>(data + pos, LITTLE_ENDIAN_);
     pos += 8;
-    subVersion_ = VarString(uchar_vector(bytes.begin() + pos, bytes.end()));
-    pos += subVersion_.getSize();
-    if (bytes.size() < pos + 4)
+    subVersion_.setSerialized(data, len, pos);
+    if (remaining(len, pos) < 4)
         throw runtime_error("Invalid data - VersionMessage missing startHeight.");
-    startHeight_ = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 4), LITTLE_ENDIAN_);
-    if (version_ >= 70001)
-    {
-        pos += 4;
-        relay_ = (bytes[pos] != 0);
-    }
-    else
+    startHeight_ = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_);
+    pos += 4;
+    relay_ = true;
+    if (version_ >= 70001 && pos < len)
     {
-        relay_ = true;
+        relay_ = (data[pos] != 0);
+        pos++;
     }
 }
 
@@ -758,20 +889,20 @@ uchar_vector AddrMessage::getSerialized() const
     return rval;
 }
 
-void AddrMessage::setSerialized(const uchar_vector& bytes)
+void AddrMessage::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_ADDR_MESSAGE_SIZE)
+    if (remaining(len, pos) < MIN_ADDR_MESSAGE_SIZE)
         throw runtime_error("Invalid data - AddrMessage too small.");
 
     addrList.clear();
 
-    VarInt count(bytes);
-    uint pos = count.getSize();
-    for (uint i = 0; i < count.value; i++) {
-        NetworkAddress addr(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 30));
-        addrList.push_back(addr);
-        pos += 30;
-    }
+    VarInt count;
+    count.setSerialized(data, len, pos);
+    if (remaining(len, pos) / 30 < count.value)
+        throw runtime_error("Invalid data - AddrMessage too small.");
+
+    addrList.resize(count.value);
+    for (auto& addr: addrList) { addr.setSerialized(data, pos + 30, pos); }
 }
 
 string AddrMessage::toString() const
@@ -809,15 +940,14 @@ uchar_vector InventoryItem::getSerialized() const
     return rval;
 }
 
-void InventoryItem::setSerialized(const uchar_vector& bytes)
+void InventoryItem::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_INVENTORY_ITEM_SIZE)
+    if (remaining(len, pos) < MIN_INVENTORY_ITEM_SIZE)
         throw runtime_error("Invalid data - InventoryItem too small.");
 
-    this->itemType = vch_to_uint<uint32_t>(bytes, LITTLE_ENDIAN_);
-    uchar_vector hashBytes(bytes.begin() + 4, bytes.begin() + 36);
-    hashBytes.reverse(); // to big endian
-    hashBytes.copyToArray((unsigned char*)this->hash);
+    this->itemType = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_);
+    std::reverse_copy(data + pos + 4, data + pos + 36, this->hash); // to big endian
+    pos += 36;
 }
 
 string InventoryItem::toString() const
@@ -849,18 +979,15 @@ uchar_vector Inventory::getSerialized() const
     return data;
 }
 
-void Inventory::setSerialized(const uchar_vector& bytes)
+void Inventory::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    VarInt count(bytes);
-    uint pos = count.getSize();
-    if (bytes.size() < pos + MIN_INVENTORY_ITEM_SIZE*count.value)
+    VarInt count;
+    count.setSerialized(data, len, pos);
+    if (remaining(len, pos) / MIN_INVENTORY_ITEM_SIZE < count.value)
         throw runtime_error("Invalid data - message too small.");
 
-    for (uint i = 0; i < count.value; i++) {
-        uchar_vector field(bytes.begin() + pos, bytes.end());
-        InventoryItem item(field); pos += item.getSerialized().size();
-        (this->items).push_back(item);
-    }
+    this->items.resize(count.value);
+    for (auto& item: this->items) { item.setSerialized(data, len, pos); }
 }
 
 string Inventory::toString() const
@@ -957,23 +1084,23 @@ uchar_vector GetBlocksMessage::getSerialized() const
     return rval;
 }
 
-void GetBlocksMessage::setSerialized(const uchar_vector& bytes)
+void GetBlocksMessage::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_GET_BLOCKS_SIZE)
+    if (remaining(len, pos) < MIN_GET_BLOCKS_SIZE)
         throw runtime_error("Invalid data - GetBlocksMessage too small.");
 
-    this->version = vch_to_uint<uint32_t>(bytes, LITTLE_ENDIAN_); uint pos = 4;
-    VarInt count(uchar_vector(bytes.begin() + 4, bytes.end())); pos += count.getSize();
-    if (bytes.size() < pos + 32*(count.value + 1))
+    this->version = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_); pos += 4;
+    VarInt count;
+    count.setSerialized(data, len, pos);
+    if (remaining(len, pos) / 32 == 0 || remaining(len, pos) / 32 - 1 < count.value)
         throw runtime_error("Invalid data - GetBlocksMessage has wrong length.");
-    this->blockLocatorHashes.clear();
-    uchar_vector hash;
-    for (uint i = 0; i < count.value; i++) {
-        hash.assign(bytes.begin() + pos, bytes.begin() + pos + 32); pos += 32;
+
+    this->blockLocatorHashes.resize(count.value);
+    for (auto& hash: this->blockLocatorHashes) {
+        hash.assign(data + pos, data + pos + 32); pos += 32;
         hash.reverse();
-        this->blockLocatorHashes.push_back(hash);
     }
-    this->hashStop.assign(bytes.begin() + pos, bytes.begin() + pos + 32);
+    this->hashStop.assign(data + pos, data + pos + 32); pos += 32;
     this->hashStop.reverse();
 }
 
@@ -1018,24 +1145,23 @@ uchar_vector GetHeadersMessage::getSerialized() const
     return rval;
 }
 
-void GetHeadersMessage::setSerialized(const uchar_vector& bytes)
+void GetHeadersMessage::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_GET_BLOCKS_SIZE)
+    if (remaining(len, pos) < MIN_GET_BLOCKS_SIZE)
         throw runtime_error("Invalid data - GetHeadersMessage too small.");
 
-    this->version = vch_to_uint<uint32_t>(bytes, LITTLE_ENDIAN_); uint pos = 4;
-    VarInt count(uchar_vector(bytes.begin() + pos, bytes.end())); pos += count.getSize();
-    if (bytes.size() < pos + 32*(count.value + 1))
+    this->version = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_); pos += 4;
+    VarInt count;
+    count.setSerialized(data, len, pos);
+    if (remaining(len, pos) / 32 == 0 || remaining(len, pos) / 32 - 1 < count.value)
         throw runtime_error("Invalid data - GetHeadersMessage has wrong length.");
 
-    this->blockLocatorHashes.clear();
-    uchar_vector hash;
-    for (uint i = 0; i < count.value; i++) {
-        hash.assign(bytes.begin() + pos, bytes.begin() + pos + 32); pos += 32;
+    this->blockLocatorHashes.resize(count.value);
+    for (auto& hash: this->blockLocatorHashes) {
+        hash.assign(data + pos, data + pos + 32); pos += 32;
         hash.reverse();
-        this->blockLocatorHashes.push_back(hash);
     }
-    this->hashStop.assign(bytes.begin() + pos, bytes.begin() + pos + 32);
+    this->hashStop.assign(data + pos, data + pos + 32); pos += 32;
     this->hashStop.reverse();
 }
 
@@ -1083,16 +1209,14 @@ uchar_vector OutPoint::getSerialized() const
     return rval;
 }
 
-void OutPoint::setSerialized(const uchar_vector& bytes)
+void OutPoint::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_OUT_POINT_SIZE)
+    if (remaining(len, pos) < MIN_OUT_POINT_SIZE)
         throw runtime_error("Invalid data - OutPoint too small.");
 
-    uchar_vector hashBytes(bytes.begin(), bytes.begin() + 32);
-    hashBytes.reverse(); // to little endian
-
-    memcpy(this->hash, &hashBytes[0], 32);
-    this->index = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + 32, bytes.begin() + 36), LITTLE_ENDIAN_);
+    std::reverse_copy(data + pos, data + pos + 32, this->hash); // to little endian
+    this->index = vch_to_uint<uint32_t>(data + pos + 32, LITTLE_ENDIAN_);
+    pos += 36;
 }
 
 string OutPoint::toDelimited(const string& delimiter) const
@@ -1144,21 +1268,20 @@ uchar_vector ScriptWitness::getSerialized() const
     
 }
 
-void ScriptWitness::setSerialized(const uchar_vector& bytes)
+void ScriptWitness::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
     clear();
 
-    VarInt count(bytes);
-    uint pos = count.getSize();
+    VarInt count;
+    count.setSerialized(data, len, pos);
     for (uint i = 0; i < count.value; i++)
     {
-        VarInt size(uchar_vector(bytes.begin() + pos, bytes.end())); pos += size.getSize();
-        if (bytes.size() < pos + size.value)
+        VarInt size;
+        size.setSerialized(data, len, pos);
+        if (remaining(len, pos) < size.value)
             throw runtime_error("Invalid data - ScriptWitness parse error");
 
-        uchar_vector item;
-        item.assign(bytes.begin() + pos, bytes.begin() + pos + size.value); pos += size.value;
-        stack.push_back(item);
+        stack.push_back(uchar_vector(data + pos, data + pos + size.value)); pos += size.value;
     }
 }
 
@@ -1185,22 +1308,21 @@ uchar_vector TxIn::getSerialized(bool includeScriptSigLength) const
     return rval;
 }
 
-void TxIn::setSerialized(const uchar_vector& bytes)
+void TxIn::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_TX_IN_SIZE)
+    if (remaining(len, pos) < MIN_TX_IN_SIZE)
         throw runtime_error("Invalid data - TxIn too small.");
 
-    this->previousOut.setSerialized(bytes);
-    VarInt scriptLength(uchar_vector(bytes.begin() + 36, bytes.end()));
-    uint pos =  scriptLength.getSize() + 36;
-    if (bytes.size() < pos + scriptLength.value) {
-        cout << "TxIn: " << bytes.getHex() << endl;
+    this->previousOut.setSerialized(data, len, pos);
+    VarInt scriptLength;
+    scriptLength.setSerialized(data, len, pos);
+    if (remaining(len, pos) < scriptLength.value || remaining(len, pos) - scriptLength.value < 4)
         throw runtime_error("Invalid data - TxIn script length too small.");
-    }
 
-    this->scriptSig.assign(bytes.begin() + pos, bytes.begin() + pos + scriptLength.value);
+    this->scriptSig.assign(data + pos, data + pos + scriptLength.value);
     pos += scriptLength.value;
-    this->sequence = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 4), LITTLE_ENDIAN_);
+    this->sequence = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_);
+    pos += 4;
 }
 
 string TxIn::getAddress() const
@@ -1275,18 +1397,19 @@ uchar_vector TxOut::getSerialized() const
     return rval;
 }
 
-void TxOut::setSerialized(const uchar_vector& bytes)
+void TxOut::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_TX_OUT_SIZE)
+    if (remaining(len, pos) < MIN_TX_OUT_SIZE)
         throw runtime_error("Invalid data - TxOut too small.");
 
-    this->value = vch_to_uint<uint64_t>(bytes, LITTLE_ENDIAN_);
-    VarInt scriptLength(uchar_vector(bytes.begin() + 8, bytes.end()));
-    uint pos = scriptLength.getSize() + 8;
-    if (bytes.size() < pos + scriptLength.value)
+    this->value = vch_to_uint<uint64_t>(data + pos, LITTLE_ENDIAN_); pos += 8;
+    VarInt scriptLength;
+    scriptLength.setSerialized(data, len, pos);
+    if (remaining(len, pos) < scriptLength.value)
         throw runtime_error("Invalid data - TxOut script length too small.");
 
-    this->scriptPubKey.assign(bytes.begin() + pos, bytes.begin() + pos + scriptLength.value);
+    this->scriptPubKey.assign(data + pos, data + pos + scriptLength.value);
+    pos += scriptLength.value;
 }
 
 string TxOut::getAddress() const
@@ -1352,16 +1475,35 @@ Transaction::Transaction(const string& hex)
     this->setSerialized(bytes);
 }
 
+const Transaction::CachedHash& Transaction::getCachedHash(bool bWithWitness) const
+{
+    // Without witness data both serializations are the same.
+    bWithWitness = bWithWitness && hasWitness();
+
+    CachedHash& cached = bWithWitness ? witnessHash_ : txHash_;
+    if (!cached.isSet)
+    {
+        HashWriter writer;
+        writer.writeTransaction(*this, bWithWitness);
+
+        unsigned char hash[SHA256_DIGEST_LENGTH];
+        writer.getHash(hash);
+        cached.hash.assign(hash, hash + SHA256_DIGEST_LENGTH);
+        std::reverse(hash, hash + SHA256_DIGEST_LENGTH);
+        cached.hashLittleEndian.assign(hash, hash + SHA256_DIGEST_LENGTH);
+        cached.isSet = true;
+    }
+    return cached;
+}
+
 const uchar_vector& Transaction::getHash(bool bWithWitness) const
 {
-    hash_ = sha256_2(getSerialized(bWithWitness));
-    return hash_;
+    return getCachedHash(bWithWitness).hash;
 }
 
 const uchar_vector& Transaction::getHashLittleEndian(bool bWithWitness) const
 {
-    hashLittleEndian_ = sha256_2(getSerialized(bWithWitness)).getReverse();
-    return hashLittleEndian_;
+    return getCachedHash(bWithWitness).hashLittleEndian;
 }
 
 const uchar_vector& Transaction::getHash(hashfunc_t hashfunc, bool bWithWitness) const
@@ -1372,14 +1514,13 @@ const uchar_vector& Transaction::getHash(hashfunc_t hashfunc, bool bWithWitness)
 
 const uchar_vector& Transaction::getHashLittleEndian(hashfunc_t hashfunc, bool bWithWitness) const
 {
-    hashLittleEndian_ = hash_.getReverse();
+    hashLittleEndian_ = hashfunc(getSerialized(bWithWitness)).getReverse();
     return hashLittleEndian_;
 }
 
 uint32_t Transaction::getChecksum() const
 {
-    getHash(true);
-    return vch_to_uint<uint32_t>(uchar_vector(hash_.begin(), hash_.begin() + 4), LITTLE_ENDIAN_);
+    return vch_to_uint<uint32_t>(&getHash(true)[0], LITTLE_ENDIAN_);
 }
 
 uint64_t Transaction::getSize(bool bWithWitness) const
@@ -1465,61 +1606,60 @@ uchar_vector Transaction::getSerialized(bool bWithWitness) const
     return rval;
 }
 
-void Transaction::setSerialized(const uchar_vector& bytes)
+void Transaction::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_TRANSACTION_SIZE)
-        throw runtime_error(string("Invalid data - Transaction too small: ") + bytes.getHex());
+    if (remaining(len, pos) < MIN_TRANSACTION_SIZE)
+        throw runtime_error(string("Invalid data - Transaction too small: ") + uchar_vector(data + pos, data + std::max(pos, len)).getHex());
 
-    // version
-    this->version = vch_to_uint<uint32_t>(uchar_vector(bytes.begin(), bytes.begin() + 4), LITTLE_ENDIAN_);
+    resetHash();
 
-    uint pos = 4;
+    // version
+    this->version = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_);
+    pos += 4;
 
     int flags = 0;
-    if (bytes[pos] == 0)
+    if (data[pos] == 0)
     {
         // witness serialization
         pos++;
-        flags = bytes[pos++];
+        flags = data[pos++];
         if (flags != 1)
             throw runtime_error("Invalid data - unrecognized flags");
     }
 
+    // Inputs and outputs are parsed in place, and the vectors are sized up front as far as the remaining data allows so
+    // they are not copied as they grow.
+    VarInt count;
+
     // inputs
     this->inputs.clear();
-    VarInt count(uchar_vector(bytes.begin() + pos, bytes.end()));
-    pos += count.getSize();
-    uint64_t i;
-    for (i = 0; i < count.value; i++) {
-        TxIn txIn(uchar_vector(bytes.begin() + pos, bytes.end()));
-        this->addInput(txIn);
-        pos += txIn.getSize();
+    count.setSerialized(data, len, pos);
+    this->inputs.reserve(std::min<uint64_t>(count.value, remaining(len, pos) / MIN_TX_IN_SIZE));
+    for (uint64_t i = 0; i < count.value; i++) {
+        this->inputs.emplace_back();
+        this->inputs.back().setSerialized(data, len, pos);
     }
 
     // outputs
     this->outputs.clear();
-    count.setSerialized(uchar_vector(bytes.begin() + pos, bytes.end()));
-    pos += count.getSize();
-    for (i = 0; i < count.value; i++) {
-        TxOut txOut(uchar_vector(bytes.begin() + pos, bytes.end()));
-        this->addOutput(txOut);
-        pos += txOut.getSize();
+    count.setSerialized(data, len, pos);
+    this->outputs.reserve(std::min<uint64_t>(count.value, remaining(len, pos) / MIN_TX_OUT_SIZE));
+    for (uint64_t i = 0; i < count.value; i++) {
+        this->outputs.emplace_back();
+        this->outputs.back().setSerialized(data, len, pos);
     }
 
     if (flags != 0)
     {
-        for (auto& input: inputs)
-        {
-            input.scriptWitness.setSerialized(uchar_vector(bytes.begin() + pos, bytes.end()));
-            pos += input.scriptWitness.getSize();
-        }
+        for (auto& input: inputs) { input.scriptWitness.setSerialized(data, len, pos); }
     }
 
-    if (bytes.size() < pos + 4)
+    if (remaining(len, pos) < 4)
         throw runtime_error("Invalid data - Transaction missing lockTime.");
 
     // lock time
-    this->lockTime = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 4), LITTLE_ENDIAN_);
+    this->lockTime = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_);
+    pos += 4;
 }
 
 string Transaction::toString() const
@@ -1576,6 +1716,7 @@ void Transaction::clearScriptSigs()
 {
     for (uint i = 0; i < this->inputs.size(); i++)
         this->inputs[i].scriptSig.clear();
+    resetHash();
 }
 
 void Transaction::setScriptSig(uint index, const uchar_vector& scriptSig)
@@ -1583,6 +1724,7 @@ void Transaction::setScriptSig(uint index, const uchar_vector& scriptSig)
     if (index > inputs.size()-1)
         throw runtime_error("Index out of range.");
     inputs[index].scriptSig = scriptSig;
+    resetHash();
 }
 
 void Transaction::setScriptSig(uint index, const string& scriptSigHex)
@@ -1605,6 +1747,32 @@ uchar_vector Transaction::getHashWithAppendedCode(uint32_t code) const
     return sha256_2(this->getSerialized() + uint_to_vch(code, LITTLE_ENDIAN_));
 }
 
+namespace
+{
+
+uchar_vector getHashPrevouts(const std::vector<TxIn>& inputs)
+{
+    HashWriter writer;
+    for (auto& input: inputs) { writer.writeOutPoint(input.previousOut); }
+    return writer.getHash();
+}
+
+uchar_vector getHashSequence(const std::vector<TxIn>& inputs)
+{
+    HashWriter writer;
+    for (auto& input: inputs) { writer.writeUint<uint32_t>(input.sequence); }
+    return writer.getHash();
+}
+
+uchar_vector getHashOutputs(const std::vector<TxOut>& outputs)
+{
+    HashWriter writer;
+    for (auto& output: outputs) { writer.writeTxOut(output); }
+    return writer.getHash();
+}
+
+}
+
 uchar_vector Transaction::getSigHash(uint32_t hashType, uint index, const uchar_vector& script, uint64_t value) const
 {
     if (index >= inputs.size())
@@ -1616,61 +1784,132 @@ uchar_vector Transaction::getSigHash(uint32_t hashType, uint index, const uchar_
 
     if (inputs[index].scriptWitness.isEmpty())
     {
-        // Old sighash
-        Transaction copy(*this);
-        for (uint i = 0; i < copy.inputs.size(); i++)
+        // Old sighash - serialize with all other scriptSigs empty
+        HashWriter writer;
+        writer.writeUint<uint32_t>(version);
+        writer.writeVarInt(inputs.size());
+        for (uint i = 0; i < inputs.size(); i++)
         {
-            if (index == i) { copy.inputs[i].scriptSig = script; }
-            else            { copy.inputs[i].scriptSig.clear();  }
+            writer.writeOutPoint(inputs[i].previousOut);
+            if (index == i) { writer.writeScript(script); }
+            else            { writer.writeVarInt(0);      }
+            writer.writeUint<uint32_t>(inputs[i].sequence);
         }
-        return sha256_2(copy.getSerialized(false) + uint_to_vch(hashType, LITTLE_ENDIAN_));
-    }
+        writer.writeVarInt(outputs.size());
+        for (auto& output: outputs) { writer.writeTxOut(output); }
+        writer.writeUint<uint32_t>(lockTime);
+        writer.writeUint<uint32_t>(hashType);
+        return writer.getHash();
+    }
+
+    if (hashPrevouts.empty())   { hashPrevouts = getHashPrevouts(inputs);   }
+    if (hashSequence.empty())   { hashSequence = getHashSequence(inputs);   }
+    if (hashOutputs.empty())    { hashOutputs = getHashOutputs(outputs);    }
+
+    HashWriter writer;
+    writer.writeUint<uint32_t>(version);
+    writer.write(hashPrevouts);
+    writer.write(hashSequence);
+    writer.writeOutPoint(inputs[index].previousOut);
+    writer.writeScript(script);
+    writer.writeUint<uint64_t>(value);
+    writer.writeUint<uint32_t>(inputs[index].sequence);
+    writer.write(hashOutputs);
+    writer.writeUint<uint32_t>(lockTime);
+    writer.writeUint<uint32_t>(hashType);
+    return writer.getHash();
+}
 
-    if (hashPrevouts.empty())
-    {
-        uchar_vector ss;
-        for (auto& input: inputs) { ss += input.previousOut.getSerialized(); }
-//        std::cout << "prevouts: " << ss.getHex() << std::endl;
-        hashPrevouts = sha256_2(ss);
-    }
+void Transaction::resetSigHash()
+{
+    hashPrevouts.clear();
+    hashSequence.clear();
+    hashOutputs.clear();
+}
 
-    if (hashSequence.empty())
+///////////////////////////////////////////////////////////////////////////////
+//
+// class SigHashContext implementation
+//
+SigHashContext::SigHashContext(const Transaction& tx)
+    : lockTime_(tx.lockTime)
+{
+    Transaction unsignedTx(tx);
+    unsignedTx.clearScriptSigs();
+    txTemplate_ = unsignedTx.getSerialized(false);
+
+    bool hasLegacyInputs = false;
+    bool hasWitnessInputs = false;
+    for (auto& input: tx.inputs)
+    {
+        witnesses_.push_back(!input.scriptWitness.isEmpty());
+        if (witnesses_.back())  { hasWitnessInputs = true; }
+        else                    { hasLegacyInputs = true; }
+    }
+
+    // version + input count, then for each input an outpoint, an empty scriptSig and a sequence
+    std::size_t pos = 4 + VarInt(tx.inputs.size()).getSize();
+    std::size_t hashed = 0;
+    HashWriter writer;
+    scriptOffsets_.reserve(tx.inputs.size());
+    if (hasLegacyInputs) { midstates_.reserve(tx.inputs.size()); }
+    for (std::size_t i = 0; i < tx.inputs.size(); i++)
     {
-        uchar_vector ss;
-        for (auto& input: inputs) { ss += uint_to_vch(input.sequence, LITTLE_ENDIAN_); }
-//        std::cout << "sequence: " << ss.getHex() << std::endl;
-        hashSequence = sha256_2(ss);
+        pos += 36;
+        scriptOffsets_.push_back(pos);
+        if (hasLegacyInputs)
+        {
+            writer.write(&txTemplate_[hashed], pos - hashed);
+            hashed = pos;
+            midstates_.push_back(writer.getContext());
+        }
+        pos += 5;
     }
 
-    if (hashOutputs.empty())
+    if (hasWitnessInputs)
     {
-        uchar_vector ss;
-        for (auto& output: outputs) { ss += output.getSerialized(); }
-//        std::cout << "outputs: " << ss.getHex() << std::endl;
-        hashOutputs = sha256_2(ss);
-    }
-
-    uchar_vector ss;
-    ss += uint_to_vch(version, LITTLE_ENDIAN_);
-    ss += hashPrevouts;
-    ss += hashSequence;
-    ss += inputs[index].previousOut.getSerialized();
-    ss += VarInt(script.size()).getSerialized();
-    ss += script;
-    ss += uint_to_vch(value, LITTLE_ENDIAN_);
-    ss += uint_to_vch(inputs[index].sequence, LITTLE_ENDIAN_);
-    ss += hashOutputs;
-    ss += uint_to_vch(lockTime, LITTLE_ENDIAN_);
-    ss += uint_to_vch(hashType, LITTLE_ENDIAN_);
-//    std::cout << "data to hash: " << ss.getHex() << std::endl;
-    return sha256_2(ss);
+        hashPrevouts_ = getHashPrevouts(tx.inputs);
+        hashSequence_ = getHashSequence(tx.inputs);
+        hashOutputs_ = getHashOutputs(tx.outputs);
+
+        HashWriter witnessWriter;
+        witnessWriter.writeUint<uint32_t>(tx.version);
+        witnessWriter.write(hashPrevouts_);
+        witnessWriter.write(hashSequence_);
+        witnessMidstate_ = witnessWriter.getContext();
+    }
 }
 
-void Transaction::resetSigHash()
+uchar_vector SigHashContext::getSigHash(uint32_t hashType, uint index, const uchar_vector& script, uint64_t value) const
 {
-    hashPrevouts.clear();
-    hashSequence.clear();
-    hashOutputs.clear();
+    if (index >= scriptOffsets_.size())
+        throw runtime_error("Index out of range.");
+
+    // TODO: Add other hashtype support
+    if (hashType != SIGHASH_ALL)
+        throw runtime_error("Unsupported hash type.");
+
+    std::size_t offset = scriptOffsets_[index];
+
+    if (!witnesses_[index])
+    {
+        // Old sighash - splice the script into the template in place of the empty scriptSig
+        HashWriter writer(midstates_[index]);
+        writer.writeScript(script);
+        writer.write(&txTemplate_[offset + 1], txTemplate_.size() - offset - 1);
+        writer.writeUint<uint32_t>(hashType);
+        return writer.getHash();
+    }
+
+    HashWriter writer(witnessMidstate_);
+    writer.write(&txTemplate_[offset - 36], 36); // outpoint
+    writer.writeScript(script);
+    writer.writeUint<uint64_t>(value);
+    writer.write(&txTemplate_[offset + 1], 4); // sequence
+    writer.write(hashOutputs_);
+    writer.writeUint<uint32_t>(lockTime_);
+    writer.writeUint<uint32_t>(hashType);
+    return writer.getHash();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1678,10 +1917,45 @@ void Transaction::resetSigHash()
 // class CoinBlockHeader implementation
 //
 
-hashfunc_t CoinBlockHeader::hashfunc_ = &sha256_2; // use Hashcash as default. Change with CoinBlockHeader::setHashFunc(<hash function>).
-hashfunc_t CoinBlockHeader::powhashfunc_ = &sha256_2;
+// Function-local so that headers constructed during static initialization, like those of coin parameters, get them.
+header_hashfuncs_t& CoinBlockHeader::defaultHashFuncsStorage()
+{
+    static header_hashfuncs_t hashFuncs = std::make_shared<BlockHeaderHashFuncs>(&sha256_2, &sha256_2); // use Hashcash as default
+    return hashFuncs;
+}
+
+void CoinBlockHeader::setHashFunc(hashfunc_t hashfunc)
+{
+    // Retried if another thread replaced the defaults in the meantime so that neither change is lost.
+    header_hashfuncs_t current = defaultHashFuncs();
+    header_hashfuncs_t replacement;
+    do
+    {
+        replacement = std::make_shared<BlockHeaderHashFuncs>(hashfunc, current->powHash);
+    } while (!std::atomic_compare_exchange_weak(&defaultHashFuncsStorage(), &current, replacement));
+}
+
+void CoinBlockHeader::setPOWHashFunc(hashfunc_t hashfunc)
+{
+    header_hashfuncs_t current = defaultHashFuncs();
+    header_hashfuncs_t replacement;
+    do
+    {
+        replacement = std::make_shared<BlockHeaderHashFuncs>(current->hash, hashfunc);
+    } while (!std::atomic_compare_exchange_weak(&defaultHashFuncsStorage(), &current, replacement));
+}
+
+void CoinBlockHeader::setHashFuncs(const header_hashfuncs_t& hashFuncs)
+{
+    if (!hashFuncs) throw std::runtime_error("CoinBlockHeader::setHashFuncs() - missing hash functions.");
+    if (hashFuncs == hashFuncs_) return;
+
+    hashFuncs_ = hashFuncs;
+    resetHash();
+}
 
 CoinBlockHeader::CoinBlockHeader(const string& hex)
+    : hashFuncs_(defaultHashFuncs())
 {
     uchar_vector bytes;
     bytes.setHex(hex);
@@ -1701,24 +1975,22 @@ uchar_vector CoinBlockHeader::getSerialized() const
     return rval;
 }
 
-void CoinBlockHeader::setSerialized(const uchar_vector& bytes)
+void CoinBlockHeader::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_COIN_BLOCK_HEADER_SIZE)
+    if (remaining(len, pos) < MIN_COIN_BLOCK_HEADER_SIZE)
         throw runtime_error("Invalid data - CoinBlockHeader too small.");
 
-    version_ = vch_to_uint<uint32_t>(bytes, LITTLE_ENDIAN_); uint pos = 4;
+    version_ = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_); pos += 4;
 
-    uchar_vector subbytes(bytes.begin() + pos, bytes.begin() + pos + 32); pos += 32;
-    subbytes.reverse();
-    prevBlockHash_ = subbytes;
+    prevBlockHash_.assign(data + pos, data + pos + 32); pos += 32;
+    prevBlockHash_.reverse();
 
-    subbytes.assign(bytes.begin() + pos, bytes.begin() + pos + 32); pos += 32;
-    subbytes.reverse();
-    merkleRoot_ = subbytes;
+    merkleRoot_.assign(data + pos, data + pos + 32); pos += 32;
+    merkleRoot_.reverse();
 
-    timestamp_ = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 4), LITTLE_ENDIAN_); pos += 4;
-    bits_ = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 4), LITTLE_ENDIAN_); pos += 4;
-    nonce_ = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 4), LITTLE_ENDIAN_); pos += 4;
+    timestamp_ = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_); pos += 4;
+    bits_ = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_); pos += 4;
+    nonce_ = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_); pos += 4;
 
     resetHash();
 }
@@ -1801,7 +2073,7 @@ const uchar_vector& CoinBlockHeader::getHash() const
 {
     if (!isHashSet_)
     {
-        hash_ = CoinNodeStructure::getHash(hashfunc_);
+        hash_ = CoinNodeStructure::getHash(hashFuncs_->hash);
         hashLittleEndian_ = hash_.getReverse();
         isHashSet_ = true;
     }
@@ -1812,7 +2084,7 @@ const uchar_vector& CoinBlockHeader::getHashLittleEndian() const
 {
     if (!isHashSet_)
     {
-        hash_ = CoinNodeStructure::getHash(hashfunc_);
+        hash_ = CoinNodeStructure::getHash(hashFuncs_->hash);
         hashLittleEndian_ = hash_.getReverse();
         isHashSet_ = true;
     }
@@ -1823,7 +2095,7 @@ const uchar_vector& CoinBlockHeader::getPOWHash() const
 {
     if (!isPOWHashSet_)
     {
-        POWHash_ = CoinNodeStructure::getHash(powhashfunc_);
+        POWHash_ = CoinNodeStructure::getHash(hashFuncs_->powHash);
         POWHashLittleEndian_ = POWHash_.getReverse();
         isPOWHashSet_ = true;
     }
@@ -1834,7 +2106,7 @@ const uchar_vector& CoinBlockHeader::getPOWHashLittleEndian() const
 {
     if (!isPOWHashSet_)
     {
-        POWHash_ = CoinNodeStructure::getHash(powhashfunc_);
+        POWHash_ = CoinNodeStructure::getHash(hashFuncs_->powHash);
         POWHashLittleEndian_ = POWHash_.getReverse();
         isPOWHashSet_ = true;
     }
@@ -1871,22 +2143,23 @@ uchar_vector CoinBlock::getSerialized() const
     return rval;
 }
 
-void CoinBlock::setSerialized(const uchar_vector& bytes)
+void CoinBlock::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_COIN_BLOCK_SIZE)
+    if (remaining(len, pos) < MIN_COIN_BLOCK_SIZE)
         throw runtime_error("Invalid data - CoinBlock too small.");
 
-    this->blockHeader.setSerialized(bytes);
-    uint pos = MIN_COIN_BLOCK_HEADER_SIZE;
+    this->blockHeader.setSerialized(data, len, pos);
 
     MerkleTree txMerkleTree;
-    VarInt count(uchar_vector(bytes.begin() + pos, bytes.end())); pos += count.getSize();
+    VarInt count;
+    count.setSerialized(data, len, pos);
+    this->txs.clear();
+    this->txs.reserve(std::min<uint64_t>(count.value, remaining(len, pos) / MIN_TRANSACTION_SIZE));
     for (uint i = 0; i < count.value; i++) {
-        Transaction tx(uchar_vector(bytes.begin() + pos, bytes.end())); pos += tx.getSize();
-        this->txs.push_back(tx);
+        this->txs.emplace_back();
+        Transaction& tx = this->txs.back();
+        tx.setSerialized(data, len, pos);
         txMerkleTree.addHash(tx.getHash());
-        if (bytes.size() < pos)
-            throw runtime_error("Invalid data - CoinBlock transactions exceed block size.");
     }
     if (blockHeader.merkleRoot() != txMerkleTree.getRootLittleEndian()) {
         throw runtime_error("Invalid data - CoinBlock merkle root mismatch.");
@@ -2013,33 +2286,32 @@ uchar_vector MerkleBlock::getSerialized() const
     return rval;
 }
 
-void MerkleBlock::setSerialized(const uchar_vector& bytes)
+void MerkleBlock::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_MERKLE_BLOCK_SIZE)
+    if (remaining(len, pos) < MIN_MERKLE_BLOCK_SIZE)
         throw runtime_error("Invalid data - MerkleBlock too small.");
 
-    this->blockHeader.setSerialized(bytes);
-    uint pos = MIN_COIN_BLOCK_HEADER_SIZE;
+    this->blockHeader.setSerialized(data, len, pos);
 
-    nTxs = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 4), LITTLE_ENDIAN_); pos += 4;
+    nTxs = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_); pos += 4;
 
-    VarInt nHashes(uchar_vector(bytes.begin() + pos, bytes.end())); pos += nHashes.getSize();
-    if (bytes.size() < pos + (nHashes.value * 32) + 1)
+    VarInt nHashes;
+    nHashes.setSerialized(data, len, pos);
+    if (remaining(len, pos) / 32 < nHashes.value || remaining(len, pos) - nHashes.value * 32 < 1)
         throw runtime_error("Invalid data - MerkleBlock hash count invalid.");
 
-    hashes.clear();
-    for (uint i = 0; i < nHashes.value; i++) {
-        hashes.push_back(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 32)); pos += 32;
+    hashes.resize(nHashes.value);
+    for (auto& hash: hashes) {
+        hash.assign(data + pos, data + pos + 32); pos += 32;
     }
-        
-    VarInt nFlags(uchar_vector(bytes.begin() + pos, bytes.end())); pos += nFlags.getSize();
-    if (bytes.size() < pos + nFlags.value)
+
+    VarInt nFlags;
+    nFlags.setSerialized(data, len, pos);
+    if (remaining(len, pos) < nFlags.value)
         throw runtime_error("Invalid data - MerkleBlock flag count invalid.");
 
-    flags.clear();
-    for (uint i = 0; i < nFlags.value; i++) {
-        flags.push_back(bytes[pos + i]);
-    }
+    flags.assign(data + pos, data + pos + nFlags.value);
+    pos += nFlags.value;
 }
 
 string MerkleBlock::toString() const
@@ -2107,18 +2379,17 @@ uchar_vector HeadersMessage::getSerialized() const
     return rval;
 }
 
-void HeadersMessage::setSerialized(const uchar_vector& bytes)
+void HeadersMessage::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    VarInt count(bytes);
-    if (bytes.size() < count.getSize() + count.value*(MIN_COIN_BLOCK_HEADER_SIZE + 1))
+    VarInt count;
+    count.setSerialized(data, len, pos);
+    if (remaining(len, pos) / (MIN_COIN_BLOCK_HEADER_SIZE + 1) < count.value)
         throw runtime_error("Invalid data - HeadersMessage too small.");
 
-    uint pos = count.getSize();
-    this->headers.clear();
-    for (uint i = 0; i < count.value; i++) {
-        CoinBlockHeader header(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + MIN_COIN_BLOCK_HEADER_SIZE));
-        this->headers.push_back(header);
-        pos += MIN_COIN_BLOCK_HEADER_SIZE + 1; // an extra blank byte is added.
+    this->headers.resize(count.value);
+    for (auto& header: this->headers) {
+        header.setSerialized(data, pos + MIN_COIN_BLOCK_HEADER_SIZE, pos);
+        pos++; // an extra blank byte is added.
     }
 }
 
@@ -2163,23 +2434,22 @@ uchar_vector FilterLoadMessage::getSerialized() const
     return rval;
 }
 
-void FilterLoadMessage::setSerialized(const uchar_vector& bytes)
+void FilterLoadMessage::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < MIN_FILTER_LOAD_SIZE) {
+    if (remaining(len, pos) < MIN_FILTER_LOAD_SIZE) {
         throw std::runtime_error("Invalid data - FilterLoadMessage too small.");
     }
 
-    VarInt filterSize(bytes);
-    std::size_t filterSizeLength = filterSize.getSize();
-    if (bytes.size() != filterSizeLength + filterSize.value + 9) {
+    VarInt filterSize;
+    filterSize.setSerialized(data, len, pos);
+    if (remaining(len, pos) < filterSize.value || remaining(len, pos) - filterSize.value != 9) {
         throw std::runtime_error("Invalid data - filter length incorrect.");
     }
 
-    uint pos = filterSizeLength + filterSize.value;
-    filter.assign(bytes.begin() + filterSizeLength, bytes.begin() + pos);
-    nHashFuncs = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 4), LITTLE_ENDIAN_); pos += 4;
-    nTweak = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 4), LITTLE_ENDIAN_); pos += 4;
-    nFlags = (uint8_t)bytes[pos]; 
+    filter.assign(data + pos, data + pos + filterSize.value); pos += filterSize.value;
+    nHashFuncs = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_); pos += 4;
+    nTweak = vch_to_uint<uint32_t>(data + pos, LITTLE_ENDIAN_); pos += 4;
+    nFlags = (uint8_t)data[pos]; pos += 1;
 }
 
 std::string FilterLoadMessage::toString() const
@@ -2196,19 +2466,20 @@ std::string FilterLoadMessage::toIndentedString(uint spaces) const
 //
 // class FilterAddMessage implementation
 //
-void FilterAddMessage::setSerialized(const uchar_vector& bytes)
+void FilterAddMessage::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.empty()) {
+    if (remaining(len, pos) == 0) {
         throw std::runtime_error("Invalid data - cannot be empty.");
     }
 
-    VarInt dataSize(bytes);
-    uint pos = dataSize.getSize();
-    if (bytes.size() < pos + dataSize.value) {
+    VarInt dataSize;
+    dataSize.setSerialized(data, len, pos);
+    if (remaining(len, pos) < dataSize.value) {
         throw std::runtime_error("Invalid data - too short.");
     }
 
-    data.assign(bytes.begin() + pos, bytes.begin() + pos + dataSize.value);
+    this->data.assign(data + pos, data + pos + dataSize.value);
+    pos += dataSize.value;
 }
 
 std::string FilterAddMessage::toString() const
@@ -2235,13 +2506,14 @@ uchar_vector PingMessage::getSerialized() const
     return uint_to_vch(nonce, LITTLE_ENDIAN_);
 }
 
-void PingMessage::setSerialized(const uchar_vector& bytes)
+void PingMessage::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < sizeof(uint64_t)) {
+    if (remaining(len, pos) < sizeof(uint64_t)) {
         throw std::runtime_error("Invalid data - PingMessage too small.");
     }
 
-    nonce = vch_to_uint<uint64_t>(uchar_vector(bytes.begin(), bytes.begin() + 8), LITTLE_ENDIAN_);
+    nonce = vch_to_uint<uint64_t>(data + pos, LITTLE_ENDIAN_);
+    pos += sizeof(uint64_t);
 }
 
 std::string PingMessage::toString() const
@@ -2263,13 +2535,14 @@ uchar_vector PongMessage::getSerialized() const
     return uint_to_vch(nonce, LITTLE_ENDIAN_);
 }
 
-void PongMessage::setSerialized(const uchar_vector& bytes)
+void PongMessage::setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos)
 {
-    if (bytes.size() < sizeof(uint64_t)) {
+    if (remaining(len, pos) < sizeof(uint64_t)) {
         throw std::runtime_error("Invalid data - PongMessage too small.");
     }
 
-    nonce = vch_to_uint<uint64_t>(uchar_vector(bytes.begin(), bytes.begin() + 8), LITTLE_ENDIAN_);
+    nonce = vch_to_uint<uint64_t>(data + pos, LITTLE_ENDIAN_);
+    pos += sizeof(uint64_t);
 }
 
 std::string PongMessage::toString() const
@@ -21,6 +21,7 @@
 
 #include <functional>
 #include <list>
+#include <memory>
 #include <queue>
 
 #include <stdio.h>
@@ -111,7 +112,11 @@ public:
     virtual uint32_t getChecksum() const; // 4 least significant bytes, little endian
 
     virtual uchar_vector getSerialized() const = 0;
-    virtual void setSerialized(const uchar_vector& bytes) = 0;
+
+    // Parses the structure starting at data[pos] without reading at or beyond data[len] and advances pos past it.
+    // Nested structures are parsed in place, so only the fields themselves are copied out of the buffer.
+    virtual void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos) = 0;
+    void setSerialized(const uchar_vector& bytes); // parses from the start of bytes, ignoring any trailing bytes
 
     virtual std::string toString() const = 0;
     virtual std::string toIndentedString(uint spaces = 0) const = 0;
@@ -137,7 +142,8 @@ public:
     const char* getCommand() const { return ""; }
     uint64_t getSize() const;
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const
     {
@@ -165,7 +171,8 @@ public:
     const char* getCommand() const { return ""; }
     uint64_t getSize() const;
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const { return value; }
     std::string toIndentedString(uint spaces = 0) const { return blankSpaces(spaces) + this->value; }
@@ -191,7 +198,8 @@ public:
     const char* getCommand() const { return ""; }
     uint64_t getSize() const { return hasTime ? 30 : 26; }
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string getName() const; 
 
@@ -213,7 +221,8 @@ public:
     const char* getCommand() const { return ""; }
     uint64_t getSize() const { return hasChecksum ? 24 : 20; }
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -238,6 +247,7 @@ public:
     CoinNodeMessage(const CoinNodeMessage& message) { this->setMessage(message.header.magic, message.pPayload); }
     CoinNodeMessage(uint32_t magic, CoinNodeStructure* pPayload) { this->setMessage(magic, pPayload); }
     CoinNodeMessage(const uchar_vector& bytes) { this->pPayload = NULL; this->setSerialized(bytes); }
+    CoinNodeMessage(const MessageHeader& header, const unsigned char* payload); // decodes header.length bytes of payload
     ~CoinNodeMessage();
 
     void setMessage(uint32_t magic, CoinNodeStructure* pPayload);
@@ -245,7 +255,8 @@ public:
     const char* getCommand() const { return this->pPayload->getCommand(); }
     uint64_t getSize() const;
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -254,6 +265,9 @@ public:
 
     MessageHeader getHeader() const { return header; }
     CoinNodeStructure* getPayload() const { return pPayload; }
+
+private:
+    void setSerializedPayload(const unsigned char* data, std::size_t len, std::size_t& pos);
 };
 
 class VersionMessage : public CoinNodeStructure
@@ -286,7 +300,8 @@ public:
     const char* getCommand() const { return "version"; }
     uint64_t getSize() const;
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -314,7 +329,8 @@ public:
     uint64_t getSize() const { return 0; }
 
     uchar_vector getSerialized() const { uchar_vector rval; return rval; }
-    void setSerialized(const uchar_vector& /*bytes*/) { }
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* /*data*/, std::size_t /*len*/, std::size_t& /*pos*/) { }
 
     std::string toString() const { return ""; }
     std::string toIndentedString(uint spaces = 0) const { return blankSpaces(spaces); }
@@ -329,7 +345,8 @@ public:
     uint64_t getSize() const { return 0; }
 
     uchar_vector getSerialized() const { uchar_vector rval; return rval; }
-    void setSerialized(const uchar_vector& /*bytes*/) { }
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* /*data*/, std::size_t /*len*/, std::size_t& /*pos*/) { }
 
     std::string toString() const { return ""; }
     std::string toIndentedString(uint spaces = 0) const { return blankSpaces(spaces); }
@@ -340,6 +357,7 @@ class AddrMessage : public CoinNodeStructure
 public:
     std::vector<NetworkAddress> addrList;
 
+    AddrMessage() { }
     AddrMessage(const std::vector<NetworkAddress> addrList) { this->addrList = addrList; }
     AddrMessage(const uchar_vector& bytes) { this->setSerialized(bytes); }
 
@@ -347,7 +365,8 @@ public:
     uint64_t getSize() const { return VarInt(this->addrList.size()).getSize() + 30*this->addrList.size(); }
 
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -389,7 +408,8 @@ public:
     const char* getCommand() const { return ""; }
     uint64_t getSize() const { return 36; }
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -417,7 +437,8 @@ public:
     const char* getCommand() const { return "inv"; }
     uint64_t getSize() const { return VarInt(this->items.size()).getSize() + 36*this->items.size(); }
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -499,7 +520,8 @@ public:
     const char* getCommand() const { return "getblocks"; }
     uint64_t getSize() const { return VarInt(this->blockLocatorHashes.size()).getSize() + 32*this->blockLocatorHashes.size() + 36; }
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -533,7 +555,8 @@ public:
     const char* getCommand() const { return "getheaders"; }
     uint64_t getSize() const { return VarInt(this->blockLocatorHashes.size()).getSize() + 32*this->blockLocatorHashes.size() + 36; }
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -562,7 +585,8 @@ public:
     const char* getCommand() const { return ""; }
     uint64_t getSize() const { return 36; }
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string getTxHash() const { return uchar_vector(this->hash, 32).getHex(); }
 	
@@ -587,7 +611,8 @@ public:
     uint64_t getSize() const;
 
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     // TODO: toString methods
     std::string toString() const { return std::string(); }
@@ -614,7 +639,8 @@ public:
     uint64_t getSize() const { return VarInt(this->scriptSig.size()).getSize() + scriptSig.size() + 40; } // 40 = previousOut + sequence
     uchar_vector getSerialized() const { return this->getSerialized(true); }
     uchar_vector getSerialized(bool includeScriptSigLength) const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     uchar_vector getOutpointHash() const { return uchar_vector(this->previousOut.hash, 32); }
     uint32_t getOutpointIndex() const { return this->previousOut.index; }
@@ -643,7 +669,8 @@ public:
     const char* getCommand() const { return ""; }
     uint64_t getSize() const { return VarInt(this->scriptPubKey.size()).getSize() + scriptPubKey.size() + 8; } // 8 = sizeof(value)
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string getAddress() const;
     std::string toString() const;
@@ -663,7 +690,12 @@ public:
     Transaction(const uchar_vector& bytes) { this->setSerialized(bytes); }
     Transaction(const std::string& hex);
     Transaction(const Transaction& tx)
-        : version(tx.version), inputs(tx.inputs), outputs(tx.outputs), lockTime(tx.lockTime) { }
+        : version(tx.version), inputs(tx.inputs), outputs(tx.outputs), lockTime(tx.lockTime), txHash_(tx.txHash_), witnessHash_(tx.witnessHash_) { }
+
+    // The txid and wtxid are computed once and memoized. The member functions below that modify the transaction reset them,
+    // but code that assigns to version, inputs, outputs or lockTime directly after hashing must call resetHash().
+    // The getters write the memoized hashes, so like the sighash midstates they are not thread-safe: a transaction shared
+    // between threads needs external locking, or getHash(true) and getHash(false) called once before it is shared.
 
     const uchar_vector& getHash() const { return getHash(false); }
     const uchar_vector& getHash(bool bWithWitness) const;
@@ -692,7 +724,8 @@ public:
     uchar_vector getSerialized() const { return this->getSerialized(true); }
     uchar_vector getSerialized(bool bWithWitness) const;
 
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -702,11 +735,11 @@ public:
     void setScriptSig(uint index, const uchar_vector& scriptSig);
     void setScriptSig(uint index, const std::string& scriptSigHex);
 
-    void clearInputs() { inputs.clear(); }
-    void clearOutputs() { outputs.clear(); }
+    void clearInputs() { inputs.clear(); resetHash(); }
+    void clearOutputs() { outputs.clear(); resetHash(); }
 
-    void addInput(const TxIn& txin) { inputs.push_back(txin); }
-    void addOutput(const TxOut& txout) { outputs.push_back(txout); }
+    void addInput(const TxIn& txin) { inputs.push_back(txin); resetHash(); }
+    void addOutput(const TxOut& txout) { outputs.push_back(txout); resetHash(); }
 	
     uint64_t getTotalSent() const;
 
@@ -714,24 +747,79 @@ public:
     uchar_vector getSigHash(uint32_t hashType, uint index, const uchar_vector& script, uint64_t value = 0) const;
     void resetSigHash();
 
+    void resetHash() { txHash_.isSet = false; witnessHash_.isSet = false; }
+
 private:
     mutable uchar_vector hashPrevouts;
     mutable uchar_vector hashSequence;
     mutable uchar_vector hashOutputs;
+
+    struct CachedHash
+    {
+        CachedHash() : isSet(false) { }
+
+        bool isSet;
+        uchar_vector hash;
+        uchar_vector hashLittleEndian;
+    };
+
+    mutable CachedHash txHash_;
+    mutable CachedHash witnessHash_;
+
+    const CachedHash& getCachedHash(bool bWithWitness) const;
+};
+
+// Precomputed state for the signature hashes of all inputs of a transaction.
+// Legacy sighashes resume from a SHA256 midstate of the serialization up to each input's script and only hash the script and
+// the remainder of a serialized template, so the transaction is never copied. Segwit (BIP143) sighashes reuse the prevouts,
+// sequence and outputs hashes. Which algorithm applies to each input is determined by its witness at construction time.
+// The transaction must not be modified other than its scriptSigs and witnesses while the context is in use.
+class SigHashContext
+{
+public:
+    SigHashContext(const Transaction& tx);
+
+    uchar_vector getSigHash(uint32_t hashType, uint index, const uchar_vector& script, uint64_t value = 0) const;
+
+    std::size_t size() const { return scriptOffsets_.size(); }
+
+private:
+    uchar_vector txTemplate_;                   // serialized without witness and with all scriptSigs empty
+    std::vector<std::size_t> scriptOffsets_;    // position of each input's scriptSig length in txTemplate_
+    std::vector<bool> witnesses_;
+    std::vector<SHA256_CTX> midstates_;         // hash state of txTemplate_ up to each scriptOffset
+
+    uchar_vector hashPrevouts_;
+    uchar_vector hashSequence_;
+    uchar_vector hashOutputs_;
+    SHA256_CTX witnessMidstate_;                // hash state after version, hashPrevouts and hashSequence
+    uint32_t lockTime_;
 };
 
 class CoinBlock;
 class MerkleBlock;
 
+// Hash functions of a network's block headers. Headers hold a shared pointer to them so that headers of several
+// networks can be handled in one process.
+struct BlockHeaderHashFuncs
+{
+    BlockHeaderHashFuncs(hashfunc_t _hash, hashfunc_t _powHash) : hash(_hash), powHash(_powHash) { }
+
+    hashfunc_t hash;
+    hashfunc_t powHash;
+};
+
+typedef std::shared_ptr<const BlockHeaderHashFuncs> header_hashfuncs_t;
+
 class CoinBlockHeader : public CoinNodeStructure
 {
 public:
-    CoinBlockHeader() : isPOWHashSet_(false) { }
+    CoinBlockHeader() : hashFuncs_(defaultHashFuncs()), isPOWHashSet_(false) { }
     CoinBlockHeader(uint32_t version, const uchar_vector& prevBlockHash, const uchar_vector& merkleRoot, uint32_t timestamp, uint32_t bits, uint32_t nonce)
-        : isPOWHashSet_(false), version_(version), prevBlockHash_(prevBlockHash), merkleRoot_(merkleRoot), timestamp_(timestamp), bits_(bits), nonce_(nonce) { }
+        : hashFuncs_(defaultHashFuncs()), isPOWHashSet_(false), version_(version), prevBlockHash_(prevBlockHash), merkleRoot_(merkleRoot), timestamp_(timestamp), bits_(bits), nonce_(nonce) { }
     CoinBlockHeader(uint32_t version, uint32_t timestamp, uint32_t bits, uint32_t nonce = 0, const uchar_vector& prevBlockHash = g_zero32bytes, const uchar_vector& merkleRoot = g_zero32bytes)
-        : isPOWHashSet_(false), version_(version), prevBlockHash_(prevBlockHash), merkleRoot_(merkleRoot), timestamp_(timestamp), bits_(bits), nonce_(nonce) { }
-    CoinBlockHeader(const uchar_vector& bytes) { setSerialized(bytes); }
+        : hashFuncs_(defaultHashFuncs()), isPOWHashSet_(false), version_(version), prevBlockHash_(prevBlockHash), merkleRoot_(merkleRoot), timestamp_(timestamp), bits_(bits), nonce_(nonce) { }
+    CoinBlockHeader(const uchar_vector& bytes) : hashFuncs_(defaultHashFuncs()) { setSerialized(bytes); }
     CoinBlockHeader(const std::string& hex);
 
     void set(uint32_t version, uint32_t timestamp, uint32_t bits, uint32_t nonce = 0, const uchar_vector& prevBlockHash = g_zero32bytes, const uchar_vector& merkleRoot = g_zero32bytes)
@@ -758,7 +846,8 @@ public:
     const char* getCommand() const { return ""; }
     uint64_t getSize() const { return 80; }
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -771,8 +860,15 @@ public:
 
     const BigInt getWork() const;
 
-    static void setHashFunc(hashfunc_t hashfunc) { hashfunc_ = hashfunc; }
-    static void setPOWHashFunc(hashfunc_t hashfunc) { powhashfunc_ = hashfunc; }
+    // Hash functions used by this header. Headers constructed or parsed without them use the defaults.
+    const header_hashfuncs_t& getHashFuncs() const { return hashFuncs_; }
+    void setHashFuncs(const header_hashfuncs_t& hashFuncs);
+
+    // Set the defaults for headers constructed afterwards. Headers that already exist keep their hash functions.
+    // The defaults are read and replaced atomically, so this is safe while other threads construct headers.
+    static void setHashFunc(hashfunc_t hashfunc);
+    static void setPOWHashFunc(hashfunc_t hashfunc);
+    static header_hashfuncs_t getDefaultHashFuncs() { return defaultHashFuncs(); }
 
     const uchar_vector& getHash() const;
     const uchar_vector& getHashLittleEndian() const;
@@ -784,8 +880,10 @@ private:
     friend class CoinBlock;
     friend class MerkleBlock;
 
-    static hashfunc_t hashfunc_;
-    static hashfunc_t powhashfunc_;
+    static header_hashfuncs_t& defaultHashFuncsStorage(); // only accessed through std::atomic_load and friends
+    static header_hashfuncs_t defaultHashFuncs() { return std::atomic_load(&defaultHashFuncsStorage()); }
+
+    header_hashfuncs_t hashFuncs_;
 
 /*
     // Inherited from CoinNodeStructure
@@ -840,7 +938,8 @@ public:
     const char* getCommand() const { return "block"; }
     uint64_t getSize() const;
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -892,7 +991,8 @@ public:
     const char* getCommand() const { return "merkleblock"; }
     uint64_t getSize() const;
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -914,7 +1014,8 @@ public:
     const char* getCommand() const { return "headers"; }
     uint64_t getSize() const;
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -932,7 +1033,8 @@ public:
     uint64_t getSize() const { return 0; }
 
     uchar_vector getSerialized() const { uchar_vector rval; return rval; }
-    void setSerialized(const uchar_vector& /*bytes*/) { }
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* /*data*/, std::size_t /*len*/, std::size_t& /*pos*/) { }
 
     std::string toString() const { return ""; }
     std::string toIndentedString(uint spaces = 0) const { return blankSpaces(spaces); }
@@ -954,7 +1056,8 @@ public:
     uint64_t getSize() const;
 
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -972,7 +1075,8 @@ public:
     uint64_t getSize() const { return VarInt(data.size()).getSize() + data.size(); }
 
     uchar_vector getSerialized() const { return VarInt(data.size()).getSerialized() + data; }
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -996,7 +1100,8 @@ public:
     uint64_t getSize() const { return sizeof(uint64_t); }
 
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -1007,6 +1112,7 @@ class PongMessage : public CoinNodeStructure
 public:
     uint64_t nonce;
 
+    PongMessage() : nonce(0) { }
     PongMessage(uint64_t nonce_) : nonce(nonce_) { }
     PongMessage(const uchar_vector& bytes) { setSerialized(bytes); }
 
@@ -1014,7 +1120,8 @@ public:
     uint64_t getSize() const { return sizeof(uint64_t); }
 
     uchar_vector getSerialized() const;
-    void setSerialized(const uchar_vector& bytes);
+    using CoinNodeStructure::setSerialized;
+    void setSerialized(const unsigned char* data, std::size_t len, std::size_t& pos);
 
     std::string toString() const;
     std::string toIndentedString(uint spaces = 0) const;
@@ -43,7 +43,7 @@ bytes_t HDSeed::getExtendedKey(bool bPrivate) const
 }
 
 HDKeychain::HDKeychain(const bytes_t& key, const bytes_t& chain_code, uint32_t child_num, uint32_t parent_fp, uint32_t depth)
-    : depth_(depth), parent_fp_(parent_fp), child_num_(child_num), chain_code_(chain_code), key_(key)
+    : priv_version_(default_priv_version_), pub_version_(default_pub_version_), depth_(depth), parent_fp_(parent_fp), child_num_(child_num), chain_code_(chain_code), key_(key)
 {
     if (chain_code_.size() != 32) {
         throw std::runtime_error("Invalid chain code.");
@@ -81,6 +81,7 @@ HDKeychain::HDKeychain(const bytes_t& key, const bytes_t& chain_code, uint32_t c
 }
 
 HDKeychain::HDKeychain(const bytes_t& extkey)
+    : priv_version_(default_priv_version_), pub_version_(default_pub_version_)
 {
     if (extkey.size() != 78) {
         throw std::runtime_error("Invalid extended key length.");
@@ -99,6 +100,7 @@ HDKeychain::HDKeychain(const bytes_t& extkey)
 }
 
 HDKeychain::HDKeychain(const HDKeychain& source)
+    : priv_version_(source.priv_version_), pub_version_(source.pub_version_)
 {
     valid_ = source.valid_;
     if (!valid_) return;
@@ -109,11 +111,13 @@ HDKeychain::HDKeychain(const HDKeychain& source)
     child_num_ = source.child_num_;
     chain_code_ = source.chain_code_;
     key_ = source.key_;
-    updatePubkey();
+    pubkey_ = source.pubkey_;
 }
 
 HDKeychain& HDKeychain::operator=(const HDKeychain& rhs)
 {
+    priv_version_ = rhs.priv_version_;
+    pub_version_ = rhs.pub_version_;
     valid_ = rhs.valid_;
     if (valid_) {
         version_ = rhs.version_;
@@ -122,11 +126,32 @@ HDKeychain& HDKeychain::operator=(const HDKeychain& rhs)
         child_num_ = rhs.child_num_;
         chain_code_ = rhs.chain_code_;
         key_ = rhs.key_;
-        updatePubkey();
+        pubkey_ = rhs.pubkey_;
     }
     return *this;
 }
 
+void HDKeychain::setNetworkVersions(uint32_t priv_version, uint32_t pub_version)
+{
+    priv_version_ = priv_version;
+    pub_version_ = pub_version;
+    if (valid_) { version_ = isPrivate() ? priv_version_ : pub_version_; }
+}
+
+void HDKeychain::clear()
+{
+    // Write through a volatile pointer so the stores are not optimized away.
+    volatile unsigned char* p = key_.data();
+    for (std::size_t i = 0; i < key_.size(); i++) { p[i] = 0; }
+    p = chain_code_.data();
+    for (std::size_t i = 0; i < chain_code_.size(); i++) { p[i] = 0; }
+
+    key_.clear();
+    chain_code_.clear();
+    pubkey_.clear();
+    valid_ = false;
+}
+
 bool HDKeychain::operator==(const HDKeychain& rhs) const
 {
     return (valid_ && rhs.valid_ &&
@@ -210,6 +235,8 @@ HDKeychain HDKeychain::getPublic() const
     if (!valid_) throw InvalidHDKeychainException();
 
     HDKeychain pub;
+    pub.priv_version_ = priv_version_;
+    pub.pub_version_ = pub_version_;
     pub.valid_ = valid_;
     pub.version_ = pub_version_;
     pub.depth_ = depth_;
@@ -230,6 +257,8 @@ HDKeychain HDKeychain::getChild(uint32_t i) const
     }
 
     HDKeychain child;
+    child.priv_version_ = priv_version_;
+    child.pub_version_ = pub_version_;
     child.valid_ = false;
 
     uchar_vector data;
@@ -356,5 +385,5 @@ void HDKeychain::updatePubkey() {
     }
 }
 
-uint32_t HDKeychain::priv_version_ = BITCOIN_HD_PRIVATE_VERSION;
-uint32_t HDKeychain::pub_version_ = BITCOIN_HD_PUBLIC_VERSION;
+uint32_t HDKeychain::default_priv_version_ = BITCOIN_HD_PRIVATE_VERSION;
+uint32_t HDKeychain::default_pub_version_ = BITCOIN_HD_PUBLIC_VERSION;
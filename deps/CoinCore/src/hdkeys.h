@@ -59,7 +59,7 @@ public:
 class HDKeychain
 {
 public:
-    HDKeychain() { }
+    HDKeychain() : priv_version_(default_priv_version_), pub_version_(default_pub_version_), valid_(false) { }
     HDKeychain(const bytes_t& key, const bytes_t& chain_code, uint32_t child_num = 0, uint32_t parent_fp = 0, uint32_t depth = 0);
     HDKeychain(const bytes_t& extkey);
     HDKeychain(const HDKeychain& source);
@@ -115,13 +115,26 @@ public:
         return bCompressed ? getChild(i).pubkey() : getChild(i).uncompressed_pubkey();
     }
 
-    static void setVersions(uint32_t priv_version, uint32_t pub_version) { priv_version_ = priv_version; pub_version_ = pub_version; }
+    // Overwrites the key material with zeros and invalidates the keychain.
+    void clear();
+
+    // Extended key versions of this keychain and the keychains derived from it. Keychains constructed without them
+    // use the defaults.
+    uint32_t priv_version() const { return priv_version_; }
+    uint32_t pub_version() const { return pub_version_; }
+    void setNetworkVersions(uint32_t priv_version, uint32_t pub_version);
+
+    // Sets the defaults for keychains constructed afterwards.
+    static void setVersions(uint32_t priv_version, uint32_t pub_version) { default_priv_version_ = priv_version; default_pub_version_ = pub_version; }
 
     std::string toString() const;
 
 private:
-    static uint32_t priv_version_;
-    static uint32_t pub_version_; 
+    static uint32_t default_priv_version_;
+    static uint32_t default_pub_version_;
+
+    uint32_t priv_version_;
+    uint32_t pub_version_;
 
     uint32_t version_;
     unsigned char depth_;
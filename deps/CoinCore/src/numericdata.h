@@ -36,22 +36,24 @@ std::vector<unsigned char> uint_to_vch(T n, uint endianness)
     return rval;
 }
 
+// Reads sizeof(T) bytes, which the caller must have checked are available.
 template<typename T>
-T vch_to_uint(const std::vector<unsigned char>& vch, uint endianness)
+T vch_to_uint(const unsigned char* bytes, uint endianness)
 {
     T n = 0;
-    uchar_vector bytes(vch.begin(), vch.begin() + sizeof(T));
-
-    if (endianness == LITTLE_ENDIAN_)
-        bytes.reverse();
-
-    for (uint i = 0; i < sizeof(T)-1; i++) {
-        n += bytes[i];
-        n *= 0x100;
+    if (endianness == LITTLE_ENDIAN_) {
+        for (uint i = sizeof(T); i > 0; i--) { n = (T)((n << 8) | bytes[i - 1]); }
+    }
+    else {
+        for (uint i = 0; i < sizeof(T); i++) { n = (T)((n << 8) | bytes[i]); }
     }
-    n += bytes[sizeof(T)-1];
-
     return n;
 }
 
+template<typename T>
+T vch_to_uint(const std::vector<unsigned char>& vch, uint endianness)
+{
+    return vch_to_uint<T>(&vch[0], endianness);
+}
+
 #endif
@@ -0,0 +1,360 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// secp256k1_libsecp256k1.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#if defined(USE_LIBSECP256K1)
+
+#include "secp256k1_openssl.h"
+#include "hash.h"
+#include "random.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef TRACE_RFC6979
+  #include <iostream>
+#endif
+
+using namespace CoinCrypto;
+
+namespace
+{
+
+// Zero-pads or truncates data to the 32 byte message ECDSA operates on. Longer digests are truncated to their leftmost
+// 256 bits and shorter ones are zero-extended on the left, which is what ECDSA_sign and ECDSA_verify do in OpenSSL.
+void get_msg32(const bytes_t& data, unsigned char* msg32)
+{
+    std::memset(msg32, 0, 32);
+    if (data.size() >= 32)  { std::copy(data.begin(), data.begin() + 32, msg32); }
+    else                    { std::copy(data.begin(), data.end(), msg32 + 32 - data.size()); }
+}
+
+// Left-pads a big-endian scalar to 32 bytes.
+void get_scalar32(const bytes_t& n, unsigned char* scalar32, const char* caller)
+{
+    std::size_t start = 0;
+    while (n.size() - start > 32)
+    {
+        if (n[start] != 0) throw std::runtime_error(std::string(caller) + " - scalar is out of range.");
+        start++;
+    }
+
+    std::memset(scalar32, 0, 32);
+    std::copy(n.begin() + start, n.end(), scalar32 + 32 - (n.size() - start));
+}
+
+bool is_zero(const unsigned char* scalar32)
+{
+    for (int i = 0; i < 32; i++) { if (scalar32[i]) return false; }
+    return true;
+}
+
+// Supplies a precomputed nonce so secp256k1_sign_rfc6979 produces the same signatures as the OpenSSL backend.
+int fixed_nonce_function(unsigned char* nonce32, const unsigned char* /*msg32*/, const unsigned char* /*key32*/, const unsigned char* /*algo16*/, void* data, unsigned int attempt)
+{
+    if (attempt > 0) return 0;
+    std::memcpy(nonce32, data, 32);
+    return 1;
+}
+
+secp256k1_context* create_context()
+{
+    secp256k1_context* ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
+    if (!ctx) throw std::runtime_error("secp256k1_get_context() - secp256k1_context_create failed.");
+
+    // Blinding for side-channel protection of signing and key generation.
+    secure_bytes_t seed = secure_random_bytes(32);
+    if (!secp256k1_context_randomize(ctx, &seed[0]))
+    {
+        secp256k1_context_destroy(ctx);
+        throw std::runtime_error("secp256k1_get_context() - secp256k1_context_randomize failed.");
+    }
+
+    return ctx;
+}
+
+}
+
+const secp256k1_context* CoinCrypto::secp256k1_get_context()
+{
+    // Initialization of function-local statics is thread-safe. The context is only read after this.
+    static const secp256k1_context* ctx = create_context();
+    return ctx;
+}
+
+
+secp256k1_key::~secp256k1_key()
+{
+    std::fill(privkey_.begin(), privkey_.end(), 0);
+}
+
+void secp256k1_key::newKey()
+{
+    const secp256k1_context* ctx = secp256k1_get_context();
+
+    secure_bytes_t privkey;
+    do
+    {
+        privkey = secure_random_bytes(32);
+    } while (!secp256k1_ec_seckey_verify(ctx, &privkey[0]));
+
+    setPrivKey(privkey);
+}
+
+bytes_t secp256k1_key::getPrivKey() const
+{
+    if (!bSet) {
+        throw std::runtime_error("secp256k1_key::getPrivKey() : key is not set.");
+    }
+
+    if (privkey_.empty()) {
+        throw std::runtime_error("secp256k1_key::getPrivKey() : key has no private key.");
+    }
+
+    return privkey_;
+}
+
+void secp256k1_key::setPrivKey(const bytes_t& privkey)
+{
+    const secp256k1_context* ctx = secp256k1_get_context();
+
+    secure_bytes_t seckey(32);
+    get_scalar32(privkey, &seckey[0], "secp256k1_key::setPrivKey()");
+
+    secp256k1_pubkey pubkey;
+    if (!secp256k1_ec_pubkey_create(ctx, &pubkey, &seckey[0])) {
+        std::fill(seckey.begin(), seckey.end(), 0);
+        throw std::runtime_error("secp256k1_key::setPrivKey() : secp256k1_ec_pubkey_create failed.");
+    }
+
+    std::fill(privkey_.begin(), privkey_.end(), 0);
+    privkey_.swap(seckey);
+    pubkey_ = pubkey;
+    bSet = true;
+}
+
+bytes_t secp256k1_key::getPubKey(bool bCompressed) const
+{
+    if (!bSet) {
+        throw std::runtime_error("secp256k1_key::getPubKey() : key is not set.");
+    }
+
+    unsigned char pubkey[65];
+    size_t nSize = sizeof(pubkey);
+    if (!secp256k1_ec_pubkey_serialize(secp256k1_get_context(), pubkey, &nSize, &pubkey_, bCompressed ? SECP256K1_EC_COMPRESSED : SECP256K1_EC_UNCOMPRESSED)) {
+        throw std::runtime_error("secp256k1_key::getPubKey() : secp256k1_ec_pubkey_serialize failed.");
+    }
+
+    return bytes_t(pubkey, pubkey + nSize);
+}
+
+void secp256k1_key::setPubKey(const bytes_t& pubkey)
+{
+    if (pubkey.empty()) throw std::runtime_error("secp256k1_key::setPubKey() : pubkey is empty.");
+
+    secp256k1_pubkey parsed;
+    if (!secp256k1_ec_pubkey_parse(secp256k1_get_context(), &parsed, &pubkey[0], pubkey.size())) throw std::runtime_error("secp256k1_key::setPubKey() : secp256k1_ec_pubkey_parse failed.");
+
+    std::fill(privkey_.begin(), privkey_.end(), 0);
+    privkey_.clear();
+    pubkey_ = parsed;
+    bSet = true;
+}
+
+const secp256k1_pubkey& secp256k1_key::getPubKeyData() const
+{
+    if (!bSet) {
+        throw std::runtime_error("secp256k1_key::getPubKeyData() : key is not set.");
+    }
+
+    return pubkey_;
+}
+
+
+void secp256k1_point::bytes(const bytes_t& bytes)
+{
+    if (bytes.empty() || !secp256k1_ec_pubkey_parse(secp256k1_get_context(), &point, &bytes[0], bytes.size())) {
+        throw std::runtime_error("secp256k1_point::set() - secp256k1_ec_pubkey_parse failed.");
+    }
+
+    bInfinity = false;
+}
+
+bytes_t secp256k1_point::bytes() const
+{
+    if (bInfinity) throw std::runtime_error("secp256k1_point::get() - point is at infinity.");
+
+    unsigned char bytes[33];
+    size_t nSize = sizeof(bytes);
+    if (!secp256k1_ec_pubkey_serialize(secp256k1_get_context(), bytes, &nSize, &point, SECP256K1_EC_COMPRESSED)) {
+        throw std::runtime_error("secp256k1_point::get() - secp256k1_ec_pubkey_serialize failed.");
+    }
+
+    return bytes_t(bytes, bytes + nSize);
+}
+
+secp256k1_point& secp256k1_point::operator+=(const secp256k1_point& rhs)
+{
+    if (rhs.bInfinity) return *this;
+    if (bInfinity) return *this = rhs;
+
+    const secp256k1_pubkey* points[2] = { &point, &rhs.point };
+    secp256k1_pubkey sum;
+
+    // Combining fails only when the sum is the point at infinity.
+    if (secp256k1_ec_pubkey_combine(secp256k1_get_context(), &sum, points, 2)) {
+        point = sum;
+    }
+    else {
+        bInfinity = true;
+    }
+
+    return *this;
+}
+
+secp256k1_point& secp256k1_point::operator*=(const bytes_t& rhs)
+{
+    unsigned char scalar[32];
+    get_scalar32(rhs, scalar, "secp256k1_point::operator*=");
+
+    if (bInfinity) return *this;
+    if (is_zero(scalar)) {
+        bInfinity = true;
+        return *this;
+    }
+
+    if (!secp256k1_ec_pubkey_tweak_mul(secp256k1_get_context(), &point, scalar)) {
+        throw std::runtime_error("secp256k1_point::operator*=  - secp256k1_ec_pubkey_tweak_mul failed.");
+    }
+
+    return *this;
+}
+
+// Computes n*G + K where K is this and G is the group generator
+void secp256k1_point::generator_mul(const bytes_t& n)
+{
+    const secp256k1_context* ctx = secp256k1_get_context();
+
+    unsigned char scalar[32];
+    get_scalar32(n, scalar, "secp256k1_point::generator_mul");
+    if (is_zero(scalar)) return;
+
+    if (!secp256k1_ec_seckey_verify(ctx, scalar)) throw std::runtime_error("secp256k1_point::generator_mul - scalar is out of range.");
+
+    if (bInfinity) {
+        if (!secp256k1_ec_pubkey_create(ctx, &point, scalar)) throw std::runtime_error("secp256k1_point::generator_mul - secp256k1_ec_pubkey_create failed.");
+        bInfinity = false;
+    }
+    else if (!secp256k1_ec_pubkey_tweak_add(ctx, &point, scalar)) {
+        // The scalar is in range so this only happens when the sum is the point at infinity.
+        bInfinity = true;
+    }
+}
+
+// Sets to n*G
+void secp256k1_point::set_generator_mul(const bytes_t& n)
+{
+    bInfinity = true;
+    generator_mul(n);
+}
+
+
+bytes_t CoinCrypto::secp256k1_sigToLowS(const bytes_t& signature)
+{
+    const secp256k1_context* ctx = secp256k1_get_context();
+
+    secp256k1_ecdsa_signature sig;
+    if (signature.empty() || !secp256k1_ecdsa_signature_parse_der(ctx, &sig, &signature[0], signature.size())) throw std::runtime_error("secp256k1_sigToLowS(): secp256k1_ecdsa_signature_parse_der failed.");
+
+    secp256k1_ecdsa_signature_normalize(ctx, &sig, &sig);
+
+    unsigned char buffer[72];
+    size_t nSize = sizeof(buffer);
+    if (!secp256k1_ecdsa_signature_serialize_der(ctx, buffer, &nSize, &sig)) throw std::runtime_error("secp256k1_sigToLowS(): secp256k1_ecdsa_signature_serialize_der failed.");
+
+    return bytes_t(buffer, buffer + nSize);
+}
+
+namespace
+{
+
+bytes_t sign(const secp256k1_key& key, const bytes_t& data, secp256k1_nonce_function noncefp, void* ndata, const char* caller)
+{
+    const secp256k1_context* ctx = secp256k1_get_context();
+
+    unsigned char msg32[32];
+    get_msg32(data, msg32);
+
+    secure_bytes_t privkey = key.getPrivKey();
+    secp256k1_ecdsa_signature sig;
+    int res = secp256k1_ecdsa_sign(ctx, &sig, msg32, &privkey[0], noncefp, ndata);
+    std::fill(privkey.begin(), privkey.end(), 0);
+    if (!res) throw std::runtime_error(std::string(caller) + ": secp256k1_ecdsa_sign failed.");
+
+    // libsecp256k1 always produces low S signatures.
+    unsigned char signature[72];
+    size_t nSize = sizeof(signature);
+    if (!secp256k1_ecdsa_signature_serialize_der(ctx, signature, &nSize, &sig)) throw std::runtime_error(std::string(caller) + ": secp256k1_ecdsa_signature_serialize_der failed.");
+
+    return bytes_t(signature, signature + nSize);
+}
+
+}
+
+// Signing function
+bytes_t CoinCrypto::secp256k1_sign(const secp256k1_key& key, const bytes_t& data)
+{
+    return sign(key, data, NULL, NULL, "secp256k1_sign()");
+}
+
+// Verification function
+bool CoinCrypto::secp256k1_verify(const secp256k1_key& key, const bytes_t& data, const bytes_t& signature, int flags)
+{
+    const secp256k1_context* ctx = secp256k1_get_context();
+
+    secp256k1_ecdsa_signature sig;
+    if (signature.empty() || !secp256k1_ecdsa_signature_parse_der(ctx, &sig, &signature[0], signature.size())) return false;
+
+    // libsecp256k1 only accepts low S signatures so normalize unless high S must be rejected.
+    if (secp256k1_ecdsa_signature_normalize(ctx, &sig, &sig) && (flags & SIGNATURE_ENFORCE_LOW_S)) return false;
+
+    unsigned char msg32[32];
+    get_msg32(data, msg32);
+
+    return secp256k1_ecdsa_verify(ctx, &sig, msg32, &key.getPubKeyData()) == 1;
+}
+
+bytes_t CoinCrypto::secp256k1_rfc6979_k(const secp256k1_key& key, const bytes_t& data)
+{
+    uchar_vector hash = sha256(data);
+    uchar_vector v("0101010101010101010101010101010101010101010101010101010101010101");
+    uchar_vector k("0000000000000000000000000000000000000000000000000000000000000000");
+    uchar_vector privkey = key.getPrivKey();
+    k = hmac_sha256(k, v + uchar_vector("00") + privkey + hash);
+    v = hmac_sha256(k, v);
+    k = hmac_sha256(k, v + uchar_vector("01") + privkey + hash);
+    v = hmac_sha256(k, v);
+    v = hmac_sha256(k, v);
+
+    return v;
+}
+
+bytes_t CoinCrypto::secp256k1_sign_rfc6979(const secp256k1_key& key, const bytes_t& data)
+{
+    bytes_t k = secp256k1_rfc6979_k(key, data);
+#ifdef TRACE_RFC6979
+    std::cout << "--------------------" << std::endl << "k = " << uchar_vector(k).getHex() << std::endl;
+#endif
+
+    bytes_t signature = sign(key, data, fixed_nonce_function, &k[0], "secp256k1_sign_rfc6979()");
+    std::fill(k.begin(), k.end(), 0);
+    return signature;
+}
+
+#endif // USE_LIBSECP256K1
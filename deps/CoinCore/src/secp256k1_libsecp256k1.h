@@ -0,0 +1,94 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// secp256k1_libsecp256k1.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+// libsecp256k1 backend for the secp256k1_key/secp256k1_point API.
+// Do not include directly - include secp256k1_openssl.h and build with USE_LIBSECP256K1 defined.
+
+#pragma once
+
+#include <stdexcept>
+
+#include <secp256k1.h>
+
+#include "typedefs.h"
+
+namespace CoinCrypto
+{
+
+// Context shared by all keys and points. It is created with precomputed tables on first use and never modified afterwards.
+const secp256k1_context* secp256k1_get_context();
+
+class secp256k1_key
+{
+public:
+    secp256k1_key() : bSet(false) { }
+    ~secp256k1_key();
+
+    void newKey();
+    bytes_t getPrivKey() const;
+    void setPrivKey(const bytes_t& privkey);
+    bytes_t getPubKey(bool bCompressed = true) const;
+    void setPubKey(const bytes_t& pubkey);
+
+    bool isSet() const { return bSet; }
+    bool isPrivate() const { return !privkey_.empty(); }
+
+    const secp256k1_pubkey& getPubKeyData() const;
+
+private:
+    secure_bytes_t privkey_;
+    secp256k1_pubkey pubkey_;
+    bool bSet;
+};
+
+
+class secp256k1_point
+{
+public:
+    secp256k1_point() : bInfinity(true) { }
+    secp256k1_point(const bytes_t& bytes) { this->bytes(bytes); }
+
+    void bytes(const bytes_t& bytes);
+    bytes_t bytes() const;
+
+    secp256k1_point& operator+=(const secp256k1_point& rhs);
+    secp256k1_point& operator*=(const bytes_t& rhs);
+
+    const secp256k1_point operator+(const secp256k1_point& rhs) const   { return secp256k1_point(*this) += rhs; }
+    const secp256k1_point operator*(const bytes_t& rhs) const           { return secp256k1_point(*this) *= rhs; }
+
+    // Computes n*G + K where K is this and G is the group generator
+    void generator_mul(const bytes_t& n);
+
+    // Sets to n*G
+    void set_generator_mul(const bytes_t& n);
+
+    bool is_at_infinity() const { return bInfinity; }
+    void set_to_infinity() { bInfinity = true; }
+
+private:
+    secp256k1_pubkey point;
+    bool bInfinity;
+};
+
+enum SignatureFlag
+{
+    SIGNATURE_ENFORCE_LOW_S = 0x1,
+};
+
+bytes_t secp256k1_sigToLowS(const bytes_t& signature);
+
+bytes_t secp256k1_sign(const secp256k1_key& key, const bytes_t& data);
+bool secp256k1_verify(const secp256k1_key& key, const bytes_t& data, const bytes_t& signature, int flags = 0);
+
+bytes_t secp256k1_rfc6979_k(const secp256k1_key& key, const bytes_t& data);
+bytes_t secp256k1_sign_rfc6979(const secp256k1_key& key, const bytes_t& data);
+
+}
@@ -12,6 +12,8 @@
 // file LICENSE or http://www.opensource.org/licenses/mit-license.php.
 //
 
+#if !defined(USE_LIBSECP256K1)
+
 #include "secp256k1_openssl.h"
 #include "hash.h"
 
@@ -455,4 +457,5 @@ bytes_t CoinCrypto::secp256k1_sign_rfc6979(const secp256k1_key& key, const bytes
 
     return secp256k1_sigToLowS(bytes_t(signature, signature + nSize));
 }
-    
+
+#endif // !USE_LIBSECP256K1
@@ -14,6 +14,13 @@
 
 #pragma once
 
+// Define USE_LIBSECP256K1 to use libsecp256k1 instead of OpenSSL for all secp256k1 operations.
+#if defined(USE_LIBSECP256K1)
+
+#include "secp256k1_libsecp256k1.h"
+
+#else
+
 #include <stdexcept>
 
 #include <openssl/bn.h>
@@ -100,3 +107,4 @@ bytes_t secp256k1_sign_rfc6979(const secp256k1_key& key, const bytes_t& data);
 
 }
 
+#endif // USE_LIBSECP256K1
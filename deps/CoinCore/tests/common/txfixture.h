@@ -0,0 +1,23 @@
+// Transactions shared by the CoinCore benchmarks.
+
+#pragma once
+
+#include <CoinCore/CoinNodeData.h>
+#include <CoinCore/random.h>
+
+// Two outputs and ninputs inputs spending 2-of-3 multisig with one of the two signatures. Legacy inputs get a 150 byte
+// scriptSig, about the size of such a P2SH scriptSig. Witness inputs get the 35 byte scriptSig of a P2SH-P2WSH spend and a
+// witness stack of a placeholder, a 72 byte signature and the 105 byte witness script. The contents are random.
+inline Coin::Transaction create_tx(int ninputs, bool witness)
+{
+    Coin::Transaction tx;
+    for (int i = 0; i < ninputs; i++)
+    {
+        Coin::TxIn txin(Coin::OutPoint(random_bytes(32), i), random_bytes(witness ? 35 : 150), 0xffffffff);
+        if (witness) { txin.scriptWitness.push(uchar_vector()); txin.scriptWitness.push(random_bytes(72)); txin.scriptWitness.push(random_bytes(105)); }
+        tx.addInput(txin);
+    }
+    tx.addOutput(Coin::TxOut(100000, random_bytes(23)));
+    tx.addOutput(Coin::TxOut(200000, random_bytes(23)));
+    return tx;
+}
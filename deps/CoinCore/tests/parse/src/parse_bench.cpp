@@ -0,0 +1,211 @@
+#include <CoinCore/CoinNodeData.h>
+#include <CoinCore/numericdata.h>
+#include <CoinCore/random.h>
+#include <stdutils/uchar_vector.h>
+
+#include "txfixture.h"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace Coin;
+using namespace std;
+
+// Transaction parsing as done by copying the rest of the buffer for every field.
+Transaction reference_parse_tx(const uchar_vector& bytes)
+{
+    Transaction tx;
+    tx.version = vch_to_uint<uint32_t>(bytes, LITTLE_ENDIAN_);
+    uint pos = 4;
+
+    bool witness = (bytes[pos] == 0);
+    if (witness) { pos += 2; }
+
+    VarInt count(uchar_vector(bytes.begin() + pos, bytes.end())); pos += count.getSize();
+    for (uint64_t i = 0; i < count.value; i++)
+    {
+        TxIn txIn(uchar_vector(bytes.begin() + pos, bytes.end())); pos += txIn.getSize();
+        tx.addInput(txIn);
+    }
+
+    count.setSerialized(uchar_vector(bytes.begin() + pos, bytes.end())); pos += count.getSize();
+    for (uint64_t i = 0; i < count.value; i++)
+    {
+        TxOut txOut(uchar_vector(bytes.begin() + pos, bytes.end())); pos += txOut.getSize();
+        tx.addOutput(txOut);
+    }
+
+    if (witness)
+    {
+        for (auto& input: tx.inputs)
+        {
+            input.scriptWitness.setSerialized(uchar_vector(bytes.begin() + pos, bytes.end()));
+            pos += input.scriptWitness.getSize();
+        }
+    }
+
+    tx.lockTime = vch_to_uint<uint32_t>(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + 4), LITTLE_ENDIAN_);
+    return tx;
+}
+
+HeadersMessage reference_parse_headers(const uchar_vector& bytes)
+{
+    HeadersMessage headers;
+    VarInt count(bytes);
+    uint pos = count.getSize();
+    for (uint64_t i = 0; i < count.value; i++)
+    {
+        headers.addHeader(CoinBlockHeader(uchar_vector(bytes.begin() + pos, bytes.begin() + pos + MIN_COIN_BLOCK_HEADER_SIZE)));
+        pos += MIN_COIN_BLOCK_HEADER_SIZE + 1;
+    }
+    return headers;
+}
+
+HeadersMessage create_headers(int nheaders)
+{
+    HeadersMessage headers;
+    uchar_vector prevBlockHash = g_zero32bytes;
+    for (int i = 0; i < nheaders; i++)
+    {
+        CoinBlockHeader header(2, prevBlockHash, random_bytes(32), 1400000000 + i * 600, 0x1d00ffff, i);
+        headers.addHeader(header);
+        prevBlockHash = header.hash();
+    }
+    return headers;
+}
+
+// Parses data[0, len) and returns whether it threw std::runtime_error. The caller keeps valid data after len, so a parser
+// that reads past the end of its span finds something to parse and succeeds instead.
+template<typename T>
+bool parse_fails(const uchar_vector& data, size_t len)
+{
+    T t;
+    size_t pos = 0;
+    try
+    {
+        t.setSerialized(&data[0], len, pos);
+    }
+    catch (const runtime_error&)
+    {
+        return true;
+    }
+    return false;
+}
+
+// Every truncation of a valid serialization must be rejected.
+template<typename T>
+void test_truncated(const uchar_vector& bytes, const string& what)
+{
+    for (size_t len = 0; len < bytes.size(); len++)
+    {
+        if (!parse_fails<T>(bytes, len)) throw runtime_error(what + " truncated to " + to_string(len) + " bytes was accepted. TEST FAILED");
+    }
+}
+
+// Counts and lengths larger than the rest of the data must be rejected before anything is allocated or read for them.
+// The data is followed by padding so that reading past len is caught as a successful parse.
+template<typename T>
+void test_oversized(const uchar_vector& bytes, const string& what)
+{
+    uchar_vector padded = bytes + uchar_vector(1000, 0);
+    if (!parse_fails<T>(padded, bytes.size())) throw runtime_error(what + " was accepted. TEST FAILED");
+}
+
+void test_malformed()
+{
+    // VarInts cut short after their prefix byte.
+    test_truncated<VarInt>(VarInt(0xfc).getSerialized(), "1 byte VarInt");
+    test_truncated<VarInt>(VarInt(0xfd).getSerialized(), "3 byte VarInt");
+    test_truncated<VarInt>(VarInt(0x10000).getSerialized(), "5 byte VarInt");
+    test_truncated<VarInt>(VarInt(0x100000000ull).getSerialized(), "9 byte VarInt");
+
+    test_truncated<Transaction>(create_tx(2, false).getSerialized(), "legacy tx");
+    test_truncated<Transaction>(create_tx(2, true).getSerialized(), "segwit tx");
+    test_truncated<HeadersMessage>(create_headers(3).getSerialized(), "headers");
+
+    uchar_vector huge = VarInt(0xffffffffffffffffull).getSerialized();
+    uchar_vector version = uint_to_vch<uint32_t>(1, LITTLE_ENDIAN_);
+    uchar_vector outpoint = OutPoint(random_bytes(32), 0).getSerialized();
+    uchar_vector sequence = uint_to_vch<uint32_t>(0xffffffff, LITTLE_ENDIAN_);
+    uchar_vector txout = TxOut(100000, random_bytes(23)).getSerialized();
+    uchar_vector locktime = uint_to_vch<uint32_t>(0, LITTLE_ENDIAN_);
+    uchar_vector one("01"), empty("00"), witness("0001");
+
+    test_oversized<Transaction>(version + huge + uchar_vector(100, 0), "tx with oversized input count");
+    test_oversized<Transaction>(version + one + outpoint + huge + sequence + one + txout + locktime, "tx with oversized scriptSig length");
+    test_oversized<Transaction>(version + one + outpoint + empty + sequence + huge + uchar_vector(100, 0), "tx with oversized output count");
+    test_oversized<Transaction>(version + one + outpoint + empty + sequence + one + uint_to_vch<uint64_t>(100000, LITTLE_ENDIAN_) + huge + locktime, "tx with oversized output script length");
+    test_oversized<Transaction>(version + witness + one + outpoint + empty + sequence + one + txout + huge + locktime, "tx with oversized witness item count");
+    test_oversized<Transaction>(version + witness + one + outpoint + empty + sequence + one + txout + one + huge + locktime, "tx with oversized witness item length");
+    test_oversized<HeadersMessage>(huge + create_headers(1).getSerialized(), "headers with oversized count");
+}
+
+// Parses bytes repeatedly and returns megabytes per second.
+typedef function<uchar_vector()> parse_t;
+double bench(const uchar_vector& bytes, int rounds, parse_t parse)
+{
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        if (parse() != bytes) throw runtime_error("Parse mismatch. TEST FAILED");
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return bytes.size() * (double)rounds / seconds / 1000000;
+}
+
+void print(const string& type, int count, size_t size, double reference, double span)
+{
+    cout << left << setw(10) << type << right << setw(8) << count << setw(12) << size << fixed << setprecision(2)
+         << setw(14) << reference << setw(14) << span << setw(10) << (span / reference) << "x" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        cerr << "# usage: " << argv[0] << " [max inputs = 1000]" << endl;
+        return -1;
+    }
+
+    try
+    {
+        int maxinputs = argc > 1 ? stoi(argv[1]) : 1000;
+        if (maxinputs <= 0) throw runtime_error("Invalid max inputs.");
+
+        test_malformed();
+
+        cout << left << setw(10) << "type" << right << setw(8) << "count" << setw(12) << "bytes" << setw(14) << "reference" << setw(14) << "span" << setw(11) << "speedup" << "  (MB/s)" << endl;
+        for (bool witness: { false, true })
+        {
+            for (int ninputs = 1; ninputs <= maxinputs; ninputs *= 10)
+            {
+                uchar_vector bytes = create_tx(ninputs, witness).getSerialized();
+
+                // Keep the total work roughly constant, the reference parser is quadratic in the transaction size.
+                int rounds = max(1, 10000 / ninputs);
+                int refrounds = max(1, rounds / ninputs);
+
+                double reference = bench(bytes, refrounds, [&]() { return reference_parse_tx(bytes).getSerialized(); });
+                double span = bench(bytes, rounds, [&]() { return Transaction(bytes).getSerialized(); });
+                print(witness ? "segwit tx" : "legacy tx", ninputs, bytes.size(), reference, span);
+            }
+        }
+
+        // A full headers message as sent during initial header sync.
+        uchar_vector bytes = create_headers(2000).getSerialized();
+        double reference = bench(bytes, 5, [&]() { return reference_parse_headers(bytes).getSerialized(); });
+        double span = bench(bytes, 50, [&]() { return HeadersMessage(bytes).getSerialized(); });
+        print("headers", 2000, bytes.size(), reference, span);
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <CoinCore/secp256k1_openssl.h>
+#include <CoinCore/hash.h>
+#include <CoinCore/random.h>
+#include <stdutils/uchar_vector.h>
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace CoinCrypto;
+using namespace std;
+
+#if defined(USE_LIBSECP256K1)
+const string BACKEND = "libsecp256k1";
+#else
+const string BACKEND = "openssl";
+#endif
+
+void bench(const string& name, int iterations, function<void(int)> op)
+{
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) { op(i); }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << left << setw(24) << name << right << setw(12) << fixed << setprecision(0) << (iterations / seconds) << " ops/sec"
+         << setw(12) << setprecision(2) << (seconds * 1000000 / iterations) << " us/op" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        cerr << "# usage: " << argv[0] << " [iterations = 1000]" << endl;
+        return -1;
+    }
+
+    try
+    {
+        int iterations = argc > 1 ? stoi(argv[1]) : 1000;
+        if (iterations <= 0) throw runtime_error("Invalid iterations.");
+
+        cout << "Backend: " << BACKEND << ", " << iterations << " iterations" << endl << endl;
+
+        secp256k1_key key;
+        key.newKey();
+        bytes_t privkey = key.getPrivKey();
+        bytes_t pubkey = key.getPubKey();
+
+        secp256k1_key pubkeyonly;
+        pubkeyonly.setPubKey(pubkey);
+
+        vector<bytes_t> hashes;
+        for (int i = 0; i < iterations; i++) { hashes.push_back(sha256(random_bytes(32))); }
+
+        vector<bytes_t> sigs(iterations);
+        bench("sign", iterations, [&](int i) { sigs[i] = secp256k1_sign(key, hashes[i]); });
+        bench("sign_rfc6979", iterations, [&](int i) { secp256k1_sign_rfc6979(key, hashes[i]); });
+
+        int invalid = 0;
+        bench("verify", iterations, [&](int i) { if (!secp256k1_verify(pubkeyonly, hashes[i], sigs[i], SIGNATURE_ENFORCE_LOW_S)) invalid++; });
+        if (invalid) throw runtime_error("Signature verification failed. TEST FAILED");
+
+        bench("pubkey from privkey", iterations, [&](int) { secp256k1_key k; k.setPrivKey(privkey); k.getPubKey(); });
+
+        // Public BIP32 child derivation: K_i = I_L*G + K
+        bench("derive (n*G + K)", iterations, [&](int i) { secp256k1_point K(pubkey); K.generator_mul(hashes[i]); K.bytes(); });
+
+        bench("point mul (n*K)", iterations, [&](int i) { secp256k1_point K(pubkey); K *= hashes[i]; K.bytes(); });
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <CoinCore/CoinNodeData.h>
+#include <CoinCore/numericdata.h>
+#include <CoinCore/random.h>
+#include <stdutils/uchar_vector.h>
+
+#include "txfixture.h"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace Coin;
+using namespace std;
+
+// Sighash as computed by copying and reserializing the whole transaction for each input.
+uchar_vector reference_sighash(const Transaction& tx, uint index, const uchar_vector& script, uint64_t value)
+{
+    if (tx.inputs[index].scriptWitness.isEmpty())
+    {
+        Transaction copy(tx);
+        for (uint i = 0; i < copy.inputs.size(); i++)
+        {
+            if (index == i) { copy.inputs[i].scriptSig = script; }
+            else            { copy.inputs[i].scriptSig.clear();  }
+        }
+        return sha256_2(copy.getSerialized(false) + uint_to_vch<uint32_t>(SIGHASH_ALL, LITTLE_ENDIAN_));
+    }
+
+    uchar_vector prevouts, sequence, outputs;
+    for (auto& input: tx.inputs) { prevouts += input.previousOut.getSerialized(); sequence += uint_to_vch(input.sequence, LITTLE_ENDIAN_); }
+    for (auto& output: tx.outputs) { outputs += output.getSerialized(); }
+
+    uchar_vector ss;
+    ss += uint_to_vch(tx.version, LITTLE_ENDIAN_);
+    ss += sha256_2(prevouts);
+    ss += sha256_2(sequence);
+    ss += tx.inputs[index].previousOut.getSerialized();
+    ss += VarInt(script.size()).getSerialized();
+    ss += script;
+    ss += uint_to_vch(value, LITTLE_ENDIAN_);
+    ss += uint_to_vch(tx.inputs[index].sequence, LITTLE_ENDIAN_);
+    ss += sha256_2(outputs);
+    ss += uint_to_vch(tx.lockTime, LITTLE_ENDIAN_);
+    ss += uint_to_vch<uint32_t>(SIGHASH_ALL, LITTLE_ENDIAN_);
+    return sha256_2(ss);
+}
+
+// Computes the sighashes of all inputs and returns microseconds per input.
+typedef function<void(vector<uchar_vector>&)> sighash_all_t;
+double bench(const Transaction& tx, int rounds, sighash_all_t sighash_all, vector<uchar_vector>& hashes)
+{
+    hashes.assign(tx.inputs.size(), uchar_vector());
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) { sighash_all(hashes); }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return seconds * 1000000 / (rounds * tx.inputs.size());
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        cerr << "# usage: " << argv[0] << " [max inputs = 1000]" << endl;
+        return -1;
+    }
+
+    try
+    {
+        int maxinputs = argc > 1 ? stoi(argv[1]) : 1000;
+        if (maxinputs <= 0) throw runtime_error("Invalid max inputs.");
+
+        uchar_vector redeemscript = random_bytes(105);
+
+        cout << left << setw(10) << "type" << right << setw(8) << "inputs" << setw(16) << "reference" << setw(16) << "getSigHash" << setw(16) << "context" << "  (us/input)" << endl;
+        for (bool witness: { false, true })
+        {
+            for (int ninputs = 1; ninputs <= maxinputs; ninputs *= (ninputs == 1 ? 100 : 10))
+            {
+                Transaction tx = create_tx(ninputs, witness);
+
+                // Keep the total work roughly constant, the reference implementation is quadratic for legacy inputs.
+                int rounds = max(1, 1000 / ninputs);
+                int refrounds = witness ? rounds : max(1, rounds / ninputs);
+
+                vector<uchar_vector> refhashes, txhashes, ctxhashes;
+                double ref = bench(tx, refrounds, [&](vector<uchar_vector>& hashes) {
+                    for (uint i = 0; i < hashes.size(); i++) { hashes[i] = reference_sighash(tx, i, redeemscript, 1000); }
+                }, refhashes);
+
+                double txsighash = bench(tx, rounds, [&](vector<uchar_vector>& hashes) {
+                    for (uint i = 0; i < hashes.size(); i++) { hashes[i] = tx.getSigHash(SIGHASH_ALL, i, redeemscript, 1000); }
+                }, txhashes);
+
+                // Includes the cost of building the context.
+                double ctxsighash = bench(tx, rounds, [&](vector<uchar_vector>& hashes) {
+                    SigHashContext context(tx);
+                    for (uint i = 0; i < hashes.size(); i++) { hashes[i] = context.getSigHash(SIGHASH_ALL, i, redeemscript, 1000); }
+                }, ctxhashes);
+
+                if (txhashes != refhashes || ctxhashes != refhashes) throw runtime_error("Sighash mismatch. TEST FAILED");
+
+                cout << left << setw(10) << (witness ? "segwit" : "legacy") << right << setw(8) << ninputs << fixed << setprecision(2)
+                     << setw(16) << ref << setw(16) << txsighash << setw(16) << ctxsighash << endl;
+            }
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include <CoinCore/CoinNodeData.h>
+#include <CoinCore/hash.h>
+#include <CoinCore/random.h>
+#include <stdutils/uchar_vector.h>
+
+#include "txfixture.h"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <string>
+
+using namespace Coin;
+using namespace std;
+
+void check(const Transaction& tx, const string& what)
+{
+    if (tx.getHash() != sha256_2(tx.getSerialized(false)) ||
+        tx.getHash(true) != sha256_2(tx.getSerialized(true)) ||
+        tx.hash() != sha256_2(tx.getSerialized(false)).getReverse() ||
+        tx.getHashLittleEndian(true) != sha256_2(tx.getSerialized(true)).getReverse())
+        throw runtime_error("Hash mismatch " + what + ". TEST FAILED");
+}
+
+// Hashes must follow every change made through the member functions and resetHash().
+void test_invalidation(bool witness)
+{
+    Transaction tx = create_tx(3, witness);
+    check(tx, "after construction");
+
+    tx.addOutput(TxOut(300000, random_bytes(23)));
+    check(tx, "after addOutput");
+
+    tx.setScriptSig(1, random_bytes(20));
+    check(tx, "after setScriptSig");
+
+    Transaction copy(tx);
+    check(copy, "after copy");
+
+    tx.clearScriptSigs();
+    check(tx, "after clearScriptSigs");
+    if (copy.getHash() == tx.getHash()) throw runtime_error("Copy shares hash. TEST FAILED");
+
+    tx.setSerialized(copy.getSerialized());
+    check(tx, "after setSerialized");
+
+    tx.lockTime = 500000;
+    tx.resetHash();
+    check(tx, "after resetHash");
+
+    tx.clearInputs();
+    check(tx, "after clearInputs");
+}
+
+// Returns calls per second.
+typedef function<void()> call_t;
+double bench(int rounds, call_t call)
+{
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) { call(); }
+    return rounds / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void expect(const uchar_vector& hash, const uchar_vector& expected)
+{
+    if (hash != expected) throw runtime_error("Hash mismatch. TEST FAILED");
+}
+
+void print(const string& type, int count, size_t size, double reference, double first, double repeated, double parse, double reparse)
+{
+    cout << left << setw(10) << type << right << setw(8) << count << setw(10) << size << fixed << setprecision(0)
+         << setw(12) << reference << setw(12) << first << setw(14) << repeated << setw(12) << parse << setw(12) << reparse << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        cerr << "# usage: " << argv[0] << " [max inputs = 1000]" << endl;
+        return -1;
+    }
+
+    try
+    {
+        int maxinputs = argc > 1 ? stoi(argv[1]) : 1000;
+        if (maxinputs <= 0) throw runtime_error("Invalid max inputs.");
+
+        test_invalidation(false);
+        test_invalidation(true);
+
+        cout << left << setw(10) << "type" << right << setw(8) << "inputs" << setw(10) << "bytes" << setw(12) << "reference" << setw(12) << "first"
+             << setw(14) << "repeated" << setw(12) << "parse" << setw(12) << "reparse" << "  (calls/s)" << endl;
+        for (bool witness: { false, true })
+        {
+            for (int ninputs = 1; ninputs <= maxinputs; ninputs *= 10)
+            {
+                Transaction tx = create_tx(ninputs, witness);
+                uchar_vector expected = sha256_2(tx.getSerialized(false));
+                int rounds = max(10, 100000 / ninputs);
+
+                // Serializing to a vector and hashing it, as every getHash() call used to.
+                double reference = bench(rounds, [&]() { expect(sha256_2(tx.getSerialized(false)), expected); });
+
+                // The first getHash() after a change, streamed into SHA256.
+                double first = bench(rounds, [&]() { tx.resetHash(); expect(tx.getHash(), expected); });
+
+                // Repeated getHash() calls on an unchanged transaction return the memoized hash.
+                tx.getHash();
+                double repeated = bench(rounds * 100, [&]() { expect(tx.getHash(), expected); });
+
+                // setSerialized must invalidate the memoized hash. Alternating between two transactions fails the check if it
+                // does not, and the cost of rehashing after a parse shows against parsing alone.
+                Transaction other = create_tx(ninputs, witness);
+                uchar_vector bytes[2] = { tx.getSerialized(), other.getSerialized() };
+                uchar_vector hashes[2] = { expected, other.getHash() };
+                int n = 0;
+                double parse = bench(rounds, [&]() { n ^= 1; tx.setSerialized(bytes[n]); });
+                double reparse = bench(rounds, [&]() { n ^= 1; tx.setSerialized(bytes[n]); expect(tx.getHash(), hashes[n]); });
+
+                print(witness ? "segwit tx" : "legacy tx", ninputs, tx.getSize(), reference, first, repeated, parse, reparse);
+            }
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,313 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinSelection.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "CoinSelection.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace CoinDB;
+
+/*
+ * class TxSizeModel
+*/
+TxSizeModel::TxSizeModel(script_type_t script_type, unsigned int minsigs, unsigned int keycount, bool compressed_keys)
+    : script_type_(script_type)
+{
+    // OP_m <pubkey>... OP_n OP_CHECKMULTISIG
+    std::size_t redeemscript_size = 3 + keycount * (1 + (compressed_keys ? 33 : 65));
+    std::size_t sigs_size = minsigs * (1 + SIGNATURE_SIZE);
+
+    switch (script_type)
+    {
+    case P2SH:
+    {
+        // OP_0 <sig>... <redeemscript>
+        std::size_t redeemscript_push = redeemscript_size < 76 ? 1 : (redeemscript_size <= 0xff ? 2 : 3);
+        std::size_t scriptsig_size = 1 + sigs_size + redeemscript_push + redeemscript_size;
+        input_weight_ = 4 * (32 + 4 + varIntSize(scriptsig_size) + scriptsig_size + 4);
+        change_script_size_ = 23;
+        break;
+    }
+    case P2WSH:
+    case P2SH_P2WSH:
+    {
+        // Witness stack is an empty item for the CHECKMULTISIG bug, the signatures and the redeemscript.
+        std::size_t witness_size = varIntSize(minsigs + 2) + 1 + sigs_size + varIntSize(redeemscript_size) + redeemscript_size;
+
+        // P2SH-P2WSH scriptSig pushes the 34 byte witness program.
+        std::size_t scriptsig_size = script_type == P2WSH ? 0 : 35;
+        input_weight_ = 4 * (32 + 4 + varIntSize(scriptsig_size) + scriptsig_size + 4) + witness_size;
+        change_script_size_ = script_type == P2WSH ? 34 : 23;
+        break;
+    }
+    default:
+        throw std::runtime_error("TxSizeModel - invalid script type.");
+    }
+}
+
+uint64_t TxSizeModel::outputWeight(std::size_t script_size) const
+{
+    return 4 * (8 + varIntSize(script_size) + script_size);
+}
+
+uint64_t TxSizeModel::overheadWeight(std::size_t input_count, std::size_t output_count) const
+{
+    return 4 * (4 + varIntSize(input_count) + varIntSize(output_count) + 4) + (witness() ? 2 : 0);
+}
+
+uint64_t TxSizeModel::txWeight(std::size_t input_count, const std::vector<std::size_t>& output_script_sizes) const
+{
+    uint64_t weight = overheadWeight(input_count, output_script_sizes.size()) + input_count * input_weight_;
+    for (auto script_size: output_script_sizes) { weight += outputWeight(script_size); }
+    return weight;
+}
+
+/*
+ * struct CoinSelectionParams
+*/
+CoinSelectionParams::strategy_t CoinSelectionParams::getStrategy(const std::string& name)
+{
+    if (name == "bnb")          return BRANCH_AND_BOUND;
+    if (name == "largest")      return LARGEST_FIRST;
+    if (name == "consolidate")  return CONSOLIDATE;
+    throw std::runtime_error("Invalid coin selection strategy.");
+}
+
+std::string CoinSelectionParams::getStrategyString(strategy_t strategy)
+{
+    switch (strategy)
+    {
+    case BRANCH_AND_BOUND:  return "bnb";
+    case LARGEST_FIRST:     return "largest";
+    case CONSOLIDATE:       return "consolidate";
+    default:                return "unknown";
+    }
+}
+
+CoinSelectionParams CoinDB::getCoinSelectionParams(const std::string& fee, const std::string& strategy, uint32_t min_confirmations)
+{
+    static const std::string RATE_SUFFIX = "/kb";
+
+    bool bRate = fee.size() > RATE_SUFFIX.size() &&
+        std::equal(RATE_SUFFIX.begin(), RATE_SUFFIX.end(), fee.end() - RATE_SUFFIX.size(), [](char a, char b) { return a == std::tolower((unsigned char)b); });
+    std::string amount = bRate ? fee.substr(0, fee.size() - RATE_SUFFIX.size()) : fee;
+
+    char* end;
+    uint64_t value = strtoull(amount.c_str(), &end, 0);
+    if (amount.empty() || amount[0] == '-' || *end != '\0') throw std::runtime_error("Invalid fee.");
+
+    CoinSelectionParams params(0, 0, CoinSelectionParams::getStrategy(strategy), min_confirmations);
+    if (bRate)  { params.fee_rate = value; }
+    else        { params.fee = value; }
+    return params;
+}
+
+/*
+ * class CoinSelector
+*/
+std::shared_ptr<CoinSelector> CoinSelector::create(const TxSizeModel& model, const CoinSelectionParams& params)
+{
+    switch (params.strategy)
+    {
+    case CoinSelectionParams::BRANCH_AND_BOUND: return std::make_shared<BranchAndBoundCoinSelector>(model, params);
+    case CoinSelectionParams::LARGEST_FIRST:    return std::make_shared<LargestFirstCoinSelector>(model, params);
+    case CoinSelectionParams::CONSOLIDATE:      return std::make_shared<ConsolidatingCoinSelector>(model, params);
+    default:                                    throw std::runtime_error("Invalid coin selection strategy.");
+    }
+}
+
+bool CoinSelector::select(const std::vector<uint64_t>& values, std::size_t preselected, uint64_t output_total, const std::vector<std::size_t>& output_script_sizes, CoinSelection& selection) const
+{
+    if (preselected > values.size()) throw std::runtime_error("CoinSelector::select() - too many preselected coins.");
+
+    selection = CoinSelection();
+
+    uint64_t fee_rate = params_.fee_rate;
+    uint64_t input_fee = fee_rate ? feeForWeight(model_.inputWeight(), fee_rate) : 0;
+    uint64_t change_fee = fee_rate ? feeForWeight(model_.changeOutputWeight(), fee_rate) : 0;
+    uint64_t cost_of_change = change_fee + input_fee;
+
+    // Counts are sized for every coin and a change output so the estimate never falls short.
+    uint64_t base_weight = model_.overheadWeight(values.size(), output_script_sizes.size() + 1);
+    for (auto script_size: output_script_sizes) { base_weight += model_.outputWeight(script_size); }
+    uint64_t base_fee = fee_rate ? feeForWeight(base_weight, fee_rate) : params_.fee;
+
+    for (std::size_t i = 0; i < preselected; i++)
+    {
+        selection.coins.push_back(i);
+        selection.input_total += values[i];
+    }
+
+    uint64_t target = output_total + base_fee + preselected * input_fee;
+    if (selection.input_total < target)
+    {
+        candidates_t candidates;
+        candidates.reserve(values.size() - preselected);
+        for (std::size_t i = preselected; i < values.size(); i++)
+        {
+            if (values[i] > input_fee) { candidates.push_back(std::make_pair(values[i] - input_fee, i)); }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const candidate_t& a, const candidate_t& b) { return a.first > b.first || (a.first == b.first && a.second < b.second); });
+
+        std::vector<std::size_t> positions = selectCandidates(candidates, target - selection.input_total, cost_of_change);
+        if (positions.empty()) return false;
+
+        for (auto position: positions)
+        {
+            std::size_t i = candidates[position].second;
+            selection.coins.push_back(i);
+            selection.input_total += values[i];
+        }
+    }
+
+    selection.fee = base_fee + selection.coins.size() * input_fee;
+    if (selection.input_total < output_total + selection.fee) return false;
+
+    std::vector<std::size_t> script_sizes(output_script_sizes);
+    uint64_t excess = selection.input_total - output_total - selection.fee;
+    if (excess > cost_of_change)
+    {
+        selection.change = excess - change_fee;
+        selection.fee += change_fee;
+        script_sizes.push_back(model_.changeScriptSize());
+    }
+    else
+    {
+        selection.fee += excess;
+    }
+
+    selection.weight = model_.txWeight(selection.coins.size(), script_sizes);
+    return true;
+}
+
+std::vector<std::size_t> CoinSelector::selectLargestFirst(const candidates_t& candidates, uint64_t target)
+{
+    std::vector<std::size_t> positions;
+    uint64_t total = 0;
+    for (std::size_t position = 0; position < candidates.size(); position++)
+    {
+        positions.push_back(position);
+        total += candidates[position].first;
+        if (total >= target) return positions;
+    }
+    return std::vector<std::size_t>();
+}
+
+/*
+ * class BranchAndBoundCoinSelector
+*/
+std::vector<std::size_t> BranchAndBoundCoinSelector::selectCandidates(const candidates_t& candidates, uint64_t target, uint64_t cost_of_change) const
+{
+    // Depth first search over include/omit decisions, largest first, for the selection with the least
+    // excess in [target, target + cost_of_change].
+    uint64_t available = 0;
+    for (auto& candidate: candidates) { available += candidate.first; }
+    if (available < target) return std::vector<std::size_t>();
+
+    std::vector<bool> current;
+    std::vector<bool> best;
+    uint64_t current_value = 0;
+    uint64_t best_excess = UINT64_MAX;
+
+    for (unsigned int tries = 0; tries < MAX_TRIES; tries++)
+    {
+        bool backtrack = false;
+        if (current_value + available < target || current_value > target + cost_of_change)
+        {
+            backtrack = true;
+        }
+        else if (current_value >= target)
+        {
+            if (current_value - target < best_excess)
+            {
+                best = current;
+                best_excess = current_value - target;
+                if (best_excess == 0) break;
+            }
+            backtrack = true;
+        }
+
+        if (backtrack)
+        {
+            // Walk back to the last included candidate and try omitting it instead.
+            while (!current.empty() && !current.back())
+            {
+                current.pop_back();
+                available += candidates[current.size()].first;
+            }
+            if (current.empty()) break;
+
+            current.back() = false;
+            current_value -= candidates[current.size() - 1].first;
+        }
+        else
+        {
+            std::size_t position = current.size();
+            available -= candidates[position].first;
+
+            // Including a candidate with the same value as one just omitted would repeat an explored branch.
+            if (!current.empty() && !current.back() && candidates[position].first == candidates[position - 1].first)
+            {
+                current.push_back(false);
+            }
+            else
+            {
+                current.push_back(true);
+                current_value += candidates[position].first;
+            }
+        }
+    }
+
+    if (best.empty()) return selectLargestFirst(candidates, target);
+
+    std::vector<std::size_t> positions;
+    for (std::size_t position = 0; position < best.size(); position++)
+    {
+        if (best[position]) { positions.push_back(position); }
+    }
+    return positions;
+}
+
+/*
+ * class LargestFirstCoinSelector
+*/
+std::vector<std::size_t> LargestFirstCoinSelector::selectCandidates(const candidates_t& candidates, uint64_t target, uint64_t /*cost_of_change*/) const
+{
+    return selectLargestFirst(candidates, target);
+}
+
+/*
+ * class ConsolidatingCoinSelector
+*/
+std::vector<std::size_t> ConsolidatingCoinSelector::selectCandidates(const candidates_t& candidates, uint64_t target, uint64_t /*cost_of_change*/) const
+{
+    // Sweep in the smallest coins, then top up with the largest ones if they fall short.
+    std::vector<std::size_t> positions;
+    uint64_t total = 0;
+    std::size_t swept = std::min<std::size_t>(params_.max_inputs, candidates.size());
+    for (std::size_t i = 0; i < swept; i++)
+    {
+        std::size_t position = candidates.size() - 1 - i;
+        positions.push_back(position);
+        total += candidates[position].first;
+    }
+
+    for (std::size_t position = 0; total < target && position < candidates.size() - swept; position++)
+    {
+        positions.push_back(position);
+        total += candidates[position].first;
+    }
+
+    if (total < target) return std::vector<std::size_t>();
+    return positions;
+}
@@ -0,0 +1,163 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinSelection.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace CoinDB
+{
+
+// Size estimates for transactions spending an account's multisig outputs, in weight units.
+// Inputs are assumed to carry minsigs signatures.
+class TxSizeModel
+{
+public:
+    enum script_type_t
+    {
+        P2SH,
+        P2WSH,
+        P2SH_P2WSH
+    };
+
+    enum { SIGNATURE_SIZE = 72 }; // DER encoded with low S, including the sighash type
+
+    TxSizeModel(script_type_t script_type, unsigned int minsigs, unsigned int keycount, bool compressed_keys = true);
+
+    script_type_t script_type() const { return script_type_; }
+    bool witness() const { return script_type_ != P2SH; }
+
+    uint64_t inputWeight() const { return input_weight_; }
+    uint64_t outputWeight(std::size_t script_size) const;
+    std::size_t changeScriptSize() const { return change_script_size_; }
+    uint64_t changeOutputWeight() const { return outputWeight(change_script_size_); }
+
+    // Version, locktime, counts and the segwit marker.
+    uint64_t overheadWeight(std::size_t input_count, std::size_t output_count) const;
+
+    uint64_t txWeight(std::size_t input_count, const std::vector<std::size_t>& output_script_sizes) const;
+
+    static uint64_t vsize(uint64_t weight) { return (weight + 3) / 4; }
+    static std::size_t varIntSize(uint64_t n) { return n < 0xfd ? 1 : (n <= 0xffff ? 3 : (n <= 0xffffffff ? 5 : 9)); }
+
+private:
+    script_type_t script_type_;
+    uint64_t input_weight_;
+    std::size_t change_script_size_;
+};
+
+// Fee in satoshis for the given weight at fee_rate satoshis per 1000 virtual bytes, rounded up.
+inline uint64_t feeForWeight(uint64_t weight, uint64_t fee_rate) { return (TxSizeModel::vsize(weight) * fee_rate + 999) / 1000; }
+
+struct CoinSelectionParams
+{
+    enum strategy_t
+    {
+        BRANCH_AND_BOUND,   // exact match avoiding change if possible, else LARGEST_FIRST
+        LARGEST_FIRST,      // fewest inputs
+        CONSOLIDATE         // sweeps in the smallest coins up to max_inputs, for low fee rates
+    };
+
+    static strategy_t getStrategy(const std::string& name); // bnb, largest or consolidate. throws std::runtime_error
+    static std::string getStrategyString(strategy_t strategy);
+
+    explicit CoinSelectionParams(uint64_t fee_ = 0, uint64_t fee_rate_ = 0, strategy_t strategy_ = BRANCH_AND_BOUND, uint32_t min_confirmations_ = 0)
+        : strategy(strategy_), fee(fee_), fee_rate(fee_rate_), min_confirmations(min_confirmations_), max_inputs(DEFAULT_MAX_INPUTS) { }
+
+    enum { DEFAULT_MAX_INPUTS = 50 };
+
+    strategy_t strategy;
+    uint64_t fee;                   // fixed fee, only used if fee_rate is zero
+    uint64_t fee_rate;              // satoshis per 1000 virtual bytes
+    uint32_t min_confirmations;
+    unsigned int max_inputs;        // CONSOLIDATE stops sweeping small coins at this many inputs
+};
+
+// Parses fee as a fixed fee in satoshis or, if it ends in /kb, a rate in satoshis per 1000 virtual bytes, and strategy as
+// for CoinSelectionParams::getStrategy(). throws std::runtime_error
+CoinSelectionParams getCoinSelectionParams(const std::string& fee, const std::string& strategy, uint32_t min_confirmations = 0);
+
+struct CoinSelection
+{
+    CoinSelection() : input_total(0), fee(0), change(0), weight(0) { }
+
+    std::vector<std::size_t> coins; // indices of the spent coins
+    uint64_t input_total;
+    uint64_t fee;
+    uint64_t change;                // zero if there is no change output
+    uint64_t weight;                // estimated weight of the signed transaction
+};
+
+// Chooses which coins fund a set of outputs, then works out the fee and change so that
+// inputs = outputs + fee + change. Coins that cost more to spend than they are worth are never
+// chosen unless preselected. Change worth less than it would cost to create and later spend
+// is added to the fee.
+class CoinSelector
+{
+public:
+    CoinSelector(const TxSizeModel& model, const CoinSelectionParams& params) : model_(model), params_(params) { }
+    virtual ~CoinSelector() { }
+
+    static std::shared_ptr<CoinSelector> create(const TxSizeModel& model, const CoinSelectionParams& params);
+
+    const TxSizeModel& model() const { return model_; }
+    const CoinSelectionParams& params() const { return params_; }
+
+    // The first preselected values are always spent. Returns false if there are insufficient funds.
+    bool select(const std::vector<uint64_t>& values, std::size_t preselected, uint64_t output_total, const std::vector<std::size_t>& output_script_sizes, CoinSelection& selection) const;
+
+protected:
+    // Effective value (value less the fee to spend it) and index, in descending order of effective value.
+    typedef std::pair<uint64_t, std::size_t> candidate_t;
+    typedef std::vector<candidate_t> candidates_t;
+
+    // Returns positions in candidates whose effective values sum to at least target, or an empty vector.
+    // Excess up to cost_of_change is cheaper as fee than as a change output.
+    virtual std::vector<std::size_t> selectCandidates(const candidates_t& candidates, uint64_t target, uint64_t cost_of_change) const = 0;
+
+    static std::vector<std::size_t> selectLargestFirst(const candidates_t& candidates, uint64_t target);
+
+    TxSizeModel model_;
+    CoinSelectionParams params_;
+};
+
+class BranchAndBoundCoinSelector : public CoinSelector
+{
+public:
+    enum { MAX_TRIES = 100000 };
+
+    BranchAndBoundCoinSelector(const TxSizeModel& model, const CoinSelectionParams& params) : CoinSelector(model, params) { }
+
+protected:
+    std::vector<std::size_t> selectCandidates(const candidates_t& candidates, uint64_t target, uint64_t cost_of_change) const;
+};
+
+class LargestFirstCoinSelector : public CoinSelector
+{
+public:
+    LargestFirstCoinSelector(const TxSizeModel& model, const CoinSelectionParams& params) : CoinSelector(model, params) { }
+
+protected:
+    std::vector<std::size_t> selectCandidates(const candidates_t& candidates, uint64_t target, uint64_t cost_of_change) const;
+};
+
+class ConsolidatingCoinSelector : public CoinSelector
+{
+public:
+    ConsolidatingCoinSelector(const TxSizeModel& model, const CoinSelectionParams& params) : CoinSelector(model, params) { }
+
+protected:
+    std::vector<std::size_t> selectCandidates(const candidates_t& candidates, uint64_t target, uint64_t cost_of_change) const;
+};
+
+}
@@ -27,11 +27,41 @@
 #include <boost/archive/text_iarchive.hpp>
 
 #include <cstring>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
 
 //#define ENABLE_CRYPTO
 
 using namespace CoinDB;
 
+/*
+ * Derivation cache
+ */
+
+namespace
+{
+
+// Nodes are keyed by the hash of the keychain they were derived from and the derivation path applied to it.
+typedef std::pair<bytes_t, std::vector<uint32_t>> derivation_cache_key_t;
+typedef std::map<derivation_cache_key_t, Coin::HDKeychain> derivation_cache_t;
+
+const std::size_t MAX_DERIVATION_CACHE_SIZE = 4096;
+
+std::mutex g_derivationCacheMutex;
+derivation_cache_t g_publicDerivationCache;
+derivation_cache_t g_privateDerivationCache;
+
+// Precondition: g_derivationCacheMutex is held
+void clearPrivateDerivationNodes(derivation_cache_t::iterator begin, derivation_cache_t::iterator end)
+{
+    for (auto it = begin; it != end; ++it) { it->second.clear(); }
+    g_privateDerivationCache.erase(begin, end);
+}
+
+}
+
 /*
  * class Keychain
  */
@@ -154,8 +184,7 @@ std::shared_ptr<Keychain> Keychain::child(uint32_t i, bool get_private, const se
     }
     else
     {
-        Coin::HDKeychain hdkeychain(pubkey_, chain_code_, child_num_, parent_fp_, depth_);
-        hdkeychain = hdkeychain.getChild(i);
+        Coin::HDKeychain hdkeychain = getDerivationNode(std::vector<uint32_t>(1, i), false);
         std::shared_ptr<Keychain> child(new Keychain());;
         child->parent_ = get_shared_ptr();
         child->pubkey_ = hdkeychain.pubkey();
@@ -174,6 +203,7 @@ void Keychain::lock() const
 {
     privkey_.clear();
     seed_.clear();
+    clearPrivateDerivationCache(hash_);
 }
 
 void Keychain::unlock(const secure_bytes_t& lock_key) const
@@ -235,18 +265,106 @@ secure_bytes_t Keychain::getSigningPrivateKey(uint32_t i, const std::vector<uint
     if (!isPrivate()) throw std::runtime_error("Missing private key.");
     if (isLocked()) throw std::runtime_error("Private key is locked.");
 
-    // Remove initial zero from privkey if necessary
-    secure_bytes_t stripped_privkey = (privkey_.size() > 32) ? secure_bytes_t(privkey_.begin() + 1, privkey_.end()) : privkey_;
-    Coin::HDKeychain hdkeychain(stripped_privkey, chain_code_, child_num_, parent_fp_, depth_);
-    for (auto k: derivation_path) { hdkeychain = hdkeychain.getChild(k); }
-    return hdkeychain.getPrivateSigningKey(i);
+    Coin::HDKeychain hdkeychain = getDerivationNode(derivation_path, true);
+    secure_bytes_t privkey = hdkeychain.getPrivateSigningKey(i);
+    hdkeychain.clear();
+    return privkey;
 }
 
 bytes_t Keychain::getSigningPublicKey(uint32_t i, bool get_compressed, const std::vector<uint32_t>& derivation_path) const
 {
-    Coin::HDKeychain hdkeychain(pubkey_, chain_code_, child_num_, parent_fp_, depth_);
-    for (auto k: derivation_path) { hdkeychain = hdkeychain.getChild(k); }
-    return hdkeychain.getPublicSigningKey(i, get_compressed);
+    return getDerivationNode(derivation_path, false).getPublicSigningKey(i, get_compressed);
+}
+
+std::vector<bytes_t> Keychain::derivePublicKeys(uint32_t begin, uint32_t end, bool get_compressed, const std::vector<uint32_t>& derivation_path) const
+{
+    if (end < begin) throw std::runtime_error("Keychain::derivePublicKeys() - invalid range.");
+
+    Coin::HDKeychain hdkeychain = getDerivationNode(derivation_path, false);
+
+    std::vector<bytes_t> pubkeys;
+    pubkeys.reserve(end - begin);
+    for (uint32_t i = begin; i < end; i++) { pubkeys.push_back(hdkeychain.getPublicSigningKey(i, get_compressed)); }
+    return pubkeys;
+}
+
+// static
+void Keychain::clearPrivateDerivationCache(const bytes_t& hash)
+{
+    std::lock_guard<std::mutex> lock(g_derivationCacheMutex);
+    auto begin = g_privateDerivationCache.lower_bound(derivation_cache_key_t(hash, std::vector<uint32_t>()));
+    auto end = begin;
+    while (end != g_privateDerivationCache.end() && end->first.first == hash) { ++end; }
+    clearPrivateDerivationNodes(begin, end);
+}
+
+Coin::HDKeychain Keychain::getDerivationNode(const std::vector<uint32_t>& derivation_path, bool get_private) const
+{
+    derivation_cache_t& cache = get_private ? g_privateDerivationCache : g_publicDerivationCache;
+    derivation_cache_key_t key(hash_, derivation_path);
+
+    // Start from the longest cached prefix of the path.
+    Coin::HDKeychain hdkeychain;
+    std::size_t n = derivation_path.size() + 1;
+    if (!hash_.empty())
+    {
+        std::lock_guard<std::mutex> lock(g_derivationCacheMutex);
+        while (n > 0)
+        {
+            key.second.resize(n - 1);
+            auto it = cache.find(key);
+            if (it != cache.end())
+            {
+                hdkeychain = it->second;
+                break;
+            }
+            n--;
+        }
+    }
+    else
+    {
+        n = 0;
+    }
+
+    derivation_cache_t new_nodes;
+    if (n == 0)
+    {
+        if (get_private)
+        {
+            // Remove initial zero from privkey if necessary
+            secure_bytes_t stripped_privkey = (privkey_.size() > 32) ? secure_bytes_t(privkey_.begin() + 1, privkey_.end()) : privkey_;
+            hdkeychain = Coin::HDKeychain(stripped_privkey, chain_code_, child_num_, parent_fp_, depth_);
+        }
+        else
+        {
+            hdkeychain = Coin::HDKeychain(pubkey_, chain_code_, child_num_, parent_fp_, depth_);
+        }
+
+        key.second.clear();
+        new_nodes[key] = hdkeychain;
+        n = 1;
+    }
+
+    for (std::size_t k = n - 1; k < derivation_path.size(); k++)
+    {
+        hdkeychain = hdkeychain.getChild(derivation_path[k]);
+        key.second.push_back(derivation_path[k]);
+        new_nodes[key] = hdkeychain;
+    }
+
+    if (!hash_.empty() && !new_nodes.empty())
+    {
+        std::lock_guard<std::mutex> lock(g_derivationCacheMutex);
+        if (cache.size() + new_nodes.size() > MAX_DERIVATION_CACHE_SIZE)
+        {
+            if (get_private)    { clearPrivateDerivationNodes(cache.begin(), cache.end()); }
+            else                { cache.clear(); }
+        }
+        cache.insert(new_nodes.begin(), new_nodes.end());
+    }
+
+    if (get_private) { for (auto& node: new_nodes) { node.second.clear(); } }
+    return hdkeychain;
 }
 
 secure_bytes_t Keychain::privkey() const
@@ -308,6 +426,12 @@ void Keychain::importBIP32(const secure_bytes_t& extkey, const secure_bytes_t& l
 }
 
 secure_bytes_t Keychain::exportBIP32(bool export_private) const
+{
+    Coin::HDKeychain defaults;
+    return exportBIP32(export_private, defaults.priv_version(), defaults.pub_version());
+}
+
+secure_bytes_t Keychain::exportBIP32(bool export_private, uint32_t priv_version, uint32_t pub_version) const
 {
     secure_bytes_t key;
 
@@ -324,7 +448,9 @@ secure_bytes_t Keychain::exportBIP32(bool export_private) const
         key = pubkey_;
     }
 
-    return Coin::HDKeychain(key, chain_code_, child_num_, parent_fp_, depth_).extkey();
+    Coin::HDKeychain hdkeychain(key, chain_code_, child_num_, parent_fp_, depth_);
+    hdkeychain.setNetworkVersions(priv_version, pub_version);
+    return hdkeychain.extkey();
 }
 
 void Keychain::clearPrivateKey()
@@ -353,6 +479,16 @@ Key::Key(const std::shared_ptr<Keychain>& keychain, uint32_t index, bool compres
     updatePrivate();
 }
 
+Key::Key(const std::shared_ptr<Keychain>& keychain, uint32_t index, const bytes_t& pubkey)
+{
+    root_keychain_ = keychain->root();
+    derivation_path_ = keychain->derivation_path();
+    index_ = index;
+
+    pubkey_ = pubkey;
+    updatePrivate();
+}
+
 secure_bytes_t Key::privkey() const
 {
     if (!is_private_ || root_keychain_->isLocked()) return secure_bytes_t();
@@ -486,22 +622,15 @@ std::string AccountBin::account_name() const
 
 SigningScriptVector AccountBin::generateSigningScripts()
 {
-    SigningScriptVector signingscripts;
+    script_count_ = 0;
+    SigningScriptVector signingscripts = newSigningScripts(next_script_index_ + unused_pool_size());
+
+    SigningScript::status_t status = (index_ == CHANGE_INDEX) ? SigningScript::CHANGE : SigningScript::ISSUED;
     for (uint32_t i = 0; i < next_script_index_; i++)
     {
-        std::string label;
         auto it = script_label_map_.find(i);
-        if (it != script_label_map_.end())   { label = it->second; }
-        SigningScript::status_t status = (index_ == CHANGE_INDEX) ? SigningScript::CHANGE : SigningScript::ISSUED;
-        std::shared_ptr<SigningScript> signingscript(new SigningScript(shared_from_this(), i, label, status));
-        signingscripts.push_back(signingscript);
-    }
-
-    script_count_ = next_script_index_ + unused_pool_size();
-    for (uint32_t i = next_script_index_; i < script_count_; i++)
-    {
-        std::shared_ptr<SigningScript> signingscript(new SigningScript(shared_from_this(), i));
-        signingscripts.push_back(signingscript);
+        if (it != script_label_map_.end())   { signingscripts[i]->label(it->second); }
+        signingscripts[i]->status(status);
     }
 
     return signingscripts;
@@ -552,6 +681,80 @@ std::shared_ptr<SigningScript> AccountBin::newSigningScript(const std::string& l
     return signingscript;
 }
 
+SigningScriptVector AccountBin::newSigningScripts(uint32_t count)
+{
+    std::shared_ptr<Account> account = account_.lock();
+    if (!account) throw std::runtime_error("AccountBin::newSigningScripts() - account is null.");
+
+    // SigningScript::initScripts() loads the templates lazily. Load them here so the workers only read the account.
+    account->loadScriptTemplates();
+
+    const KeychainSet& keychain_set = keychains();
+    std::vector<std::shared_ptr<Keychain>> keychains(keychain_set.begin(), keychain_set.end());
+    std::shared_ptr<AccountBin> self = shared_from_this();
+    uint32_t first_index = script_count_;
+    bool compressed = account->compressed_keys();
+
+    // Each worker derives the keys and builds the scripts for a contiguous range of indices. Derivation
+    // dominates, so small batches are not worth the threads. The scripts are built without labels, so
+    // the workers do not touch the label map.
+    const uint32_t MIN_SCRIPTS_PER_THREAD = 16;
+    uint32_t threads = std::thread::hardware_concurrency();
+    if (threads == 0) { threads = 1; }
+    if (threads > count / MIN_SCRIPTS_PER_THREAD) { threads = count / MIN_SCRIPTS_PER_THREAD; }
+    if (threads == 0) { threads = 1; }
+
+    SigningScriptVector signingscripts(count);
+    std::vector<std::exception_ptr> errors(threads);
+
+    auto build = [&](uint32_t thread_index, uint32_t begin, uint32_t end)
+    {
+        try
+        {
+            std::vector<std::vector<bytes_t>> keychain_pubkeys;
+            for (auto& keychain: keychains)
+            {
+                keychain_pubkeys.push_back(keychain->derivePublicKeys(first_index + begin, first_index + end, compressed));
+            }
+
+            for (uint32_t i = begin; i < end; i++)
+            {
+                KeyVector keys;
+                for (std::size_t k = 0; k < keychains.size(); k++)
+                {
+                    std::shared_ptr<Key> key(new Key(keychains[k], first_index + i, keychain_pubkeys[k][i - begin]));
+                    keys.push_back(key);
+                }
+
+                signingscripts[i] = std::shared_ptr<SigningScript>(new SigningScript(self, first_index + i, keys));
+            }
+        }
+        catch (...)
+        {
+            errors[thread_index] = std::current_exception();
+        }
+    };
+
+    uint32_t per_thread = count / threads;
+    std::vector<std::thread> workers;
+    for (uint32_t t = 1; t < threads; t++)
+    {
+        uint32_t begin = t * per_thread;
+        uint32_t end = (t == threads - 1) ? count : begin + per_thread;
+        workers.push_back(std::thread(build, t, begin, end));
+    }
+    build(0, 0, threads > 1 ? per_thread : count);
+    for (auto& worker: workers) { worker.join(); }
+
+    for (auto& error: errors)
+    {
+        if (error) std::rethrow_exception(error);
+    }
+
+    script_count_ += count;
+    return signingscripts;
+}
+
 void AccountBin::markSigningScriptIssued(uint32_t script_index)
 {
     if (script_index >= next_script_index_)
@@ -620,6 +823,19 @@ SigningScript::SigningScript(std::shared_ptr<AccountBin> account_bin, uint32_t i
         keys_.push_back(key);
     }
 
+    initScripts(label);
+}
+
+SigningScript::SigningScript(std::shared_ptr<AccountBin> account_bin, uint32_t index, const KeyVector& keys, const std::string& label, status_t status)
+    : account_(account_bin->account()), account_bin_(account_bin), index_(index), label_(label), status_(status), keys_(keys)
+{
+    if (!account_) throw std::runtime_error("SigningScript::SigningScript() - account is null.");
+
+    initScripts(label);
+}
+
+void SigningScript::initScripts(const std::string& label)
+{
     // sort keys into canonical order
     std::sort(keys_.begin(), keys_.end(), [](std::shared_ptr<Key> key1, std::shared_ptr<Key> key2) { return key1->pubkey() < key2->pubkey(); });
 
@@ -658,7 +874,7 @@ SigningScript::SigningScript(std::shared_ptr<AccountBin> account_bin, uint32_t i
         txoutscript_ = txoutscript;
     }
 
-    account_bin_->setScriptLabel(index, label);
+    account_bin_->setScriptLabel(index_, label);
 }
 
 void SigningScript::label(const std::string& label)
@@ -730,6 +946,13 @@ void BlockHeader::updateHash()
     hash_ = Coin::CoinBlockHeader(version_, timestamp_, bits_, nonce_, prevhash_, merkleroot_).hash();
 }
 
+void BlockHeader::updateHash(const Coin::header_hashfuncs_t& hashfuncs)
+{
+    Coin::CoinBlockHeader blockheader(version_, timestamp_, bits_, nonce_, prevhash_, merkleroot_);
+    blockheader.setHashFuncs(hashfuncs);
+    hash_ = blockheader.hash();
+}
+
 
 /*
  * class MerkleBlock
@@ -905,17 +1128,18 @@ std::vector<TxOut::role_t> TxOut::getRoleFlags(int flags)
 }
 
 TxOut::TxOut(uint64_t value, std::shared_ptr<SigningScript> signingscript)
-    : value_(value), status_(UNSPENT)
+    : value_(value), status_(UNSPENT), balance_tx_status_(0), balance_height_(0)
 {
     this->signingscript(signingscript);
 }
 
 TxOut::TxOut(const Coin::TxOut& coin_txout)
-    : value_(coin_txout.value), script_(coin_txout.scriptPubKey), status_(UNSPENT)
+    : value_(coin_txout.value), script_(coin_txout.scriptPubKey), status_(UNSPENT), balance_tx_status_(0), balance_height_(0)
 {
 }
 
 TxOut::TxOut(const bytes_t& raw)
+    : balance_tx_status_(0), balance_height_(0)
 {
     Coin::TxOut coin_txout(raw);
     value_ = coin_txout.value;
@@ -1073,10 +1297,10 @@ void Tx::set(const bytes_t& raw, uint32_t timestamp, status_t status, bool confl
     updateTotals();
 }
 
-bool Tx::updateStatus(status_t status /* = NO_STATUS */, bool checksigs)
+bool Tx::updateStatus(status_t status /* = NO_STATUS */, bool checksigs, CoinQ::Script::SignatureVerifier* verifier)
 {
     // Tx is not signed.
-    if (checksigs && missingSigCount())
+    if (checksigs && missingSigCount(verifier))
     {
         status_ = UNSIGNED;
         hash_ = bytes_t();
@@ -1219,16 +1443,31 @@ void Tx::fromCoinCore(const Coin::Transaction& coin_tx)
     locktime_ = coin_tx.lockTime;
 }
 
-unsigned int Tx::missingSigCount() const
+unsigned int Tx::missingSigCount(CoinQ::Script::SignatureVerifier* verifier) const
 {
     // Assume for now all inputs belong to the same account.
     using namespace CoinQ::Script;
     unsigned int count = 0;
     Coin::Transaction cointx(toCoinCore());
+
+    SignatureVerifier localverifier;
+    if (!verifier)
+    {
+        std::vector<uint64_t> outpointvalues(cointx.inputs.size(), 0);
+        for (auto& txin: txins_)
+        {
+            if (txin->outpoint() && txin->txindex() < outpointvalues.size()) { outpointvalues[txin->txindex()] = txin->outpoint()->value(); }
+        }
+        localverifier.queue(cointx, outpointvalues);
+        localverifier.verify();
+        verifier = &localverifier;
+    }
+
+    Coin::SigHashContext sighashcontext(cointx);
     for (auto& txin: txins_)
     {
         uint64_t outpointvalue = txin->outpoint() ? txin->outpoint()->value() : 0;
-        SignableTxIn signabletxin(cointx, txin->txindex(), outpointvalue);
+        SignableTxIn signabletxin(cointx, txin->txindex(), outpointvalue, bytes_t(), verifier, &sighashcontext);
         unsigned int sigsneeded = signabletxin.sigsneeded();
         if (sigsneeded > count) count = sigsneeded;
     }
@@ -1240,10 +1479,11 @@ std::set<bytes_t> Tx::missingSigPubkeys() const
     using namespace CoinQ::Script;
     std::set<bytes_t> pubkeys;
     Coin::Transaction cointx = toCoinCore();
+    Coin::SigHashContext sighashcontext(cointx);
     for (auto& txin: txins_)
     {
         uint64_t outpointvalue = txin->outpoint() ? txin->outpoint()->value() : 0;
-        SignableTxIn signabletxin(cointx, txin->txindex(), outpointvalue);
+        SignableTxIn signabletxin(cointx, txin->txindex(), outpointvalue, bytes_t(), nullptr, &sighashcontext);
         std::vector<bytes_t> txinpubkeys = signabletxin.missingsigs();
         for (auto& txinpubkey: txinpubkeys) { pubkeys.insert(txinpubkey); }
     } 
@@ -35,6 +35,8 @@
 
 #include <logger/logger.h>
 
+namespace Coin { class HDKeychain; }
+
 #pragma db namespace session
 namespace CoinDB
 {
@@ -57,7 +59,7 @@ typedef odb::nullable<unsigned long> null_id_t;
 ////////////////////
 
 #define SCHEMA_BASE_VERSION 12
-#define SCHEMA_VERSION      22
+#define SCHEMA_VERSION      23
 
 #ifdef ODB_COMPILER
 #pragma db model version(SCHEMA_BASE_VERSION, SCHEMA_VERSION, open)
@@ -233,6 +235,13 @@ public:
     secure_bytes_t getSigningPrivateKey(uint32_t i, const std::vector<uint32_t>& derivation_path = std::vector<uint32_t>()) const;
     bytes_t getSigningPublicKey(uint32_t i, bool get_compressed = true, const std::vector<uint32_t>& derivation_path = std::vector<uint32_t>()) const;
 
+    // Derives the public signing keys for indices begin through end - 1. The derivation path is only walked once.
+    std::vector<bytes_t> derivePublicKeys(uint32_t begin, uint32_t end, bool get_compressed = true, const std::vector<uint32_t>& derivation_path = std::vector<uint32_t>()) const;
+
+    // Intermediate derivation nodes are cached by keychain hash and path. Private nodes are zeroized when discarded.
+    // Discards the private nodes cached for the keychain with the given hash. Its public nodes are kept.
+    static void clearPrivateDerivationCache(const bytes_t& hash);
+
     uint32_t depth() const { return depth_; }
     uint32_t parent_fp() const { return parent_fp_; }
     uint32_t child_num() const { return child_num_; }
@@ -252,12 +261,15 @@ public:
 
     void importBIP32(const secure_bytes_t& extkey, const secure_bytes_t& lock_key = secure_bytes_t());
     secure_bytes_t exportBIP32(bool export_private = false) const;
+    secure_bytes_t exportBIP32(bool export_private, uint32_t priv_version, uint32_t pub_version) const;
 
     void clearPrivateKey();
 
 private:
     friend class odb::access;
 
+    Coin::HDKeychain getDerivationNode(const std::vector<uint32_t>& derivation_path, bool get_private) const;
+
     #pragma db id auto
     unsigned long id_;
 
@@ -375,6 +387,7 @@ class Key
 {
 public:
     Key(const std::shared_ptr<Keychain>& keychain, uint32_t index, bool compressed = true);
+    Key(const std::shared_ptr<Keychain>& keychain, uint32_t index, const bytes_t& pubkey); // pubkey must already be derived from keychain
 
     unsigned long id() const { return id_; }
     const bytes_t& pubkey() const { return pubkey_; }
@@ -456,6 +469,7 @@ public:
     uint32_t minsigs() const { return minsigs_; }
 
     std::shared_ptr<SigningScript> newSigningScript(const std::string& label = "");
+    SigningScriptVector newSigningScripts(uint32_t count); // derives keys and builds scripts for contiguous ranges in parallel, one batch per keychain per range
     void markSigningScriptIssued(uint32_t script_index);
 
     void keychains(const KeychainSet& keychains) { keychains_ = keychains; keychains__ = keychains; } // only used for imported account bins
@@ -850,6 +864,7 @@ public:
     static std::vector<status_t>    getStatusFlags(int status);
 
     SigningScript(std::shared_ptr<AccountBin> account_bin, uint32_t index, const std::string& label = "", status_t status = UNUSED);
+    SigningScript(std::shared_ptr<AccountBin> account_bin, uint32_t index, const KeyVector& keys, const std::string& label = "", status_t status = UNUSED);
     SigningScript(std::shared_ptr<AccountBin> account_bin, uint32_t index, const bytes_t& txinscript, const bytes_t& txoutscript, const std::string& label = "", status_t status = UNUSED)
         : account_(account_bin->account()), account_bin_(account_bin), index_(index), label_(label), status_(status), txinscript_(txinscript), txoutscript_(txoutscript) { }
 
@@ -882,6 +897,8 @@ private:
     friend class odb::access;
     SigningScript() { }
 
+    void initScripts(const std::string& label);
+
     #pragma db id auto
     unsigned long id_;
 
@@ -946,6 +963,10 @@ public:
 
     std::string toJson() const;
 
+    // Rehashes with the hash functions of the header's network. Headers constructed from fields or loaded from an
+    // archive are hashed with the default hash functions.
+    void updateHash(const Coin::header_hashfuncs_t& hashfuncs);
+
 private:
     friend class odb::access;
 
@@ -1217,9 +1238,9 @@ public:
     static std::vector<role_t>      getRoleFlags(int flags);
 
 
-    TxOut() : status_(UNSPENT) { }
+    TxOut() : status_(UNSPENT), balance_tx_status_(0), balance_height_(0) { }
     TxOut(uint64_t value, const bytes_t& script)
-        : value_(value), script_(script), status_(UNSPENT) { }
+        : value_(value), script_(script), status_(UNSPENT), balance_tx_status_(0), balance_height_(0) { }
 
     // Constructor for change and transfers
     TxOut(uint64_t value, std::shared_ptr<SigningScript> signingscript);
@@ -1266,6 +1287,11 @@ public:
 
     status_t status() const { return status_; }
 
+    // AccountBalance bucket of the receiving account the value is currently counted in, tx status 0 if none.
+    void balance_bucket(uint32_t tx_status, uint32_t height) { balance_tx_status_ = tx_status; balance_height_ = height; }
+    uint32_t balance_tx_status() const { return balance_tx_status_; }
+    uint32_t balance_height() const { return balance_height_; }
+
     std::string toJson() const;
 
 private:
@@ -1281,6 +1307,9 @@ private:
     std::weak_ptr<Tx> tx_;
     uint32_t txindex_;
 
+    // Lets history queries join from a tx to its outputs in output order.
+    #pragma db index("TxOut_history_i") members(tx_, txindex_)
+
     #pragma db null
     std::shared_ptr<TxIn> spent_;
 
@@ -1303,6 +1332,10 @@ private:
     // Redundant but convenient for view queries.
     status_t status_;
 
+    // Lets balance updates move the value between buckets without re-aggregating the account's outputs.
+    uint32_t balance_tx_status_;
+    uint32_t balance_height_;
+
     friend class boost::serialization::access;
     template<class Archive>
     void serialize(Archive& ar, const unsigned int /*version*/)
@@ -1373,7 +1406,7 @@ public:
     void timestamp(uint32_t timestamp) { timestamp_ = timestamp; }
     uint32_t timestamp() const { return timestamp_; }
 
-    bool updateStatus(status_t status = NO_STATUS, bool checksigs = false); // Will keep the status it already had if it didn't change and no parameter is passed. Returns true iff status changed.
+    bool updateStatus(status_t status = NO_STATUS, bool checksigs = false, CoinQ::Script::SignatureVerifier* verifier = nullptr); // Will keep the status it already had if it didn't change and no parameter is passed. Returns true iff status changed.
     void status(status_t status) { status_ = status; }
     status_t status() const { return status_; }
 
@@ -1400,7 +1433,8 @@ public:
     void shuffle_txins();
     void shuffle_txouts();
 
-    unsigned int missingSigCount() const;
+    // If no verifier is passed, the signatures of all inputs are verified together in a local batch.
+    unsigned int missingSigCount(CoinQ::Script::SignatureVerifier* verifier = nullptr) const;
     std::set<bytes_t> missingSigPubkeys() const;
     std::set<bytes_t> presentSigPubkeys() const;
 
@@ -1456,6 +1490,9 @@ private:
     #pragma db null
     odb::nullable<uint32_t> blockindex_;
 
+    // Unconfirmed txs are paged in (timestamp, id) order by walking the blockheader IS NULL prefix of this index.
+    #pragma db index("Tx_history_i") members(blockheader_, timestamp_, id_)
+
     #pragma db null
     std::shared_ptr<User> user_;
 
@@ -1580,6 +1617,45 @@ private:
 typedef std::vector<std::shared_ptr<Tx>> txs_t;
 
 
+/////////////////////
+// ACCOUNT BALANCE //
+/////////////////////
+
+// Materialized sum of the unspent outputs received by an account, bucketed by tx status and confirmation
+// height so balance queries only read a few rows. Maintained by the vault whenever txs or blocks change.
+#pragma db object pointer(std::shared_ptr)
+class AccountBalance
+{
+public:
+    AccountBalance(std::shared_ptr<Account> account, Tx::status_t tx_status, uint32_t height, uint64_t balance)
+        : account_(account), tx_status_(tx_status), height_(height), balance_(balance) { }
+
+    unsigned long id() const { return id_; }
+    std::shared_ptr<Account> account() const { return account_; }
+    Tx::status_t tx_status() const { return tx_status_; }
+    uint32_t height() const { return height_; }
+
+    void balance(uint64_t balance) { balance_ = balance; }
+    uint64_t balance() const { return balance_; }
+
+private:
+    AccountBalance() { }
+    friend class odb::access;
+
+    #pragma db id auto
+    unsigned long id_;
+
+    #pragma db not_null
+    std::shared_ptr<Account> account_;
+
+    Tx::status_t tx_status_;
+    uint32_t height_; // 0 if unconfirmed
+    uint64_t balance_;
+
+    #pragma db index("AccountBalance_bucket_i") members(account_, tx_status_, height_)
+};
+
+
 // Views
 #pragma db view \
     object(Keychain) \
@@ -1929,19 +2005,64 @@ struct TxOutView
     uint32_t height;
 };
 
+// Position in the history order used for keyset pagination: unconfirmed txs first, then confirmed txs by
+// descending height, each newest first, and the outputs of a tx by ascending index. A default cursor is
+// before the first row. A cursor made from the last row of a page continues after that row.
+struct TxViewCursor
+{
+    TxViewCursor() : started(false), confirmed(false), height(0), timestamp(0), tx_id(0), txindex(0) { }
+    explicit TxViewCursor(const TxView& view) : started(true), confirmed(view.height != 0), height(view.height), timestamp(view.timestamp), tx_id(view.id), txindex(0) { }
+    explicit TxViewCursor(const TxOutView& view) : started(true), confirmed(view.height != 0), height(view.height), timestamp(view.tx_timestamp), tx_id(view.tx_id), txindex(view.tx_index) { }
+
+    bool started;
+    bool confirmed;
+    uint32_t height;
+    uint32_t timestamp;
+    unsigned long tx_id;
+    uint32_t txindex;
+};
+
+// Computes the AccountBalance buckets from the outputs themselves.
 #pragma db view \
     object(TxOut) \
     object(Tx: TxOut::tx_) \
     object(BlockHeader: Tx::blockheader_) \
-    object(Account: TxOut::receiving_account_) \
-    object(AccountBin: TxOut::account_bin_) \
-    object(SigningScript: TxOut::signingscript_)
-struct BalanceView
+    query((?) + "GROUP BY" + Tx::status_ + "," + BlockHeader::height_)
+struct BalanceBucketView
 {
+    #pragma db column(Tx::status_)
+    Tx::status_t tx_status;
+
+    #pragma db column(BlockHeader::height_)
+    uint32_t height;
+
     #pragma db column("sum(" + TxOut::value_ + ")")
     uint64_t balance;
 };
 
+// Coin selection candidates, leaving the rest of TxOutView unloaded until coins are chosen.
+#pragma db view \
+    object(TxOut) \
+    object(Tx: TxOut::tx_) \
+    object(BlockHeader: Tx::blockheader_)
+struct CoinView
+{
+    #pragma db column(TxOut::id_)
+    unsigned long id;
+
+    #pragma db column(TxOut::value_)
+    uint64_t value;
+};
+
+#pragma db view \
+    object(AccountBalance) \
+    object(Account: AccountBalance::account_)
+struct AccountBalanceView
+{
+    #pragma db column("sum(" + AccountBalance::balance_ + ")")
+    uint64_t balance;
+};
+
 #pragma db view \
 	object(MerkleBlock) \
     object(BlockHeader: MerkleBlock::blockheader_) \
@@ -2018,6 +2139,33 @@ struct IncompleteBlockCountView
     unsigned long count;
 };
 
+#pragma db view \
+    object(SigningScript)
+struct SigningScriptIndexView
+{
+    #pragma db column(SigningScript::txinscript_)
+    bytes_t txinscript;
+
+    #pragma db column(SigningScript::txoutscript_)
+    bytes_t txoutscript;
+};
+
+#pragma db view \
+    object(Tx)
+struct TxHashView
+{
+    #pragma db column(Tx::hash_)
+    bytes_t hash;
+};
+
+#pragma db view \
+    object(TxIn)
+struct TxInOutHashView
+{
+    #pragma db column(TxIn::outhash_)
+    bytes_t outhash;
+};
+
 }
 
 BOOST_CLASS_VERSION(CoinDB::BlockHeader, 1)
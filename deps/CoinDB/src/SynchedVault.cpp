@@ -50,7 +50,10 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
     m_bSynching(false),
     m_bBlockTreeSynched(false),
     m_bGotMempool(false),
-    m_bInsertMerkleBlocks(false)
+    m_bInsertMerkleBlocks(false),
+    m_syncBatchBlocks(DEFAULT_SYNC_BATCH_BLOCKS),
+    m_syncBatchMilliseconds(DEFAULT_SYNC_BATCH_MILLISECONDS),
+    m_syncBatchBlockCount(0)
 {
     LOGGER(trace) << "SynchedVault::SynchedVault()" << std::endl;
 
@@ -87,6 +90,10 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
     m_networkSync.subscribeClose([this]()
     {
         LOGGER(trace) << "SynchedVault - connection closed." << std::endl;
+        {
+            std::lock_guard<std::mutex> lock(m_vaultMutex);
+            commitSyncBatch();
+        }
         m_bConnected = false;
         m_bSynching = false;
         m_notifyPeerDisconnected();
@@ -106,6 +113,10 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
     m_networkSync.subscribeTimeout([this]()
     {
         LOGGER(trace) << "SynchedVault - Sync timeout." << std::endl;
+        {
+            std::lock_guard<std::mutex> lock(m_vaultMutex);
+            commitSyncBatch();
+        }
         m_notifyConnectionError("Network timed out.", -1);
     });
 
@@ -153,6 +164,11 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
     {
         LOGGER(trace) << "SynchedVault - Block sync complete." << std::endl;
 
+        {
+            std::lock_guard<std::mutex> lock(m_vaultMutex);
+            commitSyncBatch();
+        }
+
         if (m_networkSync.connected())
         {
             updateStatus(SYNCHED);
@@ -194,6 +210,7 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
 
         try
         {
+            commitSyncBatch();
             m_vault->insertNewTx(cointx);
         }
         catch (const VaultException& e)
@@ -216,21 +233,7 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
         std::lock_guard<std::mutex> lock(m_vaultMutex);
         if (!m_vault) return;
 
-        try
-        {
-            m_vault->insertMerkleTx(chainmerkleblock, cointx, txindex, txcount);
-        }
-        catch (const VaultException& e)
-        {
-            LOGGER(error) << e.what() << std::endl;
-            m_notifyVaultError(e.what(), e.code());
-        } 
-        catch (const std::exception& e)
-        {
-            LOGGER(error) << e.what() << std::endl;
-            m_notifyVaultError(e.what(), -1);
-        } 
-	
+        processSyncEvent([=]() { m_vault->insertMerkleTx(chainmerkleblock, cointx, txindex, txcount); }, false);
     });
 
     m_networkSync.subscribeTxConfirmed([this](const ChainMerkleBlock& chainmerkleblock, const bytes_t& txhash, unsigned int txindex, unsigned int txcount)
@@ -241,20 +244,7 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
         std::lock_guard<std::mutex> lock(m_vaultMutex);
         if (!m_vault) return;
 
-        try
-        {
-            m_vault->confirmMerkleTx(chainmerkleblock, txhash, txindex, txcount);
-        }
-        catch (const VaultException& e)
-        {
-            LOGGER(error) << e.what() << std::endl;
-            m_notifyVaultError(e.what(), e.code());
-        } 
-        catch (const std::exception& e)
-        {
-            LOGGER(error) << e.what() << std::endl;
-            m_notifyVaultError(e.what(), -1);
-        } 
+        processSyncEvent([=]() { m_vault->confirmMerkleTx(chainmerkleblock, txhash, txindex, txcount); }, false);
     });
 
     m_networkSync.subscribeMerkleBlock([this](const ChainMerkleBlock& chainMerkleBlock)
@@ -267,22 +257,12 @@ SynchedVault::SynchedVault(const CoinQ::CoinParams& coinParams) :
         if (!m_vault) return;
         if (!m_bInsertMerkleBlocks) return;
 
-        try
+        processSyncEvent([=]()
         {
             std::shared_ptr<MerkleBlock> merkleblock(new MerkleBlock(chainMerkleBlock));
-	    merkleblock->txsinserted(true);
+            merkleblock->txsinserted(true);
             m_vault->insertMerkleBlock(merkleblock);
-        }
-        catch (const VaultException& e)
-        {
-            LOGGER(error) << e.what() << std::endl;
-            m_notifyVaultError(e.what(), e.code());
-        } 
-        catch (const std::exception& e)
-        {
-            LOGGER(error) << e.what() << std::endl;
-            m_notifyVaultError(e.what(), -1);
-        }
+        }, true);
     });
 
     m_networkSync.subscribeBlockTreeChanged([this]()
@@ -303,7 +283,7 @@ SynchedVault::~SynchedVault()
 }
 
 // Block tree operations
-void SynchedVault::loadHeaders(const std::string& blockTreeFile, bool bCheckProofOfWork, CoinQBlockTreeMem::callback_t callback)
+void SynchedVault::loadHeaders(const std::string& blockTreeFile, bool bCheckProofOfWork, ICoinQBlockTree::callback_t callback)
 {
     LOGGER(trace) << "SynchedVault::loadHeaders(" << blockTreeFile << ", " << (bCheckProofOfWork ? "true" : "false") << ")" << std::endl;
 
@@ -328,6 +308,7 @@ void SynchedVault::openVault(const std::string& dbuser, const std::string& dbpas
         m_notifyVaultClosed();
         if (m_vault) delete m_vault;
         m_vault = new Vault;
+        m_vault->setCoinParams(getCoinParams());
         try
         {
             m_vault->open(dbuser, dbpasswd, dbname, bCreate, version, network, migrate);
@@ -377,6 +358,7 @@ void SynchedVault::closeVault()
 
         m_bInsertMerkleBlocks = false;
         m_networkSync.stopSynchingBlocks();
+        commitSyncBatch();
         delete m_vault;
         m_vault = nullptr;
     }
@@ -416,6 +398,7 @@ void SynchedVault::suspendBlockUpdates()
     if (!m_vault) return;
     if (!m_bInsertMerkleBlocks) return;
     std::lock_guard<std::mutex> lock(m_vaultMutex);
+    commitSyncBatch();
     m_bInsertMerkleBlocks = false;
 }
 
@@ -429,6 +412,7 @@ void SynchedVault::syncBlocks()
     std::lock_guard<std::mutex> lock(m_vaultMutex);
     if (!m_vault) throw std::runtime_error("No vault is open.");
 
+    commitSyncBatch();
     uint32_t startTime = m_vault->getMaxFirstBlockTimestamp();
     if (startTime == 0)
     {
@@ -459,7 +443,18 @@ void SynchedVault::updateBloomFilter()
     std::lock_guard<std::mutex> lock(m_vaultMutex);
     if (!m_vault) throw std::runtime_error("No vault is open.");
 
-    m_networkSync.setBloomFilter(m_vault->getBloomFilter(0.001, 0, 0));
+    commitSyncBatch();
+    Coin::BloomFilter filter;
+    std::vector<bytes_t> newElements;
+    if (m_vault->getBloomFilterUpdate(0.001, 0, 0, filter, newElements) && m_networkSync.isBloomFilterLoaded())
+    {
+        // The filter was extended in place so the peer only needs the new elements.
+        if (!newElements.empty()) { m_networkSync.addToBloomFilter(newElements); }
+    }
+    else
+    {
+        m_networkSync.setBloomFilter(filter);
+    }
 }
 
 // This function recursively tries to send dependencies.
@@ -506,6 +501,7 @@ std::shared_ptr<Tx> SynchedVault::sendTx(const bytes_t& hash)
     std::lock_guard<std::mutex> lock(m_vaultMutex);
     if (!m_vault) throw std::runtime_error("No vault is open.");
 
+    commitSyncBatch();
     std::shared_ptr<Tx> tx = m_vault->getTx(hash);
     recursiveSendTx(*m_vault, m_networkSync, tx);
     return tx;
@@ -520,6 +516,7 @@ std::shared_ptr<Tx> SynchedVault::sendTx(unsigned long tx_id)
     std::lock_guard<std::mutex> lock(m_vaultMutex);
     if (!m_vault) throw std::runtime_error("No vault is open.");
 
+    commitSyncBatch();
     std::shared_ptr<Tx> tx = m_vault->getTx(tx_id);
     recursiveSendTx(*m_vault, m_networkSync, tx);
     return tx;
@@ -535,6 +532,107 @@ void SynchedVault::sendTx(Coin::Transaction& coin_tx)
     m_networkSync.getTx(hash);
 }
 
+// Group commit
+void SynchedVault::setSyncBatchParams(unsigned int syncBatchBlocks, unsigned int syncBatchMilliseconds)
+{
+    LOGGER(trace) << "SynchedVault::setSyncBatchParams(" << syncBatchBlocks << ", " << syncBatchMilliseconds << ")" << std::endl;
+
+    std::lock_guard<std::mutex> lock(m_vaultMutex);
+    commitSyncBatch();
+    m_syncBatchBlocks = syncBatchBlocks;
+    m_syncBatchMilliseconds = syncBatchMilliseconds;
+}
+
+// Must be called with m_vaultMutex held.
+void SynchedVault::processSyncEvent(sync_event_t event, bool bNewBlock)
+{
+    if (m_syncBatchBlocks <= 1 || m_status != SYNCHING_BLOCKS)
+    {
+        commitSyncBatch();
+        try
+        {
+            event();
+        }
+        catch (const std::exception& e)
+        {
+            notifySyncEventError(e);
+        }
+        return;
+    }
+
+    // Only close a batch at a block boundary so a block and its transactions are committed together.
+    if (bNewBlock && m_vault->isSyncBatchOpen())
+    {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_syncBatchStartTime);
+        if (m_syncBatchBlockCount >= m_syncBatchBlocks || elapsed.count() >= m_syncBatchMilliseconds) { commitSyncBatch(); }
+    }
+
+    if (!m_vault->isSyncBatchOpen())
+    {
+        m_vault->beginSyncBatch();
+        m_syncBatchBlockCount = 0;
+        m_syncBatchStartTime = std::chrono::steady_clock::now();
+    }
+
+    m_syncBatchEvents.push_back(event);
+    if (bNewBlock) { m_syncBatchBlockCount++; }
+
+    try
+    {
+        event();
+    }
+    catch (const std::exception& e)
+    {
+        LOGGER(debug) << "SynchedVault::processSyncEvent() - rolling back " << m_syncBatchEvents.size() << " batched events: " << e.what() << std::endl;
+        replaySyncBatch();
+    }
+}
+
+// Must be called with m_vaultMutex held.
+void SynchedVault::commitSyncBatch() const
+{
+    if (!m_vault || !m_vault->isSyncBatchOpen()) return;
+
+    LOGGER(debug) << "SynchedVault::commitSyncBatch() - committing " << m_syncBatchBlockCount << " blocks, " << m_syncBatchEvents.size() << " events." << std::endl;
+    try
+    {
+        m_vault->commitSyncBatch();
+        m_syncBatchEvents.clear();
+    }
+    catch (const std::exception& e)
+    {
+        LOGGER(error) << "SynchedVault::commitSyncBatch() - " << e.what() << std::endl;
+        replaySyncBatch();
+    }
+}
+
+// Rolls back the open batch and inserts its events again, each in its own database transaction.
+void SynchedVault::replaySyncBatch() const
+{
+    m_vault->rollbackSyncBatch();
+
+    std::vector<sync_event_t> events;
+    events.swap(m_syncBatchEvents);
+    for (auto& event: events)
+    {
+        try
+        {
+            event();
+        }
+        catch (const std::exception& e)
+        {
+            notifySyncEventError(e);
+        }
+    }
+}
+
+void SynchedVault::notifySyncEventError(const std::exception& e) const
+{
+    LOGGER(error) << e.what() << std::endl;
+    const VaultException* pVaultException = dynamic_cast<const VaultException*>(&e);
+    m_notifyVaultError(e.what(), pVaultException ? pVaultException->code() : -1);
+}
+
 // For testing
 void SynchedVault::insertFakeMerkleBlock(unsigned int nExtraLeaves)
 {
@@ -542,6 +640,7 @@ void SynchedVault::insertFakeMerkleBlock(unsigned int nExtraLeaves)
     std::unique_lock<std::mutex> lock(m_vaultMutex);
     if (!m_vault) throw std::runtime_error("No vault is open.");
 
+    commitSyncBatch();
     txs_t txs = m_vault->getTxs(Tx::PROPAGATED);
     std::vector<Coin::Transaction> cointxs;
     std::vector<uchar_vector> txhashes;
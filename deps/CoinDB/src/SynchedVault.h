@@ -17,6 +17,8 @@
 
 #include <CoinQ/CoinQ_netsync.h>
 
+#include <chrono>
+#include <functional>
 #include <mutex>
 
 namespace CoinDB
@@ -41,7 +43,13 @@ public:
 
     const CoinQ::CoinParams& getCoinParams() const { return m_networkSync.getCoinParams(); }
 
-    void loadHeaders(const std::string& blockTreeFile, bool bCheckProofOfWork = false, CoinQBlockTreeMem::callback_t callback = nullptr);
+    // Keep headers in a memory-mapped file next to blockTreeFile. Must be called before loadHeaders().
+    void enableMappedBlockTree(bool bMapped = true) { m_networkSync.enableMappedBlockTree(bMapped); }
+    bool isMappedBlockTreeEnabled() const { return m_networkSync.isMappedBlockTreeEnabled(); }
+    void enableBlockTreeJournal(bool bEnable = true, unsigned int compactionSize = DEFAULT_BLOCKTREE_JOURNAL_COMPACTION_SIZE) { m_networkSync.enableBlockTreeJournal(bEnable, compactionSize); }
+    bool isBlockTreeJournalEnabled() const { return m_networkSync.isBlockTreeJournalEnabled(); }
+
+    void loadHeaders(const std::string& blockTreeFile, bool bCheckProofOfWork = false, ICoinQBlockTree::callback_t callback = nullptr);
     bool areHeadersLoaded() const { return m_bBlockTreeLoaded; }
 
     void openVault(const std::string& dbname, bool bCreate = false, uint32_t version = SCHEMA_VERSION, const std::string& network = "", bool migrate = false);
@@ -60,6 +68,20 @@ public:
     void setFilterParams(double falsePositiveRate, uint32_t nTweak, uint8_t nFlags);
     void updateBloomFilter();
 
+    void setBlockWindowSize(unsigned int blockWindowSize) { m_networkSync.setBlockWindowSize(blockWindowSize); }
+    unsigned int getBlockWindowSize() const { return m_networkSync.getBlockWindowSize(); }
+    double getBlockSyncRate() const { return m_networkSync.getBlockSyncRate(); }
+
+    // While synching blocks, store up to syncBatchBlocks merkle blocks with their transactions, or as many as arrive within
+    // syncBatchMilliseconds, in a single database transaction. A batch size of 1 commits every block and transaction separately.
+    // If any insertion in a batch fails, the batch is rolled back and its events are inserted again one at a time.
+    void setSyncBatchParams(unsigned int syncBatchBlocks, unsigned int syncBatchMilliseconds = DEFAULT_SYNC_BATCH_MILLISECONDS);
+    unsigned int getSyncBatchBlocks() const { return m_syncBatchBlocks; }
+    unsigned int getSyncBatchMilliseconds() const { return m_syncBatchMilliseconds; }
+
+    static const unsigned int DEFAULT_SYNC_BATCH_BLOCKS = 1;
+    static const unsigned int DEFAULT_SYNC_BATCH_MILLISECONDS = 1000;
+
     status_t getStatus() const { return m_status; }
     uint32_t getBestHeight() const { return m_bestHeight; }
     const bytes_t& getBestHash() const { return m_bestHash; }
@@ -142,6 +164,18 @@ private:
 
     bool                        m_bInsertMerkleBlocks;
 
+    // Group commit of sync events. Vault access through VaultLock commits any open batch first.
+    typedef std::function<void()> sync_event_t;
+    unsigned int                            m_syncBatchBlocks;
+    unsigned int                            m_syncBatchMilliseconds;
+    mutable unsigned int                    m_syncBatchBlockCount;
+    mutable std::chrono::steady_clock::time_point m_syncBatchStartTime;
+    mutable std::vector<sync_event_t>       m_syncBatchEvents;
+    void                        processSyncEvent(sync_event_t event, bool bNewBlock);
+    void                        commitSyncBatch() const;
+    void                        replaySyncBatch() const;
+    void                        notifySyncEventError(const std::exception& e) const;
+
     // Vault state events
     VaultSignal                 m_notifyVaultOpened;
     VoidSignal                  m_notifyVaultClosed;
@@ -172,7 +206,7 @@ private:
 class VaultLock
 {
 public:
-    explicit VaultLock(const SynchedVault& synchedVault) : m_lock(synchedVault.m_vaultMutex) { }
+    explicit VaultLock(const SynchedVault& synchedVault) : m_lock(synchedVault.m_vaultMutex) { synchedVault.commitSyncBatch(); }
 
 private:
     std::lock_guard<std::mutex> m_lock;
@@ -41,6 +41,7 @@
 #include <sstream>
 #include <fstream>
 #include <algorithm>
+#include <random>
 
 using namespace CoinDB;
 
@@ -65,10 +66,116 @@ static void migrate_compressed_keys(odb::database& db)
 static const migration_entry<14> migrate_compressed_keys_entry(&migrate_compressed_keys);
 */
 
+/*
+ * Makes an open sync batch transaction and session current for the calling thread.
+*/
+namespace
+{
+    class SyncBatchScope
+    {
+    public:
+        SyncBatchScope(odb::core::transaction& t, odb::core::session& s)
+        {
+            odb::core::transaction::current(t);
+            odb::core::session::current(s);
+        }
+
+        ~SyncBatchScope()
+        {
+            odb::core::session::reset_current();
+            odb::core::transaction::reset_current();
+        }
+    };
+
+    /*
+     * Sends the notifications of a nested write to its own queue for the lifetime of the scope.
+    */
+    class NestedSignalQueueScope
+    {
+    public:
+        NestedSignalQueueScope(std::shared_ptr<Signals::SignalQueue>& current, std::shared_ptr<Signals::SignalQueue> nested)
+            : current_(current), enclosing_(current)
+        {
+            current_ = nested;
+        }
+
+        ~NestedSignalQueueScope()
+        {
+            current_ = enclosing_;
+        }
+
+    private:
+        std::shared_ptr<Signals::SignalQueue>& current_;
+        std::shared_ptr<Signals::SignalQueue> enclosing_;
+    };
+
+    /*
+     * Keyset pagination over the history order described in TxViewCursor. Unconfirmed and confirmed txs are
+     * queried separately. The unconfirmed ORDER BY is walked with Tx_history_i and stops after count rows.
+     * The confirmed ORDER BY is on the joined BlockHeader.height, which no index on Tx can serve, so the
+     * confirmed txs past the cursor are sorted on each page. The seek still bounds the rows returned and
+     * avoids skipping over earlier pages. The tie condition orders rows within the same tx.
+    */
+    template<typename query_t>
+    query_t unconfirmedAfterCursor(const TxViewCursor& cursor, const query_t& tie)
+    {
+        query_t query(query_t::Tx::blockheader.is_null());
+        if (cursor.started)
+        {
+            query = query && (query_t::Tx::timestamp < cursor.timestamp || (query_t::Tx::timestamp == cursor.timestamp &&
+                (query_t::Tx::id < cursor.tx_id || (query_t::Tx::id == cursor.tx_id && tie))));
+        }
+        return query;
+    }
+
+    template<typename query_t>
+    query_t confirmedAfterCursor(const TxViewCursor& cursor, const query_t& tie)
+    {
+        query_t query(query_t::BlockHeader::height.is_not_null());
+        if (cursor.confirmed)
+        {
+            query = query && (query_t::BlockHeader::height < cursor.height || (query_t::BlockHeader::height == cursor.height &&
+                (query_t::Tx::timestamp < cursor.timestamp || (query_t::Tx::timestamp == cursor.timestamp &&
+                (query_t::Tx::id < cursor.tx_id || (query_t::Tx::id == cursor.tx_id && tie))))));
+        }
+        return query;
+    }
+
+    std::string limitClause(std::size_t count)
+    {
+        std::stringstream ss;
+        ss << "LIMIT " << count;
+        return ss.str();
+    }
+
+    TxSizeModel getTxSizeModel(const Account& account)
+    {
+        TxSizeModel::script_type_t script_type = !account.use_witness() ? TxSizeModel::P2SH : (account.use_witness_p2sh() ? TxSizeModel::P2SH_P2WSH : TxSizeModel::P2WSH);
+        return TxSizeModel(script_type, account.minsigs(), account.keychains().size(), account.compressed_keys());
+    }
+
+    std::shared_ptr<TxIn> newAccountTxIn(const Account& account, const TxOutView& utxoview)
+    {
+        //std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0xffffffff));
+        std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0));
+        if (account.use_witness())
+        {
+            using namespace CoinQ::Script;
+            scriptstack_t stack;
+            std::size_t keycount = account.keychains().size();
+            for (std::size_t k = 0; k <= keycount; k++) { stack.push_back(bytes_t()); }
+            stack.push_back(utxoview.signingscript_redeemscript); 
+            txin->scriptwitnessstack(stack);
+        }
+        return txin;
+    }
+}
+
 /*
  * class Vault implementation
 */
 Vault::Vault(int argc, char** argv, bool create, uint32_t version, const std::string& network, bool migrate)
+    : coinParams_(CoinQ::getBitcoinParams())
 {
     LOGGER(trace) << "Vault::Vault(..., " << (create ? "true" : "false") << ", " << version << ", " << network << ", " << (migrate ? "true" : "false") << ")" << std::endl;
 
@@ -78,6 +185,7 @@ Vault::Vault(int argc, char** argv, bool create, uint32_t version, const std::st
 }
 
 Vault::Vault(const std::string& dbname, bool create, uint32_t version, const std::string& network, bool migrate)
+    : coinParams_(CoinQ::getBitcoinParams())
 {
     LOGGER(trace) << "Vault::Vault(" << dbname << ", " << (create ? "true" : "false") << ", " << version << ", " << network << ", " << (migrate ? "true" : "false") << ")" << std::endl;
 
@@ -87,6 +195,7 @@ Vault::Vault(const std::string& dbname, bool create, uint32_t version, const std
 }
 
 Vault::Vault(const std::string& dbuser, const std::string& dbpasswd, const std::string& dbname, bool create, uint32_t version, const std::string& network, bool migrate)
+    : coinParams_(CoinQ::getBitcoinParams())
 {
     LOGGER(trace) << "Vault::Vault(" << dbuser << ", ..., " << dbname << ", " << (create ? "true" : "false") << ", " << version << ", " << network << ", " << (migrate ? "true" : "false") << ")" << std::endl;
 
@@ -154,6 +263,8 @@ void Vault::open(int argc, char** argv, bool create, uint32_t version, const std
     if (argc >= 2) name_ = argv[1];
 
     boost::lock_guard<boost::mutex> lock(mutex);
+    resetBloomFilterElements_unwrapped();
+    resetOwnershipIndex_unwrapped();
 
     try
     {
@@ -221,6 +332,16 @@ void Vault::open(int argc, char** argv, bool create, uint32_t version, const std
                     db_->update(account);
                 }
             }
+
+            if (v < 23 && cv >= 23)
+            {
+                LOGGER(info) << "Building account balances..." << std::endl;
+                db_->execute("UPDATE TxOut SET balance_tx_status = 0, balance_height = 0");
+                odb::core::session s;
+                std::vector<unsigned long> account_ids;
+                for (auto& account: db_->query<Account>()) { account_ids.push_back(account.id()); }
+                for (auto account_id: account_ids) { rebuildAccountBalance_unwrapped(account_id); }
+            }
                 
             t.commit();
         }
@@ -243,6 +364,8 @@ void Vault::open(const std::string& dbuser, const std::string& dbpasswd, const s
     name_ = dbname;
 
     boost::lock_guard<boost::mutex> lock(mutex);
+    resetBloomFilterElements_unwrapped();
+    resetOwnershipIndex_unwrapped();
 
     try
     {
@@ -311,6 +434,16 @@ void Vault::open(const std::string& dbuser, const std::string& dbpasswd, const s
                 }
             }
 
+            if (v < 23 && cv >= 23)
+            {
+                LOGGER(info) << "Building account balances..." << std::endl;
+                db_->execute("UPDATE TxOut SET balance_tx_status = 0, balance_height = 0");
+                odb::core::session s;
+                std::vector<unsigned long> account_ids;
+                for (auto& account: db_->query<Account>()) { account_ids.push_back(account.id()); }
+                for (auto account_id: account_ids) { rebuildAccountBalance_unwrapped(account_id); }
+            }
+
             t.commit();
         }
 
@@ -331,7 +464,14 @@ void Vault::close()
 
     if (!db_) return;
     boost::lock_guard<boost::mutex> lock(mutex);
+    syncBatchTransaction_.reset();
+    syncBatchSession_.reset();
+    syncBatchSignalQueue_.reset();
     db_.reset();
+    resetBloomFilterElements_unwrapped();
+    resetOwnershipIndex_unwrapped();
+    clearAccountBalanceUpdates_unwrapped();
+    clearPrivateDerivationCaches_unwrapped();
 }
 
 uint32_t Vault::getSchemaVersion() const
@@ -423,6 +563,14 @@ void Vault::setNetwork_unwrapped(const std::string& network)
     }
 }
 
+void Vault::setCoinParams(const CoinQ::CoinParams& coinParams)
+{
+    LOGGER(trace) << "Vault::setCoinParams(" << coinParams.network_name() << ")" << std::endl;
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    coinParams_ = coinParams;
+}
+
 uint32_t Vault::getHorizonTimestamp() const
 {
     LOGGER(trace) << "Vault::getHorizonTimestamp()" << std::endl;
@@ -516,42 +664,87 @@ Coin::BloomFilter Vault::getBloomFilter(double falsePositiveRate, uint32_t nTwea
 {
     LOGGER(trace) << "Vault::getBloomFilter(" << falsePositiveRate << ", " << nTweak << ", " << nFlags << ")" << std::endl;
 
-#if defined(LOCK_ALL_CALLS)
+    // The filter and its element cache are shared with the insert paths - always lock, whatever LOCK_ALL_CALLS says.
     boost::lock_guard<boost::mutex> lock(mutex);
-#endif
     odb::core::session s;
     odb::core::transaction t(db_->begin());
     return getBloomFilter_unwrapped(falsePositiveRate, nTweak, nFlags);
 }
 
+bool Vault::getBloomFilterUpdate(double falsePositiveRate, uint32_t nTweak, uint32_t nFlags, Coin::BloomFilter& filter, std::vector<bytes_t>& newElements) const
+{
+    LOGGER(trace) << "Vault::getBloomFilterUpdate(" << falsePositiveRate << ", " << nTweak << ", " << nFlags << ")" << std::endl;
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    odb::core::session s;
+    odb::core::transaction t(db_->begin());
+    return getBloomFilterUpdate_unwrapped(falsePositiveRate, nTweak, nFlags, filter, newElements);
+}
+
 Coin::BloomFilter Vault::getBloomFilter_unwrapped(double falsePositiveRate, uint32_t nTweak, uint32_t nFlags) const
 {
-    using namespace CoinQ::Script;
+    Coin::BloomFilter filter;
+    std::vector<bytes_t> newElements;
+    getBloomFilterUpdate_unwrapped(falsePositiveRate, nTweak, nFlags, filter, newElements);
+    return filter;
+}
+
+bool Vault::getBloomFilterUpdate_unwrapped(double falsePositiveRate, uint32_t nTweak, uint32_t nFlags, Coin::BloomFilter& filter, std::vector<bytes_t>& newElements) const
+{
+    if (!bloomElementsLoaded_) { loadBloomFilterElements_unwrapped(); }
+
+    newElements.clear();
+    if (bloomElements_.empty())
+    {
+        bloomFilter_ = Coin::BloomFilter();
+        newBloomElements_.clear();
+        filter = bloomFilter_;
+        return false;
+    }
+
+    if (bloomFilter_.isSet() && bloomFilterFalsePositiveRate_ == falsePositiveRate &&
+        bloomFilter_.getNTweak() == nTweak && bloomFilter_.getNFlags() == (uint8_t)nFlags &&
+        bloomElements_.size() <= bloomFilterCapacity_)
+    {
+        LOGGER(trace) << "Vault::getBloomFilterUpdate_unwrapped - adding " << newBloomElements_.size() << " elements to filter." << std::endl;
+        for (auto& element: newBloomElements_) { bloomFilter_.insert(element); }
+        newElements.swap(newBloomElements_);
+        filter = bloomFilter_;
+        return true;
+    }
+
+    // Leave room so that subsequent additions do not degrade the false positive rate.
+    LOGGER(trace) << "Vault::getBloomFilterUpdate_unwrapped - rebuilding filter with " << bloomElements_.size() << " elements." << std::endl;
+    bloomFilterCapacity_ = bloomElements_.size() * BLOOM_FILTER_GROWTH_FACTOR;
+    bloomFilterFalsePositiveRate_ = falsePositiveRate;
+    bloomFilter_ = Coin::BloomFilter(bloomFilterCapacity_, falsePositiveRate, nTweak, nFlags);
+    for (auto& element: bloomElements_) { bloomFilter_.insert(element); }
+    newBloomElements_.clear();
+    filter = bloomFilter_;
+    return false;
+}
 
-    std::vector<bytes_t> elements;
+void Vault::resetBloomFilterElements_unwrapped() const
+{
+    bloomElementsLoaded_ = false;
+    bloomElements_.clear();
+    newBloomElements_.clear();
+    bloomFilter_ = Coin::BloomFilter();
+    bloomFilterCapacity_ = 0;
+    bloomFilterFalsePositiveRate_ = 0;
+}
+
+void Vault::loadBloomFilterElements_unwrapped() const
+{
+    LOGGER(trace) << "Vault::loadBloomFilterElements_unwrapped()" << std::endl;
+
+    resetBloomFilterElements_unwrapped();
+    bloomElementsLoaded_ = true;
 
     // Add scripts
     {
         odb::result<SigningScript> r(db_->query<SigningScript>());
-        for (auto& script: r)
-        {
-
-            // Add script elements
-            if (script.account()->use_witness())
-            {
-                WitnessProgram_P2WSH wp(script.redeemscript());
-                elements.push_back(wp.script());
-                if (script.account()->use_witness_p2sh())
-                {
-                    elements.push_back(getScriptPubKeyPayee(script.txoutscript()).second);
-                }
-            }
-            else
-            {
-                elements.push_back(getScriptPubKeyPayee(script.txoutscript()).second);
-                elements.push_back(script.redeemscript());
-            }
-        }
+        for (auto& script: r) { addSigningScriptBloomFilterElements_unwrapped(script); }
     }
 
     {
@@ -564,16 +757,135 @@ Coin::BloomFilter Vault::getBloomFilter_unwrapped(double falsePositiveRate, uint
             if (tx)
             {
                 Coin::OutPoint outpoint(tx->hash(), txout.txindex());
-                elements.push_back(outpoint.getSerialized());
+                addBloomFilterElement_unwrapped(outpoint.getSerialized());
             }
         }
     }
 
-    if (elements.empty()) return Coin::BloomFilter();
+    // Everything is in the rebuilt filter.
+    newBloomElements_.clear();
+}
 
-    Coin::BloomFilter filter(elements.size(), falsePositiveRate, nTweak, nFlags);
-    for (auto& element: elements) { filter.insert(element); }
-    return filter;
+void Vault::addBloomFilterElement_unwrapped(const bytes_t& element) const
+{
+    // If the elements have not been loaded yet they will all be read from the database when first needed.
+    if (!bloomElementsLoaded_) return;
+    if (bloomElements_.insert(element).second) { newBloomElements_.push_back(element); }
+}
+
+void Vault::addSigningScriptBloomFilterElements_unwrapped(const SigningScript& script) const
+{
+    using namespace CoinQ::Script;
+
+    if (!bloomElementsLoaded_) return;
+
+    // Add script elements
+    if (script.account()->use_witness())
+    {
+        WitnessProgram_P2WSH wp(script.redeemscript());
+        addBloomFilterElement_unwrapped(wp.script());
+        if (script.account()->use_witness_p2sh())
+        {
+            addBloomFilterElement_unwrapped(getScriptPubKeyPayee(script.txoutscript()).second);
+        }
+    }
+    else
+    {
+        addBloomFilterElement_unwrapped(getScriptPubKeyPayee(script.txoutscript()).second);
+        addBloomFilterElement_unwrapped(script.redeemscript());
+    }
+}
+
+void Vault::addTxBloomFilterElements_unwrapped(const Tx& tx) const
+{
+    if (!bloomElementsLoaded_) return;
+
+    // Add outpoints we might spend. The hash changes when signatures are added so this must be called after every update.
+    for (auto& txout: tx.txouts())
+    {
+        if (!txout->sending_account() || txout->status() != TxOut::UNSPENT) continue;
+        Coin::OutPoint outpoint(tx.hash(), txout->txindex());
+        addBloomFilterElement_unwrapped(outpoint.getSerialized());
+    }
+}
+
+void Vault::resetOwnershipIndex_unwrapped() const
+{
+    ownershipIndexLoaded_ = false;
+    txInScriptIndex_.clear();
+    txOutScriptIndex_.clear();
+    txHashIndex_.clear();
+    txInOutHashIndex_.clear();
+}
+
+void Vault::loadOwnershipIndex_unwrapped() const
+{
+    LOGGER(trace) << "Vault::loadOwnershipIndex_unwrapped()" << std::endl;
+
+    resetOwnershipIndex_unwrapped();
+
+    {
+        odb::result<SigningScriptIndexView> r(db_->query<SigningScriptIndexView>());
+        for (auto& view: r)
+        {
+            txInScriptIndex_.insert(view.txinscript);
+            txOutScriptIndex_.insert(view.txoutscript);
+        }
+    }
+
+    {
+        odb::result<TxHashView> r(db_->query<TxHashView>());
+        for (auto& view: r) { if (!view.hash.empty()) txHashIndex_.insert(view.hash); }
+    }
+
+    {
+        odb::result<TxInOutHashView> r(db_->query<TxInOutHashView>());
+        for (auto& view: r) { txInOutHashIndex_.insert(view.outhash); }
+    }
+
+    ownershipIndexLoaded_ = true;
+    LOGGER(trace) << "Vault::loadOwnershipIndex_unwrapped() - loaded " << txOutScriptIndex_.size() << " scripts and " << txHashIndex_.size() << " transaction hashes." << std::endl;
+}
+
+void Vault::addSigningScriptToOwnershipIndex_unwrapped(const SigningScript& script) const
+{
+    // If the index has not been loaded yet the script will be read from the database when first needed.
+    if (!ownershipIndexLoaded_) return;
+    txInScriptIndex_.insert(script.txinscript());
+    txOutScriptIndex_.insert(script.txoutscript());
+}
+
+void Vault::addTxToOwnershipIndex_unwrapped(const Tx& tx) const
+{
+    if (!ownershipIndexLoaded_) return;
+
+    // The hash changes when signatures are added so this must be called after every update.
+    if (!tx.hash().empty()) { txHashIndex_.insert(tx.hash()); }
+    for (auto& txin: tx.txins()) { txInOutHashIndex_.insert(txin->outhash()); }
+}
+
+bool Vault::mayBeSigningTxInScript_unwrapped(const bytes_t& txinscript) const
+{
+    if (!ownershipIndexLoaded_) { loadOwnershipIndex_unwrapped(); }
+    return txInScriptIndex_.count(txinscript) > 0;
+}
+
+bool Vault::mayBeSigningTxOutScript_unwrapped(const bytes_t& txoutscript) const
+{
+    if (!ownershipIndexLoaded_) { loadOwnershipIndex_unwrapped(); }
+    return txOutScriptIndex_.count(txoutscript) > 0;
+}
+
+bool Vault::mayBeStoredTx_unwrapped(const bytes_t& hash) const
+{
+    if (!ownershipIndexLoaded_) { loadOwnershipIndex_unwrapped(); }
+    return txHashIndex_.count(hash) > 0;
+}
+
+bool Vault::mayBeSpentByStoredTxIn_unwrapped(const bytes_t& outhash) const
+{
+    if (!ownershipIndexLoaded_) { loadOwnershipIndex_unwrapped(); }
+    return txInOutHashIndex_.count(outhash) > 0;
 }
 
 hashvector_t Vault::getIncompleteBlockHashes() const
@@ -1055,7 +1367,7 @@ secure_bytes_t Vault::exportBIP32(const std::string& keychain_name, bool export_
 
 secure_bytes_t Vault::exportBIP32_unwrapped(std::shared_ptr<Keychain> keychain, bool export_private) const
 {
-    return keychain->exportBIP32(export_private);
+    return keychain->exportBIP32(export_private, coinParams_.bip32_priv_version(), coinParams_.bip32_pub_version());
 }
 
 std::shared_ptr<Keychain> Vault::importBIP32(const std::string& keychain_name, const secure_bytes_t& extkey, const secure_bytes_t& lock_key)
@@ -1120,7 +1432,7 @@ void Vault::decryptKeychain(const std::string& keychain_name)
     t.commit(); 
 }
 
-void Vault::refillAccountPool(const std::string& account_name)
+uint32_t Vault::refillAccountPool(const std::string& account_name)
 {
     LOGGER(trace) << "Vault::refillAccountPool(" << account_name << ")" << std::endl;
 
@@ -1128,13 +1440,16 @@ void Vault::refillAccountPool(const std::string& account_name)
     odb::core::session s;
     odb::core::transaction t(db_->begin());
     std::shared_ptr<Account> account = getAccount_unwrapped(account_name);
-    refillAccountPool_unwrapped(account);
+    uint32_t count = refillAccountPool_unwrapped(account);
     t.commit();
+    return count;
 }
 
-void Vault::refillAccountPool_unwrapped(std::shared_ptr<Account> account)
+uint32_t Vault::refillAccountPool_unwrapped(std::shared_ptr<Account> account)
 {
-    for (auto& bin: account->bins()) { refillAccountBinPool_unwrapped(bin); }
+    uint32_t count = 0;
+    for (auto& bin: account->bins()) { count += refillAccountBinPool_unwrapped(bin); }
+    return count;
 }
 
 std::shared_ptr<Keychain> Vault::getKeychain(const std::string& keychain_name) const
@@ -1183,6 +1498,7 @@ void Vault::lockAllKeychains()
 
     boost::lock_guard<boost::mutex> lock(mutex);
     mapPrivateKeyUnlock.clear();
+    clearPrivateDerivationCaches_unwrapped();
     for (auto& item: mapPrivateKeyUnlock)
     {
         notifyKeychainLocked(item.first);
@@ -1195,6 +1511,12 @@ void Vault::lockKeychain(const std::string& keychain_name)
 
     boost::lock_guard<boost::mutex> lock(mutex);
     mapPrivateKeyUnlock.erase(keychain_name);
+    auto it = mapUnlockedKeychainHash.find(keychain_name);
+    if (it != mapUnlockedKeychainHash.end())
+    {
+        Keychain::clearPrivateDerivationCache(it->second);
+        mapUnlockedKeychainHash.erase(it);
+    }
     notifyKeychainLocked(keychain_name);
 }
 
@@ -1251,6 +1573,8 @@ void Vault::unlockKeychain_unwrapped(std::shared_ptr<Keychain> keychain, const s
             throw KeychainPrivateKeyUnlockFailedException(keychain->name());
         }
     }
+
+    mapUnlockedKeychainHash[keychain->name()] = keychain->hash();
 }
 
 bool Vault::tryUnlockKeychain_unwrapped(std::shared_ptr<Keychain> keychain, const secure_bytes_t& lock_key) const
@@ -1274,9 +1598,16 @@ bool Vault::tryUnlockKeychain_unwrapped(std::shared_ptr<Keychain> keychain, cons
         return false;
     }
 
+    mapUnlockedKeychainHash[keychain->name()] = keychain->hash();
     return true;
 }
 
+void Vault::clearPrivateDerivationCaches_unwrapped()
+{
+    for (auto& item: mapUnlockedKeychainHash) { Keychain::clearPrivateDerivationCache(item.second); }
+    mapUnlockedKeychainHash.clear();
+}
+
 bool Vault::isKeychainLocked(const std::string& keychainName) const
 {
     const auto& it = mapPrivateKeyUnlock.find(keychainName);
@@ -1419,12 +1750,7 @@ std::shared_ptr<Account> Vault::importAccount_unwrapped(boost::archive::text_iar
         bin->makeImport();
         db_->persist(bin);
 
-        SigningScriptVector scripts = bin->generateSigningScripts();
-        for (auto& script: scripts)
-        {
-            for (auto& key: script->keys()) { db_->persist(key); }
-            db_->persist(script);
-        }
+        persistSigningScripts_unwrapped(bin->generateSigningScripts());
 
         db_->update(bin);
     } 
@@ -1523,16 +1849,8 @@ void Vault::newAccount(const std::string& account_name, unsigned int minsigs, co
     std::shared_ptr<AccountBin> defaultAccountBin = account->addBin(DEFAULT_BIN_NAME);
     db_->persist(defaultAccountBin);
 
-    for (uint32_t i = 0; i < unused_pool_size; i++)
-    {
-        std::shared_ptr<SigningScript> changeSigningScript = changeAccountBin->newSigningScript();
-        for (auto& key: changeSigningScript->keys()) { db_->persist(key); } 
-        db_->persist(changeSigningScript);
-
-        std::shared_ptr<SigningScript> defaultSigningScript = defaultAccountBin->newSigningScript();
-        for (auto& key: defaultSigningScript->keys()) { db_->persist(key); }
-        db_->persist(defaultSigningScript);
-    }
+    persistSigningScripts_unwrapped(changeAccountBin->newSigningScripts(unused_pool_size));
+    persistSigningScripts_unwrapped(defaultAccountBin->newSigningScripts(unused_pool_size));
     db_->update(changeAccountBin);
     db_->update(defaultAccountBin);
     db_->update(account);
@@ -1620,6 +1938,142 @@ std::vector<TxOutView> Vault::getUnspentTxOutViews_unwrapped(std::shared_ptr<Acc
     return utxoviews;
 }
 
+void Vault::markAccountBalancesDirty_unwrapped(const Tx& tx)
+{
+    // Spent outpoints normally belong to the sending account but are checked in case inputs come from several accounts.
+    for (auto& txin: tx.txins())
+    {
+        std::shared_ptr<TxOut> outpoint = txin->outpoint();
+        if (outpoint) { dirtyBalanceTxOuts_.insert(outpoint); }
+    }
+
+    for (auto& txout: tx.txouts()) { dirtyBalanceTxOuts_.insert(txout); }
+}
+
+void Vault::updateAccountBalances_unwrapped()
+{
+    try
+    {
+        for (auto& txout: dirtyBalanceTxOuts_)
+        {
+            if (updateTxOutBalance_unwrapped(*txout)) { db_->update(txout); }
+        }
+        dirtyBalanceTxOuts_.clear();
+
+        for (auto& delta: balanceDeltas_)
+        {
+            if (delta.second == 0) continue;
+
+            unsigned long account_id = std::get<0>(delta.first);
+            Tx::status_t tx_status = (Tx::status_t)std::get<1>(delta.first);
+            uint32_t height = std::get<2>(delta.first);
+
+            typedef odb::query<AccountBalance> query_t;
+            odb::result<AccountBalance> r(db_->query<AccountBalance>(query_t::account == account_id && query_t::tx_status == tx_status && query_t::height == height));
+            std::shared_ptr<AccountBalance> balance;
+            if (!r.empty()) { balance = r.begin().load(); }
+
+            uint64_t stored = balance ? balance->balance() : 0;
+            if (delta.second < 0 && stored < (uint64_t)(-delta.second))
+            {
+                LOGGER(error) << "Vault::updateAccountBalances_unwrapped - stored balance for account " << account_id << " would go negative. Run checkbalances to repair." << std::endl;
+                delta.second = -(int64_t)stored;
+            }
+
+            uint64_t value = stored + delta.second;
+            if (!balance)
+            {
+                if (value == 0) continue;
+                AccountBalance new_balance(db_->load<Account>(account_id), tx_status, height, value);
+                db_->persist(new_balance);
+            }
+            else if (value == 0)
+            {
+                db_->erase(balance);
+            }
+            else
+            {
+                balance->balance(value);
+                db_->update(balance);
+            }
+        }
+        balanceDeltas_.clear();
+    }
+    catch (...)
+    {
+        clearAccountBalanceUpdates_unwrapped();
+        throw;
+    }
+}
+
+void Vault::clearAccountBalanceUpdates_unwrapped()
+{
+    dirtyBalanceTxOuts_.clear();
+    balanceDeltas_.clear();
+}
+
+// Moves the output's value to the bucket it belongs in now. Returns true if the output's bucket changed and needs to be stored.
+bool Vault::updateTxOutBalance_unwrapped(TxOut& txout, bool erased)
+{
+    uint32_t tx_status = Tx::NO_STATUS;
+    uint32_t height = 0;
+
+    std::shared_ptr<Account> account = txout.receiving_account();
+    std::shared_ptr<Tx> tx = txout.tx();
+    if (!erased && account && tx && txout.status() == TxOut::UNSPENT && txout.value() > 0)
+    {
+        tx_status = tx->status();
+        if (tx->blockheader()) { height = tx->blockheader()->height(); }
+    }
+
+    if (tx_status == txout.balance_tx_status() && height == txout.balance_height()) return false;
+
+    // Outputs are only ever counted for their receiving account.
+    if (account)
+    {
+        if (txout.balance_tx_status() != Tx::NO_STATUS) { balanceDeltas_[std::make_tuple(account->id(), txout.balance_tx_status(), txout.balance_height())] -= (int64_t)txout.value(); }
+        if (tx_status != Tx::NO_STATUS) { balanceDeltas_[std::make_tuple(account->id(), tx_status, height)] += (int64_t)txout.value(); }
+    }
+
+    txout.balance_bucket(tx_status, height);
+    return true;
+}
+
+void Vault::rebuildAccountBalance_unwrapped(unsigned long account_id)
+{
+    db_->erase_query<AccountBalance>(odb::query<AccountBalance>::account == account_id);
+
+    // Recount the outputs from scratch, including any that are still marked as counted but should not be.
+    typedef odb::query<TxOut> query_t;
+    std::vector<std::shared_ptr<TxOut>> txouts;
+    odb::result<TxOut> r(db_->query<TxOut>(query_t::receiving_account == account_id && (query_t::status == TxOut::UNSPENT || query_t::balance_tx_status != 0)));
+    for (auto it = r.begin(); it != r.end(); ++it) { txouts.push_back(it.load()); }
+
+    for (auto& txout: txouts)
+    {
+        txout->balance_bucket(Tx::NO_STATUS, 0);
+        db_->update(txout);
+        dirtyBalanceTxOuts_.insert(txout);
+    }
+
+    updateAccountBalances_unwrapped();
+}
+
+// Unspent output totals keyed on tx status and block height, 0 if unconfirmed.
+std::map<std::pair<int, uint32_t>, uint64_t> Vault::computeAccountBalance_unwrapped(unsigned long account_id) const
+{
+    typedef odb::query<BalanceBucketView> query_t;
+    odb::result<BalanceBucketView> r(db_->query<BalanceBucketView>(query_t::TxOut::receiving_account == account_id && query_t::TxOut::status == TxOut::UNSPENT));
+
+    std::map<std::pair<int, uint32_t>, uint64_t> buckets;
+    for (auto& bucket: r)
+    {
+        if (bucket.balance == 0) continue;
+        buckets[std::make_pair((int)bucket.tx_status, bucket.height)] += bucket.balance;
+    }
+    return buckets;
+}
+
 AccountInfo Vault::getAccountInfo(const std::string& account_name) const
 {
     LOGGER(trace) << "Vault::getAccountInfo(" << account_name << ")" << std::endl;
@@ -1658,18 +2112,50 @@ uint64_t Vault::getAccountBalance(const std::string& account_name, unsigned int
     boost::lock_guard<boost::mutex> lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
-    typedef odb::query<BalanceView> query_t;
-    query_t query(query_t::Account::name == account_name && query_t::TxOut::status == TxOut::UNSPENT && query_t::Tx::status.in_range(tx_statuses.begin(), tx_statuses.end()));
+    typedef odb::query<AccountBalanceView> query_t;
+    query_t query(query_t::Account::name == account_name && query_t::AccountBalance::tx_status.in_range(tx_statuses.begin(), tx_statuses.end()));
     if (min_confirmations > 0)
     {
         uint32_t best_height = getBestHeight_unwrapped();
         if (min_confirmations > best_height) return 0;
-        query = (query && query_t::BlockHeader::height <= best_height + 1 - min_confirmations);
+        query = (query && query_t::AccountBalance::height != 0 && query_t::AccountBalance::height <= best_height + 1 - min_confirmations);
     }
-    odb::result<BalanceView> r(db_->query<BalanceView>(query));
+    odb::result<AccountBalanceView> r(db_->query<AccountBalanceView>(query));
     return r.empty() ? 0 : r.begin()->balance;
 }
 
+std::vector<std::string> Vault::checkAccountBalances(bool repair)
+{
+    LOGGER(trace) << "Vault::checkAccountBalances(" << (repair ? "true" : "false") << ")" << std::endl;
+
+#if defined(LOCK_ALL_CALLS)
+    boost::lock_guard<boost::mutex> lock(mutex);
+#endif
+    odb::core::session s;
+    odb::core::transaction t(db_->begin());
+
+    std::vector<std::pair<unsigned long, std::string>> accounts;
+    odb::result<Account> account_r(db_->query<Account>());
+    for (auto& account: account_r) { accounts.push_back(std::make_pair(account.id(), account.name())); }
+
+    std::vector<std::string> mismatched;
+    for (auto& account: accounts)
+    {
+        std::map<std::pair<int, uint32_t>, uint64_t> stored;
+        odb::result<AccountBalance> balance_r(db_->query<AccountBalance>(odb::query<AccountBalance>::account == account.first));
+        for (auto& balance: balance_r) { stored[std::make_pair((int)balance.tx_status(), balance.height())] += balance.balance(); }
+
+        if (stored == computeAccountBalance_unwrapped(account.first)) continue;
+
+        LOGGER(debug) << "Vault::checkAccountBalances - stored balances for account " << account.second << " do not match." << std::endl;
+        mismatched.push_back(account.second);
+        if (repair) { rebuildAccountBalance_unwrapped(account.first); }
+    }
+
+    if (repair && !mismatched.empty()) { t.commit(); }
+    return mismatched;
+}
+
 std::shared_ptr<AccountBin> Vault::addAccountBin(const std::string& account_name, const std::string& bin_name)
 {
     LOGGER(trace) << "Vault::addAccountBin(" << account_name << ", " << bin_name << ")" << std::endl;
@@ -1699,12 +2185,7 @@ std::shared_ptr<AccountBin> Vault::addAccountBin(const std::string& account_name
     std::shared_ptr<AccountBin> bin = account->addBin(bin_name);
     db_->persist(bin);
 
-    for (uint32_t i = 0; i < account->unused_pool_size(); i++)
-    {
-        std::shared_ptr<SigningScript> script = bin->newSigningScript();
-        for (auto& key: script->keys()) { db_->persist(key); }
-        db_->persist(script);
-    }
+    persistSigningScripts_unwrapped(bin->newSigningScripts(account->unused_pool_size()));
     db_->update(bin);
     db_->update(account);
     t.commit();
@@ -1777,8 +2258,10 @@ std::shared_ptr<SigningScript> Vault::issueAccountBinSigningScript_unwrapped(std
     return script;
 }
 
-void Vault::refillAccountBinPool_unwrapped(std::shared_ptr<AccountBin> bin, uint32_t index)
+uint32_t Vault::refillAccountBinPool_unwrapped(std::shared_ptr<AccountBin> bin, uint32_t index)
 {
+    uint32_t created = 0;
+
     // get largest signing script index that is not unused
     typedef odb::query<ScriptCountView> count_query_t;
     odb::result<ScriptCountView> count_result(db_->query<ScriptCountView>(count_query_t::AccountBin::id == bin->id() && count_query_t::SigningScript::status != SigningScript::UNUSED));
@@ -1804,12 +2287,12 @@ void Vault::refillAccountBinPool_unwrapped(std::shared_ptr<AccountBin> bin, uint
     {
         count_result = db_->query<ScriptCountView>();
         uint32_t count = count_result.empty() ? 0 : count_result.begin().load()->count;
-        for (uint32_t i = count + 1; i < index; i++)
+        if (index > count + 1)
         {
-            std::shared_ptr<SigningScript> script = bin->newSigningScript();
-            script->status(SigningScript::ISSUED);
-            for (auto& key: script->keys()) { db_->persist(key); }
-            db_->persist(script); 
+            SigningScriptVector scripts = bin->newSigningScripts(index - count - 1);
+            for (auto& script: scripts) { script->status(SigningScript::ISSUED); }
+            persistSigningScripts_unwrapped(scripts);
+            created += scripts.size();
         }
     }
 
@@ -1818,13 +2301,14 @@ void Vault::refillAccountBinPool_unwrapped(std::shared_ptr<AccountBin> bin, uint
     uint32_t count = count_result.empty() ? 0 : count_result.begin().load()->count;
 
     uint32_t unused_pool_size = bin->account() ? bin->account()->unused_pool_size() : DEFAULT_UNUSED_POOL_SIZE;
-    for (uint32_t i = count; i < unused_pool_size; i++)
+    if (count < unused_pool_size)
     {
-        std::shared_ptr<SigningScript> script = bin->newSigningScript();
-        for (auto& key: script->keys()) { db_->persist(key); }
-        db_->persist(script); 
+        SigningScriptVector scripts = bin->newSigningScripts(unused_pool_size - count);
+        persistSigningScripts_unwrapped(scripts);
+        created += scripts.size();
     } 
     db_->update(bin);
+    return created;
 }
 
 std::vector<SigningScriptView> Vault::getSigningScriptViews(const std::string& account_name, const std::string& bin_name, int flags) const
@@ -1893,6 +2377,99 @@ std::vector<TxOutView> Vault::getTxOutViews(const std::string& account_name, con
     return views;
 }
 
+std::vector<TxOutView> Vault::getTxOutViewsAfter(const std::string& account_name, const TxViewCursor& cursor, int count, int role_flags, bool hide_change) const
+{
+    LOGGER(trace) << "Vault::getTxOutViewsAfter(" << account_name << ", " << cursor.height << ":" << cursor.timestamp << ":" << cursor.tx_id << ":" << cursor.txindex << ", " << count << ", " << TxOut::getRoleString(role_flags) << ")" << std::endl;
+
+    std::vector<TxOutView> views;
+    if (count <= 0) return views;
+
+    typedef odb::query<TxOutView> query_t;
+    query_t filter_query(query_t::receiving_account::id != 0 || query_t::sending_account::id != 0);
+    if (!account_name.empty())
+    {
+        query_t role_query(1 == 1);
+        if (role_flags & TxOut::ROLE_SENDER)    role_query = (role_query && (query_t::sending_account::name == account_name));
+        if (role_flags & TxOut::ROLE_RECEIVER)  role_query = (role_query || (query_t::receiving_account::name == account_name));
+        filter_query = filter_query && role_query;
+    }
+    if (hide_change)                            filter_query = (filter_query && (query_t::TxOut::account_bin.is_null() || query_t::AccountBin::name != CHANGE_BIN_NAME));
+
+    query_t tie(query_t::TxOut::txindex > cursor.txindex);
+
+#if defined(LOCK_ALL_CALLS)
+    boost::lock_guard<boost::mutex> lock(mutex);
+#endif
+    odb::core::transaction t(db_->begin());
+
+    // count limits txouts rather than views, a txout can be split into a sender and a receiver view.
+    std::size_t txouts = 0;
+    if (!cursor.confirmed)
+    {
+        query_t query(filter_query && unconfirmedAfterCursor<query_t>(cursor, tie));
+        query += "ORDER BY" + query_t::Tx::timestamp + "DESC," + query_t::Tx::id + "DESC," + query_t::TxOut::txindex + "ASC";
+        query += limitClause(count);
+
+        odb::result<TxOutView> r(db_->query<TxOutView>(query));
+        for (auto& view: r)
+        {
+            txouts++;
+            view.updateRole(role_flags);
+            std::vector<TxOutView> split_views = view.getSplitRoles(TxOut::ROLE_RECEIVER, account_name);
+            for (auto& split_view: split_views) { views.push_back(split_view); }
+        }
+    }
+
+    if (txouts < (std::size_t)count)
+    {
+        query_t query(filter_query && confirmedAfterCursor<query_t>(cursor, tie));
+        query += "ORDER BY" + query_t::BlockHeader::height + "DESC," + query_t::Tx::timestamp + "DESC," + query_t::Tx::id + "DESC," + query_t::TxOut::txindex + "ASC";
+        query += limitClause(count - txouts);
+
+        odb::result<TxOutView> r(db_->query<TxOutView>(query));
+        for (auto& view: r)
+        {
+            view.updateRole(role_flags);
+            std::vector<TxOutView> split_views = view.getSplitRoles(TxOut::ROLE_RECEIVER, account_name);
+            for (auto& split_view: split_views) { views.push_back(split_view); }
+        }
+    }
+
+    return views;
+}
+
+std::vector<TxOutView> Vault::getTxOutViews(unsigned long tx_id, const std::string& account_name, int role_flags, bool hide_change) const
+{
+    LOGGER(trace) << "Vault::getTxOutViews(" << tx_id << ", " << account_name << ", " << TxOut::getRoleString(role_flags) << ")" << std::endl;
+
+    typedef odb::query<TxOutView> query_t;
+    query_t query(query_t::Tx::id == tx_id && (query_t::receiving_account::id != 0 || query_t::sending_account::id != 0));
+    if (!account_name.empty())
+    {
+        query_t role_query(1 == 1);
+        if (role_flags & TxOut::ROLE_SENDER)    role_query = (role_query && (query_t::sending_account::name == account_name));
+        if (role_flags & TxOut::ROLE_RECEIVER)  role_query = (role_query || (query_t::receiving_account::name == account_name));
+        query = query && role_query;
+    }
+    if (hide_change)                            query = (query && (query_t::TxOut::account_bin.is_null() || query_t::AccountBin::name != CHANGE_BIN_NAME));
+
+    query += "ORDER BY" + query_t::TxOut::txindex + "ASC";
+
+#if defined(LOCK_ALL_CALLS)
+    boost::lock_guard<boost::mutex> lock(mutex);
+#endif
+    odb::core::transaction t(db_->begin());
+    std::vector<TxOutView> views;
+    odb::result<TxOutView> r(db_->query<TxOutView>(query));
+    for (auto& view: r)
+    {
+        view.updateRole(role_flags);
+        std::vector<TxOutView> split_views = view.getSplitRoles(TxOut::ROLE_RECEIVER, account_name);
+        for (auto& split_view: split_views) { views.push_back(split_view); }
+    }
+    return views;
+}
+
 
 ////////////////////////////
 // ACCOUNT BIN OPERATIONS //
@@ -2034,20 +2611,10 @@ std::shared_ptr<AccountBin> Vault::importAccountBin_unwrapped(const std::string&
     // Create signing scripts and keys and persist account bin
     db_->persist(bin);
 
-    unsigned int next_script_index = bin->next_script_index();
-    for (unsigned int i = 0; i < next_script_index; i++)
-    {
-        std::shared_ptr<SigningScript> script = bin->newSigningScript();
-        script->status(SigningScript::ISSUED);
-        for (auto& key: script->keys()) { db_->persist(key); }
-        db_->persist(script);
-    }
-    for (unsigned int i = 0; i < DEFAULT_UNUSED_POOL_SIZE; i++)
-    {
-        std::shared_ptr<SigningScript> script = bin->newSigningScript();
-        for (auto& key: script->keys()) { db_->persist(key); }
-        db_->persist(script);
-    }
+    SigningScriptVector scripts = bin->newSigningScripts(bin->next_script_index());
+    for (auto& script: scripts) { script->status(SigningScript::ISSUED); }
+    persistSigningScripts_unwrapped(scripts);
+    persistSigningScripts_unwrapped(bin->newSigningScripts(DEFAULT_UNUSED_POOL_SIZE));
     db_->update(bin);
     
     return bin;
@@ -2243,10 +2810,52 @@ std::vector<TxView> Vault::getTxViews(int tx_status_flags, unsigned long start,
     boost::lock_guard<boost::mutex> lock(mutex);
 #endif
     odb::core::transaction t(db_->begin());
-    std::vector<TxView> views;
-    odb::result<TxView> r(db_->query<TxView>(query));
-    for (auto& view: r) { views.push_back(view); }
-    return views; 
+    std::vector<TxView> views;
+    odb::result<TxView> r(db_->query<TxView>(query));
+    for (auto& view: r) { views.push_back(view); }
+    return views; 
+}
+
+std::vector<TxView> Vault::getTxViewsAfter(const TxViewCursor& cursor, int count, int tx_status_flags) const
+{
+    LOGGER(trace) << "Vault::getTxViewsAfter(" << cursor.height << ":" << cursor.timestamp << ":" << cursor.tx_id << ", " << count << ", " << Tx::getStatusString(tx_status_flags) << ")" << std::endl;
+
+    std::vector<TxView> views;
+    if (count <= 0) return views;
+
+    typedef odb::query<TxView> query_t;
+    query_t status_query(1 == 1);
+    if (tx_status_flags != Tx::ALL)
+    {
+        std::vector<Tx::status_t> tx_statuses = Tx::getStatusFlags(tx_status_flags);
+        status_query = query_t::Tx::status.in_range(tx_statuses.begin(), tx_statuses.end());
+    }
+
+#if defined(LOCK_ALL_CALLS)
+    boost::lock_guard<boost::mutex> lock(mutex);
+#endif
+    odb::core::transaction t(db_->begin());
+    if (!cursor.confirmed)
+    {
+        query_t query(status_query && unconfirmedAfterCursor<query_t>(cursor, query_t(false)));
+        query += "ORDER BY" + query_t::Tx::timestamp + "DESC," + query_t::Tx::id + "DESC";
+        query += limitClause(count);
+
+        odb::result<TxView> r(db_->query<TxView>(query));
+        for (auto& view: r) { views.push_back(view); }
+    }
+
+    if (views.size() < (std::size_t)count)
+    {
+        query_t query(status_query && confirmedAfterCursor<query_t>(cursor, query_t(false)));
+        query += "ORDER BY" + query_t::BlockHeader::height + "DESC," + query_t::Tx::timestamp + "DESC," + query_t::Tx::id + "DESC";
+        query += limitClause(count - views.size());
+
+        odb::result<TxView> r(db_->query<TxView>(query));
+        for (auto& view: r) { views.push_back(view); }
+    }
+
+    return views;
 }
 
 std::shared_ptr<Tx> Vault::insertTx(std::shared_ptr<Tx> tx, bool replace_labels)
@@ -2265,8 +2874,12 @@ std::shared_ptr<Tx> Vault::insertTx(std::shared_ptr<Tx> tx, bool replace_labels)
     return tx;
 }
 
-std::shared_ptr<Tx> Vault::insertTx_unwrapped(std::shared_ptr<Tx> tx, bool replace_labels)
+std::shared_ptr<Tx> Vault::insertTx_unwrapped(std::shared_ptr<Tx> tx, bool replace_labels, CoinQ::Script::SignatureVerifier* verifier)
 {
+    // The same signatures get checked several times below, so cache the results.
+    CoinQ::Script::SignatureVerifier localverifier;
+    if (!verifier) { verifier = &localverifier; }
+
     try
     {
         tx->updateStatus();
@@ -2301,7 +2914,7 @@ std::shared_ptr<Tx> Vault::insertTx_unwrapped(std::shared_ptr<Tx> tx, bool repla
                 if (!txin->outpoint()) { checksigs = false; }
             }
 
-            tx->updateStatus(Tx::NO_STATUS, checksigs);
+            tx->updateStatus(Tx::NO_STATUS, checksigs, verifier);
             LOGGER(trace) << "tx status: " << tx->getStatusString() << std::endl;
 
             bool updated = false;
@@ -2355,7 +2968,7 @@ std::shared_ptr<Tx> Vault::insertTx_unwrapped(std::shared_ptr<Tx> tx, bool repla
                         db_->update(txin);
                         i++;
                     }
-                    stored_tx->updateStatus(tx->status(), true);
+                    stored_tx->updateStatus(tx->status(), true, verifier);
                     db_->update(stored_tx);
                     updated = true;
                 }
@@ -2365,12 +2978,14 @@ std::shared_ptr<Tx> Vault::insertTx_unwrapped(std::shared_ptr<Tx> tx, bool repla
                     bool sigs_updated = false;
                     std::size_t i = 0;
                     txins_t txins = tx->txins();
+                    Coin::SigHashContext stored_sighashcontext(stored_cointx);
+                    Coin::SigHashContext new_sighashcontext(cointx);
                     for (auto& txin: stored_tx->txins())
                     {
                         using namespace CoinQ::Script;
                         uint64_t outpointvalue = txin->outpoint() ? txin->outpoint()->value() : 0;
-                        SignableTxIn stored_stxin(stored_cointx, i, outpointvalue);
-                        SignableTxIn new_stxin(cointx, i, outpointvalue); 
+                        SignableTxIn stored_stxin(stored_cointx, i, outpointvalue, bytes_t(), verifier, &stored_sighashcontext);
+                        SignableTxIn new_stxin(cointx, i, outpointvalue, bytes_t(), verifier, &new_sighashcontext);
                         unsigned int sigsadded = stored_stxin.mergesigs(new_stxin);
                         if (sigsadded > 0)
                         {
@@ -2388,7 +3003,7 @@ std::shared_ptr<Tx> Vault::insertTx_unwrapped(std::shared_ptr<Tx> tx, bool repla
 
                     if (sigs_updated)
                     {
-                        stored_tx->updateStatus(Tx::NO_STATUS, true);
+                        stored_tx->updateStatus(Tx::NO_STATUS, true, verifier);
                         db_->update(stored_tx);
                         updated = true;
                     }
@@ -2419,8 +3034,12 @@ std::shared_ptr<Tx> Vault::insertTx_unwrapped(std::shared_ptr<Tx> tx, bool repla
 
             if (!updated) return nullptr;
 
+            addTxBloomFilterElements_unwrapped(*stored_tx);
+            addTxToOwnershipIndex_unwrapped(*stored_tx);
             updateConfirmations_unwrapped(stored_tx);
-            signalQueue.push(notifyTxUpdated.bind(stored_tx));
+            markAccountBalancesDirty_unwrapped(*stored_tx);
+            pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(stored_tx));
+            updateAccountBalances_unwrapped();
             return stored_tx;
         }
 
@@ -2438,8 +3057,14 @@ std::shared_ptr<Tx> Vault::insertTx_unwrapped(std::shared_ptr<Tx> tx, bool repla
         for (auto& txin: tx->txins())
         {
             // Check if inputs connect
-            tx_r = db_->query<Tx>(odb::query<Tx>::hash == txin->outhash());
-            if (tx_r.empty())
+            bool connected = mayBeStoredTx_unwrapped(txin->outhash());
+            if (connected)
+            {
+                tx_r = db_->query<Tx>(odb::query<Tx>::hash == txin->outhash());
+                connected = !tx_r.empty();
+            }
+
+            if (!connected)
             {
                 // The txinscript is in one of our accounts but we don't have the outpoint, 
                 txin->outpoint(nullptr);
@@ -2454,7 +3079,7 @@ LOGGER(trace) << "txoutscript!!! " << uchar_vector(txoutscript).getHex() << std:
                 {
                     // TODO: handle errors
                 }
-                if (!txoutscript.empty())
+                if (!txoutscript.empty() && mayBeSigningTxOutScript_unwrapped(txoutscript))
                 {
                     odb::result<SigningScript> script_r(db_->query<SigningScript>(odb::query<SigningScript>::txoutscript == txoutscript));
                     if (!script_r.empty())
@@ -2488,24 +3113,27 @@ LOGGER(trace) << "txoutscript!!! " << uchar_vector(txoutscript).getHex() << std:
                 } 
 
                 // Was this transaction signed using one of our accounts?
-                odb::result<SigningScript> script_r(db_->query<SigningScript>(odb::query<SigningScript>::txoutscript == outpoint->script()));
-                if (!script_r.empty())
+                if (mayBeSigningTxOutScript_unwrapped(outpoint->script()))
                 {
-                    sent_from_vault = true;
-                    outpoint->spent(txin);
-                    updated_txouts.insert(outpoint);
-                    if (!sending_account)
+                    odb::result<SigningScript> script_r(db_->query<SigningScript>(odb::query<SigningScript>::txoutscript == outpoint->script()));
+                    if (!script_r.empty())
                     {
-                        // Assuming all inputs belong to the same account
-                        // TODO: Allow coin mixing
-                        std::shared_ptr<SigningScript> script(script_r.begin().load());
-                        sending_account = script->account();
+                        sent_from_vault = true;
+                        outpoint->spent(txin);
+                        updated_txouts.insert(outpoint);
+                        if (!sending_account)
+                        {
+                            // Assuming all inputs belong to the same account
+                            // TODO: Allow coin mixing
+                            std::shared_ptr<SigningScript> script(script_r.begin().load());
+                            sending_account = script->account();
+                        }
                     }
                 }
             }
             if (sent_from_vault)
             {
-                tx->updateStatus(Tx::NO_STATUS, true);
+                tx->updateStatus(Tx::NO_STATUS, true, verifier);
                 LOGGER(trace) << "sent from vault tx status: " << tx->getStatusString() << std::endl;
             }
         }
@@ -2517,6 +3145,7 @@ LOGGER(trace) << "txoutscript!!! " << uchar_vector(txoutscript).getHex() << std:
             // Assume all inputs sent from same account.
             // TODO: Allow coin mixing.
             if (sending_account) { txout->sending_account(sending_account); }
+            if (!mayBeSigningTxOutScript_unwrapped(txout->script())) continue;
 
             odb::result<SigningScript> script_r(db_->query<SigningScript>(odb::query<SigningScript>::txoutscript == txout->script()));
             if (!script_r.empty())
@@ -2552,6 +3181,8 @@ LOGGER(trace) << "txoutscript!!! " << uchar_vector(txoutscript).getHex() << std:
                 }
 
                 // Check if the output has already been spent (transactions inserted out of order)
+                if (!mayBeSpentByStoredTxIn_unwrapped(tx->hash())) continue;
+
                 odb::result<TxIn> txin_r(db_->query<TxIn>(odb::query<TxIn>::outhash == tx->hash() && odb::query<TxIn>::outindex == txout->txindex()));
                 if (!txin_r.empty())
                 {
@@ -2581,7 +3212,8 @@ LOGGER(trace) << "txoutscript!!! " << uchar_vector(txoutscript).getHex() << std:
                 {
                     conflicting_tx->conflicting(true);
                     db_->update(conflicting_tx);
-                    signalQueue.push(notifyTxUpdated.bind(conflicting_tx));
+                    markAccountBalancesDirty_unwrapped(*conflicting_tx);
+                    pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(conflicting_tx));
                     //notifyTxUpdated(conflicting_tx);
                 }
             }
@@ -2604,9 +3236,13 @@ LOGGER(trace) << "txoutscript!!! " << uchar_vector(txoutscript).getHex() << std:
             for (auto& txout:       updated_txouts) { db_->update(txout);       }
             for (auto& tx:          updated_txs)    { db_->update(tx);          }
 
+            addTxBloomFilterElements_unwrapped(*tx);
+            addTxToOwnershipIndex_unwrapped(*tx);
             if (tx->status() >= Tx::SENT) updateConfirmations_unwrapped(tx);
-            signalQueue.push(notifyTxInserted.bind(tx));
+            markAccountBalancesDirty_unwrapped(*tx);
+            pendingSignalQueue_unwrapped().push(notifyTxInserted.bind(tx));
             //notifyTxInserted(tx);
+            updateAccountBalances_unwrapped();
             return tx;
         }
 
@@ -2615,7 +3251,8 @@ LOGGER(trace) << "txoutscript!!! " << uchar_vector(txoutscript).getHex() << std:
     }
     catch (...)
     {
-        signalQueue.clear();
+        pendingSignalQueue_unwrapped().clear();
+        clearAccountBalanceUpdates_unwrapped();
         throw;
     }
 }
@@ -2649,6 +3286,10 @@ std::shared_ptr<Tx> Vault::insertNewTx_unwrapped(const Coin::Transaction& cointx
     {
         using namespace CoinQ::Script;
 
+#ifdef COINDB_TEST
+        if (insertNewTxTestHook) { insertNewTxTestHook(cointx); }
+#endif
+
         std::shared_ptr<Tx> tx(new Tx());
         tx->set(cointx, blockheader ? blockheader->timestamp() : time(NULL), Tx::PROPAGATED);
 
@@ -2689,7 +3330,11 @@ std::shared_ptr<Tx> Vault::insertNewTx_unwrapped(const Coin::Transaction& cointx
                 stored_tx->updateStatus(tx->status());
                 stored_tx->blockheader(blockheader);
                 db_->update(stored_tx);
-                signalQueue.push(notifyTxUpdated.bind(stored_tx));
+                addTxBloomFilterElements_unwrapped(*stored_tx);
+                addTxToOwnershipIndex_unwrapped(*stored_tx);
+                markAccountBalancesDirty_unwrapped(*stored_tx);
+                pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(stored_tx));
+                updateAccountBalances_unwrapped();
                 return stored_tx; 
             }
             return nullptr;
@@ -2723,10 +3368,12 @@ std::shared_ptr<Tx> Vault::insertNewTx_unwrapped(const Coin::Transaction& cointx
                 catch (const std::exception& e)
                 {
                     LOGGER(error) << "Vault::insertNewTx_unwrapped() - unrecognized input script type: " << e.what() << std::endl;
-                    signalQueue.push(notifyTxInsertionError.bind(tx, "Unrecognized input script type."));
+                    pendingSignalQueue_unwrapped().push(notifyTxInsertionError.bind(tx, "Unrecognized input script type."));
                     continue;
                 }
 
+                if (!mayBeSigningTxInScript_unwrapped(unsigned_script)) continue;
+
                 odb::result<SigningScript> r(db_->query<SigningScript>(odb::query<SigningScript>::txinscript == unsigned_script));
                 if (!r.empty())
                 {
@@ -2758,6 +3405,7 @@ std::shared_ptr<Tx> Vault::insertNewTx_unwrapped(const Coin::Transaction& cointx
         {
 //LOGGER(trace) << "Vault::insertNewTx_unwrapped: Checking txout" << std::endl;
             txout->sending_account(sending_account);
+            if (!mayBeSigningTxOutScript_unwrapped(txout->script())) continue;
 
             odb::result<SigningScript> r(db_->query<SigningScript>(odb::query<SigningScript>::txoutscript == txout->script()));
             if (!r.empty())
@@ -2772,6 +3420,8 @@ std::shared_ptr<Tx> Vault::insertNewTx_unwrapped(const Coin::Transaction& cointx
 
                 // Search for an input that claims it (to support out-of-order insertion)
 //LOGGER(trace) << "Vault::insertNewTx_unwrapped: Search for an input that claims it" << std::endl;
+                if (!mayBeSpentByStoredTxIn_unwrapped(tx->hash())) continue;
+
                 odb::result<TxIn> txin_r(db_->query<TxIn>(odb::query<TxIn>::outhash == tx->hash() && odb::query<TxIn>::outindex == txout->txindex()));
                 if (!txin_r.empty())
                 {
@@ -2804,7 +3454,11 @@ std::shared_ptr<Tx> Vault::insertNewTx_unwrapped(const Coin::Transaction& cointx
             for (auto& txout:   updated_txouts)         { db_->update(txout);                   }
             for (auto& tx:      updated_txs)            { tx->updateTotals(); db_->update(tx);  }
 
-            signalQueue.push(notifyTxInserted.bind(tx));
+            addTxBloomFilterElements_unwrapped(*tx);
+            addTxToOwnershipIndex_unwrapped(*tx);
+            markAccountBalancesDirty_unwrapped(*tx);
+            pendingSignalQueue_unwrapped().push(notifyTxInserted.bind(tx));
+            updateAccountBalances_unwrapped();
             return tx;
         }
 
@@ -2812,7 +3466,8 @@ std::shared_ptr<Tx> Vault::insertNewTx_unwrapped(const Coin::Transaction& cointx
     }
     catch (...)
     {
-        signalQueue.clear();
+        pendingSignalQueue_unwrapped().clear();
+        clearAccountBalanceUpdates_unwrapped();
         throw;
     }
 }
@@ -2824,6 +3479,12 @@ std::shared_ptr<Tx> Vault::insertMerkleTx(const ChainMerkleBlock& chainmerkleblo
     std::shared_ptr<Tx> tx;
     {
         boost::lock_guard<boost::mutex> lock(mutex);
+        if (syncBatchTransaction_)
+        {
+            SyncBatchScope scope(*syncBatchTransaction_, *syncBatchSession_);
+            return insertMerkleTx_unwrapped(chainmerkleblock, cointx, txindex, txcount, verifysigs, isCoinbase);
+        }
+
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         tx = insertMerkleTx_unwrapped(chainmerkleblock, cointx, txindex, txcount, verifysigs, isCoinbase);
@@ -2877,7 +3538,8 @@ std::shared_ptr<Tx> Vault::insertMerkleTx_unwrapped(const ChainMerkleBlock& chai
                         std::shared_ptr<Tx> tx(it.load());
                         tx->blockheader(nullptr);
                         db_->update(tx);
-                        signalQueue.push(notifyTxUpdated.bind(tx));
+                        markAccountBalancesDirty_unwrapped(*tx);
+                        pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(tx));
                     }
                 }
 
@@ -2918,7 +3580,8 @@ std::shared_ptr<Tx> Vault::insertMerkleTx_unwrapped(const ChainMerkleBlock& chai
                 tx->status(Tx::CONFIRMED);
                 tx->conflicting(false);
                 db_->update(tx);
-                signalQueue.push(notifyTxUpdated.bind(tx));
+                markAccountBalancesDirty_unwrapped(*tx);
+                pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(tx));
             }
             else
             {
@@ -2955,7 +3618,9 @@ std::shared_ptr<Tx> Vault::insertMerkleTx_unwrapped(const ChainMerkleBlock& chai
                     tx->status(Tx::CONFIRMED);
                     tx->conflicting(false);
                     db_->update(tx);
-                    signalQueue.push(notifyTxUpdated.bind(tx));
+                    addTxToOwnershipIndex_unwrapped(*tx);
+                    markAccountBalancesDirty_unwrapped(*tx);
+                    pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(tx));
                 }
             } 
         }
@@ -2964,37 +3629,55 @@ std::shared_ptr<Tx> Vault::insertMerkleTx_unwrapped(const ChainMerkleBlock& chai
 //LOGGER(trace) << "Vault::insertMerkleTx_unwrapped: We've never seen this transaction before - treat it as a new transaction." << std::endl;
         if (!tx)
         {
+            // insertNewTx_unwrapped clears the pending balance updates and notifications when it fails, and its failure is
+            // only reported here. Set aside the updates already made, such as for txs unconfirmed by a reorg, so they are
+            // still applied, and give it its own queue, which is flushed in order with the enclosing one.
+            dirty_txouts_t dirtyBalanceTxOuts;
+            balance_deltas_t balanceDeltas;
+            dirtyBalanceTxOuts.swap(dirtyBalanceTxOuts_);
+            balanceDeltas.swap(balanceDeltas_);
+
+            std::shared_ptr<Signals::SignalQueue> newTxSignalQueue = std::make_shared<Signals::SignalQueue>();
+            pendingSignalQueue_unwrapped().push([newTxSignalQueue]() { newTxSignalQueue->flush(); });
+
             try
             {
+                NestedSignalQueueScope scope(nestedSignalQueue_, newTxSignalQueue);
 //LOGGER(trace) << "Vault::insertMerkleTx_unrapped: calling insertNewTx_unwrapped" << std::endl;
                 tx = insertNewTx_unwrapped(cointx, merkleblock->blockheader(), verifysigs, isCoinbase);
                 if (tx)
                 {
                     tx->status(Tx::CONFIRMED);
                     db_->update(tx);
-                    signalQueue.push(notifyTxUpdated.bind(tx));
+                    markAccountBalancesDirty_unwrapped(*tx);
+                    pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(tx));
                 }
 //LOGGER(trace) << "Vault::insertMerkleTx_unrapped: returned from insertNewTx_unwrapped" << std::endl;
             }
             catch (const std::runtime_error& e)
             {
                 LOGGER(error) << "insertNewTx_unwrapped() threw exception: " << e.what() << std::endl;
-                signalQueue.push(notifyMerkleBlockInsertionError.bind(merkleblock, e.what()));
+                pendingSignalQueue_unwrapped().push(notifyMerkleBlockInsertionError.bind(merkleblock, e.what()));
             }
+
+            dirtyBalanceTxOuts_.insert(dirtyBalanceTxOuts.begin(), dirtyBalanceTxOuts.end());
+            for (auto& delta: balanceDeltas) { balanceDeltas_[delta.first] += delta.second; }
         }
 
         if (txindex + 1 == txcount)
         {
             merkleblock->txsinserted(true);
             db_->update(merkleblock);
-            signalQueue.push(notifyMerkleBlockInserted.bind(merkleblock));
+            pendingSignalQueue_unwrapped().push(notifyMerkleBlockInserted.bind(merkleblock));
         }
 
+        updateAccountBalances_unwrapped();
         return tx;
     }
     catch (...)
     {
-        signalQueue.clear();
+        pendingSignalQueue_unwrapped().clear();
+        clearAccountBalanceUpdates_unwrapped();
         throw;
     }
 }
@@ -3006,6 +3689,12 @@ std::shared_ptr<Tx> Vault::confirmMerkleTx(const ChainMerkleBlock& chainmerklebl
     std::shared_ptr<Tx> tx;
     {
         boost::lock_guard<boost::mutex> lock(mutex);
+        if (syncBatchTransaction_)
+        {
+            SyncBatchScope scope(*syncBatchTransaction_, *syncBatchSession_);
+            return confirmMerkleTx_unwrapped(chainmerkleblock, txhash, txindex, txcount);
+        }
+
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         tx = confirmMerkleTx_unwrapped(chainmerkleblock, txhash, txindex, txcount);
@@ -3055,7 +3744,8 @@ std::shared_ptr<Tx> Vault::confirmMerkleTx_unwrapped(const ChainMerkleBlock& cha
                         std::shared_ptr<Tx> tx(it.load());
                         tx->status(Tx::PROPAGATED);
                         db_->update(tx);
-                        signalQueue.push(notifyTxUpdated.bind(tx));
+                        markAccountBalancesDirty_unwrapped(*tx);
+                        pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(tx));
                     }
                 }
 
@@ -3091,21 +3781,24 @@ std::shared_ptr<Tx> Vault::confirmMerkleTx_unwrapped(const ChainMerkleBlock& cha
             tx->status(Tx::CONFIRMED);
             tx->conflicting(false);
             db_->update(tx);
-            signalQueue.push(notifyTxUpdated.bind(tx));
+            markAccountBalancesDirty_unwrapped(*tx);
+            pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(tx));
         }
 
         if (txindex + 1 == txcount)
         {
             merkleblock->txsinserted(true);
             db_->update(merkleblock);
-            signalQueue.push(notifyMerkleBlockInserted.bind(merkleblock));
+            pendingSignalQueue_unwrapped().push(notifyMerkleBlockInserted.bind(merkleblock));
         }
 
+        updateAccountBalances_unwrapped();
         return tx;
     }
     catch (...)
     {
-        signalQueue.clear();
+        pendingSignalQueue_unwrapped().clear();
+        clearAccountBalanceUpdates_unwrapped();
         throw;
     }
 }
@@ -3133,66 +3826,8 @@ std::shared_ptr<Tx> Vault::createTx(const std::string& account_name, uint32_t tx
 
 std::shared_ptr<Tx> Vault::createTx_unwrapped(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, txouts_t txouts, uint64_t fee, unsigned int /*maxchangeouts*/)
 {
-    // TODO: Better rng seeding
-    std::srand(std::time(0));
-
-    // TODO: Better fee calculation heuristics
-    uint64_t desired_total = fee;
-    for (auto& txout: txouts)
-    {
-        if (txout->value() == 0) throw TxInvalidOutputsException();
-        desired_total += txout->value();
-    }
-
-    std::shared_ptr<Account> account = getAccount_unwrapped(account_name);
-
-    // TODO: Better coin selection
-    typedef odb::query<TxOutView> query_t;
-    odb::result<TxOutView> utxoview_r(db_->query<TxOutView>(query_t::Tx::status > Tx::UNSIGNED && query_t::TxOut::status == TxOut::UNSPENT && query_t::receiving_account::id == account->id()));
-    std::vector<TxOutView> utxoviews;
-    for (auto& utxoview: utxoview_r) { utxoviews.push_back(utxoview); }
-   
-    std::random_shuffle(utxoviews.begin(), utxoviews.end(), [](int i) { return std::rand() % i; });
-
-    txins_t txins;
-    int i = 0;
-    uint64_t total = 0;
-    for (auto& utxoview: utxoviews)
-    {
-        total += utxoview.value;
-        //std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0xffffffff));
-        std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0));
-        if (account->use_witness())
-        {
-            using namespace CoinQ::Script;
-            scriptstack_t stack;
-            for (std::size_t k = 0; k <= account->keychains().size(); k++) { stack.push_back(bytes_t()); }
-            stack.push_back(utxoview.signingscript_redeemscript); 
-            txin->scriptwitnessstack(stack);
-        }
-        txins.push_back(txin);
-        i++;
-        if (total >= desired_total) break;
-    }
-    if (total < desired_total) throw AccountInsufficientFundsException(account_name, desired_total, total); 
-
-    utxoviews.resize(i);
-    uint64_t change = total - desired_total;
-
-    if (change > 0)
-    {
-        std::shared_ptr<AccountBin> bin = getAccountBin_unwrapped(account_name, CHANGE_BIN_NAME);
-        std::shared_ptr<SigningScript> changescript = issueAccountBinSigningScript_unwrapped(bin);
-
-        // TODO: Allow adding multiple change outputs
-        std::shared_ptr<TxOut> txout(new TxOut(change, changescript));
-        txouts.push_back(txout);
-    }
-    std::random_shuffle(txouts.begin(), txouts.end(), [](int i) { return std::rand() % i; });
-
-    std::shared_ptr<Tx> tx(new Tx());
-    tx->set(tx_version, txins, txouts, tx_locktime, time(NULL), Tx::UNSIGNED);
-    return tx;
+    // TODO: Allow adding multiple change outputs
+    return createTx_unwrapped(account_name, tx_version, tx_locktime, ids_t(), txouts, CoinSelectionParams(fee));
 }
 
 std::shared_ptr<Tx> Vault::createTx(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, txouts_t txouts, uint64_t fee, unsigned int maxchangeouts, bool insert)
@@ -3265,79 +3900,90 @@ std::shared_ptr<Tx> Vault::createTx(const std::string& account_name, uint32_t tx
 }
 
 std::shared_ptr<Tx> Vault::createTx_unwrapped(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee, uint32_t min_confirmations)
+{
+    return createTx_unwrapped(account_name, tx_version, tx_locktime, coin_ids, txouts, CoinSelectionParams(fee, 0, CoinSelectionParams::BRANCH_AND_BOUND, min_confirmations));
+}
+
+std::shared_ptr<Tx> Vault::createTx(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, const CoinSelectionParams& params, bool insert)
+{
+    LOGGER(trace) << "Vault::createTx(" << account_name << ", " << tx_version << ", " << tx_locktime << ", " << coin_ids.size() << " txin(s), " << txouts.size() << " txout(s), " << params.fee << ", " << params.fee_rate << "/kvB, " << CoinSelectionParams::getStrategyString(params.strategy) << ", " << params.min_confirmations << ", " << (insert ? "insert" : "no insert") << ")" << std::endl;
+
+    std::shared_ptr<Tx> tx;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        odb::core::session s;
+        odb::core::transaction t(db_->begin());
+        tx = createTx_unwrapped(account_name, tx_version, tx_locktime, coin_ids, txouts, params);
+        if (insert)
+        {
+            tx = insertTx_unwrapped(tx);
+            if (tx) t.commit();
+        }
+    }
+
+    signalQueue.flush();
+    return tx;
+}
+
+std::shared_ptr<Tx> Vault::createTx_unwrapped(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, const CoinSelectionParams& params)
 {
     std::shared_ptr<Account> account = getAccount_unwrapped(account_name);
+    TxSizeModel model = getTxSizeModel(*account);
 
-    // TODO: Better fee calculation heuristics
-    uint64_t input_total = 0;
-    uint64_t desired_total = fee;
+    uint64_t output_total = 0;
+    std::vector<std::size_t> output_script_sizes;
     for (auto& txout: txouts)
     {
-        desired_total += txout->value();
         if (txout->value() == 0) throw TxInvalidOutputsException();
+        output_total += txout->value();
+        output_script_sizes.push_back(txout->script().empty() ? model.changeScriptSize() : txout->script().size());
     }
 
-    typedef odb::query<TxOutView> query_t;
-    query_t base_query(query_t::Tx::status > Tx::UNSIGNED && query_t::TxOut::status == TxOut::UNSPENT && query_t::receiving_account::id == account->id());
+    typedef odb::query<CoinView> query_t;
+    query_t base_query(query_t::Tx::status > Tx::UNSIGNED && query_t::TxOut::status == TxOut::UNSPENT && query_t::TxOut::receiving_account == account->id());
 
-    if (min_confirmations > 0)
+    if (params.min_confirmations > 0)
     {
         uint32_t best_height = getBestHeight_unwrapped();
-        if (min_confirmations > best_height) throw AccountInsufficientFundsException(account_name, desired_total, 0);
-        base_query = (base_query && query_t::BlockHeader::height <= best_height + 1 - min_confirmations);
+        if (params.min_confirmations > best_height) throw AccountInsufficientFundsException(account_name, output_total + params.fee, 0);
+        base_query = (base_query && query_t::BlockHeader::height <= best_height + 1 - params.min_confirmations);
     }
 
-    txins_t txins;
+    // Supplied coins go first so they are always spent
+    std::vector<unsigned long> ids;
+    std::vector<uint64_t> values;
     if (!coin_ids.empty())
     {
-        odb::result<TxOutView> utxoview_r(db_->query<TxOutView>(base_query && query_t::TxOut::id.in_range(coin_ids.begin(), coin_ids.end())));
-        for (auto& utxoview: utxoview_r)
-        {
-            //std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0xffffffff));
-            std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0));
-            if (account->use_witness())
-            {
-                using namespace CoinQ::Script;
-                scriptstack_t stack;
-                for (std::size_t k = 0; k <= account->keychains().size(); k++) { stack.push_back(bytes_t()); }
-                stack.push_back(utxoview.signingscript_redeemscript); 
-                txin->scriptwitnessstack(stack);
-            }
-            txins.push_back(txin);
-            input_total += utxoview.value;
-        }
-        if (txins.size() < coin_ids.size()) throw TxInvalidInputsException();
+        odb::result<CoinView> coin_r(db_->query<CoinView>(base_query && query_t::TxOut::id.in_range(coin_ids.begin(), coin_ids.end())));
+        for (auto& coin: coin_r) { ids.push_back(coin.id); values.push_back(coin.value); }
+        if (ids.size() < coin_ids.size()) throw TxInvalidInputsException();
     }
+    std::size_t preselected = ids.size();
 
-    // If the supplied inputs are insufficient, automatically add more
-    // TODO; Better coin selection heuristics
-    if (input_total < desired_total)
+    // If the supplied coins are insufficient, select more
+    std::shared_ptr<CoinSelector> selector = CoinSelector::create(model, params);
+    CoinSelection selection;
+    if (coin_ids.empty() || !selector->select(values, preselected, output_total, output_script_sizes, selection))
     {
         query_t query(base_query);
         if (!coin_ids.empty()) { query = (query && !query_t::TxOut::id.in_range(coin_ids.begin(), coin_ids.end())); }
-        odb::result<TxOutView> utxoview_r(db_->query<TxOutView>(query));
-        std::vector<TxOutView> utxoviews;
-        for (auto& utxoview: utxoview_r) { utxoviews.push_back(utxoview); }
-        std::random_shuffle(utxoviews.begin(), utxoviews.end(), [](int i) { return std::rand() % i; });
+        odb::result<CoinView> coin_r(db_->query<CoinView>(query));
+        uint64_t available = 0;
+        for (auto& coin: coin_r) { ids.push_back(coin.id); values.push_back(coin.value); }
+        for (auto value: values) { available += value; }
 
-        for (auto& utxoview: utxoviews)
-        {
-            //std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0xffffffff));
-            std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0));
-            if (account->use_witness())
-            {
-                using namespace CoinQ::Script;
-                scriptstack_t stack;
-                for (std::size_t k = 0; k <= account->keychains().size(); k++) { stack.push_back(bytes_t()); }
-                stack.push_back(utxoview.signingscript_redeemscript); 
-                txin->scriptwitnessstack(stack);
-            }
-            txins.push_back(txin);
-            input_total += utxoview.value;
-            if (input_total >= desired_total) break;
-        }
-        if (input_total < desired_total) throw AccountInsufficientFundsException(account_name, desired_total, input_total);
+        if (!selector->select(values, preselected, output_total, output_script_sizes, selection)) throw AccountInsufficientFundsException(account_name, output_total + params.fee, available);
     }
+
+    LOGGER(debug) << "Vault::createTx_unwrapped - selected " << selection.coins.size() << " of " << values.size() << " coin(s). fee: " << selection.fee << ", change: " << selection.change << ", vsize: " << TxSizeModel::vsize(selection.weight) << std::endl;
+
+    ids_t selected_ids;
+    for (auto i: selection.coins) { selected_ids.push_back(ids[i]); }
+
+    txins_t txins;
+    odb::result<TxOutView> utxoview_r(db_->query<TxOutView>(odb::query<TxOutView>::TxOut::id.in_range(selected_ids.begin(), selected_ids.end())));
+    for (auto& utxoview: utxoview_r) { txins.push_back(newAccountTxIn(*account, utxoview)); }
+    if (txins.size() < selected_ids.size()) throw TxInvalidInputsException();
  
     // Use supplied outputs first
     std::shared_ptr<AccountBin> change_bin;
@@ -3352,19 +3998,18 @@ std::shared_ptr<Tx> Vault::createTx_unwrapped(const std::string& account_name, u
     }
 
     // If supplied change amounts are insufficient, add another change output
-    uint64_t change = input_total - desired_total;
-    if (change > 0)
+    if (selection.change > 0)
     {
         if (!change_bin) { change_bin = getAccountBin_unwrapped(account_name, CHANGE_BIN_NAME); }
         std::shared_ptr<SigningScript> changescript = issueAccountBinSigningScript_unwrapped(change_bin);
 
-        std::shared_ptr<TxOut> txout(new TxOut(change, changescript));
+        std::shared_ptr<TxOut> txout(new TxOut(selection.change, changescript));
         txouts.push_back(txout);
     }
-    // TODO: Better rng seeding
-    std::srand(std::time(0));
-    std::random_shuffle(txins.begin(), txins.end(), [](int i) { return std::rand() % i; });
-    std::random_shuffle(txouts.begin(), txouts.end(), [](int i) { return std::rand() % i; });
+
+    std::mt19937 rng(std::random_device{}());
+    std::shuffle(txins.begin(), txins.end(), rng);
+    std::shuffle(txouts.begin(), txouts.end(), rng);
 
     std::shared_ptr<Tx> tx(new Tx());
     tx->set(tx_version, txins, txouts, tx_locktime, time(NULL), Tx::UNSIGNED);
@@ -3393,6 +4038,32 @@ std::shared_ptr<Tx> Vault::createTx(const std::string& username, const std::stri
 }
 
 std::shared_ptr<Tx> Vault::createTx_unwrapped(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee, uint32_t min_confirmations)
+{
+    return createTx_unwrapped(username, account_name, tx_version, tx_locktime, coin_ids, txouts, CoinSelectionParams(fee, 0, CoinSelectionParams::BRANCH_AND_BOUND, min_confirmations));
+}
+
+std::shared_ptr<Tx> Vault::createTx(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, const CoinSelectionParams& params, bool insert)
+{
+    LOGGER(trace) << "Vault::createTx(" << username << ", " << account_name << ", " << tx_version << ", " << tx_locktime << ", " << coin_ids.size() << " txin(s), " << txouts.size() << " txout(s), " << params.fee << ", " << params.fee_rate << "/kvB, " << CoinSelectionParams::getStrategyString(params.strategy) << ", " << params.min_confirmations << ", " << (insert ? "insert" : "no insert") << ")" << std::endl;
+
+    std::shared_ptr<Tx> tx;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        odb::core::session s;
+        odb::core::transaction t(db_->begin());
+        tx = createTx_unwrapped(username, account_name, tx_version, tx_locktime, coin_ids, txouts, params);
+        if (insert)
+        {
+            tx = insertTx_unwrapped(tx);
+            if (tx) t.commit();
+        }
+    }
+
+    signalQueue.flush();
+    return tx;
+}
+
+std::shared_ptr<Tx> Vault::createTx_unwrapped(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, const CoinSelectionParams& params)
 {
     std::shared_ptr<User> user = getUser_unwrapped(username);
 
@@ -3404,21 +4075,41 @@ std::shared_ptr<Tx> Vault::createTx_unwrapped(const std::string& username, const
         }
     }
 
-    std::shared_ptr<Tx> tx = createTx_unwrapped(account_name, tx_version, tx_locktime, coin_ids, txouts, fee, min_confirmations);
+    std::shared_ptr<Tx> tx;
+    try
+    {
+        tx = createTx_unwrapped(account_name, tx_version, tx_locktime, coin_ids, txouts, params);
+    }
+    catch (AccountInsufficientFundsException& e)
+    {
+        e.username(username);
+        throw e;
+    }
+
     tx->user(user);
     return tx;
 }
 
 txs_t Vault::consolidateTxOuts(const std::string& account_name, uint32_t max_tx_size, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations, bool insert)
 {
-    LOGGER(trace) << "Vault::consolidateTxOuts(" << account_name << ", " << max_tx_size << ", " << tx_version << ", " << tx_locktime << ", " << coin_ids.size() << " txin(s), " << uchar_vector(txoutscript).getHex() << ", " << min_fee << ", " << min_confirmations << ", " << (insert ? "insert" : "no insert") << ")" << std::endl;
+    return consolidateTxOuts(account_name, max_tx_size, tx_version, tx_locktime, coin_ids, txoutscript, CoinSelectionParams(min_fee, 0, CoinSelectionParams::CONSOLIDATE, min_confirmations), insert);
+}
+
+txs_t Vault::consolidateTxOuts(const std::string& username, const std::string& account_name, uint32_t max_tx_size, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations, bool insert)
+{
+    return consolidateTxOuts(username, account_name, max_tx_size, tx_version, tx_locktime, coin_ids, txoutscript, CoinSelectionParams(min_fee, 0, CoinSelectionParams::CONSOLIDATE, min_confirmations), insert);
+}
+
+txs_t Vault::consolidateTxOuts(const std::string& account_name, uint32_t max_tx_size, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, const CoinSelectionParams& params, bool insert)
+{
+    LOGGER(trace) << "Vault::consolidateTxOuts(" << account_name << ", " << max_tx_size << ", " << tx_version << ", " << tx_locktime << ", " << coin_ids.size() << " txin(s), " << uchar_vector(txoutscript).getHex() << ", " << params.fee << ", " << params.fee_rate << "/kvB, " << params.min_confirmations << ", " << (insert ? "insert" : "no insert") << ")" << std::endl;
 
     txs_t txs;
     {
         boost::lock_guard<boost::mutex> lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
-        txs = consolidateTxOuts_unwrapped(account_name, max_tx_size, tx_version, tx_locktime, coin_ids, txoutscript, min_fee, min_confirmations);
+        txs = consolidateTxOuts_unwrapped(account_name, max_tx_size, tx_version, tx_locktime, coin_ids, txoutscript, params);
         if (insert)
         {
             bool bInserted = false;
@@ -3435,9 +4126,9 @@ txs_t Vault::consolidateTxOuts(const std::string& account_name, uint32_t max_tx_
     return txs;
 }
 
-txs_t Vault::consolidateTxOuts(const std::string& username, const std::string& account_name, uint32_t max_tx_size, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations, bool insert)
+txs_t Vault::consolidateTxOuts(const std::string& username, const std::string& account_name, uint32_t max_tx_size, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, const CoinSelectionParams& params, bool insert)
 {
-    LOGGER(trace) << "Vault::consolidateTxOuts(" << username << ", " << account_name << ", " << max_tx_size << ", " << tx_version << ", " << tx_locktime << ", " << coin_ids.size() << " txin(s), " << uchar_vector(txoutscript).getHex() << ", " << min_fee << ", " << min_confirmations << ", " << (insert ? "insert" : "no insert") << ")" << std::endl;
+    LOGGER(trace) << "Vault::consolidateTxOuts(" << username << ", " << account_name << ", " << max_tx_size << ", " << tx_version << ", " << tx_locktime << ", " << coin_ids.size() << " txin(s), " << uchar_vector(txoutscript).getHex() << ", " << params.fee << ", " << params.fee_rate << "/kvB, " << params.min_confirmations << ", " << (insert ? "insert" : "no insert") << ")" << std::endl;
 
     std::shared_ptr<User> user = getUser_unwrapped(username);
 
@@ -3446,7 +4137,7 @@ txs_t Vault::consolidateTxOuts(const std::string& username, const std::string& a
         boost::lock_guard<boost::mutex> lock(mutex);
         odb::core::session s;
         odb::core::transaction t(db_->begin());
-        txs = consolidateTxOuts_unwrapped(account_name, max_tx_size, tx_version, tx_locktime, coin_ids, txoutscript, min_fee, min_confirmations);
+        txs = consolidateTxOuts_unwrapped(account_name, max_tx_size, tx_version, tx_locktime, coin_ids, txoutscript, params);
         bool bInserted = false;
         for (auto& tx: txs)
         {
@@ -3464,91 +4155,103 @@ txs_t Vault::consolidateTxOuts(const std::string& username, const std::string& a
     return txs;
 }
 
-txs_t Vault::consolidateTxOuts_unwrapped(const std::string& account_name, uint32_t max_tx_size, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations)
+txs_t Vault::consolidateTxOuts_unwrapped(const std::string& account_name, uint32_t max_tx_size, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, const CoinSelectionParams& params)
 {
     std::shared_ptr<Account> account = getAccount_unwrapped(account_name);
+    TxSizeModel model = getTxSizeModel(*account);
 
-    typedef odb::query<TxOutView> query_t;
-    query_t base_query(query_t::Tx::status > Tx::UNSIGNED && query_t::TxOut::status == TxOut::UNSPENT && query_t::receiving_account::id == account->id());
+    typedef odb::query<CoinView> query_t;
+    query_t base_query(query_t::Tx::status > Tx::UNSIGNED && query_t::TxOut::status == TxOut::UNSPENT && query_t::TxOut::receiving_account == account->id());
 
-    if (min_confirmations > 0)
+    if (params.min_confirmations > 0)
     {
         uint32_t best_height = getBestHeight_unwrapped();
-        if (min_confirmations > best_height) throw AccountInsufficientFundsException(account_name, 0, 0);
-        base_query = (base_query && query_t::BlockHeader::height <= best_height + 1 - min_confirmations);
+        if (params.min_confirmations > best_height) throw AccountInsufficientFundsException(account_name, 0, 0);
+        base_query = (base_query && query_t::BlockHeader::height <= best_height + 1 - params.min_confirmations);
     }
 
-    odb::result<TxOutView> utxoview_r;
+    odb::result<CoinView> coin_r;
     if (coin_ids.empty())
     {
-        utxoview_r = db_->query<TxOutView>(base_query);
+        coin_r = db_->query<CoinView>(base_query);
     }
     else
     {
-        utxoview_r = db_->query<TxOutView>(base_query && query_t::TxOut::id.in_range(coin_ids.begin(), coin_ids.end()));
+        coin_r = db_->query<CoinView>(base_query && query_t::TxOut::id.in_range(coin_ids.begin(), coin_ids.end()));
     }
 
-    std::vector<TxOutView> utxoviews;
-    for (auto& utxoview: utxoview_r) { utxoviews.push_back(utxoview); }
-    if (utxoviews.size() < coin_ids.size()) throw TxInvalidInputsException();
+    std::vector<CoinView> coins;
+    for (auto& coin: coin_r) { coins.push_back(coin); }
+    if (coins.size() < coin_ids.size()) throw TxInvalidInputsException();
 
-    // TODO: Better rng seeding
-    std::srand(std::time(0));
-    std::random_shuffle(utxoviews.begin(), utxoviews.end(), [](int i) { return std::rand() % i; });
+    // Smallest coins first so each transaction removes as many as it can from the pool. Unless they were
+    // chosen explicitly, coins worth less than the fee to spend them are left alone.
+    uint64_t input_fee = params.fee_rate ? feeForWeight(model.inputWeight(), params.fee_rate) : 0;
+    if (coin_ids.empty())
+    {
+        coins.erase(std::remove_if(coins.begin(), coins.end(), [&](const CoinView& coin) { return coin.value <= input_fee; }), coins.end());
+    }
+    std::sort(coins.begin(), coins.end(), [](const CoinView& a, const CoinView& b) { return a.value < b.value; });
 
-    txins_t txins;
+    // Sizes are estimated for the signed transactions rather than serializing each candidate.
+    std::vector<std::size_t> output_script_sizes(1, txoutscript.size());
+    txs_t txs;
+    ids_t tx_coin_ids;
     uint64_t input_total = 0;
 
-    std::shared_ptr<Tx> test_tx = std::make_shared<Tx>();
-    txs_t txs;
-    std::shared_ptr<TxOut> txout = std::make_shared<TxOut>(0, txoutscript);
-    txouts_t txouts;
-    txouts.push_back(txout);
-    for (auto& utxoview: utxoviews)
+    auto newConsolidationTx = [&]() -> std::shared_ptr<Tx>
     {
-        //std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0xffffffff));
-        std::shared_ptr<TxIn> txin(new TxIn(utxoview.tx_hash, utxoview.tx_index, utxoview.signingscript_txinscript, 0));
-        if (account->use_witness())
-        {
-            using namespace CoinQ::Script;
-            scriptstack_t stack;
-            for (std::size_t k = 0; k <= account->keychains().size(); k++) { stack.push_back(bytes_t()); }
-            stack.push_back(utxoview.signingscript_redeemscript); 
-            txin->scriptwitnessstack(stack);
-        }
-        txins.push_back(txin);
-        test_tx->set(tx_version, txins, txouts, tx_locktime, time(NULL), Tx::UNSIGNED);
-        if (test_tx->raw().size() > max_tx_size)
+        uint64_t fee = params.fee_rate ? feeForWeight(model.txWeight(tx_coin_ids.size(), output_script_sizes), params.fee_rate) : params.fee;
+        if (input_total <= fee) return std::shared_ptr<Tx>();
+
+        txins_t txins;
+        odb::result<TxOutView> utxoview_r(db_->query<TxOutView>(odb::query<TxOutView>::TxOut::id.in_range(tx_coin_ids.begin(), tx_coin_ids.end())));
+        for (auto& utxoview: utxoview_r) { txins.push_back(newAccountTxIn(*account, utxoview)); }
+        if (txins.size() < tx_coin_ids.size()) throw TxInvalidInputsException();
+
+        txouts_t txouts;
+        txouts.push_back(std::make_shared<TxOut>(input_total - fee, txoutscript));
+        std::shared_ptr<Tx> tx = std::make_shared<Tx>();
+        tx->set(tx_version, txins, txouts, tx_locktime, time(NULL), Tx::UNSIGNED);
+        return tx;
+    };
+
+    for (auto& coin: coins)
+    {
+        if (TxSizeModel::vsize(model.txWeight(tx_coin_ids.size() + 1, output_script_sizes)) > max_tx_size)
         {
-            txins.pop_back();
-            if (txins.empty()) throw std::runtime_error("Vault::consolidateTxOuts_unwrapped() - txins empty.");
-            if (input_total <= min_fee) throw std::runtime_error("Vault::consolidateTxOuts_unwrapped() - input total is not greater than fee.");
-            txouts_t txouts;
-            std::shared_ptr<TxOut> txout = std::make_shared<TxOut>(input_total - min_fee, txoutscript);
-            txouts.push_back(txout);
-            std::shared_ptr<Tx> tx = std::make_shared<Tx>();
-            tx->set(tx_version, txins, txouts, tx_locktime, time(NULL), Tx::UNSIGNED);
-            if (tx->raw().size() > max_tx_size) throw std::runtime_error("Vault::consolidateTxOuts_unwrapped() - maximum transaction size is too small.");
+            if (tx_coin_ids.empty()) throw std::runtime_error("Vault::consolidateTxOuts_unwrapped() - maximum transaction size is too small.");
+            std::shared_ptr<Tx> tx = newConsolidationTx();
+            if (!tx) throw std::runtime_error("Vault::consolidateTxOuts_unwrapped() - input total is not greater than fee.");
 
             txs.push_back(tx);
             input_total = 0;
-            txins.clear();
-            txins.push_back(txin);
+            tx_coin_ids.clear();
         }
-            
-        input_total += utxoview.value;
+
+        tx_coin_ids.push_back(coin.id);
+        input_total += coin.value;
     }
-    
-    if (!txins.empty() && input_total >= min_fee)
+
+    if (!tx_coin_ids.empty())
     {
-        txouts_t txouts;
-        std::shared_ptr<TxOut> txout = std::make_shared<TxOut>(input_total - min_fee, txoutscript);
-        txouts.push_back(txout);
-        std::shared_ptr<Tx> tx = std::make_shared<Tx>();
-        tx->set(tx_version, txins, txouts, tx_locktime, time(NULL), Tx::UNSIGNED);
-        if (tx->raw().size() < max_tx_size) { txs.push_back(tx); }
+        // The last batch cannot be merged into the previous one without exceeding max_tx_size, so if it does not cover its
+        // fee its coins are left unspent.
+        std::shared_ptr<Tx> tx = newConsolidationTx();
+        if (tx)
+        {
+            txs.push_back(tx);
+        }
+        else if (txs.empty())
+        {
+            throw std::runtime_error("Vault::consolidateTxOuts_unwrapped() - input total is not greater than fee.");
+        }
+        else
+        {
+            LOGGER(warning) << "Vault::consolidateTxOuts_unwrapped() - skipped " << tx_coin_ids.size() << " coin(s) totalling " << input_total << " whose input total is not greater than fee." << std::endl;
+        }
     }
-    
+
     return txs;
 }
 
@@ -3557,6 +4260,10 @@ void Vault::updateTx_unwrapped(std::shared_ptr<Tx> tx)
     for (auto& txin: tx->txins()) { db_->update(txin); }
     for (auto& txout: tx->txouts()) { db_->update(txout); }
     db_->update(tx); 
+    addTxBloomFilterElements_unwrapped(*tx);
+    addTxToOwnershipIndex_unwrapped(*tx);
+    markAccountBalancesDirty_unwrapped(*tx);
+    updateAccountBalances_unwrapped();
 }
 
 void Vault::deleteTx(const bytes_t& tx_hash)
@@ -3609,6 +4316,7 @@ void Vault::deleteTx_unwrapped(std::shared_ptr<Tx> tx)
                 std::shared_ptr<TxOut> txout(txout_r.begin().load());
                 txout->spent(nullptr);
                 db_->update(txout);
+                dirtyBalanceTxOuts_.insert(txout);
             }
             db_->erase(txin);
         }
@@ -3618,16 +4326,20 @@ void Vault::deleteTx_unwrapped(std::shared_ptr<Tx> tx)
         {
             // recursively delete any transactions that depend on this one first
             if (txout->spent()) { deleteTx_unwrapped(txout->spent()->tx()); }
+            updateTxOutBalance_unwrapped(*txout, true);
+            dirtyBalanceTxOuts_.erase(txout);
             db_->erase(txout);
         }
 
         // delete tx
         db_->erase(tx);
-        signalQueue.push(notifyTxDeleted.bind(tx));
+        pendingSignalQueue_unwrapped().push(notifyTxDeleted.bind(tx));
+        updateAccountBalances_unwrapped();
     }
     catch (...)
     {
-        signalQueue.clear();
+        pendingSignalQueue_unwrapped().clear();
+        clearAccountBalanceUpdates_unwrapped();
         throw;
     }
 }
@@ -3817,6 +4529,7 @@ unsigned int Vault::signTx_unwrapped(std::shared_ptr<Tx> tx, std::vector<std::st
     using namespace CoinCrypto;
 
     Coin::Transaction coin_tx = tx->toCoinCore();
+    Coin::SigHashContext sighashcontext(coin_tx);
 
     // No point in trying nonprivate keys
     odb::query<Key> privkey_query(odb::query<Key>::is_private != 0);
@@ -3831,7 +4544,7 @@ unsigned int Vault::signTx_unwrapped(std::shared_ptr<Tx> tx, std::vector<std::st
     for (auto& txin: tx->txins())
     {
         uint64_t outpointvalue = txin->outpoint() ? txin->outpoint()->value() : 0;
-        SignableTxIn signableTxIn(coin_tx, txin->txindex(), outpointvalue);
+        SignableTxIn signableTxIn(coin_tx, txin->txindex(), outpointvalue, bytes_t(), nullptr, &sighashcontext);
 
         unsigned int sigsneeded = signableTxIn.sigsneeded();
         if (sigsneeded == 0) continue;
@@ -3843,7 +4556,7 @@ unsigned int Vault::signTx_unwrapped(std::shared_ptr<Tx> tx, std::vector<std::st
         if (key_r.empty()) continue;
 
         // Compute hash to sign
-        bytes_t signingHash = coin_tx.getSigHash(SIGHASH_ALL, txin->txindex(), signableTxIn.redeemscript(), outpointvalue);
+        bytes_t signingHash = sighashcontext.getSigHash(SIGHASH_ALL, txin->txindex(), signableTxIn.redeemscript(), outpointvalue);
         LOGGER(debug) << "Vault::signTx_unwrapped - computed signing hash " << uchar_vector(signingHash).getHex() << " for input " << txin->txindex() << std::endl;
 
         for (auto& key: key_r)
@@ -4143,12 +4856,24 @@ unsigned int Vault::importTxs_unwrapped(boost::archive::text_iarchive& ia)
 {
     uint32_t n;
     ia >> n;
+
+    // Read all transactions first so their signatures can be verified in a single batch.
+    // Outpoint values are not known yet so segwit signature checks will miss the cache and get verified on insertion.
+    txs_t txs;
+    CoinQ::Script::SignatureVerifier verifier;
     for (uint32_t i = 0; i < n; i++)
     {
         std::shared_ptr<Tx> tx(new Tx());
         ia >> *tx;
+        verifier.queue(tx->toCoinCore());
+        txs.push_back(tx);
+    }
+    verifier.verify();
+
+    for (auto& tx: txs)
+    {
         odb::core::session s;
-        insertTx_unwrapped(tx);
+        insertTx_unwrapped(tx, false, &verifier);
     }
     return n;
 }
@@ -4177,6 +4902,29 @@ std::shared_ptr<SigningScript> Vault::getSigningScript_unwrapped(const bytes_t&
     return r.begin().load(); 
 }
 
+void Vault::persistSigningScript_unwrapped(std::shared_ptr<SigningScript> script)
+{
+    for (auto& key: script->keys()) { db_->persist(key); }
+    db_->persist(script);
+    addSigningScriptBloomFilterElements_unwrapped(*script);
+    addSigningScriptToOwnershipIndex_unwrapped(*script);
+}
+
+void Vault::persistSigningScripts_unwrapped(const SigningScriptVector& scripts)
+{
+    // Keep each table's insert statement hot rather than alternating between the key and script statements.
+    for (auto& script: scripts)
+    {
+        for (auto& key: script->keys()) { db_->persist(key); }
+    }
+    for (auto& script: scripts) { db_->persist(script); }
+    for (auto& script: scripts)
+    {
+        addSigningScriptBloomFilterElements_unwrapped(*script);
+        addSigningScriptToOwnershipIndex_unwrapped(*script);
+    }
+}
+
 ///////////////////////////
 // BLOCKCHAIN OPERATIONS //
 ///////////////////////////
@@ -4258,6 +5006,12 @@ std::shared_ptr<MerkleBlock> Vault::insertMerkleBlock(std::shared_ptr<MerkleBloc
 
     {
         boost::lock_guard<boost::mutex> lock(mutex);
+        if (syncBatchTransaction_)
+        {
+            SyncBatchScope scope(*syncBatchTransaction_, *syncBatchSession_);
+            return insertMerkleBlock_unwrapped(merkleblock);
+        }
+
         odb::core::session s;
         odb::core::transaction t(db_->begin());
         merkleblock = insertMerkleBlock_unwrapped(merkleblock);
@@ -4301,7 +5055,7 @@ std::shared_ptr<MerkleBlock> Vault::insertMerkleBlock_unwrapped(std::shared_ptr<
             LOGGER(debug) << "Vault::insertMerkleBlock_unwrapped - inserting horizon merkle block. hash: " << new_blockheader_hash << ", height: " << new_blockheader->height() << std::endl;
             db_->persist(new_blockheader);
             db_->persist(merkleblock);
-            signalQueue.push(notifyMerkleBlockInserted.bind(merkleblock));
+            pendingSignalQueue_unwrapped().push(notifyMerkleBlockInserted.bind(merkleblock));
             //notifyMerkleBlockInserted(merkleblock);
             return merkleblock;
         }
@@ -4340,24 +5094,27 @@ std::shared_ptr<MerkleBlock> Vault::insertMerkleBlock_unwrapped(std::shared_ptr<
         LOGGER(debug) << "Vault::insertMerkleBlock_unwrapped - inserting merkle block. hash: " << new_blockheader_hash << ", height: " << new_blockheader->height() << std::endl;
         db_->persist(new_blockheader);
         db_->persist(merkleblock);
-        signalQueue.push(notifyMerkleBlockInserted.bind(merkleblock));
+        pendingSignalQueue_unwrapped().push(notifyMerkleBlockInserted.bind(merkleblock));
 
         // Confirm transactions
         bool confirmations_updated = false;
         const auto& hashes = merkleblock->hashes();
         odb::result<Tx> tx_r(db_->query<Tx>(odb::query<Tx>::hash.in_range(hashes.begin(), hashes.end())));
-        for (auto& tx: tx_r)
+        for (auto it = tx_r.begin(); it != tx_r.end(); ++it)
         {
-            if (tx.blockheader())
+            // Loaded straight into the pointer the signal carries rather than copied out of the result.
+            std::shared_ptr<Tx> tx(it.load());
+            if (tx->blockheader())
             {
-                LOGGER(error) << "Vault::insertMerkleBlock_unwrapped - transaction appears in more than one block. hash: " << uchar_vector(tx.hash()).getHex() << std::endl;
+                LOGGER(error) << "Vault::insertMerkleBlock_unwrapped - transaction appears in more than one block. hash: " << uchar_vector(tx->hash()).getHex() << std::endl;
                 throw MerkleBlockInvalidException(new_blockheader->hash(), new_blockheader->height());
             } 
-            LOGGER(debug) << "Vault::insertMerkleBlock_unwrapped - confirming transaction. hash: " << uchar_vector(tx.hash()).getHex() << std::endl;
-            tx.blockheader(new_blockheader);
+            LOGGER(debug) << "Vault::insertMerkleBlock_unwrapped - confirming transaction. hash: " << uchar_vector(tx->hash()).getHex() << std::endl;
+            tx->blockheader(new_blockheader);
             db_->update(tx);
             confirmations_updated = true;
-            signalQueue.push(notifyTxUpdated.bind(std::make_shared<Tx>(tx)));
+            markAccountBalancesDirty_unwrapped(*tx);
+            pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(tx));
         }
 
         if (confirmations_updated)
@@ -4365,11 +5122,13 @@ std::shared_ptr<MerkleBlock> Vault::insertMerkleBlock_unwrapped(std::shared_ptr<
             db_->update(merkleblock);
         }
 
+        updateAccountBalances_unwrapped();
         return merkleblock;     
     }
     catch (...)
     {
-        signalQueue.clear();
+        pendingSignalQueue_unwrapped().clear();
+        clearAccountBalanceUpdates_unwrapped();
         throw;
     }
 }
@@ -4413,7 +5172,7 @@ unsigned int Vault::deleteMerkleBlock_unwrapped(uint32_t height)
             {
                 tx->blockheader(nullptr);
                 db_->update(tx);
-                signalQueue.push(notifyTxUpdated.bind(tx));
+                pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(tx));
             }
 
             std::shared_ptr<MerkleBlock> merkleblock(db_->find<MerkleBlock>(view.merkleblock_id));
@@ -4439,13 +5198,14 @@ unsigned int Vault::deleteMerkleBlock_unwrapped(uint32_t height)
 
             // Remove tx confirmations
             odb::result<Tx> tx_r(db_->query<Tx>(odb::query<Tx>::blockheader == blockheader.id()));
-            for (auto& tx: tx_r)
+            for (auto it = tx_r.begin(); it != tx_r.end(); ++it)
             {
-    //            LOGGER(debug) << "Vault::deleteMerkleBlock_unwrapped - unconfirming transaction. hash: " << uchar_vector(tx.hash()).getHex() << std::endl;
-                tx.blockheader(nullptr);
+                std::shared_ptr<Tx> tx(it.load());
+    //            LOGGER(debug) << "Vault::deleteMerkleBlock_unwrapped - unconfirming transaction. hash: " << uchar_vector(tx->hash()).getHex() << std::endl;
+                tx->blockheader(nullptr);
                 db_->update(tx);
-                signalQueue.push(notifyTxUpdated.bind(std::make_shared<Tx>(tx)));
-                //notifyTxUpdated(std::make_shared<Tx>(tx));
+                markAccountBalancesDirty_unwrapped(*tx);
+                pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(tx));
             }
 
             // Delete merkle block
@@ -4457,11 +5217,13 @@ unsigned int Vault::deleteMerkleBlock_unwrapped(uint32_t height)
             count++;
         }
 
+        updateAccountBalances_unwrapped();
         return count;
     }
     catch (...)
     {
-        signalQueue.clear();
+        pendingSignalQueue_unwrapped().clear();
+        clearAccountBalanceUpdates_unwrapped();
         throw;
     }
 }
@@ -4488,16 +5250,19 @@ unsigned int Vault::updateConfirmations_unwrapped(std::shared_ptr<Tx> tx)
 
             tx->blockheader(blockheader);
             db_->update(tx);
-            signalQueue.push(notifyTxUpdated.bind(tx));
+            markAccountBalancesDirty_unwrapped(*tx);
+            pendingSignalQueue_unwrapped().push(notifyTxUpdated.bind(tx));
             count++;
             LOGGER(debug) << "Vault::updateConfirmations_unwrapped - transaction " << uchar_vector(tx->hash()).getHex() << " confirmed in block " << uchar_vector(tx->blockheader()->hash()).getHex() << " height: " << tx->blockheader()->height() << std::endl;
         }
 
+        updateAccountBalances_unwrapped();
         return count;
     }
     catch (...)
     {
-        signalQueue.clear();
+        pendingSignalQueue_unwrapped().clear();
+        clearAccountBalanceUpdates_unwrapped();
         throw;
     }
 }
@@ -4548,6 +5313,84 @@ void Vault::importMerkleBlocks(const std::string& filepath)
     signalQueue.flush();
 }
 
+void Vault::beginSyncBatch()
+{
+    LOGGER(trace) << "Vault::beginSyncBatch()" << std::endl;
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (syncBatchTransaction_) throw std::runtime_error("Vault::beginSyncBatch() - sync batch already open.");
+
+    syncBatchSession_ = std::make_shared<odb::core::session>(false);
+    syncBatchTransaction_ = std::make_shared<odb::core::transaction>(db_->begin(), false);
+    syncBatchSignalQueue_ = std::make_shared<Signals::SignalQueue>();
+}
+
+void Vault::commitSyncBatch()
+{
+    LOGGER(trace) << "Vault::commitSyncBatch()" << std::endl;
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (!syncBatchTransaction_) return;
+
+        try
+        {
+            syncBatchTransaction_->commit();
+        }
+        catch (...)
+        {
+            endSyncBatch_unwrapped(false);
+            throw;
+        }
+
+        // Queued behind any notifications already pending so they are all sent in the order the writes were made.
+        std::shared_ptr<Signals::SignalQueue> batchSignalQueue = syncBatchSignalQueue_;
+        signalQueue.push([batchSignalQueue]() { batchSignalQueue->flush(); });
+        endSyncBatch_unwrapped(true);
+    }
+
+    signalQueue.flush();
+}
+
+void Vault::rollbackSyncBatch()
+{
+    LOGGER(trace) << "Vault::rollbackSyncBatch()" << std::endl;
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (!syncBatchTransaction_) return;
+
+    endSyncBatch_unwrapped(false);
+}
+
+void Vault::endSyncBatch_unwrapped(bool committed)
+{
+    // Destroying an uncommitted transaction rolls it back.
+    syncBatchTransaction_.reset();
+    syncBatchSession_.reset();
+    syncBatchSignalQueue_.reset();
+    clearAccountBalanceUpdates_unwrapped();
+
+    if (!committed)
+    {
+        // The caches may hold elements and hashes added by the rolled back writes.
+        resetBloomFilterElements_unwrapped();
+        resetOwnershipIndex_unwrapped();
+    }
+}
+
+Signals::SignalQueue& Vault::pendingSignalQueue_unwrapped()
+{
+    if (nestedSignalQueue_) return *nestedSignalQueue_;
+    if (syncBatchTransaction_ && odb::core::transaction::has_current() && &odb::core::transaction::current() == syncBatchTransaction_.get()) return *syncBatchSignalQueue_;
+    return signalQueue;
+}
+
+bool Vault::isSyncBatchOpen() const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return (bool)syncBatchTransaction_;
+}
+
 void Vault::importMerkleBlocks_unwrapped(boost::archive::text_iarchive& ia)
 {
     uint32_t n;
@@ -4556,6 +5399,7 @@ void Vault::importMerkleBlocks_unwrapped(boost::archive::text_iarchive& ia)
     {
         std::shared_ptr<MerkleBlock> merkleblock(new MerkleBlock());
         ia >> *merkleblock;
+        if (merkleblock->blockheader()) { merkleblock->blockheader()->updateHash(coinParams_.block_header_hash_funcs()); }
         insertMerkleBlock_unwrapped(merkleblock);
     }
 }
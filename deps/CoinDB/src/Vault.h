@@ -15,20 +15,28 @@
 #include "VaultExceptions.h"
 #include "SigningRequest.h"
 #include "SignatureInfo.h"
+#include "CoinSelection.h"
 
 #include <Signals/Signals.h>
 #include <Signals/SignalQueue.h>
 
 #include <CoinQ/CoinQ_blocks.h>
+#include <CoinQ/CoinQ_coinparams.h>
 
 #include <CoinCore/BloomFilter.h>
 
 #include <boost/thread.hpp>
+#include <boost/functional/hash.hpp>
 
 // support for boost serialization
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
 
+#include <map>
+#include <set>
+#include <tuple>
+#include <unordered_set>
+
 namespace CoinDB
 {
 
@@ -46,7 +54,7 @@ typedef Signals::Signal<std::shared_ptr<MerkleBlock>, bytes_t> TxConfirmationErr
 class Vault
 {
 public:
-    Vault() : db_(nullptr) { }
+    Vault() : db_(nullptr), coinParams_(CoinQ::getBitcoinParams()), bloomElementsLoaded_(false), bloomFilterCapacity_(0), bloomFilterFalsePositiveRate_(0), ownershipIndexLoaded_(false) { }
     Vault(int argc, char** argv, bool create = false, uint32_t version = SCHEMA_VERSION, const std::string& network = "", bool migrate = false);
     Vault(const std::string& dbname, bool create = false, uint32_t version = SCHEMA_VERSION, const std::string& network = "", bool migrate = false);
     Vault(const std::string& dbuser, const std::string& dbpasswd, const std::string& dbname, bool create = false, uint32_t version = SCHEMA_VERSION, const std::string& network = "", bool migrate = false);
@@ -74,12 +82,21 @@ public:
     std::string                             getNetwork() const;
     void                                    setNetwork(const std::string& network);
 
+    // Block header hash functions and extended key versions of the vault's network. Vaults of different networks can
+    // be open in the same process. Defaults to bitcoin.
+    void                                    setCoinParams(const CoinQ::CoinParams& coinParams);
+    const CoinQ::CoinParams&                getCoinParams() const { return coinParams_; }
+
     static const uint32_t                   MAX_HORIZON_TIMESTAMP_OFFSET = 6 * 60 * 60; // a good six hours initial tolerance for incorrect clock
+    static const uint32_t                   BLOOM_FILTER_GROWTH_FACTOR = 2; // filter capacity relative to element count when rebuilt
     uint32_t                                getHorizonTimestamp() const; // nothing that happened before this should matter to us.
     uint32_t                                getMaxFirstBlockTimestamp() const; // convenience method. getHorizonTimestamp() - MIN_HORIZON_TIMESTAMP_OFFSET
     uint32_t                                getHorizonHeight() const;
     std::vector<bytes_t>                    getLocatorHashes() const;
     Coin::BloomFilter                       getBloomFilter(double falsePositiveRate, uint32_t nTweak, uint32_t nFlags) const;
+    // Returns true if the filter from the previous call could be extended in place. In that case newElements holds the elements
+    // inserted since then and sending them with filteradd suffices. Returns false if the filter was rebuilt and must be reloaded.
+    bool                                    getBloomFilterUpdate(double falsePositiveRate, uint32_t nTweak, uint32_t nFlags, Coin::BloomFilter& filter, std::vector<bytes_t>& newElements) const;
     hashvector_t                            getIncompleteBlockHashes() const;
 
     void                                    exportVault(const std::string& filepath, bool exportprivkeys = true) const;
@@ -140,13 +157,16 @@ public:
     AccountInfo                             getAccountInfo(const std::string& account_name) const;
     std::vector<AccountInfo>                getAllAccountInfo() const;
     uint64_t                                getAccountBalance(const std::string& account_name, unsigned int min_confirmations = 1, int tx_flags = Tx::ALL) const;
+    std::vector<std::string>                checkAccountBalances(bool repair = false); // returns names of accounts whose stored balances do not match their txouts
     std::shared_ptr<AccountBin>             addAccountBin(const std::string& account_name, const std::string& bin_name);
     std::shared_ptr<SigningScript>          issueSigningScript(const std::string& account_name, const std::string& bin_name = DEFAULT_BIN_NAME, const std::string& label = "", uint32_t index = 0, const std::string& username = std::string());
-    void                                    refillAccountPool(const std::string& account_name);
+    uint32_t                                refillAccountPool(const std::string& account_name); // returns the number of signing scripts created
 
     // empty account_name or bin_name means do not filter on those fields
     std::vector<SigningScriptView>          getSigningScriptViews(const std::string& account_name = "", const std::string& bin_name = "", int flags = SigningScript::ALL) const;
     std::vector<TxOutView>                  getTxOutViews(const std::string& account_name = "", const std::string& bin_name = "", int role_flags = TxOut::ROLE_BOTH, int txout_status_flags = TxOut::BOTH, int tx_status_flags = Tx::ALL, bool hide_change = true) const;
+    std::vector<TxOutView>                  getTxOutViews(unsigned long tx_id, const std::string& account_name = "", int role_flags = TxOut::ROLE_BOTH, bool hide_change = true) const;
+    std::vector<TxOutView>                  getTxOutViewsAfter(const std::string& account_name, const TxViewCursor& cursor, int count, int role_flags = TxOut::ROLE_BOTH, bool hide_change = true) const; // count limits txouts, see TxViewCursor for the order
     std::vector<TxOutView>                  getUnspentTxOutViews(const std::string& account_name, uint32_t min_confirmations = 0) const;
 
     ////////////////////////////
@@ -167,6 +187,7 @@ public:
     uint32_t                                getTxConfirmations(unsigned long tx_id) const;
     uint32_t                                getTxConfirmations(std::shared_ptr<Tx> tx) const;
     std::vector<TxView>                     getTxViews(int tx_status_flags = Tx::ALL, unsigned long start = 0, int count = -1, uint32_t minheight = 0) const; // count = -1 means display all
+    std::vector<TxView>                     getTxViewsAfter(const TxViewCursor& cursor, int count, int tx_status_flags = Tx::ALL) const; // see TxViewCursor for the order
     std::vector<std::string>                getSerializedUnsignedTxs(const std::string& account_name) const;
     std::shared_ptr<Tx>                     insertTx(std::shared_ptr<Tx> tx, bool replace_labels = false); // Inserts transaction only if it affects one of our accounts. Returns transaction in vault if change occured. Otherwise returns nullptr.
     std::shared_ptr<Tx>                     insertNewTx(const Coin::Transaction& cointx, std::shared_ptr<BlockHeader> blockheader = nullptr, bool verifysigs = false, bool isCoinbase = false);
@@ -176,8 +197,12 @@ public:
     std::shared_ptr<Tx>                     createTx(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, txouts_t txouts, uint64_t fee, unsigned int maxchangeouts = 1, bool insert = false);
     std::shared_ptr<Tx>                     createTx(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee, uint32_t min_confirmations, bool insert = false); // Pass empty output scripts to generate change outputs.
     std::shared_ptr<Tx>                     createTx(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee, uint32_t min_confirmations, bool insert = false); // Pass empty output scripts to generate change outputs.
-    txs_t                                   consolidateTxOuts(const std::string& account_name, uint32_t max_tx_size /* in bytes */, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations, bool insert = false);
-    txs_t                                   consolidateTxOuts(const std::string& username, const std::string& account_name, uint32_t max_tx_size /* in bytes */, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations, bool insert = false);
+    std::shared_ptr<Tx>                     createTx(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, const CoinSelectionParams& params, bool insert = false); // Supplied coins are always spent, more are selected if needed.
+    std::shared_ptr<Tx>                     createTx(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, const CoinSelectionParams& params, bool insert = false);
+    txs_t                                   consolidateTxOuts(const std::string& account_name, uint32_t max_tx_size /* in vbytes */, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations, bool insert = false);
+    txs_t                                   consolidateTxOuts(const std::string& username, const std::string& account_name, uint32_t max_tx_size /* in vbytes */, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations, bool insert = false);
+    txs_t                                   consolidateTxOuts(const std::string& account_name, uint32_t max_tx_size /* in vbytes */, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, const CoinSelectionParams& params, bool insert = false); // params.fee is per transaction, strategy is ignored.
+    txs_t                                   consolidateTxOuts(const std::string& username, const std::string& account_name, uint32_t max_tx_size /* in vbytes */, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, const CoinSelectionParams& params, bool insert = false);
     void                                    deleteTx(const bytes_t& tx_hash); // Tries both signed and unsigned hashes. Throws TxNotFoundException.
     void                                    deleteTx(unsigned long tx_id); // Throws TxNotFoundException.
     SigningRequest                          getSigningRequest(const bytes_t& hash, bool include_raw_tx = false) const; // Tries both signed and unsigned hashes. Throws TxNotFoundException.
@@ -221,6 +246,14 @@ public:
     void                                    exportMerkleBlocks(const std::string& filepath) const;
     void                                    importMerkleBlocks(const std::string& filepath);
 
+    // Merkle block insertions and merkle tx insertions and confirmations made while a sync batch is open share a single database
+    // transaction and session. Their notifications are held in the batch's own queue until it is committed and are discarded on
+    // rollback, along with the cached bloom filter elements and ownership index.
+    void                                    beginSyncBatch();
+    void                                    commitSyncBatch();
+    void                                    rollbackSyncBatch();
+    bool                                    isSyncBatchOpen() const;
+
     /////////////////////
     // USER OPERATIONS //
     /////////////////////
@@ -266,6 +299,11 @@ public:
         notifyTxConfirmationError.clear();
     }
 
+#ifdef COINDB_TEST
+    // Called by insertNewTx_unwrapped before it stores anything, so tests can make an insertion fail.
+    std::function<void(const Coin::Transaction&)> insertNewTxTestHook;
+#endif
+
 protected:
     ///////////////////////
     // GLOBAL OPERATIONS //
@@ -281,8 +319,24 @@ protected:
     uint32_t                                getHorizonHeight_unwrapped() const;
     std::vector<bytes_t>                    getLocatorHashes_unwrapped() const;
     Coin::BloomFilter                       getBloomFilter_unwrapped(double falsePositiveRate, uint32_t nTweak, uint32_t nFlags) const;
+    bool                                    getBloomFilterUpdate_unwrapped(double falsePositiveRate, uint32_t nTweak, uint32_t nFlags, Coin::BloomFilter& filter, std::vector<bytes_t>& newElements) const;
     hashvector_t                            getIncompleteBlockHashes_unwrapped() const;
 
+    void                                    resetBloomFilterElements_unwrapped() const;
+    void                                    loadBloomFilterElements_unwrapped() const;
+    void                                    addBloomFilterElement_unwrapped(const bytes_t& element) const;
+    void                                    addSigningScriptBloomFilterElements_unwrapped(const SigningScript& script) const;
+    void                                    addTxBloomFilterElements_unwrapped(const Tx& tx) const;
+
+    void                                    resetOwnershipIndex_unwrapped() const;
+    void                                    loadOwnershipIndex_unwrapped() const;
+    void                                    addSigningScriptToOwnershipIndex_unwrapped(const SigningScript& script) const;
+    void                                    addTxToOwnershipIndex_unwrapped(const Tx& tx) const;
+    bool                                    mayBeSigningTxInScript_unwrapped(const bytes_t& txinscript) const;
+    bool                                    mayBeSigningTxOutScript_unwrapped(const bytes_t& txoutscript) const;
+    bool                                    mayBeStoredTx_unwrapped(const bytes_t& hash) const;
+    bool                                    mayBeSpentByStoredTxIn_unwrapped(const bytes_t& outhash) const;
+
     ////////////////////////
     // CONTACT OPERATIONS //
     ////////////////////////
@@ -314,13 +368,16 @@ protected:
     // The following methods return true iff successful
     bool                                    tryUnlockKeychain_unwrapped(std::shared_ptr<Keychain> keychain, const secure_bytes_t& lock_key = secure_bytes_t()) const;
 
+    // Discards the cached private derivation nodes of every keychain this vault has unlocked
+    void                                    clearPrivateDerivationCaches_unwrapped();
+
     ////////////////////////
     // Account operations //
     ////////////////////////
     void                                    exportAccount_unwrapped(Account& account, boost::archive::text_oarchive& oa, bool exportprivkeys) const;
     std::shared_ptr<Account>                importAccount_unwrapped(boost::archive::text_iarchive& ia, unsigned int& privkeysimported);
 
-    void                                    refillAccountPool_unwrapped(std::shared_ptr<Account> account);
+    uint32_t                                refillAccountPool_unwrapped(std::shared_ptr<Account> account);
 
     bool                                    accountExists_unwrapped(const std::string& account_name) const;
     std::string                             getNextAvailableAccountName_unwrapped(const std::string& desired_account_name) const;
@@ -328,12 +385,22 @@ protected:
 
     std::vector<TxOutView>                  getUnspentTxOutViews_unwrapped(std::shared_ptr<Account> account, uint32_t min_confirmations = 0) const;
 
+    // The outputs of marked txs, and the outputs they spend, are moved between stored balance buckets when the writing
+    // operation finishes. Writes that fail must clear the pending updates, so a caller that carries on after a nested
+    // write fails has to set its own aside first. Only repairs and migrations rebuild a whole account.
+    void                                    markAccountBalancesDirty_unwrapped(const Tx& tx);
+    void                                    updateAccountBalances_unwrapped();
+    void                                    clearAccountBalanceUpdates_unwrapped();
+    bool                                    updateTxOutBalance_unwrapped(TxOut& txout, bool erased = false);
+    void                                    rebuildAccountBalance_unwrapped(unsigned long account_id);
+    std::map<std::pair<int, uint32_t>, uint64_t> computeAccountBalance_unwrapped(unsigned long account_id) const;
+
     ////////////////////////////
     // ACCOUNT BIN OPERATIONS //
     ////////////////////////////
     std::shared_ptr<AccountBin>             getAccountBin_unwrapped(const std::string& account_name, const std::string& bin_name) const;
     std::shared_ptr<SigningScript>          issueAccountBinSigningScript_unwrapped(std::shared_ptr<AccountBin> account_bin, const std::string& label = "", uint32_t index = 0);
-    void                                    refillAccountBinPool_unwrapped(std::shared_ptr<AccountBin> bin, uint32_t index = 0);
+    uint32_t                                refillAccountBinPool_unwrapped(std::shared_ptr<AccountBin> bin, uint32_t index = 0);
     void                                    exportAccountBin_unwrapped(const std::shared_ptr<AccountBin> account_bin, const std::string& export_name, const std::string& filepath) const;
     std::shared_ptr<AccountBin>             importAccountBin_unwrapped(const std::string& filepath); 
 
@@ -345,7 +412,7 @@ protected:
     txs_t                                   getTxs_unwrapped(int tx_status_flags = Tx::ALL, unsigned long start = 0, int count = -1, uint32_t minheight = 0) const;
     std::vector<std::string>                getSerializedUnsignedTxs_unwrapped(const std::string& account_name) const;
     uint32_t                                getTxConfirmations_unwrapped(std::shared_ptr<Tx> tx) const;
-    std::shared_ptr<Tx>                     insertTx_unwrapped(std::shared_ptr<Tx> tx, bool replace_labels = false);
+    std::shared_ptr<Tx>                     insertTx_unwrapped(std::shared_ptr<Tx> tx, bool replace_labels = false, CoinQ::Script::SignatureVerifier* verifier = nullptr);
     std::shared_ptr<Tx>                     insertNewTx_unwrapped(const Coin::Transaction& cointx, std::shared_ptr<BlockHeader> blockheader = nullptr, bool verifysigs = false, bool isCoinbase = false);
     std::shared_ptr<Tx>                     insertMerkleTx_unwrapped(const ChainMerkleBlock& chainmerkleblock, const Coin::Transaction& cointx, unsigned int txindex, unsigned int txcount, bool verifysigs = false, bool isCoinbase = false);
     std::shared_ptr<Tx>                     confirmMerkleTx_unwrapped(const ChainMerkleBlock& chainmerkleblock, const bytes_t& txhash, unsigned int txindex, unsigned int txcount);
@@ -353,7 +420,9 @@ protected:
     std::shared_ptr<Tx>                     createTx_unwrapped(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, txouts_t txouts, uint64_t fee, unsigned int maxchangeouts = 1);
     std::shared_ptr<Tx>                     createTx_unwrapped(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee, uint32_t min_confirmations);
     std::shared_ptr<Tx>                     createTx_unwrapped(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, uint64_t fee, uint32_t min_confirmations);
-    txs_t                                   consolidateTxOuts_unwrapped(const std::string& account_name, uint32_t max_tx_size /* in bytes */, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, uint64_t min_fee, uint32_t min_confirmations);
+    std::shared_ptr<Tx>                     createTx_unwrapped(const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, const CoinSelectionParams& params);
+    std::shared_ptr<Tx>                     createTx_unwrapped(const std::string& username, const std::string& account_name, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, txouts_t txouts, const CoinSelectionParams& params);
+    txs_t                                   consolidateTxOuts_unwrapped(const std::string& account_name, uint32_t max_tx_size /* in vbytes */, uint32_t tx_version, uint32_t tx_locktime, ids_t coin_ids, const bytes_t& txoutscript, const CoinSelectionParams& params);
     void                                    deleteTx_unwrapped(std::shared_ptr<Tx> tx);
     void                                    updateTx_unwrapped(std::shared_ptr<Tx> tx);
     SigningRequest                          getSigningRequest_unwrapped(std::shared_ptr<Tx> tx, bool include_raw_tx = false) const;
@@ -371,6 +440,8 @@ protected:
     // SIGNINGSCRIPT OPERATIONS //
     //////////////////////////////
     std::shared_ptr<SigningScript>          getSigningScript_unwrapped(const bytes_t& script) const;
+    void                                    persistSigningScript_unwrapped(std::shared_ptr<SigningScript> script);
+    void                                    persistSigningScripts_unwrapped(const SigningScriptVector& scripts);
 
     ///////////////////////////
     // BLOCKCHAIN OPERATIONS //
@@ -416,8 +487,53 @@ private:
     mutable boost::mutex mutex;
     std::shared_ptr<odb::core::database> db_;
     std::string name_;
+    CoinQ::CoinParams coinParams_;
 
     mutable std::map<std::string, secure_bytes_t> mapPrivateKeyUnlock;
+
+    // Hashes of the keychains this vault has unlocked, by name. Their cached private derivation nodes are discarded
+    // when they are locked.
+    mutable std::map<std::string, bytes_t> mapUnlockedKeychainHash;
+
+    // Open sync batch, if any. Made current only for the duration of each batched call so it can be used from any thread.
+    std::shared_ptr<odb::core::session> syncBatchSession_;
+    std::shared_ptr<odb::core::transaction> syncBatchTransaction_;
+    std::shared_ptr<Signals::SignalQueue> syncBatchSignalQueue_;
+
+    // Set for a nested write whose failure the caller only reports, so that the failure clears no other notifications.
+    std::shared_ptr<Signals::SignalQueue> nestedSignalQueue_;
+
+    // Queue for the notifications of the current write: the nested write's own queue while one is set, the batch's queue
+    // during a batched call, signalQueue otherwise.
+    Signals::SignalQueue& pendingSignalQueue_unwrapped();
+    void endSyncBatch_unwrapped(bool committed);
+
+    // Bloom filter elements, loaded from the database once and then maintained as scripts and outpoints are added.
+    // Elements from rolled back transactions and spent outpoints are not removed - they only add false positives. Rolling back
+    // a sync batch reloads them all.
+    mutable bool bloomElementsLoaded_;
+    mutable std::set<bytes_t> bloomElements_;
+    mutable std::vector<bytes_t> newBloomElements_;
+    mutable Coin::BloomFilter bloomFilter_;
+    mutable uint32_t bloomFilterCapacity_;
+    mutable double bloomFilterFalsePositiveRate_;
+
+    // Scripts and hashes checked for every transaction we are sent, loaded from the database once and then maintained
+    // as they are added so transactions that are not ours can be rejected without queries. Nothing is ever removed,
+    // so a miss is definitive while a hit still has to be confirmed by the database.
+    typedef std::unordered_set<bytes_t, boost::hash<bytes_t>> bytes_set_t;
+    mutable bool ownershipIndexLoaded_;
+    mutable bytes_set_t txInScriptIndex_;
+    mutable bytes_set_t txOutScriptIndex_;
+    mutable bytes_set_t txHashIndex_;
+    mutable bytes_set_t txInOutHashIndex_;
+
+    // Outputs whose AccountBalance bucket may have changed within the current write, and the pending
+    // change to each (account, tx status, height) bucket.
+    typedef std::set<std::shared_ptr<TxOut>> dirty_txouts_t;
+    typedef std::map<std::tuple<unsigned long, uint32_t, uint32_t>, int64_t> balance_deltas_t;
+    dirty_txouts_t dirtyBalanceTxOuts_;
+    balance_deltas_t balanceDeltas_;
 };
 
 }
@@ -0,0 +1,144 @@
+#include <CoinSelection.h>
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace CoinDB;
+using namespace std;
+
+// Log-uniform values between 1000 and 10 BTC, like a payout account that receives many small deposits.
+vector<uint64_t> create_pool(size_t count, mt19937_64& rng)
+{
+    uniform_real_distribution<double> exponent(3.0, 9.0);
+    vector<uint64_t> values(count);
+    for (auto& value: values) { value = (uint64_t)pow(10.0, exponent(rng)); }
+    return values;
+}
+
+// Previous behavior: shuffle, take coins until the target is reached. The fee is what the
+// resulting transaction would need at the same fee rate.
+bool reference_select(const vector<uint64_t>& values, const TxSizeModel& model, uint64_t fee_rate, uint64_t payment, mt19937_64& rng, CoinSelection& selection)
+{
+    vector<size_t> order(values.size());
+    for (size_t i = 0; i < order.size(); i++) { order[i] = i; }
+    shuffle(order.begin(), order.end(), rng);
+
+    selection = CoinSelection();
+    vector<size_t> script_sizes { 23, model.changeScriptSize() };
+    for (auto i: order)
+    {
+        selection.coins.push_back(i);
+        selection.input_total += values[i];
+        selection.weight = model.txWeight(selection.coins.size(), script_sizes);
+        selection.fee = feeForWeight(selection.weight, fee_rate);
+        if (selection.input_total >= payment + selection.fee)
+        {
+            selection.change = selection.input_total - payment - selection.fee;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct result_t
+{
+    result_t() : selections(0), inputs(0), fees(0), changeouts(0), seconds(0) { }
+
+    int selections;
+    uint64_t inputs;
+    uint64_t fees;
+    int changeouts;
+    double seconds;
+};
+
+typedef function<bool(uint64_t, CoinSelection&)> select_t;
+result_t bench(const vector<uint64_t>& values, const vector<uint64_t>& payments, select_t select)
+{
+    result_t result;
+    auto start = chrono::steady_clock::now();
+    for (auto payment: payments)
+    {
+        CoinSelection selection;
+        if (!select(payment, selection)) throw runtime_error("Selection failed. TEST FAILED");
+        if (selection.input_total != payment + selection.fee + selection.change) throw runtime_error("Selection does not balance. TEST FAILED");
+
+        uint64_t total = 0;
+        for (auto i: selection.coins) { total += values[i]; }
+        if (total != selection.input_total) throw runtime_error("Selection input total mismatch. TEST FAILED");
+
+        result.selections++;
+        result.inputs += selection.coins.size();
+        result.fees += selection.fee;
+        if (selection.change) { result.changeouts++; }
+    }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+void print(const string& name, const result_t& result)
+{
+    cout << left << setw(14) << name << right << fixed
+         << setw(10) << setprecision(2) << ((double)result.inputs / result.selections)
+         << setw(12) << setprecision(0) << ((double)result.fees / result.selections)
+         << setw(10) << setprecision(1) << (100.0 * result.changeouts / result.selections) << "%"
+         << setw(12) << setprecision(2) << (result.seconds * 1000 / result.selections) << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 4)
+    {
+        cerr << "# usage: " << argv[0] << " [pool size = 100000] [payments = 100] [fee rate = 20000 satoshis/kvB]" << endl;
+        return -1;
+    }
+
+    try
+    {
+        size_t poolsize = argc > 1 ? stoul(argv[1]) : 100000;
+        int npayments = argc > 2 ? stoi(argv[2]) : 100;
+        uint64_t fee_rate = argc > 3 ? stoull(argv[3]) : 20000;
+        if (poolsize == 0 || npayments <= 0) throw runtime_error("Invalid parameters.");
+
+        mt19937_64 rng(1);
+        vector<uint64_t> values = create_pool(poolsize, rng);
+        vector<uint64_t> payments = create_pool(npayments, rng);
+
+        for (auto script_type: { TxSizeModel::P2SH, TxSizeModel::P2WSH, TxSizeModel::P2SH_P2WSH })
+        {
+            TxSizeModel model(script_type, 2, 3);
+            vector<size_t> script_sizes { 23 };
+
+            cout << (script_type == TxSizeModel::P2SH ? "P2SH" : (script_type == TxSizeModel::P2WSH ? "P2WSH" : "P2SH-P2WSH"))
+                 << " 2-of-3, " << poolsize << " coins, " << npayments << " payments, " << fee_rate << " satoshis/kvB, input vsize "
+                 << TxSizeModel::vsize(model.inputWeight()) << endl;
+            cout << left << setw(14) << "strategy" << right << setw(10) << "inputs" << setw(12) << "fee" << setw(11) << "change" << setw(12) << "ms/select" << endl;
+
+            print("random", bench(values, payments, [&](uint64_t payment, CoinSelection& selection) {
+                return reference_select(values, model, fee_rate, payment, rng, selection);
+            }));
+
+            for (auto strategy: { CoinSelectionParams::BRANCH_AND_BOUND, CoinSelectionParams::LARGEST_FIRST, CoinSelectionParams::CONSOLIDATE })
+            {
+                std::shared_ptr<CoinSelector> selector = CoinSelector::create(model, CoinSelectionParams(0, fee_rate, strategy));
+                print(CoinSelectionParams::getStrategyString(strategy), bench(values, payments, [&](uint64_t payment, CoinSelection& selection) {
+                    return selector->select(values, 0, payment, script_sizes, selection);
+                }));
+            }
+            cout << endl;
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include <Vault.h>
+
+#include <CoinCore/CoinNodeData.h>
+#include <CoinCore/MerkleTree.h>
+#include <CoinCore/random.h>
+#include <CoinQ/CoinQ_blocks.h>
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace CoinDB;
+using namespace std;
+
+const string ACCOUNT_NAME = "test";
+const uint64_t VALUE = 100000;
+
+void check(bool condition, const string& what)
+{
+    if (!condition) throw runtime_error(what + ". TEST FAILED");
+}
+
+// A tx paying value to script, spending an outpoint that is not ours.
+Coin::Transaction create_payment(const bytes_t& script, uint64_t value)
+{
+    Coin::Transaction cointx;
+    cointx.addInput(Coin::TxIn(Coin::OutPoint(random_bytes(32), 0), uchar_vector(), 0xffffffff));
+    cointx.addOutput(Coin::TxOut(value, script));
+    return cointx;
+}
+
+// A block at height containing only cointx. Blocks at the same height differ by their random merkle root.
+ChainMerkleBlock create_block(const bytes_t& prevhash, int height, const Coin::Transaction& cointx)
+{
+    vector<uchar_vector> txhashes;
+    txhashes.push_back(cointx.hash());
+    Coin::MerkleBlock merkleblock(Coin::randomPartialMerkleTree(txhashes, 2), 2, prevhash, 1400000000 + height * 600, 0x1d00ffff, 0);
+    return ChainMerkleBlock(merkleblock, true, height, 0);
+}
+
+// A block that reorganizes away a confirmed tx and whose own tx fails to insert. The failure is only reported, so
+// the tx that was unconfirmed must still be moved out of its confirmed balance and its notifications, and those
+// of the rest of the batch, must still be sent.
+void test_reorg_with_failed_insert(Vault& vault, bool batch)
+{
+    bytes_t script = vault.issueSigningScript(ACCOUNT_NAME)->txoutscript();
+    Coin::Transaction confirmed_tx = create_payment(script, VALUE);
+    Coin::Transaction failing_tx = create_payment(script, VALUE);
+
+    int inserted = 0;
+    int updated = 0;
+    int errors = 0;
+    vault.subscribeTxInserted([&](shared_ptr<Tx> tx) { if (tx->hash() == confirmed_tx.hash()) inserted++; });
+    vault.subscribeTxUpdated([&](shared_ptr<Tx> tx) { if (tx->hash() == confirmed_tx.hash()) updated++; });
+    vault.subscribeMerkleBlockInsertionError([&](shared_ptr<MerkleBlock>, const string&) { errors++; });
+
+    if (batch) { vault.beginSyncBatch(); }
+
+    // The block both competing blocks build on.
+    Coin::Transaction other_tx = create_payment(random_bytes(25), VALUE);
+    ChainMerkleBlock parent = create_block(random_bytes(32), 99, other_tx);
+    vault.insertMerkleTx(parent, other_tx, 0, 1);
+    bytes_t prevhash = parent.hash();
+
+    vault.insertMerkleTx(create_block(prevhash, 100, confirmed_tx), confirmed_tx, 0, 1);
+    if (!batch) { check(vault.getAccountBalance(ACCOUNT_NAME, 1) == VALUE, "Confirmed balance before the reorg is wrong"); }
+
+    vault.insertNewTxTestHook = [&](const Coin::Transaction& cointx)
+    {
+        if (cointx.hash() == failing_tx.hash()) throw runtime_error("Insertion failed by the test.");
+    };
+    vault.insertMerkleTx(create_block(prevhash, 100, failing_tx), failing_tx, 0, 1);
+    vault.insertNewTxTestHook = nullptr;
+
+    if (batch) { vault.commitSyncBatch(); }
+
+    check(vault.getAccountBalance(ACCOUNT_NAME, 1) == 0, "Unconfirmed tx is still in the confirmed balance");
+    check(vault.getAccountBalance(ACCOUNT_NAME, 0) == VALUE, "Unconfirmed tx is missing from the balance");
+    check(vault.checkAccountBalances().empty(), "Stored balances do not match the txouts");
+
+    // Inserted, confirmed, then unconfirmed by the reorg.
+    check(inserted == 1 && updated == 2, "Tx notifications were lost");
+    check(errors == 1, "Insertion failure was not notified");
+}
+
+void run(const string& dbname, bool batch)
+{
+    remove(dbname.c_str());
+
+    Vault vault(dbname, true);
+    vault.newKeychain("test", secure_random_bytes(32));
+    vault.newAccount(ACCOUNT_NAME, 1, vector<string>(1, "test"));
+
+    test_reorg_with_failed_insert(vault, batch);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        cerr << "# usage: " << argv[0] << " [dbname = vault_test.db]" << endl;
+        return -1;
+    }
+
+    try
+    {
+        string dbname = argc > 1 ? argv[1] : "vault_test.db";
+        run(dbname, false);
+        run(dbname, true);
+        cout << "TEST PASSED" << endl;
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -2;
+    }
+
+    return 0;
+}
@@ -31,6 +31,8 @@
 #include <sstream>
 #include <fstream>
 #include <ctime>
+#include <chrono>
+#include <iomanip>
 #include <functional>
 
 #include <boost/algorithm/string.hpp>
@@ -488,6 +490,31 @@ cli::result_t cmd_listaccounts(const cli::params_t& params)
     return ss.str();
 }
 
+cli::result_t cmd_checkbalances(const cli::params_t& params)
+{
+    bool repair = false;
+    if (params.size() > 1)
+    {
+        if (params[1] != "repair" && params[1] != "true") throw runtime_error("Invalid option: " + params[1] + ". Use repair to rebuild mismatched balances.");
+        repair = true;
+    }
+
+    Vault vault(g_dbuser, g_dbpasswd, params[0], false);
+    vector<string> mismatched = vault.checkAccountBalances(repair);
+
+    stringstream ss;
+    if (mismatched.empty())
+    {
+        ss << "All account balances are consistent.";
+    }
+    else
+    {
+        ss << "Balance mismatch in " << mismatched.size() << " account(s): " << stdutils::delimited_list(mismatched, ", ") << ".";
+        if (repair) { ss << endl << "Account balances rebuilt."; }
+    }
+    return ss.str();
+}
+
 cli::result_t cmd_exportaccount(const cli::params_t& params)
 {
     Vault vault(g_dbuser, g_dbpasswd, params[0], false);
@@ -747,10 +774,12 @@ cli::result_t cmd_refillaccountpool(const cli::params_t& params)
 {
     Vault vault(g_dbuser, g_dbpasswd, params[0], false);
     AccountInfo accountInfo = vault.getAccountInfo(params[1]);
-    vault.refillAccountPool(params[1]);
+    auto start = chrono::steady_clock::now();
+    uint32_t count = vault.refillAccountPool(params[1]);
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
 
     stringstream ss;
-    ss << "Refilled account pool for account " << params[1] << ".";
+    ss << "Refilled account pool for account " << params[1] << ". Created " << count << " signing scripts in " << fixed << setprecision(1) << elapsed.count() << " ms.";
     return ss.str();
 }
 
@@ -988,12 +1017,13 @@ cli::result_t cmd_createtx(const cli::params_t& params)
          
     } while (i < (params.size() - 1) && params[i].size() > MAX_VERSION_LEN);
 
-    uint64_t fee = i < params.size() ? strtoull(params[i++].c_str(), NULL, 0) : 0;
-    uint64_t min_confirmations = i < params.size() ? strtoull(params[i++].c_str(), NULL, 0) : 1;
+    string fee = i < params.size() ? params[i++] : "0";
+    uint32_t min_confirmations = i < params.size() ? strtoul(params[i++].c_str(), NULL, 0) : 1;
     uint32_t version = i < params.size() ? strtoul(params[i++].c_str(), NULL, 0) : 1;
     uint32_t locktime = i < params.size() ? strtoul(params[i++].c_str(), NULL, 0) : 0;
+    string strategy = i < params.size() ? params[i++] : "bnb";
 
-    std::shared_ptr<Tx> tx = vault.createTx(params[1], version, locktime, coin_ids, txouts, fee, min_confirmations, true);
+    std::shared_ptr<Tx> tx = vault.createTx(params[1], version, locktime, coin_ids, txouts, getCoinSelectionParams(fee, strategy, min_confirmations), true);
     return tx->toJson();
 }
 
@@ -1029,12 +1059,12 @@ cli::result_t cmd_consolidate(const cli::params_t& params)
     string account_name(params[1]);
     uint32_t max_tx_size = strtoul(params[2].c_str(), NULL, 0);
     bytes_t txoutscript = getTxOutScriptForAddress(params[3], coinParams.address_versions());
-    uint64_t min_fee = params.size() > 4 ? strtoull(params[4].c_str(), NULL, 0) : 0;
+    string fee = params.size() > 4 ? params[4] : "0";
     uint32_t min_confirmations = params.size() > 5 ? strtoul(params[5].c_str(), NULL, 0) : 1;
     uint32_t tx_version = params.size() > 6 ? strtoul(params[6].c_str(), NULL, 0) : 1;
     uint32_t tx_locktime = params.size() > 7 ? strtoul(params[7].c_str(), NULL, 0) : 0;
 
-    txs_t txs = vault.consolidateTxOuts(account_name, max_tx_size, tx_version, tx_locktime, ids_t(), txoutscript, min_fee, min_confirmations, false);
+    txs_t txs = vault.consolidateTxOuts(account_name, max_tx_size, tx_version, tx_locktime, ids_t(), txoutscript, getCoinSelectionParams(fee, "consolidate", min_confirmations), false);
 
     stringstream ss;
     for (auto& tx: txs) { ss << uchar_vector(tx->raw()).getHex() << endl; }
@@ -1454,6 +1484,12 @@ int main(int argc, char* argv[])
         "listaccounts",
         "display list of accounts",
         command::params(1, "db file")));
+    shell.add(command(
+        &cmd_checkbalances,
+        "checkbalances",
+        "compare stored account balances against unspent outputs",
+        command::params(1, "db file"),
+        command::params(1, "repair")));
     shell.add(command(
         &cmd_exportaccount,
         "exportaccount",
@@ -1587,7 +1623,7 @@ int main(int argc, char* argv[])
         "createtx",
         "create a new transaction",
         command::params(5, "db file", "account name", "txout index list", "address 1", "value 1"),
-        command::params(7, "address 2", "value 2", "...", "fee = 0", "min confirmations = 1", "version = 1", "locktime = 0")));
+        command::params(8, "address 2", "value 2", "...", "fee or fee rate/kb = 0", "min confirmations = 1", "version = 1", "locktime = 0", "selection = bnb|largest|consolidate")));
     shell.add(command(
         &cmd_deletetx,
         "deletetx",
@@ -1597,8 +1633,8 @@ int main(int argc, char* argv[])
         &cmd_consolidate,
         "consolidate",
         "consolidate transaction outputs",
-        command::params(4, "db file", "account name", "max tx size(bytes)", "address"),
-        command::params(4, "min fee = 0", "min confirmations = 1", "version = 1", "locktime = 0")));
+        command::params(4, "db file", "account name", "max tx size(vbytes)", "address"),
+        command::params(4, "fee per tx or fee rate/kb = 0", "min confirmations = 1", "version = 1", "locktime = 0")));
     shell.add(command(
         &cmd_signingrequest,
         "signingrequest",
@@ -16,6 +16,9 @@
 const double DEFAULT_FILTER_FALSE_POSITIVE_RATE = 0.001;
 const uint32_t DEFAULT_FILTER_TWEAK = 0;
 const uint8_t DEFAULT_FILTER_FLAGS = 0;
+const unsigned int DEFAULT_SYNC_BLOCK_WINDOW = 64;
+const unsigned int DEFAULT_SYNC_BATCH_BLOCKS = 100;
+const unsigned int DEFAULT_SYNC_BATCH_MILLISECONDS = 2000;
 
 class SyncDBConfig : public CoinDBConfig
 {
@@ -27,11 +30,19 @@ public:
     double getFilterFalsePositiveRate() const { return m_filterFalsePositiveRate; }
     uint32_t getFilterTweak() const { return m_filterTweak; }
     uint8_t getFilterFlags() const { return m_filterFlags; }
+    unsigned int getBlockWindow() const { return m_blockWindow; }
+    unsigned int getBatchBlocks() const { return m_batchBlocks; }
+    unsigned int getBatchMilliseconds() const { return m_batchMilliseconds; }
+    bool getMapHeaders() const { return m_vm.count("mapheaders") > 0; }
+    bool getJournalHeaders() const { return m_vm.count("nojournal") == 0; }
 
 protected:
     double m_filterFalsePositiveRate;
     uint32_t m_filterTweak;
     uint8_t m_filterFlags;
+    unsigned int m_blockWindow;
+    unsigned int m_batchBlocks;
+    unsigned int m_batchMilliseconds;
 };
 
 inline SyncDBConfig::SyncDBConfig() : CoinDBConfig()
@@ -42,6 +53,11 @@ inline SyncDBConfig::SyncDBConfig() : CoinDBConfig()
         ("filterfpr", po::value<double>(&m_filterFalsePositiveRate), "filter false positive rate")
         ("filtertweak", po::value<uint32_t>(&m_filterTweak), "filter tweak")
         ("filterflags", po::value<uint8_t>(&m_filterFlags), "filter flags")
+        ("blockwindow", po::value<unsigned int>(&m_blockWindow), "number of filtered blocks to keep in flight during sync")
+        ("batchblocks", po::value<unsigned int>(&m_batchBlocks), "maximum number of blocks to store per database commit during sync")
+        ("batchms", po::value<unsigned int>(&m_batchMilliseconds), "maximum time in milliseconds to keep a database commit open during sync")
+        ("mapheaders", "keep block headers in a memory-mapped file instead of in memory")
+        ("nojournal", "rewrite the whole block tree file on every flush instead of appending to a journal")
     ;
 }
 
@@ -52,6 +68,9 @@ inline bool SyncDBConfig::parseParams(int argc, char* argv[])
     if (!m_vm.count("filterfpr"))   { m_filterFalsePositiveRate = DEFAULT_FILTER_FALSE_POSITIVE_RATE; }
     if (!m_vm.count("filtertweak")) { m_filterTweak = DEFAULT_FILTER_TWEAK; }
     if (!m_vm.count("filterflags")) { m_filterFlags = DEFAULT_FILTER_FLAGS; }
+    if (!m_vm.count("blockwindow")) { m_blockWindow = DEFAULT_SYNC_BLOCK_WINDOW; }
+    if (!m_vm.count("batchblocks")) { m_batchBlocks = DEFAULT_SYNC_BATCH_BLOCKS; }
+    if (!m_vm.count("batchms"))     { m_batchMilliseconds = DEFAULT_SYNC_BATCH_MILLISECONDS; }
 
     return true;
 }
@@ -48,6 +48,13 @@ void subscribeHandlers(SynchedVault& synchedVault)
         LOGGER(info) << ss.str() << endl;
         cout << ss.str() << endl;
         if (status == SynchedVault::STOPPED) { g_bShutdown = true; }
+        if (status == SynchedVault::SYNCHED)
+        {
+            stringstream rate;
+            rate << "Block sync rate: " << synchedVault.getBlockSyncRate() << " blocks/s";
+            LOGGER(info) << rate.str() << endl;
+            cout << rate.str() << endl;
+        }
     });
 
     synchedVault.subscribeTxInserted([](std::shared_ptr<Tx> tx)
@@ -179,6 +186,10 @@ int main(int argc, char* argv[])
     SynchedVault synchedVault(coinParams);
     LOGGER(trace) << "bar" << endl;
     subscribeHandlers(synchedVault);
+    synchedVault.setBlockWindowSize(config.getBlockWindow());
+    synchedVault.setSyncBatchParams(config.getBatchBlocks(), config.getBatchMilliseconds());
+    synchedVault.enableMappedBlockTree(config.getMapHeaders());
+    synchedVault.enableBlockTreeJournal(config.getJournalHeaders());
 
     try
     {
@@ -188,7 +199,7 @@ int main(int argc, char* argv[])
 
         cout << "Loading block tree " << blocktreefile << "..." << endl;
         LOGGER(info) << "Loading block tree " << blocktreefile << endl;
-        synchedVault.loadHeaders(blocktreefile, false, [&](const CoinQBlockTreeMem& blockTree) {
+        synchedVault.loadHeaders(blocktreefile, false, [&](const ICoinQBlockTree& blockTree) {
             cout << "  " << blockTree.getBestHash().getHex() << " height: " << blockTree.getBestHeight() << endl;
             return !g_bShutdown;
         });
@@ -209,7 +220,11 @@ int main(int argc, char* argv[])
            << "  host:             " << host << endl
            << "  port:             " << port << endl
            << "  magic bytes:      " << hex << coinParams.magic_bytes() << endl
-           << "  protocol version: " << dec << coinParams.protocol_version() << endl;
+           << "  protocol version: " << dec << coinParams.protocol_version() << endl
+           << "  block window:     " << synchedVault.getBlockWindowSize() << endl
+           << "  commit batch:     " << synchedVault.getSyncBatchBlocks() << " blocks / " << synchedVault.getSyncBatchMilliseconds() << " ms" << endl
+           << "  header store:     " << (synchedVault.isMappedBlockTreeEnabled() ? "mapped" : "memory") << endl
+           << "  header journal:   " << (synchedVault.isBlockTreeJournalEnabled() ? "enabled" : "disabled") << endl;
 
         LOGGER(info) << ss.str() << endl;
         cout << ss.str() << endl;
@@ -0,0 +1,233 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// message framing replay benchmark
+//
+// main.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include <CoinQ_framer.h>
+
+#include <CoinCore/CoinNodeData.h>
+#include <CoinCore/numericdata.h>
+#include <CoinCore/random.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace CoinQ;
+using namespace Coin;
+using namespace std;
+
+const uint32_t DEFAULT_MAGIC_BYTES = 0xd9b4bef9;
+
+typedef map<string, uint64_t> command_counts_t;
+
+// Framing as Peer::do_read used to do it: append each read to a vector, search it for the magic bytes,
+// decode from the vector, check the checksum on the decoded message and shift the rest of the vector down.
+class LegacyFramer
+{
+public:
+    LegacyFramer(uint32_t magic_bytes) : magic_bytes_vector_(uint_to_vch(magic_bytes, LITTLE_ENDIAN_)) { }
+
+    void read(const unsigned char* data, size_t len, command_counts_t& counts)
+    {
+        read_message += uchar_vector(data, len);
+
+        while (true)
+        {
+            if (read_message.size() < MIN_MESSAGE_HEADER_SIZE) break;
+
+            uchar_vector::iterator it = search(read_message.begin(), read_message.end(), magic_bytes_vector_.begin(), magic_bytes_vector_.end());
+            if (it == read_message.end())
+            {
+                read_message.clear();
+                break;
+            }
+
+            read_message.assign(it, read_message.end());
+            if (read_message.size() < MIN_MESSAGE_HEADER_SIZE) break;
+
+            unsigned int payloadSize = vch_to_uint<uint32_t>(uchar_vector(read_message.begin() + 16, read_message.begin() + 20), LITTLE_ENDIAN_);
+            if (read_message.size() < MIN_MESSAGE_HEADER_SIZE + payloadSize) break;
+
+            try
+            {
+                CoinNodeMessage peerMessage(read_message);
+                if (!peerMessage.isChecksumValid()) throw runtime_error("Invalid checksum.");
+                counts[peerMessage.getCommand()]++;
+            }
+            catch (const exception& e)
+            {
+                counts["error"]++;
+            }
+
+            read_message.assign(read_message.begin() + MIN_MESSAGE_HEADER_SIZE + payloadSize, read_message.end());
+        }
+    }
+
+private:
+    uchar_vector magic_bytes_vector_;
+    uchar_vector read_message;
+};
+
+void frame(MessageFramer& framer, const unsigned char* data, size_t len, command_counts_t& counts)
+{
+    while (len > 0)
+    {
+        size_t n = framer.write(data, len);
+        data += n;
+        len -= n;
+
+        while (true)
+        {
+            MessageFramer::Message message;
+            try
+            {
+                if (!framer.next(message)) break;
+                CoinNodeMessage peerMessage(message.header, message.payload);
+                counts[peerMessage.getCommand()]++;
+            }
+            catch (const exception& e)
+            {
+                counts["error"]++;
+            }
+        }
+    }
+}
+
+// A sync session: handshake, header batches, full blocks and relayed transactions with their inventories.
+Transaction create_tx(int ninputs)
+{
+    Transaction tx;
+    for (int i = 0; i < ninputs; i++) { tx.addInput(TxIn(OutPoint(random_bytes(32), i), random_bytes(107), 0xffffffff)); }
+    tx.addOutput(TxOut(100000, random_bytes(25)));
+    tx.addOutput(TxOut(200000, random_bytes(25)));
+    return tx;
+}
+
+uchar_vector create_stream(uint32_t magic_bytes)
+{
+    uchar_vector stream;
+    auto append = [&](CoinNodeStructure& payload) { stream += CoinNodeMessage(magic_bytes, &payload).getSerialized(); };
+
+    NetworkAddress address;
+    VersionMessage version(70015, 1, 1400000000, address, address, 1, "/replay/", 0);
+    append(version);
+    VerackMessage verack;
+    append(verack);
+
+    uchar_vector prevBlockHash = g_zero32bytes;
+    for (int i = 0; i < 10; i++)
+    {
+        HeadersMessage headers;
+        for (int j = 0; j < 2000; j++)
+        {
+            CoinBlockHeader header(2, prevBlockHash, random_bytes(32), 1400000000 + j * 600, 0x1d00ffff, j);
+            headers.addHeader(header);
+            prevBlockHash = header.hash();
+        }
+        append(headers);
+    }
+
+    for (int i = 0; i < 10; i++)
+    {
+        CoinBlock block;
+        block.blockHeader = CoinBlockHeader(2, prevBlockHash, random_bytes(32), 1400000000 + i * 600, 0x1d00ffff, i);
+        for (int j = 0; j < 2000; j++) { block.txs.push_back(create_tx(j % 3 + 1)); }
+        block.updateMerkleRoot();
+        append(block);
+    }
+
+    for (int i = 0; i < 5000; i++)
+    {
+        Transaction tx = create_tx(i % 3 + 1);
+        Inventory inv;
+        inv.addItem(InventoryItem(MSG_TX, tx.getHash()));
+        append(inv);
+        append(tx);
+    }
+
+    return stream;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 3)
+    {
+        cerr << "# usage: " << argv[0] << " [recorded stream file] [read size]" << endl
+             << "# A recorded stream is the raw bytes received from a peer. Without one a sync session is synthesized." << endl;
+        return -1;
+    }
+
+    try
+    {
+        uchar_vector stream;
+        uint32_t magic_bytes = DEFAULT_MAGIC_BYTES;
+        if (argc > 1)
+        {
+            ifstream file(argv[1], ios::binary);
+            if (!file) throw runtime_error(string("Could not open ") + argv[1]);
+            stream.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+            if (stream.size() < MIN_MESSAGE_HEADER_SIZE) throw runtime_error("Stream too short.");
+            magic_bytes = vch_to_uint<uint32_t>(&stream[0], LITTLE_ENDIAN_);
+        }
+        else
+        {
+            stream = create_stream(magic_bytes);
+        }
+
+        vector<size_t> read_sizes;
+        if (argc > 2)   { read_sizes.push_back(stoul(argv[2])); }
+        else            { read_sizes = { 1460, 16384, MessageFramer::DEFAULT_BUFFER_SIZE }; }
+
+        cout << "Replaying " << stream.size() << " bytes" << endl;
+        cout << setw(10) << "read size" << setw(10) << "messages" << setw(14) << "legacy" << setw(14) << "framer" << setw(11) << "speedup" << "  (MB/s)" << endl;
+        for (size_t read_size: read_sizes)
+        {
+            if (read_size == 0) throw runtime_error("Invalid read size.");
+
+            command_counts_t legacy_counts;
+            LegacyFramer legacy(magic_bytes);
+            auto start = chrono::steady_clock::now();
+            for (size_t pos = 0; pos < stream.size(); pos += read_size) { legacy.read(&stream[pos], min(read_size, stream.size() - pos), legacy_counts); }
+            double legacy_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            command_counts_t framer_counts;
+            MessageFramer framer(magic_bytes);
+            start = chrono::steady_clock::now();
+            for (size_t pos = 0; pos < stream.size(); pos += read_size) { frame(framer, &stream[pos], min(read_size, stream.size() - pos), framer_counts); }
+            double framer_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            if (legacy_counts != framer_counts) throw runtime_error("Message count mismatch. TEST FAILED");
+            if (argc == 1 && framer_counts.count("error")) throw runtime_error("Decode error in synthesized stream. TEST FAILED");
+
+            uint64_t messages = 0;
+            for (auto& item: framer_counts) { messages += item.second; }
+
+            double legacy_rate = stream.size() / legacy_seconds / 1000000;
+            double framer_rate = stream.size() / framer_seconds / 1000000;
+            cout << setw(10) << read_size << setw(10) << messages << fixed << setprecision(2) << setw(14) << legacy_rate << setw(14) << framer_rate
+                 << setw(10) << (framer_rate / legacy_rate) << "x" << endl;
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,337 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// multi-peer block sync example program
+//
+// main.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+// Syncs a synthesized chain from scripted peer stubs on localhost: one peer answers normally, one is slow,
+// one stops answering block requests partway through and one answers normally. The blocks must be delivered
+// exactly once and in order, and the stalling peer's blocks must be reassigned.
+
+#include <CoinQ/CoinQ_netsync.h>
+#include <CoinQ/CoinQ_coinparams.h>
+#include <CoinQ/CoinQ_framer.h>
+
+#include <CoinCore/CoinNodeData.h>
+#include <CoinCore/MerkleTree.h>
+#include <CoinCore/hash.h>
+#include <CoinCore/random.h>
+
+#include <logger/logger.h>
+
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace CoinQ;
+using namespace Coin;
+using namespace std;
+
+const uint32_t MAGIC_BYTES = 0xdab5bffa;
+const uint32_t PROTOCOL_VERSION = 70015;
+const uint32_t BITS = 0x207fffff;
+
+void mine(CoinBlockHeader& header)
+{
+    while (BigInt(header.getPOWHashLittleEndian()) > header.getTarget()) { header.incrementNonce(); }
+}
+
+Transaction create_tx()
+{
+    Transaction tx;
+    tx.addInput(TxIn(OutPoint(random_bytes(32), 0), random_bytes(107), 0xffffffff));
+    tx.addOutput(TxOut(100000, random_bytes(25)));
+    return tx;
+}
+
+vector<CoinBlock> create_chain(int nblocks)
+{
+    vector<CoinBlock> chain(nblocks + 1);
+    chain[0].blockHeader = CoinBlockHeader(1, g_zero32bytes, g_zero32bytes, 1400000000, BITS, 0);
+    mine(chain[0].blockHeader);
+    for (int i = 1; i <= nblocks; i++)
+    {
+        CoinBlock& block = chain[i];
+        block.blockHeader = CoinBlockHeader(2, chain[i - 1].blockHeader.hash(), g_zero32bytes, 1400000000 + i * 600, BITS, 0);
+        for (int j = 0; j <= i % 3; j++) { block.txs.push_back(create_tx()); }
+        block.updateMerkleRoot();
+        mine(block.blockHeader);
+    }
+    return chain;
+}
+
+// Serves the chain to one connection. Every transaction matches the filter.
+class StubPeer
+{
+public:
+    StubPeer(const vector<CoinBlock>& chain, unsigned int blockDelayMs, int stallAfter)
+        : chain_(chain), blockDelayMs_(blockDelayMs), stallAfter_(stallAfter), blocksServed_(0), acceptor_(io_service_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)), socket_(io_service_)
+    {
+        for (size_t i = 0; i < chain_.size(); i++) { heights_[chain_[i].blockHeader.hash()] = i; }
+        thread_ = thread([this]() { run(); });
+    }
+
+    ~StubPeer()
+    {
+        boost::system::error_code ec;
+        acceptor_.close(ec);
+        socket_.close(ec);
+        thread_.join();
+    }
+
+    string port() const { return to_string(acceptor_.local_endpoint().port()); }
+    int blocksServed() const { return blocksServed_; }
+
+private:
+    const vector<CoinBlock>& chain_;
+    unsigned int blockDelayMs_;
+    int stallAfter_;
+    atomic<int> blocksServed_;
+    map<bytes_t, int> heights_;
+
+    io_service_t io_service_;
+    tcp::acceptor acceptor_;
+    tcp::socket socket_;
+    thread thread_;
+
+    void send(CoinNodeStructure& payload)
+    {
+        uchar_vector data = CoinNodeMessage(MAGIC_BYTES, &payload).getSerialized();
+        boost::asio::write(socket_, boost::asio::buffer(data));
+    }
+
+    void run()
+    {
+        boost::system::error_code ec;
+        acceptor_.accept(socket_, ec);
+        if (ec) return;
+
+        MessageFramer framer(MAGIC_BYTES);
+        while (true)
+        {
+            size_t n = socket_.read_some(boost::asio::buffer(framer.readBuffer(), framer.readBufferSize()), ec);
+            if (ec) return;
+            framer.commit(n);
+
+            MessageFramer::Message message;
+            while (framer.next(message))
+            {
+                try
+                {
+                    handle(CoinNodeMessage(message.header, message.payload));
+                }
+                catch (const exception& e)
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+    void handle(const CoinNodeMessage& message)
+    {
+        string command = message.getCommand();
+        if (command == "version")
+        {
+            NetworkAddress address;
+            address.set(NODE_NETWORK, Peer::DEFAULT_Ipv6, 0);
+            VersionMessage version(PROTOCOL_VERSION, NODE_NETWORK, time(NULL), address, address, getRandomNonce64(), "/stub/", chain_.size() - 1, true);
+            send(version);
+            VerackMessage verack;
+            send(verack);
+        }
+        else if (command == "getheaders")
+        {
+            GetHeadersMessage* pGetHeaders = static_cast<GetHeadersMessage*>(message.getPayload());
+            int height = 0;
+            for (auto& hash: pGetHeaders->blockLocatorHashes)
+            {
+                auto it = heights_.find(hash);
+                if (it != heights_.end()) { height = it->second; break; }
+            }
+
+            HeadersMessage headers;
+            for (size_t i = height + 1; i < chain_.size() && headers.headers.size() < 2000; i++) { headers.addHeader(chain_[i].blockHeader); }
+            send(headers);
+        }
+        else if (command == "getdata")
+        {
+            GetDataMessage* pGetData = static_cast<GetDataMessage*>(message.getPayload());
+            for (auto& item: pGetData->items)
+            {
+                auto it = heights_.find(uchar_vector(item.hash, 32));
+                if (it == heights_.end()) continue;
+                if (stallAfter_ >= 0 && blocksServed_ >= stallAfter_) return;
+                if (blockDelayMs_) { this_thread::sleep_for(chrono::milliseconds(blockDelayMs_)); }
+
+                const CoinBlock& block = chain_[it->second];
+                if ((item.itemType & ~MSG_WITNESS_FLAG) == MSG_BLOCK)
+                {
+                    CoinBlock copy(block);
+                    send(copy);
+                }
+                else
+                {
+                    vector<MerkleLeaf> leaves;
+                    for (auto& tx: block.txs) { leaves.push_back(make_pair(tx.hash().getReverse(), true)); }
+                    PartialMerkleTree tree(leaves);
+
+                    MerkleBlock merkleBlock;
+                    merkleBlock.blockHeader = block.blockHeader;
+                    merkleBlock.nTxs = tree.getNTxs();
+                    merkleBlock.hashes = tree.getMerkleHashesVector();
+                    merkleBlock.flags = tree.getFlags();
+                    send(merkleBlock);
+
+                    for (auto& tx: block.txs)
+                    {
+                        Transaction copy(tx);
+                        send(copy);
+                    }
+                }
+                blocksServed_++;
+            }
+        }
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        cerr << "# usage: " << argv[0] << " [blocks = 500]" << endl;
+        return -1;
+    }
+
+    try
+    {
+        INIT_LOGGER("multisync.log");
+
+        int nblocks = argc > 1 ? stoi(argv[1]) : 500;
+        if (nblocks < 100) throw runtime_error("Use at least 100 blocks.");
+
+        cout << "Mining " << nblocks << " blocks..." << endl;
+        vector<CoinBlock> chain = create_chain(nblocks);
+
+        CoinParams coinParams(MAGIC_BYTES, PROTOCOL_VERSION, "18444", 0x6f, 0xc4, 0xc4, 0x03, 0x28, 0xef, "regtest", "bitcoin", 100000000, "testBTC", 21000000, 1000, &sha256_2, &sha256_2, chain[0].blockHeader);
+
+        StubPeer primary(chain, 0, -1);
+        StubPeer slow(chain, 20, -1);
+        StubPeer stalling(chain, 0, 20);
+        StubPeer fast(chain, 0, -1);
+
+        mutex m;
+        condition_variable cond;
+        bool bHeadersSynched = false;
+        bool bBlocksSynched = false;
+        int nextHeight = 1;
+        size_t nextTx = 0;
+        string error;
+
+        char blockTreeFile[] = "/tmp/multisync_blocktree_XXXXXX";
+        close(mkstemp(blockTreeFile));
+        remove(blockTreeFile);
+
+        Network::NetworkSync networkSync(coinParams);
+        networkSync.enableBlockTreeJournal(false);
+        networkSync.loadHeaders(blockTreeFile, false);
+        networkSync.setBlockWindowSize(64);
+        networkSync.setBlockRangeSize(8);
+        networkSync.setPeerStallTimeout(2);
+
+        networkSync.subscribeHeadersSynched([&]()
+        {
+            lock_guard<mutex> lock(m);
+            bHeadersSynched = true;
+            cond.notify_all();
+        });
+
+        networkSync.subscribeBlocksSynched([&]()
+        {
+            lock_guard<mutex> lock(m);
+            bBlocksSynched = true;
+            cond.notify_all();
+        });
+
+        networkSync.subscribeMerkleTx([&](const ChainMerkleBlock& merkleBlock, const Transaction& tx, unsigned int txIndex, unsigned int txCount)
+        {
+            lock_guard<mutex> lock(m);
+            if (!error.empty()) return;
+
+            const CoinBlock& block = chain[nextHeight];
+            if (merkleBlock.height != nextHeight || merkleBlock.hash() != block.blockHeader.hash() || txIndex != nextTx || txCount != block.txs.size() || tx.hash() != block.txs[txIndex].hash())
+            {
+                error = "Expected tx " + to_string(nextTx) + " of block " + to_string(nextHeight) + ", got tx " + to_string(txIndex) + " of block " + to_string(merkleBlock.height) + ".";
+                return;
+            }
+
+            if (++nextTx == txCount)
+            {
+                nextHeight++;
+                nextTx = 0;
+            }
+        });
+
+        networkSync.addSyncPeer("127.0.0.1", slow.port());
+        networkSync.addSyncPeer("127.0.0.1", stalling.port());
+        networkSync.addSyncPeer("127.0.0.1", fast.port());
+        networkSync.start("127.0.0.1", primary.port());
+
+        {
+            unique_lock<mutex> lock(m);
+            if (!cond.wait_for(lock, chrono::seconds(30), [&]() { return bHeadersSynched; })) throw runtime_error("Timed out synching headers.");
+        }
+
+        cout << "Synched " << networkSync.getBestHeight() << " headers." << endl;
+        if (networkSync.getBestHeight() != nblocks) throw runtime_error("Wrong best height.");
+
+        // Let the sync peers finish their handshakes.
+        this_thread::sleep_for(chrono::milliseconds(500));
+        networkSync.syncBlocks(1);
+
+        {
+            unique_lock<mutex> lock(m);
+            if (!cond.wait_for(lock, chrono::seconds(60), [&]() { return bBlocksSynched || !error.empty(); })) throw runtime_error("Timed out synching blocks.");
+            if (!error.empty()) throw runtime_error(error);
+            if (nextHeight != nblocks + 1) throw runtime_error("Blocks synched at height " + to_string(nextHeight - 1) + ".");
+        }
+
+        cout << "Synched " << networkSync.getBlocksSynchedCount() << " blocks at " << fixed << setprecision(2) << networkSync.getBlockSyncRate() << " blocks/s." << endl << endl;
+
+        vector<Network::SyncPeerStats> stats = networkSync.getSyncPeerStats();
+        networkSync.stop();
+        remove(blockTreeFile);
+
+        cout << left << setw(18) << "peer" << right << setw(10) << "blocks" << setw(12) << "bytes" << setw(8) << "stalls" << setw(12) << "blocks/s" << endl;
+        for (auto& peer: stats)
+        {
+            cout << left << setw(18) << peer.name << right << setw(10) << peer.blocksReceived << setw(12) << peer.bytesReceived << setw(8) << peer.stalls << setw(12) << peer.blockRate << endl;
+            if (peer.name == "127.0.0.1:" + stalling.port() && peer.stalls == 0) throw runtime_error("Stalled peer was not detected.");
+        }
+
+        cout << endl << "TEST PASSED" << endl;
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl << "TEST FAILED" << endl;
+        return -2;
+    }
+
+    return 0;
+}
@@ -70,7 +70,7 @@ int main(int argc, char* argv[])
         unsigned int blockTxIndex = 0;
 
         Network::NetworkSync networkSync(coinParams);
-        networkSync.loadHeaders("blocktree.dat", false, [&](const CoinQBlockTreeMem& blocktree) {
+        networkSync.loadHeaders("blocktree.dat", false, [&](const ICoinQBlockTree& blocktree) {
             cout << "Best height: " << blocktree.getBestHeight() << " Total work: " << blocktree.getTotalWork().getDec() << endl;
             return !g_bShutdown;
         });
@@ -29,8 +29,8 @@ BlockchainDownload::BlockchainDownload(const CoinQ::CoinParams& coinParams, bool
     m_peer(m_ioService)
 {
     // Select hash functions
-    Coin::CoinBlockHeader::setHashFunc(m_coinParams.block_header_hash_function());
-    Coin::CoinBlockHeader::setPOWHashFunc(m_coinParams.block_header_pow_hash_function());
+    m_blockTree.setHashFuncs(m_coinParams.block_header_hash_funcs());
+    m_peer.setHashFuncs(m_coinParams.block_header_hash_funcs());
 
     // Subscribe peer handlers
     m_peer.subscribeOpen([&](CoinQ::Peer& /*peer*/)
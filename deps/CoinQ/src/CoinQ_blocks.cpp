@@ -13,8 +13,379 @@
 
 #include <logger/logger.h>
 
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include <string.h>
+
 using namespace CoinQ;
 
+namespace
+{
+    const char JOURNAL_MAGIC[8] = { 'C', 'Q', 'B', 'T', 'J', 'N', 'L', 0 };
+}
+
+CoinQBlockTreeFile::CoinQBlockTreeFile(const std::string& filename, const Coin::header_hashfuncs_t& hashFuncs) : mHashFuncs(hashFuncs), mData(nullptr), mSize(0)
+{
+    using namespace boost::interprocess;
+
+    boost::filesystem::path p(filename);
+    if (!boost::filesystem::exists(p)) throw BlockTreeFileNotFoundException();
+
+    if (!boost::filesystem::is_regular_file(p)) throw BlockTreeInvalidFileTypeException();
+
+    uintmax_t fileSize = boost::filesystem::file_size(p);
+    if (fileSize % RECORD_SIZE != 0) throw BlockTreeInvalidFileLengthException();
+    if (fileSize == 0) return;
+
+    try
+    {
+        mFileMapping.reset(new file_mapping(filename.c_str(), read_only));
+        mMappedRegion.reset(new mapped_region(*mFileMapping, read_only));
+    }
+    catch (const interprocess_exception& e)
+    {
+        LOGGER(error) << "CoinQBlockTreeFile::CoinQBlockTreeFile() - " << e.what() << std::endl;
+        throw BlockTreeFailedToOpenFileForReadException();
+    }
+
+    mMappedRegion->advise(mapped_region::advice_sequential);
+    mData = (const unsigned char*)mMappedRegion->get_address();
+    mSize = fileSize / RECORD_SIZE;
+}
+
+CoinQBlockTreeFile::~CoinQBlockTreeFile()
+{
+}
+
+Coin::CoinBlockHeader CoinQBlockTreeFile::getHeader(size_t i) const
+{
+    Coin::CoinBlockHeader header;
+    header.setHashFuncs(mHashFuncs);
+    std::size_t pos = 0;
+    header.setSerialized(getHeaderBytes(i), MIN_COIN_BLOCK_HEADER_SIZE, pos);
+    return header;
+}
+
+void CoinQBlockTreeFile::validate(bool bCheckProofOfWork, int checkpointHeight, const uchar_vector& checkpointHash, unsigned int nThreads, std::function<bool()> callback)
+{
+    mHashes.assign(mSize * 32, 0);
+    if (mSize == 0) return;
+
+    if (nThreads == 0) { nThreads = std::max(std::thread::hardware_concurrency(), 1u); }
+
+    // Assume the checkpoint matches so the trusted records only have to be hashed.
+    size_t powBegin = mSize;
+    if (bCheckProofOfWork) { powBegin = checkpointHeight > 0 ? (size_t)checkpointHeight + 1 : 1; }
+    processRecords(0, mSize, true, powBegin, nThreads, callback);
+
+    if (checkpointHeight > 0 && bCheckProofOfWork)
+    {
+        bool bCheckpointMatched = (size_t)checkpointHeight < mSize && checkpointHash.size() == 32 && !memcmp(getHash(checkpointHeight), &checkpointHash[0], 32);
+        if (!bCheckpointMatched)
+        {
+            LOGGER(debug) << "CoinQBlockTreeFile::validate() - checkpoint at height " << checkpointHeight << " not matched, checking proof of work below it." << std::endl;
+            processRecords(1, std::min(mSize, (size_t)checkpointHeight + 1), false, 1, nThreads, callback);
+        }
+    }
+}
+
+void CoinQBlockTreeFile::processRecords(size_t begin, size_t end, bool bHash, size_t powBegin, unsigned int nThreads, std::function<bool()> callback)
+{
+    const size_t CHUNK_SIZE = 4096;
+
+    std::atomic<size_t> next(begin);
+    std::atomic<bool> bAbort(false);
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    unsigned int nFinished = 0;
+    size_t errorIndex = end;
+    std::exception_ptr error;
+
+    auto worker = [&]()
+    {
+        Coin::CoinBlockHeader header;
+        header.setHashFuncs(mHashFuncs);
+
+        while (!bAbort)
+        {
+            size_t chunkBegin = next.fetch_add(CHUNK_SIZE);
+            if (chunkBegin >= end) break;
+
+            size_t chunkEnd = std::min(chunkBegin + CHUNK_SIZE, end);
+            for (size_t i = chunkBegin; i < chunkEnd && !bAbort; i++)
+            {
+                try
+                {
+                    const unsigned char* record = getHeaderBytes(i);
+                    std::size_t pos = 0;
+                    header.setSerialized(record, MIN_COIN_BLOCK_HEADER_SIZE, pos);
+
+                    if (bHash)
+                    {
+                        const uchar_vector& hash = header.hash();
+                        if (memcmp(record + MIN_COIN_BLOCK_HEADER_SIZE, &hash[0], 4)) throw BlockTreeChecksumErrorException();
+                        memcpy(&mHashes[i * 32], &hash[0], 32);
+                    }
+
+                    // Check proof of work
+                    if (i >= powBegin && BigInt(header.getPOWHashLittleEndian()) > header.getTarget())
+                        throw std::runtime_error(std::string("Block ") + uchar_vector(getHash(i), 32).getHex() + ": Header hash is too big.");
+                }
+                catch (...)
+                {
+                    // Report the error for the earliest record.
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (i < errorIndex)
+                    {
+                        errorIndex = i;
+                        error = std::current_exception();
+                    }
+                    bAbort = true;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        nFinished++;
+        cond.notify_all();
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < nThreads; i++) { threads.push_back(std::thread(worker)); }
+
+    bool bInterrupted = false;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (nFinished < nThreads)
+        {
+            if (cond.wait_for(lock, std::chrono::milliseconds(200)) == std::cv_status::timeout && callback && !bAbort)
+            {
+                lock.unlock();
+                if (!callback())
+                {
+                    bInterrupted = true;
+                    bAbort = true;
+                }
+                lock.lock();
+            }
+        }
+    }
+
+    for (auto& thread: threads) { thread.join(); }
+
+    if (bInterrupted) throw BlockTreeLoadInterruptedException();
+    if (error) std::rethrow_exception(error);
+}
+
+void ICoinQBlockTree::setHashFuncs(const Coin::header_hashfuncs_t& hashFuncs)
+{
+    if (!hashFuncs) throw std::runtime_error("ICoinQBlockTree::setHashFuncs() - missing hash functions.");
+    if (hashFuncs == mHashFuncs) return;
+    if (!isEmpty()) throw std::runtime_error("ICoinQBlockTree::setHashFuncs() - tree is not empty.");
+    mHashFuncs = hashFuncs;
+}
+
+void ICoinQBlockTree::writeFile(const std::string& filename)
+{
+    int bestHeight = getBestHeight();
+    if (bestHeight == -1) throw std::runtime_error("Tree is empty.");
+
+    // The journal can only grow the chain, a shorter best chain needs a rewrite.
+    int fromHeight = std::min(mChangedHeight, mFileBestHeight + 1);
+    unsigned int nEntries = bestHeight >= fromHeight ? bestHeight - fromHeight + 1 : 0;
+    bool bAppend = bJournalEnabled && filename == mFilename && mFileBestHeight >= 0 && bestHeight >= mFileBestHeight &&
+                   mJournalEntries + nEntries <= mJournalCompactionSize;
+
+    boost::filesystem::path journalfile(filename + ".journal");
+    if (bAppend)
+    {
+        // Make sure nobody else touched the journal and no earlier append failed midway.
+        boost::system::error_code ec;
+        uintmax_t journalSize = boost::filesystem::file_size(journalfile, ec);
+        bAppend = !ec && journalSize == CoinQBlockTreeFile::JOURNAL_HEADER_SIZE + (uintmax_t)mJournalEntries * CoinQBlockTreeFile::JOURNAL_ENTRY_SIZE;
+    }
+
+    if (!bAppend)
+    {
+        compactFile(filename);
+        return;
+    }
+
+    if (nEntries > 0)
+    {
+#ifndef _WIN32
+        std::ofstream fs(journalfile.native(), std::ios::binary | std::ios::app);
+#else
+        std::ofstream fs(filename + ".journal", std::ios::binary | std::ios::app);
+#endif
+        if (!fs.good()) throw BlockTreeFileWriteFailureException();
+
+        unsigned char entry[CoinQBlockTreeFile::JOURNAL_ENTRY_SIZE];
+        for (int height = fromHeight; height <= bestHeight; height++)
+        {
+            for (unsigned int i = 0; i < 4; i++) { entry[i] = (unsigned char)(height >> (8 * i)); }
+            getFileRecord(height, entry + 4);
+
+            fs.write((const char*)entry, CoinQBlockTreeFile::JOURNAL_ENTRY_SIZE);
+            if (fs.bad()) throw BlockTreeFileWriteFailureException();
+        }
+
+        fs.close();
+        if (fs.fail()) throw BlockTreeFileWriteFailureException();
+    }
+
+    mJournalEntries += nEntries;
+    mFileBestHeight = bestHeight;
+    mChangedHeight = INT_MAX;
+}
+
+void ICoinQBlockTree::compactFile(const std::string& filename)
+{
+    int bestHeight = getBestHeight();
+    unsigned char record[CoinQBlockTreeFile::RECORD_SIZE];
+
+    boost::filesystem::path swapfile(filename + ".swp");
+    //if (boost::filesystem::exists(swapfile)) throw BlockTreeSwapfileAlreadyExistsException();
+
+    {
+#ifndef _WIN32
+        std::ofstream fs(swapfile.native(), std::ios::binary | std::ios::trunc);
+#else
+        std::ofstream fs(filename + ".swp", std::ios::binary | std::ios::trunc);
+#endif
+
+        for (int i = 0; i <= bestHeight; i++)
+        {
+            getFileRecord(i, record);
+
+            fs.write((const char*)record, CoinQBlockTreeFile::RECORD_SIZE);
+            if (fs.bad()) throw BlockTreeFileWriteFailureException();
+        }
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::path p(filename);
+    boost::filesystem::rename(swapfile, p, ec);
+    if (!!ec) throw std::runtime_error(ec.message());
+
+    // A journal left over from a crash at this point does not match the new file and is ignored.
+    boost::filesystem::path journalfile(filename + ".journal");
+    if (bJournalEnabled)
+    {
+        unsigned char header[CoinQBlockTreeFile::JOURNAL_HEADER_SIZE];
+        memcpy(header, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        for (unsigned int i = 0; i < 4; i++) { header[8 + i] = (unsigned char)((bestHeight + 1) >> (8 * i)); }
+        memcpy(header + 12, record + MIN_COIN_BLOCK_HEADER_SIZE, 4);
+
+        boost::filesystem::path journalswapfile(filename + ".journal.swp");
+        {
+#ifndef _WIN32
+            std::ofstream fs(journalswapfile.native(), std::ios::binary | std::ios::trunc);
+#else
+            std::ofstream fs(filename + ".journal.swp", std::ios::binary | std::ios::trunc);
+#endif
+            fs.write((const char*)header, CoinQBlockTreeFile::JOURNAL_HEADER_SIZE);
+            if (fs.bad()) throw BlockTreeFileWriteFailureException();
+        }
+
+        boost::filesystem::rename(journalswapfile, journalfile, ec);
+        if (!!ec) throw std::runtime_error(ec.message());
+    }
+    else
+    {
+        boost::filesystem::remove(journalfile, ec);
+    }
+
+    mFilename = filename;
+    mFileBestHeight = bestHeight;
+    mChangedHeight = INT_MAX;
+    mJournalEntries = 0;
+}
+
+bool ICoinQBlockTree::replayJournal(const std::string& filename, bool bCheckProofOfWork)
+{
+    setFileState(filename, 0);
+
+    boost::filesystem::path journalfile(filename + ".journal");
+    if (!boost::filesystem::exists(journalfile)) return true;
+
+#ifndef _WIN32
+    std::ifstream fs(journalfile.native(), std::ios::binary);
+#else
+    std::ifstream fs(filename + ".journal", std::ios::binary);
+#endif
+
+    // The journal must have been started for this file.
+    unsigned char header[CoinQBlockTreeFile::JOURNAL_HEADER_SIZE];
+    fs.read((char*)header, CoinQBlockTreeFile::JOURNAL_HEADER_SIZE);
+    int bestHeight = getBestHeight();
+    uint32_t count = (uint32_t)header[8] | ((uint32_t)header[9] << 8) | ((uint32_t)header[10] << 16) | ((uint32_t)header[11] << 24);
+    if (!fs.good() || bestHeight == -1 || memcmp(header, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) || count != (uint32_t)bestHeight + 1 ||
+        memcmp(header + 12, &getTip().hash()[0], 4))
+    {
+        LOGGER(debug) << "ICoinQBlockTree::replayJournal() - ignoring journal that does not match " << filename << std::endl;
+        resetFileState();
+        return false;
+    }
+
+    unsigned int nEntries = 0;
+    unsigned char entry[CoinQBlockTreeFile::JOURNAL_ENTRY_SIZE];
+    Coin::CoinBlockHeader blockHeader;
+    blockHeader.setHashFuncs(mHashFuncs);
+    bool bComplete = true;
+    while (fs.read((char*)entry, CoinQBlockTreeFile::JOURNAL_ENTRY_SIZE))
+    {
+        std::size_t pos = 4;
+        blockHeader.setSerialized(entry, 4 + MIN_COIN_BLOCK_HEADER_SIZE, pos);
+        const uchar_vector& hash = blockHeader.hash();
+
+        // Stop at an entry torn by a crash.
+        if (memcmp(entry + 4 + MIN_COIN_BLOCK_HEADER_SIZE, &hash[0], 4) || !hasHeader(blockHeader.prevBlockHash()))
+        {
+            bComplete = false;
+            break;
+        }
+
+        try
+        {
+            insertHeader(blockHeader, bCheckProofOfWork, true);
+        }
+        catch (const std::exception& e)
+        {
+            throw std::runtime_error(std::string("Block ") + hash.getHex() + ": " + e.what());
+        }
+        nEntries++;
+    }
+    if (fs.gcount() != 0) { bComplete = false; }
+
+    LOGGER(debug) << "ICoinQBlockTree::replayJournal() - replayed " << nEntries << " journal entries, best height: " << getBestHeight() << std::endl;
+
+    if (!bComplete)
+    {
+        resetFileState();
+        return false;
+    }
+
+    setFileState(filename, nEntries);
+    return true;
+}
+
+void ICoinQBlockTree::setFileState(const std::string& filename, unsigned int journalEntries)
+{
+    mFilename = filename;
+    mFileBestHeight = getBestHeight();
+    mChangedHeight = INT_MAX;
+    mJournalEntries = journalEntries;
+}
+
 bool CoinQBlockTreeMem::setBestChain(ChainHeader& header)
 {
     if (header.inBestChain) return false;
@@ -42,6 +413,8 @@ bool CoinQBlockTreeMem::setBestChain(ChainHeader& header)
     mBestHeight = header.height;
     mTotalWork = header.chainWork;
 
+    bestChainChanged(newBestChain.top()->height);
+
     // Pop back up stack and make this the best chain
     int count = 0;
     while (!newBestChain.empty())
@@ -66,6 +439,8 @@ bool CoinQBlockTreeMem::unsetBestChain(ChainHeader& header)
 
     if (header.height == 0) throw std::runtime_error("Cannot remove genesis block from best chain.");
 
+    bestChainChanged(header.height);
+
     ChainHeader* pParent = &mHeaderHashMap.at(header.prevBlockHash());
     if (pParent->inBestChain)
     {
@@ -98,6 +473,13 @@ void CoinQBlockTreeMem::setGenesisBlock(const Coin::CoinBlockHeader& header)
 {
     LOGGER(trace) << "setGenesisBlock - hash: " << header.getPOWHashLittleEndian().getHex() << std::endl;
     if (mHeaderHashMap.size() != 0) throw std::runtime_error("Tree is not empty.");
+    if (header.getHashFuncs() != mHashFuncs)
+    {
+        Coin::CoinBlockHeader networkHeader(header);
+        networkHeader.setHashFuncs(mHashFuncs);
+        setGenesisBlock(networkHeader);
+        return;
+    }
 
     bFlushed = false;
     uchar_vector hash = header.hash();
@@ -109,6 +491,7 @@ void CoinQBlockTreeMem::setGenesisBlock(const Coin::CoinBlockHeader& header)
     mBestHeight = 0;
     mTotalWork = genesisHeader.chainWork;
     pHead = &genesisHeader;
+    bestChainChanged(0);
     notifyInsert(header);
     notifyAddBestChain(header);
 }
@@ -116,6 +499,12 @@ void CoinQBlockTreeMem::setGenesisBlock(const Coin::CoinBlockHeader& header)
 bool CoinQBlockTreeMem::insertHeader(const Coin::CoinBlockHeader& header, bool bCheckProofOfWork, bool bReplaceTip)
 {
     if (mHeaderHashMap.size() == 0) throw std::runtime_error("No genesis block.");
+    if (header.getHashFuncs() != mHashFuncs)
+    {
+        Coin::CoinBlockHeader networkHeader(header);
+        networkHeader.setHashFuncs(mHashFuncs);
+        return insertHeader(networkHeader, bCheckProofOfWork, bReplaceTip);
+    }
 
     uchar_vector headerHash = header.hash();
     if (hasHeader(headerHash)) return false;
@@ -180,7 +569,7 @@ bool CoinQBlockTreeMem::hasHeader(const uchar_vector& hash) const
     return (mHeaderHashMap.find(hash) != mHeaderHashMap.end());
 }
 
-const ChainHeader& CoinQBlockTreeMem::getHeader(const uchar_vector& hash) const
+ChainHeader CoinQBlockTreeMem::getHeader(const uchar_vector& hash) const
 {
     header_hash_map_t::const_iterator it = mHeaderHashMap.find(hash);
     if (it == mHeaderHashMap.end()) throw std::runtime_error("Not found.");
@@ -188,7 +577,7 @@ const ChainHeader& CoinQBlockTreeMem::getHeader(const uchar_vector& hash) const
     return it->second;
 }
 
-const ChainHeader& CoinQBlockTreeMem::getHeader(int height) const
+ChainHeader CoinQBlockTreeMem::getHeader(int height) const
 {
     if (mHeaderHeightMap.size() > 0)
     {
@@ -203,7 +592,7 @@ const ChainHeader& CoinQBlockTreeMem::getHeader(int height) const
     throw std::runtime_error("Not found.");
 }
 
-const ChainHeader& CoinQBlockTreeMem::getTip() const
+ChainHeader CoinQBlockTreeMem::getTip() const
 {
     if (!pHead) throw std::runtime_error("Tree is empty.");
 
@@ -217,7 +606,7 @@ int CoinQBlockTreeMem::getTipHeight() const
     return pHead->height;
 }
 
-const ChainHeader& CoinQBlockTreeMem::getHeaderBefore(uint32_t timestamp) const
+ChainHeader CoinQBlockTreeMem::getHeaderBefore(uint32_t timestamp) const
 {
     if (mBestHeight == -1) throw std::runtime_error("Tree is empty.");
 
@@ -264,117 +653,68 @@ int CoinQBlockTreeMem::getConfirmations(const uchar_vector& hash) const
     return mBestHeight - it->second.height + 1;
 }
 
-void CoinQBlockTreeMem::loadFromFile(const std::string& filename, bool bCheckProofOfWork, CoinQBlockTreeMem::callback_t callback)
+void CoinQBlockTreeMem::loadFromFile(const std::string& filename, bool bCheckProofOfWork, callback_t callback)
 {
-    boost::filesystem::path p(filename);
-    if (!boost::filesystem::exists(p)) throw BlockTreeFileNotFoundException();
-
-    if (!boost::filesystem::is_regular_file(p)) throw BlockTreeInvalidFileTypeException();
-
-    const unsigned int RECORD_SIZE = MIN_COIN_BLOCK_HEADER_SIZE + 4;
-    if (boost::filesystem::file_size(p) % RECORD_SIZE != 0) throw BlockTreeInvalidFileLengthException();
-
-#ifndef _WIN32
-    std::ifstream fs(p.native(), std::ios::binary);
-#else
-    std::ifstream fs(filename, std::ios::binary);
-#endif
-    if (!fs.good()) throw BlockTreeFailedToOpenFileForReadException();
+    CoinQBlockTreeFile file(filename, mHashFuncs);
 
     clear();
-    uchar_vector headerBytes;
-    uchar_vector hash;
-    Coin::CoinBlockHeader header;
+    if (file.size() == 0) return;
 
-    unsigned int count = 0;
+    // Start with the genesis block so the callback sees a valid tree while the file is being validated.
+    Coin::CoinBlockHeader header = file.getHeader(0);
+    if (memcmp(file.getHeaderBytes(0) + MIN_COIN_BLOCK_HEADER_SIZE, &header.hash()[0], 4)) throw BlockTreeChecksumErrorException();
+    setGenesisBlock(header);
+    if (callback && !callback(*this)) throw BlockTreeLoadInterruptedException();
+    LOGGER(debug) << "CoinQBlockTreeMem::loadFromFile() - genesis hash: " << header.hash().getHex() << std::endl;
 
-    char buf[RECORD_SIZE * 64];
-    while (fs)
-    {
-        fs.read(buf, RECORD_SIZE * 64);
-        if (fs.bad()) throw BlockTreeFileReadFailureException();
+    file.validate(bCheckProofOfWork, mCheckpointHeight, mCheckpointHash, mLoadThreads, [&]() { return !callback || callback(*this); });
 
-        unsigned int nbytesread = fs.gcount();
-        unsigned int pos = 0;
-        for (; pos <= nbytesread - RECORD_SIZE; pos += RECORD_SIZE)
+    // The records are the best chain in order so each header extends the tip.
+    std::map<uint32_t, BigInt> work;
+    for (size_t i = 1; i < file.size(); i++)
+    {
+        std::size_t pos = 0;
+        header.setSerialized(file.getHeaderBytes(i), MIN_COIN_BLOCK_HEADER_SIZE, pos);
+        uchar_vector hash(file.getHash(i), 32);
+        if (header.prevBlockHash() != pHead->hash()) throw std::runtime_error(std::string("Block ") + hash.getHex() + ": Parent not found.");
+
+        auto it = work.find(header.bits());
+        if (it == work.end()) { it = work.insert(std::make_pair(header.bits(), header.getWork())).first; }
+
+        ChainHeader& chainHeader = mHeaderHashMap[hash] = header;
+        chainHeader.height = pHead->height + 1;
+        chainHeader.chainWork = pHead->chainWork + it->second;
+        chainHeader.inBestChain = true;
+        pHead->childHashes.insert(hash);
+        mHeaderHeightMap[chainHeader.height] = &chainHeader;
+        mBestHeight = chainHeader.height;
+        mTotalWork = chainHeader.chainWork;
+        pHead = &chainHeader;
+        notifyInsert(chainHeader);
+        notifyReorg(chainHeader);
+        notifyAddBestChain(chainHeader);
+
+        if (i % 10000 == 0)
         {
-            headerBytes.assign((unsigned char*)&buf[pos], (unsigned char*)&buf[pos + MIN_COIN_BLOCK_HEADER_SIZE]);
-            header.setSerialized(headerBytes);
-            hash = header.hash();
-            if (memcmp(&buf[pos + MIN_COIN_BLOCK_HEADER_SIZE], &hash[0], 4)) throw BlockTreeChecksumErrorException();
-
-            try
-            {
-                if (mBestHeight >= 0)
-                {
-                    insertHeader(header, bCheckProofOfWork);
-                    if (count % 10000 == 0)
-                    {
-                        if (callback && !callback(*this)) throw BlockTreeLoadInterruptedException();
-                        LOGGER(debug) << "CoinQBlockTreeMem::loadFromFile() - header hash: " << header.hash().getHex() << " height: " << count << std::endl;
-                    }
-                    count++;
-                }
-                else
-                { 
-                    setGenesisBlock(header);
-                    if (callback && !callback(*this)) throw BlockTreeLoadInterruptedException();
-                    LOGGER(debug) << "CoinQBlockTreeMem::loadFromFile() - genesis hash: " << header.hash().getHex() << std::endl;
-                    count++;
-                }
-            }
-            catch (const BlockTreeException& e)
-            {
-                throw e;
-            }
-            catch (const std::exception& e)
-            {
-                throw std::runtime_error(std::string("Block ") + hash.getHex() + ": " + e.what());
-            }
+            if (callback && !callback(*this)) throw BlockTreeLoadInterruptedException();
+            LOGGER(debug) << "CoinQBlockTreeMem::loadFromFile() - header hash: " << hash.getHex() << " height: " << i << std::endl;
         }
-
-        if (pos != nbytesread) throw BlockTreeUnexpectedEndOfFileException();
     }
 
+    bFlushed = replayJournal(filename, bCheckProofOfWork);
     if (callback) callback(*this); // No need to interrupt since we're done.
 }
 
 void CoinQBlockTreeMem::flushToFile(const std::string& filename)
 {
-    if (mBestHeight == -1) throw std::runtime_error("Tree is empty.");
-
-    boost::filesystem::path swapfile(filename + ".swp");
-    //if (boost::filesystem::exists(swapfile)) throw BlockTreeSwapfileAlreadyExistsException();
-
-    {
-#ifndef _WIN32
-        std::ofstream fs(swapfile.native(), std::ios::binary | std::ios::trunc);
-#else
-        std::ofstream fs(filename + ".swp", std::ios::binary | std::ios::trunc);
-#endif
-
-        uchar_vector headerBytes, hash;
-
-        for (int i = 0; i <= mBestHeight; i++)
-        {
-            ChainHeader* pHeader = mHeaderHeightMap.at(i);
-
-            headerBytes = pHeader->getSerialized();
-            hash = pHeader->hash();
-
-            fs.write((const char*)&headerBytes[0], MIN_COIN_BLOCK_HEADER_SIZE);
-            if (fs.bad()) throw BlockTreeFileWriteFailureException();
-
-            fs.write((const char*)&hash[0], 4);
-            if (fs.bad()) throw BlockTreeFileWriteFailureException();
-        }
-    }
-
-    boost::system::error_code ec;
-    boost::filesystem::path p(filename);
-    boost::filesystem::rename(swapfile, p, ec);
-    if (!!ec) throw std::runtime_error(ec.message());
-
+    writeFile(filename);
     bFlushed = true;
 }
 
+void CoinQBlockTreeMem::getFileRecord(int height, unsigned char* record) const
+{
+    const ChainHeader* pHeader = mHeaderHeightMap.at(height);
+    uchar_vector headerBytes = pHeader->getSerialized();
+    memcpy(record, &headerBytes[0], MIN_COIN_BLOCK_HEADER_SIZE);
+    memcpy(record + MIN_COIN_BLOCK_HEADER_SIZE, &pHeader->hash()[0], 4);
+}
@@ -20,8 +20,10 @@
 #include <set>
 #include <map>
 #include <stack>
+#include <memory>
 #include <stdexcept>
 #include <fstream>
+#include <climits>
 
 #include <assert.h>
 
@@ -79,9 +81,57 @@ typedef std::function<void(const ChainHeader&)>      chain_header_slot_t;
 typedef std::function<void(const ChainBlock&)>       chain_block_slot_t;
 typedef std::function<void(const ChainMerkleBlock&)> chain_merkle_block_slot_t;
 
+namespace boost { namespace interprocess { class file_mapping; class mapped_region; } }
+
+// Memory-mapped blocktree file. Each record is a serialized header followed by the first four bytes of its hash.
+// The journal next to it starts with a magic, the record count and the last record's checksum of the file it applies to,
+// followed by entries made of a height and a record.
+class CoinQBlockTreeFile
+{
+public:
+    enum
+    {
+        RECORD_SIZE         = MIN_COIN_BLOCK_HEADER_SIZE + 4,
+        JOURNAL_HEADER_SIZE = 16,
+        JOURNAL_ENTRY_SIZE  = 4 + RECORD_SIZE
+    };
+
+    // throws BlockTreeException if the file is missing or has an invalid length
+    explicit CoinQBlockTreeFile(const std::string& filename, const Coin::header_hashfuncs_t& hashFuncs = Coin::CoinBlockHeader::getDefaultHashFuncs());
+    ~CoinQBlockTreeFile();
+
+    size_t size() const { return mSize; }
+    const unsigned char* getHeaderBytes(size_t i) const { return mData + i * RECORD_SIZE; }
+    Coin::CoinBlockHeader getHeader(size_t i) const;
+
+    // Hashes and checks the records in chunks on nThreads threads, 0 to use all cores. Proof of work is not checked
+    // for the genesis block nor, if the record at checkpointHeight matches checkpointHash, for the records up to it.
+    // callback is polled from the calling thread and the load is interrupted if it returns false.
+    void validate(bool bCheckProofOfWork, int checkpointHeight = -1, const uchar_vector& checkpointHash = uchar_vector(), unsigned int nThreads = 0, std::function<bool()> callback = nullptr);
+
+    // hash of record i as returned by CoinBlockHeader::hash(), set by validate()
+    const unsigned char* getHash(size_t i) const { return &mHashes[i * 32]; }
+
+private:
+    std::unique_ptr<boost::interprocess::file_mapping> mFileMapping;
+    std::unique_ptr<boost::interprocess::mapped_region> mMappedRegion;
+    Coin::header_hashfuncs_t mHashFuncs;
+    const unsigned char* mData;
+    size_t mSize;
+    std::vector<unsigned char> mHashes;
+
+    void processRecords(size_t begin, size_t end, bool bHash, size_t powBegin, unsigned int nThreads, std::function<bool()> callback);
+};
+
+const unsigned int DEFAULT_BLOCKTREE_JOURNAL_COMPACTION_SIZE = 10000;
+
 class ICoinQBlockTree
 {
 public:
+    ICoinQBlockTree() : mHashFuncs(Coin::CoinBlockHeader::getDefaultHashFuncs()), mCheckpointHeight(-1), mLoadThreads(0), bJournalEnabled(false), mJournalCompactionSize(DEFAULT_BLOCKTREE_JOURNAL_COMPACTION_SIZE),
+        mFileBestHeight(-1), mChangedHeight(INT_MAX), mJournalEntries(0) { }
+    virtual ~ICoinQBlockTree() { }
+
     virtual void subscribeAddBestChain(chain_header_slot_t slot) = 0;
     virtual void subscribeRemoveBestChain(chain_header_slot_t slot) = 0;
     virtual void subscribeInsert(chain_header_slot_t slot) = 0;
@@ -103,19 +153,19 @@ public:
     // returns true if new header added, false if header already exists
     // throws runtime_error if header invalid or parent not known
 //    virtual bool insertHeader(const Coin::CoinBlockHeader& header) = 0;
-    virtual bool insertHeader(const Coin::CoinBlockHeader& header, bool bCheckProofOfWork, bool bReplaceTip) = 0;
+    virtual bool insertHeader(const Coin::CoinBlockHeader& header, bool bCheckProofOfWork = true, bool bReplaceTip = false) = 0;
 
     // returns true if header removed, false if header unknown
     virtual bool deleteHeader(const uchar_vector& hash) = 0;
  
     virtual bool hasHeader(const uchar_vector& hash) const = 0;
-    virtual const ChainHeader& getHeader(const uchar_vector& hash) const = 0;
-    virtual const ChainHeader& getHeader(int height) const = 0; // Use -1 to get top block
-    virtual const ChainHeader& getTip() const = 0;
+    virtual ChainHeader getHeader(const uchar_vector& hash) const = 0;
+    virtual ChainHeader getHeader(int height) const = 0; // Use -1 to get top block
+    virtual ChainHeader getTip() const = 0;
     virtual int getTipHeight() const = 0;
-    virtual const ChainHeader& getHeaderBefore(uint32_t timestamp) const = 0;
+    virtual ChainHeader getHeaderBefore(uint32_t timestamp) const = 0;
 
-    virtual const uchar_vector& getBestHash() const = 0;
+    virtual uchar_vector getBestHash() const = 0;
     virtual int getBestHeight() const = 0;
     virtual BigInt getTotalWork() const = 0;
 
@@ -123,6 +173,66 @@ public:
 
     virtual int getConfirmations(const uchar_vector& hash) const = 0;
     virtual void clear() = 0;
+
+    // callback is invoked periodically during load, return false to interrupt
+    typedef std::function<bool(const ICoinQBlockTree&)> callback_t;
+    virtual void loadFromFile(const std::string& filename, bool bCheckProofOfWork = true, callback_t callback = nullptr) = 0;
+    virtual void flushToFile(const std::string& filename) = 0;
+    virtual bool flushed() const = 0;
+
+    // Hash functions of the network's headers. Inserted headers are hashed with them whatever hash functions they
+    // carry, so trees of several networks can be used side by side. Throws if the tree already holds other headers.
+    void setHashFuncs(const Coin::header_hashfuncs_t& hashFuncs);
+    const Coin::header_hashfuncs_t& getHashFuncs() const { return mHashFuncs; }
+
+    // Headers up to and including the checkpoint are not checked for proof of work on load if the file matches it.
+    void setCheckpoint(int height, const uchar_vector& hash) { mCheckpointHeight = height; mCheckpointHash = hash; }
+    int getCheckpointHeight() const { return mCheckpointHeight; }
+
+    // Number of threads used to hash and check the file on load, 0 to use all cores.
+    void setLoadThreads(unsigned int nThreads) { mLoadThreads = nThreads; }
+    unsigned int getLoadThreads() const { return mLoadThreads; }
+
+    // When enabled, flushToFile appends best chain changes to a journal (filename + ".journal") instead of rewriting
+    // the whole file. Reorgs append the new branch from the fork height. The file is rewritten and the journal
+    // restarted once it holds compactionSize entries. Journals are replayed on load whether or not this is enabled.
+    void enableJournal(bool bEnable = true, unsigned int compactionSize = DEFAULT_BLOCKTREE_JOURNAL_COMPACTION_SIZE) { bJournalEnabled = bEnable; mJournalCompactionSize = compactionSize; }
+    bool isJournalEnabled() const { return bJournalEnabled; }
+
+protected:
+    Coin::header_hashfuncs_t mHashFuncs;
+    int mCheckpointHeight;
+    uchar_vector mCheckpointHash;
+    unsigned int mLoadThreads;
+
+    // serialized best chain header at height followed by the first four bytes of its hash
+    virtual void getFileRecord(int height, unsigned char* record) const = 0;
+
+    // must be called whenever the best chain header at height or above changes
+    void bestChainChanged(int height) { if (height < mChangedHeight) mChangedHeight = height; }
+
+    // writes the best chain to filename, appending to the journal if enabled
+    void writeFile(const std::string& filename);
+
+    // applies the journal after filename has been loaded, returns false if the file needs to be rewritten
+    bool replayJournal(const std::string& filename, bool bCheckProofOfWork);
+
+    // records that filename and its journal of journalEntries entries hold the current best chain
+    void setFileState(const std::string& filename, unsigned int journalEntries);
+
+    // forgets what was last written so the next write rewrites the whole file
+    void resetFileState() { mFileBestHeight = -1; mChangedHeight = INT_MAX; mJournalEntries = 0; }
+
+private:
+    bool bJournalEnabled;
+    unsigned int mJournalCompactionSize;
+
+    std::string mFilename;
+    int mFileBestHeight;        // best height stored in the file and journal, -1 if unknown
+    int mChangedHeight;         // lowest best chain height changed since the last write
+    unsigned int mJournalEntries;
+
+    void compactFile(const std::string& filename);
 };
 
 class CoinQBlockTreeMem : public ICoinQBlockTree
@@ -154,6 +264,8 @@ protected:
     bool setBestChain(ChainHeader& header);
     bool unsetBestChain(ChainHeader& header);
 
+    void getFileRecord(int height, unsigned char* record) const;
+
 public:
     CoinQBlockTreeMem(bool _bCheckTimestamp = true, bool _bCheckProofOfWork = true)
         : bFlushed(true), mBestHeight(-1), mTotalWork(0), pHead(NULL), bCheckTimestamp(_bCheckTimestamp), bCheckProofOfWork(_bCheckProofOfWork) { }
@@ -178,22 +290,21 @@ public:
     bool deleteHeader(const uchar_vector& hash);
 
     bool hasHeader(const uchar_vector& hash) const;
-    const ChainHeader& getHeader(const uchar_vector& hash) const;
-    const ChainHeader& getHeader(int height) const;
-    const ChainHeader& getTip() const;
+    ChainHeader getHeader(const uchar_vector& hash) const;
+    ChainHeader getHeader(int height) const;
+    ChainHeader getTip() const;
     int getTipHeight() const;
-    const ChainHeader& getHeaderBefore(uint32_t timestamp) const;
+    ChainHeader getHeaderBefore(uint32_t timestamp) const;
 
-    const uchar_vector& getBestHash() const { return getHeader(-1).hash(); }
+    uchar_vector getBestHash() const { return getHeader(-1).hash(); }
     int getBestHeight() const { return mBestHeight; }
     BigInt getTotalWork() const { return mTotalWork; }
 
     std::vector<uchar_vector> getLocatorHashes(int maxSize) const;
 
     int getConfirmations(const uchar_vector& hash) const;
-    void clear() { mHeaderHashMap.clear(); mHeaderHeightMap.clear(); mBestHeight = -1; mTotalWork = 0; pHead = NULL; }
+    void clear() { mHeaderHashMap.clear(); mHeaderHeightMap.clear(); mBestHeight = -1; mTotalWork = 0; pHead = NULL; resetFileState(); }
 
-    typedef std::function<bool(const CoinQBlockTreeMem&)> callback_t;
     void loadFromFile(const std::string& filename, bool bCheckProofOfWork = true, callback_t callback = nullptr); 
 
     void flushToFile(const std::string& filename);
@@ -0,0 +1,814 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinQ_blocks_mapped.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "CoinQ_blocks_mapped.h"
+
+#include <logger/logger.h>
+
+#include <algorithm>
+#include <string.h>
+
+using namespace CoinQ;
+
+namespace
+{
+    const char MAP_FILE_MAGIC[8] = { 'C', 'Q', 'B', 'T', 'M', 'A', 'P', 0 };
+    const uint32_t MAP_FILE_VERSION = 1;
+    const uint64_t INITIAL_CAPACITY = 1024;
+
+    const unsigned int TIMESTAMP_OFFSET = 68;
+}
+
+const uint32_t CoinQBlockTreeMapped::NO_RECORD;
+
+CoinQBlockTreeMapped::CoinQBlockTreeMapped(bool _bCheckTimestamp, bool _bCheckProofOfWork)
+    : bFlushed(true), bCheckTimestamp(_bCheckTimestamp), bCheckProofOfWork(_bCheckProofOfWork), mData(nullptr), mCapacity(0), mHashIndexCount(0)
+{
+    static_assert(sizeof(Record) == 160, "Unexpected record size.");
+    static_assert(sizeof(FileHeader) == 64, "Unexpected file header size.");
+
+    initStorage();
+}
+
+CoinQBlockTreeMapped::CoinQBlockTreeMapped(const Coin::CoinBlockHeader& header, bool _bCheckTimestamp, bool _bCheckProofOfWork)
+    : bFlushed(true), bCheckTimestamp(_bCheckTimestamp), bCheckProofOfWork(_bCheckProofOfWork), mData(nullptr), mCapacity(0), mHashIndexCount(0)
+{
+    initStorage();
+    setGenesisBlock(header);
+}
+
+CoinQBlockTreeMapped::~CoinQBlockTreeMapped()
+{
+    closeMapFile();
+}
+
+////////////////////////////////
+//
+// Record storage
+//
+void CoinQBlockTreeMapped::openMapFile(const std::string& filename)
+{
+    closeMapFile();
+
+    mMapFilename = filename + ".map";
+    boost::filesystem::path p(mMapFilename);
+    if (!boost::filesystem::exists(p) || boost::filesystem::file_size(p) < sizeof(FileHeader) + INITIAL_CAPACITY * sizeof(Record))
+    {
+        {
+#ifndef _WIN32
+            std::ofstream fs(p.native(), std::ios::binary | std::ios::trunc);
+#else
+            std::ofstream fs(mMapFilename, std::ios::binary | std::ios::trunc);
+#endif
+            if (!fs.good()) throw std::runtime_error("CoinQBlockTreeMapped::openMapFile() - failed to create map file.");
+        }
+        boost::filesystem::resize_file(p, sizeof(FileHeader) + INITIAL_CAPACITY * sizeof(Record));
+    }
+
+    mapRegion();
+    mDatFilename = filename;
+    mHeapStorage.clear();
+    mHeapStorage.shrink_to_fit();
+
+    const FileHeader* header = fileHeader();
+    if (memcmp(header->magic, MAP_FILE_MAGIC, sizeof(MAP_FILE_MAGIC)) || header->version != MAP_FILE_VERSION ||
+        header->recordSize != sizeof(Record) || header->count > mCapacity)
+    {
+        LOGGER(debug) << "CoinQBlockTreeMapped::openMapFile() - initializing " << mMapFilename << std::endl;
+        initFileHeader();
+    }
+}
+
+void CoinQBlockTreeMapped::closeMapFile()
+{
+    if (!mFileMapping) return;
+
+    mMappedRegion.reset();
+    mFileMapping.reset();
+    mDatFilename.clear();
+    mMapFilename.clear();
+    mData = nullptr;
+    mCapacity = 0;
+}
+
+void CoinQBlockTreeMapped::mapRegion()
+{
+    using namespace boost::interprocess;
+
+    mFileMapping.reset(new file_mapping(mMapFilename.c_str(), read_write));
+    mMappedRegion.reset(new mapped_region(*mFileMapping, read_write));
+    mData = (unsigned char*)mMappedRegion->get_address();
+    mCapacity = (mMappedRegion->get_size() - sizeof(FileHeader)) / sizeof(Record);
+}
+
+void CoinQBlockTreeMapped::initStorage()
+{
+    mHeapStorage.assign(sizeof(FileHeader) + INITIAL_CAPACITY * sizeof(Record), 0);
+    mData = &mHeapStorage[0];
+    mCapacity = INITIAL_CAPACITY;
+    initFileHeader();
+}
+
+void CoinQBlockTreeMapped::initFileHeader()
+{
+    FileHeader* header = fileHeader();
+    memset(header, 0, sizeof(FileHeader));
+    memcpy(header->magic, MAP_FILE_MAGIC, sizeof(MAP_FILE_MAGIC));
+    header->version = MAP_FILE_VERSION;
+    header->recordSize = sizeof(Record);
+    header->count = 0;
+    header->tip = NO_RECORD;
+    header->clean = 0;
+}
+
+void CoinQBlockTreeMapped::reserve(uint64_t count)
+{
+    if (count <= mCapacity) return;
+    if (count > NO_RECORD) throw std::runtime_error("CoinQBlockTreeMapped::reserve() - too many records.");
+
+    uint64_t capacity = std::max(count, mCapacity * 2);
+    if (mFileMapping)
+    {
+        // Records are addressed by index so remapping at a different address is harmless.
+        mMappedRegion.reset();
+        mFileMapping.reset();
+        boost::filesystem::resize_file(boost::filesystem::path(mMapFilename), sizeof(FileHeader) + capacity * sizeof(Record));
+        mapRegion();
+    }
+    else
+    {
+        mHeapStorage.resize(sizeof(FileHeader) + capacity * sizeof(Record), 0);
+        mData = &mHeapStorage[0];
+        mCapacity = capacity;
+    }
+}
+
+void CoinQBlockTreeMapped::markDirty()
+{
+    bFlushed = false;
+
+    // Make sure the map file is not trusted after a crash before it has been changed.
+    FileHeader* header = fileHeader();
+    if (!header->clean) return;
+    header->clean = 0;
+    if (mMappedRegion) { mMappedRegion->flush(0, sizeof(FileHeader), false); }
+}
+
+void CoinQBlockTreeMapped::markClean(const std::string& filename)
+{
+    // Only trust the map file on the next load once the records it depends on are on disk.
+    boost::system::error_code ec;
+    uint64_t journalFileSize = boost::filesystem::file_size(boost::filesystem::path(filename + ".journal"), ec);
+
+    mMappedRegion->flush();
+    fileHeader()->datFileSize = boost::filesystem::file_size(boost::filesystem::path(filename));
+    fileHeader()->journalFileSize = !ec ? journalFileSize : 0;
+    fileHeader()->clean = 1;
+    mMappedRegion->flush(0, sizeof(FileHeader), false);
+}
+
+bool CoinQBlockTreeMapped::mapFileMatches(const boost::filesystem::path& datPath) const
+{
+    const FileHeader* header = fileHeader();
+    if (!header->clean || header->tip >= header->count) return false;
+
+    uint64_t datFileSize = boost::filesystem::file_size(datPath);
+    if (header->datFileSize != datFileSize || datFileSize < CoinQBlockTreeFile::RECORD_SIZE) return false;
+
+    boost::system::error_code ec;
+    boost::filesystem::path journalPath(datPath.string() + ".journal");
+    uint64_t journalFileSize = boost::filesystem::file_size(journalPath, ec);
+    if (ec) { journalFileSize = 0; }
+    if (header->journalFileSize != journalFileSize) return false;
+
+    const Record& tip = record(header->tip);
+    if ((tip.flags & (RECORD_IN_BEST_CHAIN | RECORD_DELETED)) != RECORD_IN_BEST_CHAIN) return false;
+
+    // The last record written, either to the journal or to the blocktree file, must be the tip.
+    char buf[CoinQBlockTreeFile::JOURNAL_ENTRY_SIZE];
+    const char* last = buf;
+    if (journalFileSize > CoinQBlockTreeFile::JOURNAL_HEADER_SIZE)
+    {
+        if ((journalFileSize - CoinQBlockTreeFile::JOURNAL_HEADER_SIZE) % CoinQBlockTreeFile::JOURNAL_ENTRY_SIZE != 0) return false;
+
+#ifndef _WIN32
+        std::ifstream fs(journalPath.native(), std::ios::binary);
+#else
+        std::ifstream fs(journalPath.string(), std::ios::binary);
+#endif
+        fs.seekg(journalFileSize - CoinQBlockTreeFile::JOURNAL_ENTRY_SIZE);
+        fs.read(buf, CoinQBlockTreeFile::JOURNAL_ENTRY_SIZE);
+        if (!fs.good()) return false;
+
+        int32_t height = (int32_t)((uint32_t)(unsigned char)buf[0] | ((uint32_t)(unsigned char)buf[1] << 8) |
+                                   ((uint32_t)(unsigned char)buf[2] << 16) | ((uint32_t)(unsigned char)buf[3] << 24));
+        if (tip.height != height) return false;
+        last = buf + 4;
+    }
+    else
+    {
+        if ((uint64_t)tip.height + 1 != datFileSize / CoinQBlockTreeFile::RECORD_SIZE) return false;
+
+#ifndef _WIN32
+        std::ifstream fs(datPath.native(), std::ios::binary);
+#else
+        std::ifstream fs(datPath.string(), std::ios::binary);
+#endif
+        fs.seekg(datFileSize - CoinQBlockTreeFile::RECORD_SIZE);
+        fs.read(buf, CoinQBlockTreeFile::RECORD_SIZE);
+        if (!fs.good()) return false;
+    }
+
+    return !memcmp(last, tip.header, MIN_COIN_BLOCK_HEADER_SIZE) && !memcmp(&last[MIN_COIN_BLOCK_HEADER_SIZE], tip.hash, 4);
+}
+
+////////////////////////////////
+//
+// Indexes
+//
+uint64_t CoinQBlockTreeMapped::hashKey(const unsigned char* hash)
+{
+    // The trailing bytes are the least significant ones so they are never constrained by proof of work.
+    uint64_t key;
+    memcpy(&key, hash + 24, sizeof(key));
+    return key;
+}
+
+uint32_t CoinQBlockTreeMapped::findRecord(const unsigned char* hash) const
+{
+    if (mHashIndex.empty()) return NO_RECORD;
+
+    size_t mask = mHashIndex.size() - 1;
+    for (size_t i = hashKey(hash) & mask; mHashIndex[i]; i = (i + 1) & mask)
+    {
+        uint32_t index = mHashIndex[i] - 1;
+        if (!memcmp(record(index).hash, hash, 32)) return index;
+    }
+
+    return NO_RECORD;
+}
+
+uint32_t CoinQBlockTreeMapped::findRecord(const uchar_vector& hash) const
+{
+    if (hash.size() != 32) return NO_RECORD;
+    return findRecord(&hash[0]);
+}
+
+void CoinQBlockTreeMapped::indexRecord(uint32_t index)
+{
+    if ((uint64_t)(mHashIndexCount + 1) * 2 > mHashIndex.size())
+    {
+        std::vector<uint32_t> oldIndex;
+        oldIndex.swap(mHashIndex);
+        mHashIndex.assign(std::max<size_t>(oldIndex.size() * 2, INITIAL_CAPACITY * 2), 0);
+        mHashIndexCount = 0;
+        for (auto slot: oldIndex) { if (slot) indexRecord(slot - 1); }
+    }
+
+    size_t mask = mHashIndex.size() - 1;
+    size_t i = hashKey(record(index).hash) & mask;
+    while (mHashIndex[i]) { i = (i + 1) & mask; }
+    mHashIndex[i] = index + 1;
+    mHashIndexCount++;
+}
+
+void CoinQBlockTreeMapped::rebuildHashIndex()
+{
+    uint32_t count = fileHeader()->count;
+    size_t size = INITIAL_CAPACITY * 2;
+    while (size < (size_t)count * 2) { size *= 2; }
+
+    mHashIndex.assign(size, 0);
+    mHashIndexCount = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!(record(i).flags & RECORD_DELETED)) indexRecord(i);
+    }
+}
+
+void CoinQBlockTreeMapped::rebuildBestChain()
+{
+    mBestChain.clear();
+
+    uint32_t index = fileHeader()->tip;
+    if (index == NO_RECORD) return;
+
+    mBestChain.assign(record(index).height + 1, NO_RECORD);
+    for (int height = record(index).height; height >= 0; height--)
+    {
+        if (index >= fileHeader()->count || record(index).height != height || !(record(index).flags & RECORD_IN_BEST_CHAIN))
+            throw std::runtime_error("CoinQBlockTreeMapped::rebuildBestChain() - inconsistent best chain.");
+
+        mBestChain[height] = index;
+        index = record(index).parent;
+    }
+
+    if (index != NO_RECORD) throw std::runtime_error("CoinQBlockTreeMapped::rebuildBestChain() - inconsistent best chain.");
+}
+
+////////////////////////////////
+//
+// Chain work
+//
+CoinQBlockTreeMapped::work_t CoinQBlockTreeMapped::getWork(const Coin::CoinBlockHeader& header)
+{
+    auto it = mWorkCache.find(header.bits());
+    if (it != mWorkCache.end()) return it->second;
+
+    work_t work;
+    memset(&work, 0, sizeof(work));
+
+    std::vector<unsigned char> bytes = header.getWork().getBytes(); // most significant byte first
+    if (bytes.size() > 32) throw std::runtime_error("CoinQBlockTreeMapped::getWork() - work out of range.");
+    for (size_t i = 0; i < bytes.size(); i++)
+    {
+        work.words[i / 8] |= (uint64_t)bytes[bytes.size() - 1 - i] << (8 * (i % 8));
+    }
+
+    mWorkCache[header.bits()] = work;
+    return work;
+}
+
+void CoinQBlockTreeMapped::addWork(work_t& lhs, const work_t& rhs)
+{
+    uint64_t carry = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t sum = lhs.words[i] + rhs.words[i];
+        uint64_t carryOut = sum < lhs.words[i];
+        sum += carry;
+        carryOut |= sum < carry;
+        lhs.words[i] = sum;
+        carry = carryOut;
+    }
+}
+
+int CoinQBlockTreeMapped::compareWork(const work_t& lhs, const work_t& rhs)
+{
+    for (int i = 3; i >= 0; i--)
+    {
+        if (lhs.words[i] < rhs.words[i]) return -1;
+        if (lhs.words[i] > rhs.words[i]) return 1;
+    }
+    return 0;
+}
+
+BigInt CoinQBlockTreeMapped::toBigInt(const work_t& work)
+{
+    std::vector<unsigned char> bytes(32);
+    for (size_t i = 0; i < 32; i++)
+    {
+        bytes[31 - i] = (unsigned char)(work.words[i / 8] >> (8 * (i % 8)));
+    }
+    return BigInt(bytes);
+}
+
+////////////////////////////////
+//
+// Chain operations
+//
+uint32_t CoinQBlockTreeMapped::appendRecord(const Coin::CoinBlockHeader& header, const uchar_vector& hash, uint32_t parent)
+{
+    work_t work = getWork(header);
+    uchar_vector headerBytes = header.getSerialized();
+
+    uint32_t index = fileHeader()->count;
+    reserve((uint64_t)index + 1);
+
+    Record& r = record(index);
+    memcpy(r.header, &headerBytes[0], MIN_COIN_BLOCK_HEADER_SIZE);
+    memcpy(r.hash, &hash[0], 32);
+    if (parent == NO_RECORD)
+    {
+        r.chainWork = work;
+        r.height = 0;
+    }
+    else
+    {
+        r.chainWork = record(parent).chainWork;
+        addWork(r.chainWork, work);
+        r.height = record(parent).height + 1;
+    }
+    r.parent = parent;
+    r.flags = 0;
+    r.reserved = 0;
+
+    fileHeader()->count = index + 1;
+    indexRecord(index);
+    return index;
+}
+
+void CoinQBlockTreeMapped::setBestChain(uint32_t index)
+{
+    if (record(index).flags & RECORD_IN_BEST_CHAIN) return;
+
+    // Retrace back to earliest best block
+    std::vector<uint32_t> newBestChain;
+    for (uint32_t i = index; !(record(i).flags & RECORD_IN_BEST_CHAIN); i = record(i).parent) { newBestChain.push_back(i); }
+
+    int forkHeight = record(newBestChain.back()).height - 1;
+    bestChainChanged(forkHeight + 1);
+    for (int height = forkHeight + 1; height < (int)mBestChain.size(); height++)
+    {
+        uint32_t i = mBestChain[height];
+        record(i).flags &= ~RECORD_IN_BEST_CHAIN;
+        updateCachedHeader(i);
+        if (!notifyRemoveBestChain.empty()) notifyRemoveBestChain(getChainHeader(i));
+    }
+    mBestChain.resize(forkHeight + 1);
+    fileHeader()->tip = index;
+
+    // Pop back up and make this the best chain
+    for (auto it = newBestChain.rbegin(); it != newBestChain.rend(); ++it)
+    {
+        record(*it).flags |= RECORD_IN_BEST_CHAIN;
+        updateCachedHeader(*it);
+        mBestChain.push_back(*it);
+        if (it == newBestChain.rbegin() && !notifyReorg.empty()) notifyReorg(getChainHeader(*it));
+        if (!notifyAddBestChain.empty()) notifyAddBestChain(getChainHeader(*it));
+    }
+}
+
+void CoinQBlockTreeMapped::setGenesisBlock(const Coin::CoinBlockHeader& header)
+{
+    LOGGER(trace) << "setGenesisBlock - hash: " << header.getPOWHashLittleEndian().getHex() << std::endl;
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    if (fileHeader()->count != 0) throw std::runtime_error("Tree is not empty.");
+    if (header.getHashFuncs() != mHashFuncs)
+    {
+        Coin::CoinBlockHeader networkHeader(header);
+        networkHeader.setHashFuncs(mHashFuncs);
+        setGenesisBlock(networkHeader);
+        return;
+    }
+
+    markDirty();
+    uint32_t index = appendRecord(header, header.hash(), NO_RECORD);
+    record(index).flags |= RECORD_IN_BEST_CHAIN;
+    fileHeader()->tip = index;
+    mBestChain.assign(1, index);
+    bestChainChanged(0);
+
+    if (!notifyInsert.empty()) notifyInsert(getChainHeader(index));
+    if (!notifyAddBestChain.empty()) notifyAddBestChain(getChainHeader(index));
+}
+
+bool CoinQBlockTreeMapped::isEmpty() const
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    return fileHeader()->tip == NO_RECORD;
+}
+
+bool CoinQBlockTreeMapped::insertHeader(const Coin::CoinBlockHeader& header, bool bCheckProofOfWork, bool bReplaceTip)
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    if (fileHeader()->tip == NO_RECORD) throw std::runtime_error("No genesis block.");
+    if (header.getHashFuncs() != mHashFuncs)
+    {
+        Coin::CoinBlockHeader networkHeader(header);
+        networkHeader.setHashFuncs(mHashFuncs);
+        return insertHeader(networkHeader, bCheckProofOfWork, bReplaceTip);
+    }
+
+    const uchar_vector& headerHash = header.hash();
+    if (findRecord(&headerHash[0]) != NO_RECORD) return false;
+
+    uint32_t parent = findRecord(header.prevBlockHash());
+    if (parent == NO_RECORD) throw std::runtime_error("Parent not found.");
+
+    // Check proof of work
+    if (bCheckProofOfWork && BigInt(header.getPOWHashLittleEndian()) > header.getTarget()) throw std::runtime_error("Header hash is too big.");
+
+    markDirty();
+    uint32_t index = appendRecord(header, headerHash, parent);
+    if (!notifyInsert.empty()) notifyInsert(getChainHeader(index));
+
+    int cmp = compareWork(record(index).chainWork, record(fileHeader()->tip).chainWork);
+    if ((bReplaceTip && cmp >= 0) || cmp > 0)
+    {
+        setBestChain(index);
+    }
+
+    return true;
+}
+
+bool CoinQBlockTreeMapped::deleteHeader(const uchar_vector& hash)
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    uint32_t index = findRecord(hash);
+    if (index == NO_RECORD) return false;
+
+    if (record(index).height == 0) throw std::runtime_error("Cannot remove genesis block from best chain.");
+
+    markDirty();
+
+    // Descendants are always stored after their ancestors.
+    std::vector<uint32_t> deleted;
+    std::set<uint32_t> subtree;
+    subtree.insert(index);
+    deleted.push_back(index);
+    for (uint32_t i = index + 1; i < fileHeader()->count; i++)
+    {
+        const Record& r = record(i);
+        if (!(r.flags & RECORD_DELETED) && subtree.count(r.parent))
+        {
+            subtree.insert(i);
+            deleted.push_back(i);
+        }
+    }
+
+    // TODO: Find new best chain if this header was in best chain.
+    if (record(index).flags & RECORD_IN_BEST_CHAIN)
+    {
+        int height = record(index).height;
+        bestChainChanged(height);
+        for (int i = height; i < (int)mBestChain.size(); i++)
+        {
+            uint32_t j = mBestChain[i];
+            record(j).flags &= ~RECORD_IN_BEST_CHAIN;
+            updateCachedHeader(j);
+            if (!notifyRemoveBestChain.empty()) notifyRemoveBestChain(getChainHeader(j));
+        }
+        mBestChain.resize(height);
+        fileHeader()->tip = mBestChain.back();
+    }
+
+    // Remove children before parents
+    for (auto it = deleted.rbegin(); it != deleted.rend(); ++it)
+    {
+        record(*it).flags |= RECORD_DELETED;
+        if (!notifyDelete.empty()) notifyDelete(getChainHeader(*it));
+        mHeaderCache.erase(*it);
+    }
+    mHeaderCacheOrder.erase(std::remove_if(mHeaderCacheOrder.begin(), mHeaderCacheOrder.end(), [&](uint32_t i) { return subtree.count(i) != 0; }), mHeaderCacheOrder.end());
+
+    rebuildHashIndex();
+    return true;
+}
+
+bool CoinQBlockTreeMapped::hasHeader(const uchar_vector& hash) const
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    return findRecord(hash) != NO_RECORD;
+}
+
+ChainHeader CoinQBlockTreeMapped::getHeader(const uchar_vector& hash) const
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    uint32_t index = findRecord(hash);
+    if (index == NO_RECORD) throw std::runtime_error("Not found.");
+
+    return getChainHeader(index);
+}
+
+ChainHeader CoinQBlockTreeMapped::getHeader(int height) const
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    if (!mBestChain.empty())
+    {
+        if (height < 0) height += mBestChain.size();
+        if (height >= 0 && height < (int)mBestChain.size()) return getChainHeader(mBestChain[height]);
+    }
+
+    throw std::runtime_error("Not found.");
+}
+
+ChainHeader CoinQBlockTreeMapped::getTip() const
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    if (fileHeader()->tip == NO_RECORD) throw std::runtime_error("Tree is empty.");
+
+    return getChainHeader(fileHeader()->tip);
+}
+
+int CoinQBlockTreeMapped::getTipHeight() const
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    if (fileHeader()->tip == NO_RECORD) throw std::runtime_error("Tree is empty.");
+
+    return record(fileHeader()->tip).height;
+}
+
+ChainHeader CoinQBlockTreeMapped::getHeaderBefore(uint32_t timestamp) const
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    if (mBestChain.empty()) throw std::runtime_error("Tree is empty.");
+
+    size_t i;
+    for (i = 1; i < mBestChain.size(); i++)
+    {
+        const unsigned char* p = record(mBestChain[i]).header + TIMESTAMP_OFFSET;
+        uint32_t headerTimestamp = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        if (headerTimestamp > timestamp) break;
+    }
+
+    return getChainHeader(mBestChain[i - 1]);
+}
+
+int CoinQBlockTreeMapped::getBestHeight() const
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    return (int)mBestChain.size() - 1;
+}
+
+BigInt CoinQBlockTreeMapped::getTotalWork() const
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    if (fileHeader()->tip == NO_RECORD) return 0;
+
+    return toBigInt(record(fileHeader()->tip).chainWork);
+}
+
+std::vector<uchar_vector> CoinQBlockTreeMapped::getLocatorHashes(int maxSize = -1) const
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    std::vector<uchar_vector> locatorHashes;
+
+    int bestHeight = (int)mBestChain.size() - 1;
+    if (bestHeight == -1)
+    {
+        locatorHashes.push_back(g_zero32bytes);
+        return locatorHashes;
+    }
+
+    if (maxSize < 0) maxSize = bestHeight + 1;
+
+    int i = bestHeight;
+    int n = 0;
+    int step = 1;
+    while ((i >= 0) && (n < maxSize))
+    {
+        const unsigned char* hash = record(mBestChain[i]).hash;
+        locatorHashes.push_back(uchar_vector(hash, hash + 32));
+        i -= step;
+        n++;
+        if (n > 10) step *= 2;
+    }
+    return locatorHashes;
+}
+
+int CoinQBlockTreeMapped::getConfirmations(const uchar_vector& hash) const
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    uint32_t index = findRecord(hash);
+    if (index == NO_RECORD || !(record(index).flags & RECORD_IN_BEST_CHAIN)) return 0;
+
+    return (int)mBestChain.size() - record(index).height;
+}
+
+void CoinQBlockTreeMapped::clear()
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    FileHeader* header = fileHeader();
+    header->clean = 0;
+    if (mMappedRegion) { mMappedRegion->flush(0, sizeof(FileHeader), false); }
+    header->count = 0;
+    header->tip = NO_RECORD;
+
+    mHashIndex.clear();
+    mHashIndexCount = 0;
+    mBestChain.clear();
+    mHeaderCache.clear();
+    mHeaderCacheOrder.clear();
+    resetFileState();
+}
+
+////////////////////////////////
+//
+// Materialized headers
+//
+ChainHeader CoinQBlockTreeMapped::getChainHeader(uint32_t index) const
+{
+    auto it = mHeaderCache.find(index);
+    if (it != mHeaderCache.end()) return it->second;
+
+    while (mHeaderCache.size() >= HEADER_CACHE_SIZE)
+    {
+        mHeaderCache.erase(mHeaderCacheOrder.front());
+        mHeaderCacheOrder.pop_front();
+    }
+
+    const Record& r = record(index);
+    Coin::CoinBlockHeader header;
+    header.setHashFuncs(mHashFuncs);
+    std::size_t pos = 0;
+    header.setSerialized(r.header, MIN_COIN_BLOCK_HEADER_SIZE, pos);
+    it = mHeaderCache.insert(std::make_pair(index, ChainHeader(header, r.flags & RECORD_IN_BEST_CHAIN, r.height, toBigInt(r.chainWork)))).first;
+    mHeaderCacheOrder.push_back(index);
+    return it->second;
+}
+
+void CoinQBlockTreeMapped::updateCachedHeader(uint32_t index)
+{
+    auto it = mHeaderCache.find(index);
+    if (it != mHeaderCache.end()) { it->second.inBestChain = record(index).flags & RECORD_IN_BEST_CHAIN; }
+}
+
+////////////////////////////////
+//
+// File operations
+//
+void CoinQBlockTreeMapped::loadFromFile(const std::string& filename, bool bCheckProofOfWork, callback_t callback)
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+
+    // Open the map file first so a new tree can be started in it if the blocktree file is missing.
+    openMapFile(filename);
+
+    boost::filesystem::path p(filename);
+    if (!boost::filesystem::exists(p)) throw BlockTreeFileNotFoundException();
+
+    if (!boost::filesystem::is_regular_file(p)) throw BlockTreeInvalidFileTypeException();
+
+    if (boost::filesystem::file_size(p) % CoinQBlockTreeFile::RECORD_SIZE != 0) throw BlockTreeInvalidFileLengthException();
+
+    if (mapFileMatches(p))
+    {
+        try
+        {
+            rebuildHashIndex();
+            rebuildBestChain();
+            mHeaderCache.clear();
+            mHeaderCacheOrder.clear();
+            uint64_t journalFileSize = fileHeader()->journalFileSize;
+            setFileState(filename, journalFileSize ? (journalFileSize - CoinQBlockTreeFile::JOURNAL_HEADER_SIZE) / CoinQBlockTreeFile::JOURNAL_ENTRY_SIZE : 0);
+            bFlushed = true;
+            LOGGER(debug) << "CoinQBlockTreeMapped::loadFromFile() - reusing " << mMapFilename << " best height: " << getBestHeight() << std::endl;
+            if (callback) callback(*this);
+            return;
+        }
+        catch (const std::exception& e)
+        {
+            LOGGER(error) << "CoinQBlockTreeMapped::loadFromFile() - " << e.what() << std::endl;
+        }
+    }
+
+    LOGGER(debug) << "CoinQBlockTreeMapped::loadFromFile() - rebuilding " << mMapFilename << " from " << filename << std::endl;
+
+    CoinQBlockTreeFile file(filename, mHashFuncs);
+
+    clear();
+    if (file.size() == 0) return;
+    reserve(file.size());
+
+    // Start with the genesis block so the callback sees a valid tree while the file is being validated.
+    Coin::CoinBlockHeader header = file.getHeader(0);
+    if (memcmp(file.getHeaderBytes(0) + MIN_COIN_BLOCK_HEADER_SIZE, &header.hash()[0], 4)) throw BlockTreeChecksumErrorException();
+    setGenesisBlock(header);
+    if (callback && !callback(*this)) throw BlockTreeLoadInterruptedException();
+
+    file.validate(bCheckProofOfWork, mCheckpointHeight, mCheckpointHash, mLoadThreads, [&]() { return !callback || callback(*this); });
+
+    // The records are the best chain in order so each header extends the tip.
+    for (size_t i = 1; i < file.size(); i++)
+    {
+        uint32_t parent = fileHeader()->tip;
+        std::size_t pos = 0;
+        header.setSerialized(file.getHeaderBytes(i), MIN_COIN_BLOCK_HEADER_SIZE, pos);
+        if (memcmp(&header.prevBlockHash()[0], record(parent).hash, 32))
+            throw std::runtime_error(std::string("Block ") + uchar_vector(file.getHash(i), 32).getHex() + ": Parent not found.");
+
+        uint32_t index = appendRecord(header, uchar_vector(file.getHash(i), 32), parent);
+        record(index).flags |= RECORD_IN_BEST_CHAIN;
+        fileHeader()->tip = index;
+        mBestChain.push_back(index);
+
+        if (!notifyInsert.empty()) notifyInsert(getChainHeader(index));
+        if (!notifyReorg.empty()) notifyReorg(getChainHeader(index));
+        if (!notifyAddBestChain.empty()) notifyAddBestChain(getChainHeader(index));
+
+        if (i % 10000 == 0)
+        {
+            if (callback && !callback(*this)) throw BlockTreeLoadInterruptedException();
+            LOGGER(debug) << "CoinQBlockTreeMapped::loadFromFile() - header hash: " << uchar_vector(file.getHash(i), 32).getHex() << " height: " << i << std::endl;
+        }
+    }
+
+    // The records now match the blocktree file and its journal.
+    bFlushed = replayJournal(filename, bCheckProofOfWork);
+    if (bFlushed) { markClean(filename); }
+
+    if (callback) callback(*this); // No need to interrupt since we're done.
+}
+
+void CoinQBlockTreeMapped::flushToFile(const std::string& filename)
+{
+    boost::lock_guard<boost::recursive_mutex> lock(mutex);
+    writeFile(filename);
+    if (mMappedRegion && filename == mDatFilename) { markClean(filename); }
+    bFlushed = true;
+}
+
+void CoinQBlockTreeMapped::getFileRecord(int height, unsigned char* fileRecord) const
+{
+    const Record& r = record(mBestChain.at(height));
+    memcpy(fileRecord, r.header, MIN_COIN_BLOCK_HEADER_SIZE);
+    memcpy(fileRecord + MIN_COIN_BLOCK_HEADER_SIZE, r.hash, 4);
+}
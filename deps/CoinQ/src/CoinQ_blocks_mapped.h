@@ -0,0 +1,185 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinQ_blocks_mapped.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include "CoinQ_blocks.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+
+#include <deque>
+#include <memory>
+
+// Block tree that keeps headers in a flat array of fixed-size records instead of a map of ChainHeaders.
+//
+// When loaded from a file the records live in a memory-mapped companion file (filename + ".map") that
+// survives restarts, so a subsequent load only has to rebuild the hash index. The map file is a cache:
+// it is rebuilt from the blocktree file whenever it does not match the last flush. Trees that were never
+// loaded from a file keep their records on the heap.
+//
+// ChainHeader objects are materialized on demand into a bounded cache. The getters return copies, so headers
+// held by callers stay valid when the cache evicts them.
+class CoinQBlockTreeMapped : public ICoinQBlockTree
+{
+public:
+    enum { HEADER_CACHE_SIZE = 4096 };
+
+    CoinQBlockTreeMapped(bool _bCheckTimestamp = true, bool _bCheckProofOfWork = true);
+    CoinQBlockTreeMapped(const Coin::CoinBlockHeader& header, bool _bCheckTimestamp = true, bool _bCheckProofOfWork = true);
+    ~CoinQBlockTreeMapped();
+
+    void subscribeAddBestChain(chain_header_slot_t slot) { notifyAddBestChain.connect(slot); }
+    void subscribeRemoveBestChain(chain_header_slot_t slot) { notifyRemoveBestChain.connect(slot); }
+    void subscribeInsert(chain_header_slot_t slot) { notifyInsert.connect(slot); }
+    void subscribeDelete(chain_header_slot_t slot) { notifyDelete.connect(slot); }
+    void subscribeReorg(chain_header_slot_t slot) { notifyReorg.connect(slot); }
+
+    void clearAddBestChain() { notifyAddBestChain.clear(); }
+    void clearRemoveBestChain() { notifyRemoveBestChain.clear(); }
+    void clearInsert() { notifyInsert.clear(); }
+    void clearDelete() { notifyDelete.clear(); }
+    void clearReorg() { notifyReorg.clear(); }
+
+    void setGenesisBlock(const Coin::CoinBlockHeader& header);
+    bool isEmpty() const;
+    bool insertHeader(const Coin::CoinBlockHeader& header, bool bCheckProofOfWork = true, bool bReplaceTip = false);
+    bool deleteHeader(const uchar_vector& hash);
+
+    bool hasHeader(const uchar_vector& hash) const;
+    ChainHeader getHeader(const uchar_vector& hash) const;
+    ChainHeader getHeader(int height) const;
+    ChainHeader getTip() const;
+    int getTipHeight() const;
+    ChainHeader getHeaderBefore(uint32_t timestamp) const;
+
+    uchar_vector getBestHash() const { return getHeader(-1).hash(); }
+    int getBestHeight() const;
+    BigInt getTotalWork() const;
+
+    std::vector<uchar_vector> getLocatorHashes(int maxSize) const;
+
+    int getConfirmations(const uchar_vector& hash) const;
+    void clear();
+
+    void loadFromFile(const std::string& filename, bool bCheckProofOfWork = true, callback_t callback = nullptr);
+    void flushToFile(const std::string& filename);
+    bool flushed() const { return bFlushed; }
+
+protected:
+    void getFileRecord(int height, unsigned char* record) const;
+
+private:
+    // 256-bit unsigned integer, least significant word first.
+    struct work_t
+    {
+        uint64_t words[4];
+    };
+
+    enum
+    {
+        RECORD_IN_BEST_CHAIN    = 0x1,
+        RECORD_DELETED          = 0x2
+    };
+
+    static const uint32_t NO_RECORD = 0xffffffff;
+
+    // Fixed-size header record. Hashes are stored as returned by CoinBlockHeader::hash().
+    struct Record
+    {
+        unsigned char header[MIN_COIN_BLOCK_HEADER_SIZE];
+        unsigned char hash[32];
+        work_t chainWork;
+        uint32_t parent;
+        int32_t height;
+        uint32_t flags;
+        uint32_t reserved;
+    };
+
+    // Header of the map file, followed by the records.
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t count;         // records in use, including deleted ones
+        uint32_t tip;           // record index of the best chain tip
+        uint32_t clean;         // nonzero if nothing changed since the last flush to the blocktree file
+        uint32_t reserved;
+        uint64_t datFileSize;   // size of the blocktree file at the last flush
+        uint64_t journalFileSize; // size of the blocktree journal at the last flush, 0 if there is none
+        unsigned char reserved2[16];
+    };
+
+    mutable boost::recursive_mutex mutex;
+
+    bool bFlushed;
+    bool bCheckTimestamp;
+    bool bCheckProofOfWork;
+
+    // Record storage
+    std::string mDatFilename;
+    std::string mMapFilename;
+    std::unique_ptr<boost::interprocess::file_mapping> mFileMapping;
+    std::unique_ptr<boost::interprocess::mapped_region> mMappedRegion;
+    std::vector<unsigned char> mHeapStorage;
+    unsigned char* mData;
+    uint64_t mCapacity;     // in records
+
+    FileHeader* fileHeader() const { return (FileHeader*)mData; }
+    Record& record(uint32_t index) const { return ((Record*)(mData + sizeof(FileHeader)))[index]; }
+
+    void openMapFile(const std::string& filename);
+    void closeMapFile();
+    void mapRegion();
+    void initStorage();
+    void initFileHeader();
+    void reserve(uint64_t count);
+    void markDirty();
+    void markClean(const std::string& filename);
+    bool mapFileMatches(const boost::filesystem::path& datPath) const;
+
+    // Open addressing index of record index + 1 keyed on the hash, 0 marks an empty slot.
+    std::vector<uint32_t> mHashIndex;
+    uint32_t mHashIndexCount;
+    static uint64_t hashKey(const unsigned char* hash);
+    uint32_t findRecord(const unsigned char* hash) const;
+    uint32_t findRecord(const uchar_vector& hash) const; // NO_RECORD unless hash is 32 bytes
+    void indexRecord(uint32_t index);
+    void rebuildHashIndex();
+    void rebuildBestChain();
+
+    // Record index of the best chain header at each height.
+    std::vector<uint32_t> mBestChain;
+
+    // Chain work per difficulty target, so BigInt arithmetic is only done when the target changes.
+    std::map<uint32_t, work_t> mWorkCache;
+    work_t getWork(const Coin::CoinBlockHeader& header);
+    static void addWork(work_t& lhs, const work_t& rhs);
+    static int compareWork(const work_t& lhs, const work_t& rhs);
+    static BigInt toBigInt(const work_t& work);
+
+    uint32_t appendRecord(const Coin::CoinBlockHeader& header, const uchar_vector& hash, uint32_t parent);
+    void setBestChain(uint32_t index);
+
+    // Materialized headers
+    mutable std::map<uint32_t, ChainHeader> mHeaderCache;
+    mutable std::deque<uint32_t> mHeaderCacheOrder;
+    ChainHeader getChainHeader(uint32_t index) const;
+    void updateCachedHeader(uint32_t index);
+
+    CoinQSignal<const ChainHeader&> notifyAddBestChain;
+    CoinQSignal<const ChainHeader&> notifyRemoveBestChain;
+    CoinQSignal<const ChainHeader&> notifyInsert;
+    CoinQSignal<const ChainHeader&> notifyDelete;
+    CoinQSignal<const ChainHeader&> notifyReorg;
+};
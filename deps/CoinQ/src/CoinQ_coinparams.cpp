@@ -92,7 +92,9 @@ const CoinParams bitcoinParams(
         uchar_vector(32, 0),
         uchar_vector("4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b")
     ),
-    true
+    true,
+    295000,
+    "00000000000000004d9b4ef50f0f9d686fd69db2e03af35a100370c64632a983"
 );
 const CoinParams& getBitcoinParams() { return bitcoinParams; }
 
@@ -122,7 +124,9 @@ const CoinParams testnet3Params(
         uchar_vector(32, 0),
         uchar_vector("4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b")
     ),
-    true
+    true,
+    546,
+    "000000002a936ca763904c3c35fce2f3556c559c0214345d31b1bcebf76acb70"
 );
 const CoinParams& getTestnet3Params() { return testnet3Params; }
 
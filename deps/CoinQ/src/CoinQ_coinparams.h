@@ -23,7 +23,10 @@ namespace CoinQ {
 class CoinParams
 {
 public:
-    CoinParams() { }
+    static const uint32_t BITCOIN_BIP32_PRIV_VERSION = 0x0488ade4;
+    static const uint32_t BITCOIN_BIP32_PUB_VERSION = 0x0488b21e;
+
+    CoinParams() : block_header_hash_funcs_(Coin::CoinBlockHeader::getDefaultHashFuncs()), bip32_priv_version_(BITCOIN_BIP32_PRIV_VERSION), bip32_pub_version_(BITCOIN_BIP32_PUB_VERSION) { }
 
     CoinParams(
         uint32_t magic_bytes,
@@ -44,7 +47,9 @@ public:
         Coin::hashfunc_t block_header_hash_function,
         Coin::hashfunc_t block_header_pow_hash_function,
         const Coin::CoinBlockHeader& genesis_block,
-        bool segwit_enabled = false) :
+        bool segwit_enabled = false,
+        int checkpoint_height = -1,
+        const char* checkpoint_hash = "") :
     magic_bytes_(magic_bytes),
     protocol_version_(protocol_version),
     default_port_(default_port),
@@ -62,9 +67,16 @@ public:
     default_fee_(default_fee),
     block_header_hash_function_(block_header_hash_function),
     block_header_pow_hash_function_(block_header_pow_hash_function),
+    block_header_hash_funcs_(std::make_shared<Coin::BlockHeaderHashFuncs>(block_header_hash_function, block_header_pow_hash_function)),
     genesis_block_(genesis_block),
-    segwit_enabled_(segwit_enabled)
+    segwit_enabled_(segwit_enabled),
+    checkpoint_height_(checkpoint_height),
+    checkpoint_hash_(checkpoint_hash),
+    bip32_priv_version_(BITCOIN_BIP32_PRIV_VERSION),
+    bip32_pub_version_(BITCOIN_BIP32_PUB_VERSION)
     {
+        genesis_block_.setHashFuncs(block_header_hash_funcs_);
+
         address_versions_[0] = pay_to_pubkey_hash_version_;
         address_versions_[1] = pay_to_script_hash_version_;
 
@@ -96,9 +108,22 @@ public:
     unsigned int                    currency_decimals() const { return currency_decimals_; }
     Coin::hashfunc_t                block_header_hash_function() const { return block_header_hash_function_; }
     Coin::hashfunc_t                block_header_pow_hash_function() const { return block_header_pow_hash_function_; }
+
+    // Shared by the headers of this network, see Coin::CoinBlockHeader::setHashFuncs().
+    const Coin::header_hashfuncs_t& block_header_hash_funcs() const { return block_header_hash_funcs_; }
     const Coin::CoinBlockHeader&    genesis_block() const { return genesis_block_; }
     bool                            segwit_enabled() const { return segwit_enabled_; }
 
+    // Headers up to and including a matching checkpoint are trusted when loading the blocktree file.
+    int                             checkpoint_height() const { return checkpoint_height_; }
+    const uchar_vector&             checkpoint_hash() const { return checkpoint_hash_; }
+    void                            set_checkpoint(int height, const uchar_vector& hash) { checkpoint_height_ = height; checkpoint_hash_ = hash; }
+
+    // Extended key versions. All networks use bitcoin's unless set otherwise so that existing extended keys still load.
+    uint32_t                        bip32_priv_version() const { return bip32_priv_version_; }
+    uint32_t                        bip32_pub_version() const { return bip32_pub_version_; }
+    void                            set_bip32_versions(uint32_t priv_version, uint32_t pub_version) { bip32_priv_version_ = priv_version; bip32_pub_version_ = pub_version; }
+
 private:
     uint32_t                magic_bytes_;
     uint32_t                protocol_version_;
@@ -119,8 +144,13 @@ private:
     unsigned int            currency_decimals_;
     Coin::hashfunc_t        block_header_hash_function_;
     Coin::hashfunc_t        block_header_pow_hash_function_;
+    Coin::header_hashfuncs_t block_header_hash_funcs_;
     Coin::CoinBlockHeader   genesis_block_;
     bool                    segwit_enabled_;
+    int                     checkpoint_height_;
+    uchar_vector            checkpoint_hash_;
+    uint32_t                bip32_priv_version_;
+    uint32_t                bip32_pub_version_;
 };
 
 typedef std::pair<std::string, const CoinParams&> NetworkPair;
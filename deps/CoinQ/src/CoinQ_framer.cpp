@@ -0,0 +1,178 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinQ_framer.cpp
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#include "CoinQ_framer.h"
+
+#include <CoinCore/numericdata.h>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+using namespace CoinQ;
+
+MessageFramer::MessageFramer(uint32_t magic_bytes, std::size_t buffer_size)
+    : magic_bytes_(magic_bytes), buffer_(std::max<std::size_t>(buffer_size, MIN_MESSAGE_HEADER_SIZE))
+{
+    clear();
+}
+
+void MessageFramer::clear()
+{
+    begin_ = 0;
+    end_ = 0;
+    in_use_ = 0;
+    bHaveHeader_ = false;
+    payload_.clear();
+    payload_received_ = 0;
+    discarded_bytes_ = 0;
+}
+
+// Once next() has returned false the read buffer holds less than a header at its start, or nothing if a
+// payload is being received, in which case reads go straight into the payload buffer.
+unsigned char* MessageFramer::readBuffer()
+{
+    if (bHaveHeader_) return payload_.data() + payload_received_;
+    return buffer_.data() + end_;
+}
+
+std::size_t MessageFramer::readBufferSize() const
+{
+    if (bHaveHeader_) return header_.length - payload_received_;
+    return buffer_.size() - end_;
+}
+
+std::size_t MessageFramer::minReadBytes() const
+{
+    if (bHaveHeader_) return header_.length - payload_received_;
+    return MIN_MESSAGE_HEADER_SIZE - (end_ - begin_);
+}
+
+void MessageFramer::commit(std::size_t bytes_read)
+{
+    if (bytes_read > readBufferSize()) throw std::runtime_error("MessageFramer::commit() - read past end of buffer.");
+
+    if (bHaveHeader_)   { receivePayload(payload_.data() + payload_received_, bytes_read); }
+    else                { end_ += bytes_read; }
+}
+
+std::size_t MessageFramer::write(const unsigned char* data, std::size_t len)
+{
+    std::size_t n = std::min(len, readBufferSize());
+    if (n) { memcpy(readBuffer(), data, n); }
+    commit(n);
+    return n;
+}
+
+bool MessageFramer::next(Message& message)
+{
+    release();
+
+    if (!bHaveHeader_)
+    {
+        // Find the magic bytes, discarding anything before them.
+        while (end_ - begin_ >= 4 && vch_to_uint<uint32_t>(buffer_.data() + begin_, LITTLE_ENDIAN_) != magic_bytes_)
+        {
+            begin_++;
+            discarded_bytes_++;
+        }
+
+        if (end_ - begin_ < MIN_MESSAGE_HEADER_SIZE)
+        {
+            // Keep the partial header at the start so the next read has the whole buffer.
+            if (begin_ > 0)
+            {
+                memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+                end_ -= begin_;
+                begin_ = 0;
+            }
+            return false;
+        }
+
+        frameHeader();
+
+        // Hand out payloads that are already here in place.
+        if (end_ - begin_ >= header_.length)
+        {
+            const unsigned char* payload = buffer_.data() + begin_;
+            in_use_ = header_.length;
+            SHA256_Update(&payload_sha256_, payload, header_.length);
+            verifyChecksum();
+
+            message.header = header_;
+            message.payload = payload;
+            return true;
+        }
+
+        if (payload_.size() < header_.length) { payload_.resize(header_.length); }
+        bHaveHeader_ = true;
+    }
+
+    // Move whatever has arrived of the payload out of the read buffer. If that is not all of it the read buffer
+    // is now empty, and the rest of the payload is read directly into the payload buffer.
+    std::size_t n = std::min<std::size_t>(end_ - begin_, header_.length - payload_received_);
+    receivePayload(buffer_.data() + begin_, n);
+    begin_ += n;
+    if (begin_ == end_) { begin_ = end_ = 0; }
+    if (payload_received_ < header_.length) return false;
+
+    bHaveHeader_ = false;
+    verifyChecksum();
+
+    message.header = header_;
+    message.payload = payload_.data();
+    return true;
+}
+
+void MessageFramer::release()
+{
+    begin_ += in_use_;
+    in_use_ = 0;
+}
+
+void MessageFramer::frameHeader()
+{
+    std::size_t pos = begin_;
+    header_.setSerialized(buffer_.data(), pos + MIN_MESSAGE_HEADER_SIZE, pos);
+    begin_ = pos;
+
+    SHA256_Init(&payload_sha256_);
+    payload_received_ = 0;
+
+    if (header_.length > MAX_PAYLOAD_SIZE)
+    {
+        // The payload is skipped by the search for the next magic bytes.
+        std::stringstream err;
+        err << "Payload too large: " << header_.length << " bytes.";
+        throw std::runtime_error(err.str());
+    }
+}
+
+void MessageFramer::receivePayload(const unsigned char* data, std::size_t len)
+{
+    if (!len) return;
+
+    unsigned char* dest = payload_.data() + payload_received_;
+    if (data != dest) { memcpy(dest, data, len); }
+    SHA256_Update(&payload_sha256_, dest, len);
+    payload_received_ += len;
+}
+
+void MessageFramer::verifyChecksum()
+{
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    unsigned char hash2[SHA256_DIGEST_LENGTH];
+    SHA256_Final(hash, &payload_sha256_);
+    SHA256(hash, SHA256_DIGEST_LENGTH, hash2);
+
+    if (header_.hasChecksum && vch_to_uint<uint32_t>(hash2, LITTLE_ENDIAN_) != header_.checksum)
+        throw std::runtime_error("Invalid checksum.");
+}
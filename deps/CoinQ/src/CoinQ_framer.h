@@ -0,0 +1,95 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// CoinQ_framer.h
+//
+// Copyright (c) 2011-2016 Ciphrex Corp.
+//
+// Distributed under the MIT software license, see the accompanying
+// file LICENSE or http://www.opensource.org/licenses/mit-license.php.
+//
+
+#pragma once
+
+#include <CoinCore/CoinNodeData.h>
+
+#include <openssl/sha.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace CoinQ {
+
+// Splits a peer's byte stream into messages without copying it around.
+//
+// Socket reads go into readBuffer(). Headers and any payloads that arrive in the same read are framed in
+// place and handed out as pointers into the read buffer. The payload of a message that does not fit in
+// one read is read straight into a payload buffer sized from its header. The checksum is computed over
+// the payload bytes as they arrive, so it never requires reserializing the decoded message.
+//
+// Bytes before the magic bytes are discarded, as are messages with a bad checksum or a payload larger
+// than MAX_PAYLOAD_SIZE.
+class MessageFramer
+{
+public:
+    enum
+    {
+        DEFAULT_BUFFER_SIZE = 262144,
+        MAX_PAYLOAD_SIZE = 0x02000000   // 32 MiB, the reference client's limit
+    };
+
+    struct Message
+    {
+        Coin::MessageHeader header;
+        const unsigned char* payload;   // header.length bytes, valid until the framer is next used
+    };
+
+    explicit MessageFramer(uint32_t magic_bytes = 0, std::size_t buffer_size = DEFAULT_BUFFER_SIZE);
+
+    void setMagicBytes(uint32_t magic_bytes) { magic_bytes_ = magic_bytes; clear(); }
+    uint32_t getMagicBytes() const { return magic_bytes_; }
+
+    void clear();
+
+    // Where the next read should go, and how many bytes must arrive before another message can be framed.
+    // Call next() until it returns false before reading again.
+    unsigned char* readBuffer();
+    std::size_t readBufferSize() const;
+    std::size_t minReadBytes() const;
+
+    // Accounts for bytes_read bytes read into readBuffer().
+    void commit(std::size_t bytes_read);
+
+    // Copies as much of data as fits into readBuffer() and commits it. Returns the number of bytes taken.
+    std::size_t write(const unsigned char* data, std::size_t len);
+
+    // Frames the next complete message. Returns false if more bytes are needed. Throws std::runtime_error
+    // for a message that was dropped; the stream resumes after it, so next() can be called again.
+    bool next(Message& message);
+
+    uint64_t getDiscardedBytes() const { return discarded_bytes_; }
+
+private:
+    uint32_t magic_bytes_;
+
+    // Read buffer. Unframed bytes are buffer_[begin_, end_).
+    std::vector<unsigned char> buffer_;
+    std::size_t begin_;
+    std::size_t end_;
+    std::size_t in_use_; // bytes at begin_ handed out by the last call to next()
+
+    // Message whose payload is still arriving.
+    bool bHaveHeader_;
+    Coin::MessageHeader header_;
+    std::vector<unsigned char> payload_;
+    std::size_t payload_received_;
+    SHA256_CTX payload_sha256_;
+
+    uint64_t discarded_bytes_;
+
+    void release();
+    void frameHeader();
+    void receivePayload(const unsigned char* data, std::size_t len);
+    void verifyChecksum();
+};
+
+}
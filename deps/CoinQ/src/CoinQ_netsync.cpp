@@ -19,12 +19,30 @@
 
 #include <logger/logger.h>
 
+#include <algorithm>
 #include <thread>
 #include <chrono>
 
 using namespace CoinQ::Network;
 using namespace std;
 
+namespace
+{
+
+// Peers with a measured block rate rank by it, the rest by how quickly they completed the handshake.
+bool isFasterPeer(const SyncPeerStats& a, const SyncPeerStats& b)
+{
+    if (a.bStalled != b.bStalled) return b.bStalled;
+
+    bool aMeasured = a.blocksReceived > 0 && a.blockRate > 0.0;
+    bool bMeasured = b.blocksReceived > 0 && b.blockRate > 0.0;
+    if (aMeasured != bMeasured) return aMeasured;
+    if (aMeasured) return a.blockRate > b.blockRate;
+    return a.connectLatency < b.connectLatency;
+}
+
+}
+
 NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOfWork) :
     m_coinParams(coinParams),
     m_bCheckProofOfWork(bCheckProofOfWork),
@@ -33,23 +51,35 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
     m_work(m_ioService),
     m_bConnected(false),
     m_peer(m_ioService),
+    m_syncPeers(m_ioService),
     m_bFlushingToFile(false),
+    m_blockTree(new CoinQBlockTreeMem()),
+    m_bMappedBlockTree(false),
+    m_bBlockTreeJournal(true),
+    m_blockTreeJournalCompactionSize(DEFAULT_BLOCKTREE_JOURNAL_COMPACTION_SIZE),
     m_bHeadersSynched(false),
-    m_bMissingTxs(false)
+    m_bBloomFilterLoaded(false),
+    m_bMissingTxs(false),
+    m_blockWindowSize(DEFAULT_BLOCK_WINDOW_SIZE),
+    m_bPipelining(false),
+    m_nextRequestHeight(0),
+    m_nextDeliverHeight(0),
+    m_blockRangeSize(DEFAULT_BLOCK_RANGE_SIZE),
+    m_peerStallTimeout(DEFAULT_PEER_STALL_TIMEOUT),
+    m_stallTimer(m_ioService),
+    m_blocksSynched(0)
 {
-    // Select hash functions
-    Coin::CoinBlockHeader::setHashFunc(m_coinParams.block_header_hash_function());
-    Coin::CoinBlockHeader::setPOWHashFunc(m_coinParams.block_header_pow_hash_function());
+    setHashFuncs();
 
 /*
     // Subscribe block tree handlers 
-    m_blockTree.subscribeRemoveBestChain([&](const ChainHeader& header)
+    m_blockTree->subscribeRemoveBestChain([&](const ChainHeader& header)
     {
         notifyBlockTreeChanged();
         notifyRemoveBestChain(header);
     });
 
-    m_blockTree.subscribeAddBestChain([&](const ChainHeader& header)
+    m_blockTree->subscribeAddBestChain([&](const ChainHeader& header)
     {
         notifyBlockTreeChanged();
         notifyAddBestChain(header);
@@ -61,9 +91,11 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
 */
 
     // Subscribe peer handlers
-    m_peer.subscribeOpen([&](CoinQ::Peer& /*peer*/)
+    m_peer.subscribeOpen([&](CoinQ::Peer& peer)
     {
+        openSyncPeer(peer.name());
         m_bConnected = true;
+        startStallTimer();
         notifyOpen();
         try
         {
@@ -71,11 +103,12 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
             {
                 Coin::FilterLoadMessage filterLoad(m_bloomFilter.getNHashFuncs(), m_bloomFilter.getNTweak(), m_bloomFilter.getNFlags(), m_bloomFilter.getFilter());
                 m_peer.send(filterLoad);
+                m_bBloomFilterLoaded = true;
                 LOGGER(trace) << "Sent filter to peer." << std::endl;
             }
 
             LOGGER(trace) << "Peer connection opened." << endl;
-            m_peer.getHeaders(m_blockTree.getLocatorHashes(-1));
+            m_peer.getHeaders(m_blockTree->getLocatorHashes(-1));
         }
         catch (const std::exception& e)
         {
@@ -131,12 +164,16 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
         if (!getData.items.empty()) { m_peer.send(getData); }
     });
 
-    m_peer.subscribeTx([&](CoinQ::Peer& /*peer*/, const Coin::Transaction& tx)
+    m_peer.subscribeTx([&](CoinQ::Peer& peer, const Coin::Transaction& tx)
     {
         LOGGER(trace) << "Received transaction: " << tx.hash().getHex() << endl;
 
         boost::unique_lock<boost::mutex> syncLock(m_syncMutex);
-        if (m_currentMerkleTxHashes.empty())
+        if (m_bPipelining && m_pendingMerkleTxHeights.count(tx.hash()))
+        {
+            processPipelinedTx(peer.name(), tx, syncLock);
+        }
+        else if (m_currentMerkleTxHashes.empty())
         {
             {
                 boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
@@ -153,7 +190,8 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
         }
     });
 
-    m_peer.subscribeHeaders([&](CoinQ::Peer& peer, const Coin::HeadersMessage& headersMessage)
+    // Headers are processed the same from any peer, and more are asked for from the fastest peer.
+    auto headersHandler = [this](CoinQ::Peer& peer, const Coin::HeadersMessage& headersMessage)
     {
         if (!m_bConnected) return;
         LOGGER(trace) << "Received headers message..." << std::endl;
@@ -168,7 +206,7 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
                 {
                     try
                     {
-                        if (m_blockTree.insertHeader(item)) { m_bHeadersSynched = false; }
+                        if (m_blockTree->insertHeader(item)) { m_bHeadersSynched = false; }
                     }
                     catch (const std::exception& e)
                     {
@@ -182,32 +220,41 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
                 }
 
                 LOGGER(trace)   << "Processed " << headersMessage.headers.size() << " headers."
-                                << " mBestHeight: " << m_blockTree.getBestHeight()
-                                << " mTotalWork: " << m_blockTree.getTotalWork().getDec()
+                                << " mBestHeight: " << m_blockTree->getBestHeight()
+                                << " mTotalWork: " << m_blockTree->getTotalWork().getDec()
                                 << " Attempting to fetch more headers..." << std::endl;
 
                 notifyBlockTreeChanged();
                 std::stringstream status;
-                status << "Best Height: " << m_blockTree.getBestHeight() << " / " << "Total Work: " << m_blockTree.getTotalWork().getDec();
+                status << "Best Height: " << m_blockTree->getBestHeight() << " / " << "Total Work: " << m_blockTree->getTotalWork().getDec();
                 notifyStatus(status.str());
 
-                vector<uchar_vector> locatorHashes = m_blockTree.getLocatorHashes(1);
+                vector<uchar_vector> locatorHashes = m_blockTree->getLocatorHashes(1);
                 if (locatorHashes.empty()) throw runtime_error("Blocktree is empty.");
                 if (headersMessage.headers[headersMessage.headers.size() - 1].hash() != locatorHashes[0])
                 {
                     throw runtime_error("Blocktree conflicts with peer.");
                 }
- 
-                peer.getHeaders(locatorHashes);
+
+                fileFlushLock.unlock();
+                std::string fastestPeer;
+                {
+                    boost::lock_guard<boost::mutex> syncLock(m_syncMutex);
+                    fastestPeer = getFastestPeer();
+                }
+
+                std::shared_ptr<CoinQ::Peer> nextPeer = getPeer(fastestPeer);
+                if (nextPeer)   { nextPeer->getHeaders(locatorHashes); }
+                else            { peer.getHeaders(locatorHashes); }
             }
             else
             {
                 m_fileFlushCond.notify_one();
 /*
-                if (!m_blockTree.flushed())
+                if (!m_blockTree->flushed())
                 {
                     notifyStatus("Flushing block chain to file...");
-                    m_blockTree.flushToFile(m_blockTreeFile);
+                    m_blockTree->flushToFile(m_blockTreeFile);
                     notifyStatus("Done flushing block chain to file");
                 }
 */
@@ -223,7 +270,9 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
         {
             LOGGER(error) << "block tree exception: " << e.what() << std::endl;
         }
-    });
+    };
+
+    m_peer.subscribeHeaders(headersHandler);
 
     m_peer.subscribeBlock([&](CoinQ::Peer& /*peer*/, const Coin::CoinBlock& block)
     {
@@ -234,6 +283,7 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
         try
         {
             boost::unique_lock<boost::mutex> syncLock(m_syncMutex);
+            if (m_bPipelining && processPipelinedBlock(block, syncLock)) return;
             if (!m_bMissingTxs || m_currentMerkleBlock.hash() != block.hash()) return;    // Not the block we're working on.
 
             LOGGER(trace) << "Processing " << block.txs.size() << " block transactions..." << endl;
@@ -265,7 +315,7 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
 
             // Once the queue is empty, if we're at the tip signal completion of block sync.
             uchar_vector currentMerkleBlockHash = m_currentMerkleBlock.hash();
-            const ChainHeader& chainTip = m_blockTree.getTip();
+            const ChainHeader& chainTip = m_blockTree->getTip();
             if (chainTip.hash() == currentMerkleBlockHash)
             {
                 LOGGER(trace) << "Block sync detected from block handler." << endl;
@@ -277,7 +327,7 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
             }
 
             // Ask for the next block
-            const ChainHeader& nextHeader = m_blockTree.getHeader(m_currentMerkleBlock.height + 1);
+            const ChainHeader& nextHeader = m_blockTree->getHeader(m_currentMerkleBlock.height + 1);
             m_lastRequestedMerkleBlockHash = nextHeader.hash();
             LOGGER(trace) << "Asking for filtered block from block handler: " << m_lastRequestedMerkleBlockHash.getHex() << std::endl;
             
@@ -299,14 +349,14 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
         }
     });
 
-    m_peer.subscribeMerkleBlock([&](CoinQ::Peer& /*peer*/, const Coin::MerkleBlock& merkleBlock)
+    m_peer.subscribeMerkleBlock([&](CoinQ::Peer& peer, const Coin::MerkleBlock& merkleBlock)
     {
         if (!m_bConnected) return;
 
         uchar_vector merkleBlockHash = merkleBlock.hash();
         LOGGER(trace) << "Received merkle block: " << merkleBlockHash.getHex() << endl;
 
-        const ChainHeader& chainTip = m_blockTree.getHeader(-1);
+        const ChainHeader& chainTip = m_blockTree->getHeader(-1);
         uchar_vector chainTipHash = chainTip.hash();
         LOGGER(trace) << "Current chain tip: " << chainTipHash.getHex() << " Height: " << chainTip.height << endl;
 
@@ -324,7 +374,7 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
                 LOGGER(trace) << "REORG - attempting again to resync block headers from peer..." << endl;
                 try
                 {
-                    m_peer.getHeaders(m_blockTree.getLocatorHashes(-1));
+                    m_peer.getHeaders(m_blockTree->getLocatorHashes(-1));
                 }
                 catch (const exception& e)
                 {
@@ -335,10 +385,15 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
             }
 
             boost::unique_lock<boost::mutex> syncLock(m_syncMutex);
-            if (merkleBlockHash == m_lastRequestedMerkleBlockHash)
+            if (m_bPipelining && m_pendingMerkleBlockHeights.count(merkleBlockHash))
+            {
+                // It's one of the blocks in our download window
+                processPipelinedMerkleBlock(peer.name(), merkleBlock, merkleTree, syncLock);
+            }
+            else if (merkleBlockHash == m_lastRequestedMerkleBlockHash)
             {
                 // It's the block we requested - sync it and continue requesting the next until we're at the tip
-                const ChainHeader& merkleHeader = m_blockTree.getHeader(merkleBlockHash);
+                const ChainHeader& merkleHeader = m_blockTree->getHeader(merkleBlockHash);
                 syncMerkleBlock(ChainMerkleBlock(merkleBlock, true, merkleHeader.height, merkleHeader.chainWork), merkleTree);
 
                 if (!m_currentMerkleTxHashes.empty()) return; // We need to wait for some transactions
@@ -355,7 +410,7 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
                 else
                 {
                     // Ask for the next block
-                    const ChainHeader& nextHeader = m_blockTree.getHeader(merkleHeader.height + 1);
+                    const ChainHeader& nextHeader = m_blockTree->getHeader(merkleHeader.height + 1);
                     m_lastRequestedMerkleBlockHash = nextHeader.hash();
                     LOGGER(trace) << "Asking for filtered block (2) " << m_lastRequestedMerkleBlockHash.getHex() << endl;
     
@@ -379,7 +434,7 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
 
                 // Try inserting into block tree. If it fails it throws a protocol error exception which is caught below.
                 boost::unique_lock<boost::mutex> fileFlushLock(m_fileFlushMutex);
-                m_blockTree.insertHeader(merkleBlock.blockHeader, m_bCheckProofOfWork);
+                m_blockTree->insertHeader(merkleBlock.blockHeader, m_bCheckProofOfWork);
                 fileFlushLock.unlock();
 
                 // Start flushing to file
@@ -391,17 +446,17 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
                 {
                     // We were synched prior to this block - we need to process this merkle block and we'll be synched again
                     notifySynchingBlocks();
-                    const ChainHeader& merkleHeader = m_blockTree.getHeader(merkleBlockHash);
+                    const ChainHeader& merkleHeader = m_blockTree->getHeader(merkleBlockHash);
                     syncMerkleBlock(ChainMerkleBlock(merkleBlock, true, merkleHeader.height, merkleHeader.chainWork), merkleTree);
                     if (m_currentMerkleTxHashes.empty())
                     {
-                        m_lastSynchedMerkleBlockHash = m_blockTree.getTip().hash();
+                        m_lastSynchedMerkleBlockHash = m_blockTree->getTip().hash();
                         syncLock.unlock();
                         notifyBlocksSynched();
                     }
                 }
             }
-            else if (!m_blockTree.hasHeader(merkleBlockHash))
+            else if (!m_blockTree->hasHeader(merkleBlockHash))
             {
                 // A reorg of depth 2 or greater has occurred - update block headers
                 LOGGER(trace) << "NetworkSync merkle block handler - block rejected: " << merkleBlockHash.getHex() << endl;
@@ -410,7 +465,7 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
                 m_bHeadersSynched = false;
                 try
                 {
-                    m_peer.getHeaders(m_blockTree.getLocatorHashes(-1));
+                    m_peer.getHeaders(m_blockTree->getLocatorHashes(-1));
                 }
                 catch (const exception& e)
                 {
@@ -427,6 +482,98 @@ NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams, bool bCheckProofOf
             notifyProtocolError(e.what(), -1);
         }
     });
+
+    // Subscribe sync peer handlers - sync peers only take part in header and filtered block downloads
+    m_syncPeers.subscribeOpen([this](CoinQ::Peer& peer)
+    {
+        LOGGER(trace) << "Sync peer " << peer.name() << " connection opened." << endl;
+        try
+        {
+            if (m_bloomFilter.isSet())
+            {
+                Coin::FilterLoadMessage filterLoad(m_bloomFilter.getNHashFuncs(), m_bloomFilter.getNTweak(), m_bloomFilter.getNFlags(), m_bloomFilter.getFilter());
+                peer.send(filterLoad);
+            }
+
+            openSyncPeer(peer.name());
+        }
+        catch (const std::exception& e)
+        {
+            LOGGER(error) << "NetworkSync - sync peer open handler - " << e.what() << std::endl;
+            // TODO: propagate code
+            notifyConnectionError(e.what(), -1);
+        }
+    });
+
+    m_syncPeers.subscribeClose([this](CoinQ::Peer& peer)
+    {
+        LOGGER(trace) << "Sync peer " << peer.name() << " connection closed." << endl;
+        closeSyncPeer(peer.name());
+    });
+
+    m_syncPeers.subscribeConnectionError([](CoinQ::Peer& peer, const std::string& error, int /*code*/)
+    {
+        LOGGER(debug) << "Sync peer " << peer.name() << " connection error: " << error << endl;
+    });
+
+    m_syncPeers.subscribeProtocolError([](CoinQ::Peer& peer, const std::string& error, int /*code*/)
+    {
+        LOGGER(debug) << "Sync peer " << peer.name() << " protocol error: " << error << endl;
+    });
+
+    m_syncPeers.subscribeHeaders(headersHandler);
+
+    m_syncPeers.subscribeMerkleBlock([this](CoinQ::Peer& peer, const Coin::MerkleBlock& merkleBlock)
+    {
+        if (!m_bConnected) return;
+        LOGGER(trace) << "Received merkle block from sync peer " << peer.name() << ": " << merkleBlock.hash().getHex() << endl;
+
+        try
+        {
+            // Constructing the partial tree will validate the merkle root - throws exception if invalid.
+            Coin::PartialMerkleTree merkleTree(merkleBlock.merkleTree());
+
+            boost::unique_lock<boost::mutex> syncLock(m_syncMutex);
+            if (m_bPipelining && m_pendingMerkleBlockHeights.count(merkleBlock.hash()))
+            {
+                processPipelinedMerkleBlock(peer.name(), merkleBlock, merkleTree, syncLock);
+            }
+        }
+        catch (const exception& e)
+        {
+            LOGGER(error) << "NetworkSync - sync peer " << peer.name() << " protocol error: " << e.what() << std::endl;
+            // TODO: propagate code
+            notifyProtocolError(e.what(), -1);
+        }
+    });
+
+    m_syncPeers.subscribeTx([this](CoinQ::Peer& peer, const Coin::Transaction& tx)
+    {
+        if (!m_bConnected) return;
+
+        // Only transactions belonging to pipelined merkle blocks - m_peer takes care of the mempool.
+        boost::unique_lock<boost::mutex> syncLock(m_syncMutex);
+        if (m_bPipelining && m_pendingMerkleTxHeights.count(tx.hash()))
+        {
+            processPipelinedTx(peer.name(), tx, syncLock);
+        }
+    });
+
+    m_syncPeers.subscribeBlock([this](CoinQ::Peer& /*peer*/, const Coin::CoinBlock& block)
+    {
+        if (!m_bConnected) return;
+
+        try
+        {
+            boost::unique_lock<boost::mutex> syncLock(m_syncMutex);
+            if (m_bPipelining) { processPipelinedBlock(block, syncLock); }
+        }
+        catch (const exception& e)
+        {
+            // TODO: Propagate code
+            notifyProtocolError(e.what(), -1);
+        }
+    });
 }
 
 NetworkSync::~NetworkSync()
@@ -440,22 +587,55 @@ void NetworkSync::setCoinParams(const CoinQ::CoinParams& coinParams)
     boost::lock_guard<boost::mutex> lock(m_startMutex);
     if (m_bStarted) throw std::runtime_error("NetworkSync::setCoinParams() - must be stopped to set coin parameters.");
 
-    m_coinParams = coinParams;    
+    m_coinParams = coinParams;
+    setHashFuncs();
 }
 
-void NetworkSync::loadHeaders(const std::string& blockTreeFile, bool bCheckProofOfWork, CoinQBlockTreeMem::callback_t callback)
+void NetworkSync::setHashFuncs()
+{
+    const Coin::header_hashfuncs_t& hashFuncs = m_coinParams.block_header_hash_funcs();
+    if (m_blockTree->getHashFuncs() != hashFuncs)
+    {
+        m_blockTree->clear();
+        m_blockTree->setHashFuncs(hashFuncs);
+    }
+    m_peer.setHashFuncs(hashFuncs);
+    m_syncPeers.setHashFuncs(hashFuncs);
+}
+
+void NetworkSync::enableMappedBlockTree(bool bMapped)
+{
+    if (m_bStarted) throw std::runtime_error("NetworkSync::enableMappedBlockTree() - must be stopped to change block tree.");
+    if (bMapped == m_bMappedBlockTree) return;
+
+    stopFileFlushThread();
+    if (bMapped)    { m_blockTree.reset(new CoinQBlockTreeMapped()); }
+    else            { m_blockTree.reset(new CoinQBlockTreeMem()); }
+    m_blockTree->setHashFuncs(m_coinParams.block_header_hash_funcs());
+    m_bMappedBlockTree = bMapped;
+}
+
+void NetworkSync::enableBlockTreeJournal(bool bEnable, unsigned int compactionSize)
+{
+    m_bBlockTreeJournal = bEnable;
+    m_blockTreeJournalCompactionSize = compactionSize;
+}
+
+void NetworkSync::loadHeaders(const std::string& blockTreeFile, bool bCheckProofOfWork, ICoinQBlockTree::callback_t callback)
 {
     stopFileFlushThread();
     m_blockTreeFile = blockTreeFile;
 
     try
     {
-        m_blockTree.loadFromFile(blockTreeFile, bCheckProofOfWork, callback);
+        m_blockTree->setCheckpoint(m_coinParams.checkpoint_height(), m_coinParams.checkpoint_hash());
+        m_blockTree->enableJournal(m_bBlockTreeJournal, m_blockTreeJournalCompactionSize);
+        m_blockTree->loadFromFile(blockTreeFile, bCheckProofOfWork, callback);
 
         std::stringstream status;
-        status << "Best Height: " << m_blockTree.getBestHeight() << " / " << "Total Work: " << m_blockTree.getTotalWork().getDec();
+        status << "Best Height: " << m_blockTree->getBestHeight() << " / " << "Total Work: " << m_blockTree->getTotalWork().getDec();
         notifyStatus(status.str());
-        notifyAddBestChain(m_blockTree.getHeader(-1));
+        notifyAddBestChain(m_blockTree->getHeader(-1));
         return;
     }
     catch (const std::exception& e)
@@ -465,20 +645,20 @@ void NetworkSync::loadHeaders(const std::string& blockTreeFile, bool bCheckProof
         notifyBlockTreeError(e.what(), -1);
     }
 
-    m_blockTree.clear();
-    m_blockTree.setGenesisBlock(m_coinParams.genesis_block());
+    m_blockTree->clear();
+    m_blockTree->setGenesisBlock(m_coinParams.genesis_block());
     notifyStatus("Block tree file not found. A new one will be created.");
-    notifyAddBestChain(m_blockTree.getHeader(-1));
+    notifyAddBestChain(m_blockTree->getHeader(-1));
 }
 
 int NetworkSync::getBestHeight() const
 {
-    return m_blockTree.getBestHeight();
+    return m_blockTree->getBestHeight();
 }
 
-const bytes_t& NetworkSync::getBestHash() const
+bytes_t NetworkSync::getBestHash() const
 {
-    return m_blockTree.getBestHash();
+    return m_blockTree->getBestHash();
 }
 
 void NetworkSync::syncBlocks(const std::vector<bytes_t>& locatorHashes, uint32_t startTime)
@@ -491,14 +671,14 @@ void NetworkSync::syncBlocks(const std::vector<bytes_t>& locatorHashes, uint32_t
 
     boost::lock_guard<boost::mutex> syncLock(m_syncMutex);
 
-    const ChainHeader* pMostRecentHeader = nullptr;
+    std::unique_ptr<ChainHeader> pMostRecentHeader;
     for (auto& hash: locatorHashes)
     {
         try
         {
-            pMostRecentHeader = &m_blockTree.getHeader(hash);
-            if (pMostRecentHeader && pMostRecentHeader->inBestChain) break;
-            pMostRecentHeader = nullptr;
+            pMostRecentHeader.reset(new ChainHeader(m_blockTree->getHeader(hash)));
+            if (pMostRecentHeader->inBestChain) break;
+            pMostRecentHeader.reset();
         }
         catch (const std::exception& e)
         {
@@ -511,7 +691,7 @@ void NetworkSync::syncBlocks(const std::vector<bytes_t>& locatorHashes, uint32_t
 
     if (pMostRecentHeader)
     {
-        if (m_blockTree.getTipHeight() == pMostRecentHeader->height)
+        if (m_blockTree->getTipHeight() == pMostRecentHeader->height)
         {
             m_lastSynchedMerkleBlockHash = pMostRecentHeader->hash();
             notifyBlocksSynched();
@@ -524,7 +704,7 @@ void NetworkSync::syncBlocks(const std::vector<bytes_t>& locatorHashes, uint32_t
     }
     else
     {
-        startHeight = m_blockTree.getHeaderBefore(startTime).height;
+        startHeight = m_blockTree->getHeaderBefore(startTime).height;
     }
 
     do_syncBlocks(startHeight);
@@ -538,10 +718,27 @@ void NetworkSync::syncBlocks(int startHeight)
 
 void NetworkSync::do_syncBlocks(int startHeight)
 {
+    clearPipeline();
+    m_blocksSynched = 0;
+    m_blockSyncStartTime = m_blockSyncEndTime = std::chrono::steady_clock::now();
     m_lastSynchedMerkleBlockHash.clear();
-    m_lastRequestedMerkleBlockHash = m_blockTree.getHeader(startHeight).hash();
 
-    LOGGER(trace) "Resynching blocks " << startHeight << " - " << m_blockTree.getTipHeight() << endl;
+    if (m_blockWindowSize > 1 || m_syncPeers.peerCount() > 0)
+    {
+        m_lastRequestedMerkleBlockHash.clear();
+        m_bPipelining = true;
+        m_nextRequestHeight = startHeight;
+        m_nextDeliverHeight = startHeight;
+
+        LOGGER(trace) << "Resynching blocks " << startHeight << " - " << m_blockTree->getTipHeight() << " with window size " << m_blockWindowSize << endl;
+        notifySynchingBlocks();
+        requestPipelinedBlocks();
+        return;
+    }
+
+    m_lastRequestedMerkleBlockHash = m_blockTree->getHeader(startHeight).hash();
+
+    LOGGER(trace) "Resynching blocks " << startHeight << " - " << m_blockTree->getTipHeight() << endl;
     notifySynchingBlocks();
 
     LOGGER(trace) << "Asking for filtered block (3) " << m_lastRequestedMerkleBlockHash.getHex() << endl;
@@ -553,9 +750,48 @@ void NetworkSync::stopSynchingBlocks(bool bClearFilter)
     boost::lock_guard<boost::mutex> lock(m_syncMutex);
     m_lastRequestedMerkleBlockHash.clear();
     m_lastSynchedMerkleBlockHash.clear();
+    clearPipeline();
     if (bClearFilter) { clearBloomFilter(); }
 }
 
+void NetworkSync::setBlockWindowSize(unsigned int blockWindowSize)
+{
+    if (blockWindowSize == 0) throw runtime_error("NetworkSync::setBlockWindowSize() - window size must be at least 1.");
+
+    boost::lock_guard<boost::mutex> lock(m_syncMutex);
+    m_blockWindowSize = blockWindowSize;
+}
+
+void NetworkSync::setBlockRangeSize(unsigned int blockRangeSize)
+{
+    if (blockRangeSize == 0) throw runtime_error("NetworkSync::setBlockRangeSize() - range size must be at least 1.");
+
+    boost::lock_guard<boost::mutex> lock(m_syncMutex);
+    m_blockRangeSize = blockRangeSize;
+}
+
+void NetworkSync::setPeerStallTimeout(unsigned int seconds)
+{
+    if (seconds == 0) throw runtime_error("NetworkSync::setPeerStallTimeout() - timeout must be at least 1 second.");
+
+    boost::lock_guard<boost::mutex> lock(m_syncMutex);
+    m_peerStallTimeout = seconds;
+}
+
+unsigned int NetworkSync::getBlocksSynchedCount() const
+{
+    boost::lock_guard<boost::mutex> lock(m_syncMutex);
+    return m_blocksSynched;
+}
+
+double NetworkSync::getBlockSyncRate() const
+{
+    boost::lock_guard<boost::mutex> lock(m_syncMutex);
+    double seconds = std::chrono::duration<double>(m_blockSyncEndTime - m_blockSyncStartTime).count();
+    if (seconds <= 0.0) return 0.0;
+    return m_blocksSynched / seconds;
+}
+
 void NetworkSync::addToMempool(const uchar_vector& txHash)
 {
     boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
@@ -575,9 +811,9 @@ void NetworkSync::insertTx(const Coin::Transaction& tx)
 void NetworkSync::insertMerkleBlock(const Coin::MerkleBlock& merkleBlock, const vector<Coin::Transaction>& txs)
 {
     boost::unique_lock<boost::mutex> fileFlushLock(m_fileFlushMutex);
-    m_blockTree.insertHeader(merkleBlock.blockHeader, m_bCheckProofOfWork);
+    m_blockTree->insertHeader(merkleBlock.blockHeader, m_bCheckProofOfWork);
 
-    const ChainHeader& merkleHeader = m_blockTree.getHeader(merkleBlock.hash());
+    const ChainHeader& merkleHeader = m_blockTree->getHeader(merkleBlock.hash());
 
     fileFlushLock.unlock();
     m_fileFlushCond.notify_one();
@@ -624,9 +860,20 @@ void NetworkSync::start(const std::string& host, const std::string& port)
         std::string port_ = port.empty() ? m_coinParams.default_port() : port;
         m_peer.set(host, port_, m_coinParams.magic_bytes(), m_coinParams.protocol_version(), "Wallet v0.1", 0, false);
 
+        {
+            boost::lock_guard<boost::mutex> syncLock(m_syncMutex);
+            m_syncPeerStates.clear();
+            SyncPeerState& state = m_syncPeerStates[m_peer.name()];
+            state.stats.name = m_peer.name();
+            state.startTime = std::chrono::steady_clock::now();
+        }
+
         LOGGER(trace) << "Starting peer " << host << ":" << port_ << "..." << endl;
         m_peer.start();
         LOGGER(trace) << "Peer started." << endl;
+
+        m_syncPeers.start();
+        for (auto& address: m_syncPeerAddresses) { connectSyncPeer(address.first, address.second); }
     }
 
     notifyStarted();
@@ -647,6 +894,9 @@ void NetworkSync::stop()
         if (!m_bStarted) return;
 
         m_bConnected = false;
+        m_bBloomFilterLoaded = false;
+        m_stallTimer.cancel();
+        m_syncPeers.stop();
         m_peer.stop();
         stopIOServiceThread();
         stopFileFlushThread();
@@ -655,11 +905,64 @@ void NetworkSync::stop()
         m_bHeadersSynched = false;
         m_lastRequestedMerkleBlockHash.clear();
         while (!m_currentMerkleTxHashes.empty()) { m_currentMerkleTxHashes.pop(); }
+
+        boost::lock_guard<boost::mutex> syncLock(m_syncMutex);
+        clearPipeline();
+        for (auto& item: m_syncPeerStates) { item.second.stats.bConnected = false; }
     }
 
     notifyStopped();
 }
 
+void NetworkSync::addSyncPeer(const std::string& host, const std::string& port)
+{
+    boost::lock_guard<boost::mutex> lock(m_startMutex);
+    m_syncPeerAddresses.push_back(std::make_pair(host, port));
+    if (m_bStarted) { connectSyncPeer(host, port); }
+}
+
+std::vector<SyncPeerStats> NetworkSync::getSyncPeerStats() const
+{
+    std::vector<SyncPeerStats> stats;
+    boost::lock_guard<boost::mutex> syncLock(m_syncMutex);
+    for (auto& item: m_syncPeerStates)
+    {
+        stats.push_back(item.second.stats);
+        stats.back().blocksInFlight = item.second.heights.size();
+    }
+    return stats;
+}
+
+void NetworkSync::connectSyncPeer(const std::string& host, const std::string& port)
+{
+    std::string port_ = port.empty() ? m_coinParams.default_port() : port;
+    std::string name = host + ":" + port_;
+    if (name == m_peer.name() || m_syncPeers.hasPeer(name)) return;
+
+    {
+        boost::lock_guard<boost::mutex> syncLock(m_syncMutex);
+        SyncPeerState& state = m_syncPeerStates[name] = SyncPeerState();
+        state.stats.name = name;
+        state.startTime = std::chrono::steady_clock::now();
+    }
+
+    LOGGER(trace) << "Starting sync peer " << name << "..." << endl;
+    m_syncPeers.createPeer(host, port_, m_coinParams.magic_bytes(), m_coinParams.protocol_version(), "Wallet v0.1", 0, false);
+}
+
+std::shared_ptr<CoinQ::Peer> NetworkSync::getPeer(const std::string& name)
+{
+    // m_peer is not owned by a shared pointer - hand it out with a deleter that does nothing.
+    if (name == m_peer.name()) return std::shared_ptr<CoinQ::Peer>(&m_peer, [](CoinQ::Peer*) { });
+    return m_syncPeers.getPeer(name);
+}
+
+void NetworkSync::sendToAllPeers(Coin::CoinNodeStructure& message)
+{
+    m_peer.send(message);
+    for (auto& peer: m_syncPeers.getPeers()) { peer->send(message); }
+}
+
 void NetworkSync::sendTx(Coin::Transaction& tx)
 {
     m_peer.send(tx); 
@@ -689,18 +992,36 @@ void NetworkSync::getFilteredBlock(const bytes_t& hash)
 void NetworkSync::setBloomFilter(const Coin::BloomFilter& bloomFilter)
 {
     m_bloomFilter = bloomFilter;
+    m_bBloomFilterLoaded = false;
     if (!m_bloomFilter.isSet()) return;
 
     LOGGER(trace) << "Sending new bloom filter to peer." << endl;
     Coin::FilterLoadMessage filterLoad(m_bloomFilter.getNHashFuncs(), m_bloomFilter.getNTweak(), m_bloomFilter.getNFlags(), m_bloomFilter.getFilter());
-    m_peer.send(filterLoad);
+    sendToAllPeers(filterLoad);
+    m_bBloomFilterLoaded = true;
+}
+
+void NetworkSync::addToBloomFilter(const std::vector<bytes_t>& elements)
+{
+    if (!m_bBloomFilterLoaded) throw std::runtime_error("NetworkSync::addToBloomFilter() - bloom filter is not loaded.");
+
+    LOGGER(trace) << "Adding " << elements.size() << " elements to peer bloom filter." << endl;
+    for (auto& element: elements)
+    {
+        m_bloomFilter.insert(element);
+
+        Coin::FilterAddMessage filterAdd;
+        filterAdd.data = element;
+        sendToAllPeers(filterAdd);
+    }
 }
 
 void NetworkSync::clearBloomFilter()
 {
     LOGGER(trace) << "Clearing bloom filter." << endl;
     Coin::FilterClearMessage filterClear;
-    m_peer.send(filterClear);
+    sendToAllPeers(filterClear);
+    m_bBloomFilterLoaded = false;
 }
 
 void NetworkSync::startIOServiceThread()
@@ -764,13 +1085,13 @@ void NetworkSync::fileFlushLoop()
     while (true)
     {
         boost::unique_lock<boost::mutex> lock(m_fileFlushMutex);
-        while (m_bFlushingToFile && m_blockTree.flushed()) { m_fileFlushCond.wait(lock); }
+        while (m_bFlushingToFile && m_blockTree->flushed()) { m_fileFlushCond.wait(lock); }
         if (!m_bFlushingToFile) break;
 
         try
         {
             LOGGER(trace) << "Starting blocktree file flush..." << endl;
-            m_blockTree.flushToFile(m_blockTreeFile);
+            m_blockTree->flushToFile(m_blockTreeFile);
             LOGGER(trace) << "Finished flushing blocktree file." << endl;
         }
         // TODO: use async timer
@@ -797,6 +1118,9 @@ void NetworkSync::syncMerkleBlock(const ChainMerkleBlock& merkleBlock, const Coi
 {
     LOGGER(trace) << "Synchronizing merkle block: " << merkleBlock.hash().getHex() << " height: " << merkleBlock.height << endl;
 
+    m_blocksSynched++;
+    m_blockSyncEndTime = std::chrono::steady_clock::now();
+
     while (!m_currentMerkleTxHashes.empty()) { m_currentMerkleTxHashes.pop(); }
 
     // The byte order of the tx hashes must be reversed when moving between merkle trees and the block chain
@@ -871,7 +1195,7 @@ void NetworkSync::processBlockTx(const Coin::Transaction& tx)
 
         // Once the queue is empty, if we're at the tip signal completion of block sync.
         uchar_vector currentMerkleBlockHash = m_currentMerkleBlock.hash();
-        const ChainHeader& chainTip = m_blockTree.getTip();
+        const ChainHeader& chainTip = m_blockTree->getTip();
         if (chainTip.hash() == currentMerkleBlockHash)
         {
             LOGGER(trace) << "Block sync detected from tx handler." << endl;
@@ -883,7 +1207,7 @@ void NetworkSync::processBlockTx(const Coin::Transaction& tx)
         }
 
         // Ask for the next block
-        const ChainHeader& nextHeader = m_blockTree.getHeader(m_currentMerkleBlock.height + 1);
+        const ChainHeader& nextHeader = m_blockTree->getHeader(m_currentMerkleBlock.height + 1);
         m_lastRequestedMerkleBlockHash = nextHeader.hash();
         LOGGER(trace) << "Asking for filtered block (1) " << m_lastRequestedMerkleBlockHash.getHex() << std::endl;
         
@@ -923,3 +1247,476 @@ void NetworkSync::processMempoolConfirmations()
     }
     LOGGER(trace) << "Done processing mempool confirmations." << endl;
 }
+
+void NetworkSync::clearPipeline()
+{
+    m_bPipelining = false;
+    clearPipelineRequests();
+}
+
+void NetworkSync::clearPipelineRequests()
+{
+    m_pendingMerkleBlocks.clear();
+    m_pendingMerkleBlockHeights.clear();
+    m_pendingMerkleTxHeights.clear();
+    for (auto& item: m_syncPeerStates) { releasePeerHeights(item.second); }
+    m_unassignedHeights.clear();
+}
+
+void NetworkSync::requestPipelinedBlocks()
+{
+    std::vector<std::string> peers = getDownloadPeers();
+    if (peers.empty()) return;
+
+    // A single peer gets the whole window in one request. Several peers take turns getting ranges of consecutive
+    // blocks, fastest first, so the blocks we need soonest go to the fastest peer.
+    unsigned int windowSize = m_blockWindowSize;
+    unsigned int peerLimit = windowSize;
+    unsigned int rangeSize = windowSize;
+    if (peers.size() > 1)
+    {
+        windowSize = std::max<unsigned int>(windowSize, m_blockRangeSize * peers.size());
+        peerLimit = std::max<unsigned int>(m_blockRangeSize, windowSize / peers.size());
+        rangeSize = m_blockRangeSize;
+    }
+
+    int tipHeight = m_blockTree->getTipHeight();
+    auto nextHeight = [&](int& height)
+    {
+        // Blocks taken back from other peers come first, they are the ones holding up delivery.
+        while (!m_unassignedHeights.empty())
+        {
+            height = *m_unassignedHeights.begin();
+            m_unassignedHeights.erase(m_unassignedHeights.begin());
+            auto it = m_pendingMerkleBlocks.find(height);
+            if (it != m_pendingMerkleBlocks.end() && !it->second.bReceived) return true;
+        }
+
+        if (m_pendingMerkleBlocks.size() >= windowSize || m_nextRequestHeight > tipHeight) return false;
+
+        height = m_nextRequestHeight++;
+        m_pendingMerkleBlocks[height];
+        m_pendingMerkleBlockHeights[m_blockTree->getHeader(height).hash()] = height;
+        return true;
+    };
+
+    std::map<std::string, hashvector_t> requests;
+    auto now = std::chrono::steady_clock::now();
+    bool bMore = true;
+    while (bMore)
+    {
+        bMore = false;
+        for (auto& name: peers)
+        {
+            SyncPeerState& state = m_syncPeerStates[name];
+            unsigned int count = 0;
+            int height;
+            while (count < rangeSize && state.heights.size() < peerLimit && nextHeight(height))
+            {
+                if (state.heights.empty()) { state.lastResponseTime = now; }
+                state.heights.insert(height);
+                requests[name].push_back(m_blockTree->getHeader(height).hash());
+                count++;
+            }
+            if (count == rangeSize) { bMore = true; }
+        }
+    }
+
+    for (auto& request: requests)
+    {
+        LOGGER(trace) << "Asking " << request.first << " for " << request.second.size() << " filtered blocks up to height " << (m_nextRequestHeight - 1) << endl;
+        std::shared_ptr<CoinQ::Peer> peer = getPeer(request.first);
+        if (peer) { peer->getFilteredBlocks(request.second); }
+    }
+}
+
+bool NetworkSync::isPipelinedBlockComplete(const PendingMerkleBlock& pending) const
+{
+    if (!pending.bReceived) return false;
+
+    boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
+    for (auto& txHash: pending.txHashes)
+    {
+        if (!pending.txs.count(txHash) && !m_mempoolTxs.count(txHash)) return false;
+    }
+    return true;
+}
+
+void NetworkSync::requestPipelinedBlock(PendingMerkleBlock& pending)
+{
+    if (pending.bMissingTxs) return;
+
+    // Ask the peer that sent the merkle block unless it has gone away.
+    SyncPeerState* state = getSyncPeerState(pending.peerName);
+    std::shared_ptr<CoinQ::Peer> peer = getPeer((state && state->stats.bConnected) ? pending.peerName : getFastestPeer());
+    if (!peer) return;
+
+    // The peer will not resend transactions it thinks we already have - fall back to the full block.
+    pending.bMissingTxs = true;
+    uchar_vector hash = pending.merkleBlock.hash();
+    LOGGER(trace) << "We are missing some transactions for block " << hash.getHex() << " - asking " << peer->name() << " for full block." << endl;
+    peer->getBlock(hash);
+}
+
+void NetworkSync::processPipelinedMerkleBlock(const std::string& peerName, const Coin::MerkleBlock& merkleBlock, const Coin::PartialMerkleTree& merkleTree, boost::unique_lock<boost::mutex>& syncLock)
+{
+    uchar_vector merkleBlockHash = merkleBlock.hash();
+    int height = m_pendingMerkleBlockHeights[merkleBlockHash];
+
+    SyncPeerState* state = getSyncPeerState(peerName);
+    if (state) { recordPeerResponse(*state, merkleBlock.getSize()); }
+
+    const ChainHeader& merkleHeader = m_blockTree->getHeader(merkleBlockHash);
+    if (!merkleHeader.inBestChain || merkleHeader.height != height)
+    {
+        // Headers were reorganized after we sent our requests - start over from the next block we owe subscribers.
+        LOGGER(trace) << "NetworkSync - requested block " << merkleBlockHash.getHex() << " is no longer in best chain. Restarting block download from height " << m_nextDeliverHeight << endl;
+        int restartHeight = m_nextDeliverHeight;
+        clearPipelineRequests();
+        m_nextRequestHeight = restartHeight;
+        requestPipelinedBlocks();
+        return;
+    }
+
+    if (merkleTree.getRootLittleEndian() != merkleHeader.merkleRoot())
+    {
+        // The transactions do not belong to the block in our header chain - get the block from another peer.
+        stringstream err;
+        err << "Merkle root from peer " << peerName << " does not match header chain for block " << merkleBlockHash.getHex() << " height: " << height;
+        LOGGER(error) << "NetworkSync - " << err.str() << endl;
+        if (state)
+        {
+            state->stats.invalidBlocks++;
+            state->stats.bStalled = true;
+            state->heights.erase(height);
+        }
+        if (!m_pendingMerkleBlocks[height].bReceived) { m_unassignedHeights.insert(height); }
+        if (peerName != m_peer.name()) { m_ioService.post([this, peerName]() { m_syncPeers.deletePeer(peerName); }); }
+        requestPipelinedBlocks();
+        throw runtime_error(err.str());
+    }
+
+    LOGGER(trace) << "Received pipelined merkle block from " << peerName << ": " << merkleBlockHash.getHex() << " height: " << height << endl;
+
+    // Transactions for a block are streamed right after its merkle block, so the streams of all blocks this peer sent earlier are closed now.
+    for (auto& item: m_pendingMerkleBlocks)
+    {
+        if (item.first == height) continue;
+        PendingMerkleBlock& other = item.second;
+        if (other.bReceived && other.peerName == peerName && !isPipelinedBlockComplete(other)) { requestPipelinedBlock(other); }
+    }
+
+    PendingMerkleBlock& pending = m_pendingMerkleBlocks[height];
+    if (pending.bReceived) return; // duplicate
+
+    pending.bReceived = true;
+    pending.peerName = peerName;
+    pending.merkleBlock = ChainMerkleBlock(merkleBlock, true, merkleHeader.height, merkleHeader.chainWork);
+
+    // The block may have been requested from more than one peer - none of them owe it anymore.
+    for (auto& item: m_syncPeerStates) { item.second.heights.erase(height); }
+    m_unassignedHeights.erase(height);
+    if (state)
+    {
+        state->stats.blocksReceived++;
+        state->updateBlockRate();
+    }
+
+    // The byte order of the tx hashes must be reversed when moving between merkle trees and the block chain
+    for (auto& reversedTxHash: merkleTree.getTxHashes())
+    {
+        uchar_vector txHash = reversedTxHash.getReverse();
+        pending.txHashes.push_back(txHash);
+        m_pendingMerkleTxHeights[txHash] = height;
+    }
+
+    deliverPipelinedBlocks(syncLock);
+}
+
+void NetworkSync::processPipelinedTx(const std::string& peerName, const Coin::Transaction& tx, boost::unique_lock<boost::mutex>& syncLock)
+{
+    uchar_vector txHash = tx.hash();
+    int height = m_pendingMerkleTxHeights[txHash];
+    LOGGER(trace) << "NetworkSync::processPipelinedTx(" << txHash.getHex() << ") height: " << height << endl;
+
+    SyncPeerState* state = getSyncPeerState(peerName);
+    if (state) { recordPeerResponse(*state, tx.getSize()); }
+
+    try
+    {
+        PendingMerkleBlock& pending = m_pendingMerkleBlocks[height];
+        pending.txs[txHash] = tx;
+
+        // Transactions are streamed in block order so anything before this one that we neither received nor have in our mempool is missing.
+        {
+            boost::unique_lock<boost::mutex> mempoolLock(m_mempoolMutex);
+            for (auto& hash: pending.txHashes)
+            {
+                if (hash == txHash) break;
+                if (!pending.txs.count(hash) && !m_mempoolTxs.count(hash))
+                {
+                    mempoolLock.unlock();
+                    requestPipelinedBlock(pending);
+                    break;
+                }
+            }
+        }
+
+        deliverPipelinedBlocks(syncLock);
+    }
+    catch (const exception& e)
+    {
+        LOGGER(error) << "Protocol error processing merkle transactions: " << e.what() << endl;
+        if (syncLock.owns_lock()) { syncLock.unlock(); }
+        // TODO: propagate code
+        notifyProtocolError(e.what(), -1);
+    }
+}
+
+bool NetworkSync::processPipelinedBlock(const Coin::CoinBlock& block, boost::unique_lock<boost::mutex>& syncLock)
+{
+    auto it = m_pendingMerkleBlockHeights.find(block.hash());
+    if (it == m_pendingMerkleBlockHeights.end()) return false;
+
+    PendingMerkleBlock& pending = m_pendingMerkleBlocks[it->second];
+    if (!pending.bMissingTxs) return false;
+
+    LOGGER(trace) << "Processing " << block.txs.size() << " block transactions for pipelined block at height " << it->second << "..." << endl;
+    for (auto& tx: block.txs)
+    {
+        uchar_vector txHash = tx.hash();
+        if (m_pendingMerkleTxHeights.count(txHash) && m_pendingMerkleTxHeights[txHash] == it->second) { pending.txs[txHash] = tx; }
+    }
+
+    if (pending.txs.size() != pending.txHashes.size())
+    {
+        // In principle this should never happen. If it does we missed some earlier check.
+        throw runtime_error("Block is missing some transactions.");
+    }
+
+    pending.bMissingTxs = false;
+    deliverPipelinedBlocks(syncLock);
+    return true;
+}
+
+void NetworkSync::deliverPipelinedBlocks(boost::unique_lock<boost::mutex>& syncLock)
+{
+    while (!m_pendingMerkleBlocks.empty())
+    {
+        auto it = m_pendingMerkleBlocks.begin();
+        PendingMerkleBlock& pending = it->second;
+        if (it->first != m_nextDeliverHeight || !isPipelinedBlockComplete(pending)) break;
+
+        const ChainMerkleBlock& merkleBlock = pending.merkleBlock;
+        unsigned int txCount = pending.txHashes.size();
+        LOGGER(trace) << "Delivering pipelined merkle block: " << merkleBlock.hash().getHex() << " height: " << merkleBlock.height << " txs: " << txCount << endl;
+
+        if (txCount == 0)
+        {
+            notifyMerkleBlock(merkleBlock);
+        }
+        else
+        {
+            for (unsigned int i = 0; i < txCount; i++)
+            {
+                const bytes_t& txHash = pending.txHashes[i];
+                auto txIt = pending.txs.find(txHash);
+                if (txIt != pending.txs.end())
+                {
+                    notifyMerkleTx(merkleBlock, txIt->second, i, txCount);
+                }
+                else
+                {
+                    notifyTxConfirmed(merkleBlock, txHash, i, txCount);
+                }
+
+                boost::lock_guard<boost::mutex> mempoolLock(m_mempoolMutex);
+                m_mempoolTxs.erase(txHash);
+            }
+        }
+
+        for (auto& txHash: pending.txHashes) { m_pendingMerkleTxHeights.erase(txHash); }
+        m_lastSynchedMerkleBlockHash = merkleBlock.hash();
+        m_pendingMerkleBlockHeights.erase(m_lastSynchedMerkleBlockHash);
+        m_pendingMerkleBlocks.erase(it);
+        m_nextDeliverHeight++;
+        m_blocksSynched++;
+        m_blockSyncEndTime = std::chrono::steady_clock::now();
+    }
+
+    if (m_pendingMerkleBlocks.empty() && m_nextRequestHeight > m_blockTree->getTipHeight())
+    {
+        LOGGER(trace) << "Block sync detected from pipelined block handler." << endl;
+        double seconds = std::chrono::duration<double>(m_blockSyncEndTime - m_blockSyncStartTime).count();
+        LOGGER(debug) << "Synched " << m_blocksSynched << " blocks in " << seconds << " seconds." << endl;
+        clearPipeline();
+        syncLock.unlock();
+        notifyBlocksSynched();
+        return;
+    }
+
+    try
+    {
+        requestPipelinedBlocks();
+    }
+    catch (const exception& e)
+    {
+        // TODO: Propagate code
+        syncLock.unlock();
+        notifyConnectionError(e.what(), -1);
+    }
+}
+
+std::vector<std::string> NetworkSync::getDownloadPeers() const
+{
+    std::vector<const SyncPeerStats*> peers;
+    for (auto& item: m_syncPeerStates)
+    {
+        if (item.second.stats.bConnected) { peers.push_back(&item.second.stats); }
+    }
+
+    std::sort(peers.begin(), peers.end(), [](const SyncPeerStats* a, const SyncPeerStats* b) { return isFasterPeer(*a, *b); });
+
+    // Stalled peers sort last and only get requests when there is no one else.
+    std::vector<std::string> names;
+    for (auto& peer: peers)
+    {
+        if (peer->bStalled && !names.empty()) break;
+        names.push_back(peer->name);
+    }
+    return names;
+}
+
+std::string NetworkSync::getFastestPeer() const
+{
+    std::vector<std::string> peers = getDownloadPeers();
+    return peers.empty() ? m_peer.name() : peers.front();
+}
+
+NetworkSync::SyncPeerState* NetworkSync::getSyncPeerState(const std::string& name)
+{
+    auto it = m_syncPeerStates.find(name);
+    return it == m_syncPeerStates.end() ? nullptr : &it->second;
+}
+
+void NetworkSync::recordPeerResponse(SyncPeerState& state, uint64_t bytes)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (!state.heights.empty()) { state.busyTime += now - state.lastResponseTime; }
+    state.lastResponseTime = now;
+    state.stats.bytesReceived += bytes;
+    state.stats.bStalled = false;
+    state.updateBlockRate();
+}
+
+void NetworkSync::releasePeerHeights(SyncPeerState& state)
+{
+    if (state.heights.empty()) return;
+
+    state.busyTime += std::chrono::steady_clock::now() - state.lastResponseTime;
+    state.updateBlockRate();
+    m_unassignedHeights.insert(state.heights.begin(), state.heights.end());
+    state.heights.clear();
+}
+
+void NetworkSync::openSyncPeer(const std::string& name)
+{
+    boost::lock_guard<boost::mutex> syncLock(m_syncMutex);
+    SyncPeerState& state = m_syncPeerStates[name];
+    state.stats.name = name;
+    state.stats.bConnected = true;
+    state.lastResponseTime = std::chrono::steady_clock::now();
+    state.stats.connectLatency = std::chrono::duration<double>(state.lastResponseTime - state.startTime).count();
+
+    if (m_bPipelining) { requestPipelinedBlocks(); }
+}
+
+void NetworkSync::closeSyncPeer(const std::string& name)
+{
+    boost::lock_guard<boost::mutex> syncLock(m_syncMutex);
+    SyncPeerState* state = getSyncPeerState(name);
+    if (!state || !state->stats.bConnected) return;
+
+    state->stats.bConnected = false;
+    releasePeerHeights(*state);
+    if (!m_bConnected || !m_bPipelining) return;
+
+    LOGGER(debug) << "NetworkSync - sync peer " << name << " closed. Reassigning " << m_unassignedHeights.size() << " blocks." << endl;
+    try
+    {
+        // Full blocks asked of this peer will not come either.
+        for (auto& item: m_pendingMerkleBlocks)
+        {
+            PendingMerkleBlock& pending = item.second;
+            if (!pending.bReceived || pending.peerName != name || isPipelinedBlockComplete(pending)) continue;
+            pending.bMissingTxs = false;
+            requestPipelinedBlock(pending);
+        }
+
+        requestPipelinedBlocks();
+    }
+    catch (const exception& e)
+    {
+        LOGGER(error) << "NetworkSync - error reassigning blocks: " << e.what() << endl;
+    }
+}
+
+void NetworkSync::checkStalledPeers()
+{
+    auto now = std::chrono::steady_clock::now();
+    auto timeout = std::chrono::seconds(m_peerStallTimeout);
+
+    // Taking blocks back only helps if there is another peer to give them to.
+    unsigned int connectedPeers = 0;
+    for (auto& item: m_syncPeerStates) { if (item.second.stats.bConnected) connectedPeers++; }
+
+    if (connectedPeers > 1)
+    {
+        for (auto& item: m_syncPeerStates)
+        {
+            SyncPeerState& state = item.second;
+            if (!state.stats.bConnected || state.heights.empty() || now - state.lastResponseTime < timeout) continue;
+
+            LOGGER(debug) << "NetworkSync - peer " << item.first << " stalled with " << state.heights.size() << " blocks in flight. Reassigning them." << endl;
+            state.stats.stalls++;
+            state.stats.bStalled = true;
+            releasePeerHeights(state);
+        }
+    }
+
+    // A missing transaction is otherwise only noticed once the same peer sends another merkle block.
+    for (auto& item: m_pendingMerkleBlocks)
+    {
+        PendingMerkleBlock& pending = item.second;
+        if (!pending.bReceived || pending.bMissingTxs) continue;
+
+        SyncPeerState* state = getSyncPeerState(pending.peerName);
+        if (state && state->stats.bConnected && now - state->lastResponseTime < timeout) continue;
+        if (!isPipelinedBlockComplete(pending)) { requestPipelinedBlock(pending); }
+    }
+
+    requestPipelinedBlocks();
+}
+
+void NetworkSync::startStallTimer()
+{
+    m_stallTimer.expires_from_now(boost::posix_time::seconds(1));
+    m_stallTimer.async_wait([this](const boost::system::error_code& ec)
+    {
+        if (ec == boost::asio::error::operation_aborted || !m_bConnected) return;
+
+        try
+        {
+            boost::lock_guard<boost::mutex> syncLock(m_syncMutex);
+            if (m_bPipelining) { checkStalledPeers(); }
+        }
+        catch (const exception& e)
+        {
+            LOGGER(error) << "NetworkSync - stall check error: " << e.what() << endl;
+            // TODO: Propagate code
+            notifyConnectionError(e.what(), -1);
+        }
+
+        startStallTimer();
+    });
+}
@@ -16,7 +16,9 @@
 #endif
 
 #include "CoinQ_peer_io.h"
+#include "CoinQ_peermanager.h"
 #include "CoinQ_blocks.h"
+#include "CoinQ_blocks_mapped.h"
 #include "CoinQ_filter.h"
 
 #include "CoinQ_signals.h"
@@ -31,6 +33,9 @@
 #include <CoinCore/BloomFilter.h>
 
 #include <queue>
+#include <map>
+#include <set>
+#include <chrono>
 
 typedef Coin::Transaction coin_tx_t;
 typedef ChainHeader chain_header_t;
@@ -50,6 +55,32 @@ namespace CoinQ
 typedef std::function<void(const ChainMerkleBlock&, const Coin::Transaction&, unsigned int /*txindex*/, unsigned int /*txcount*/)> merkle_tx_slot_t;
 typedef std::function<void(const ChainMerkleBlock&, const bytes_t& /*txhash*/ , unsigned int /*txindex*/, unsigned int /*txcount*/)> tx_confirmed_slot_t;
 
+// Number of filtered blocks kept in flight during block sync. A window of 1 is stop-and-wait.
+const unsigned int DEFAULT_BLOCK_WINDOW_SIZE = 1;
+
+// Number of consecutive filtered blocks requested from one peer at a time when downloading from several peers.
+const unsigned int DEFAULT_BLOCK_RANGE_SIZE = 16;
+
+// Seconds a peer may leave requested blocks unanswered before they are reassigned to other peers.
+const unsigned int DEFAULT_PEER_STALL_TIMEOUT = 10;
+
+// Block download statistics for one peer.
+struct SyncPeerStats
+{
+    SyncPeerStats() : bConnected(false), bStalled(false), blocksInFlight(0), blocksReceived(0), bytesReceived(0), stalls(0), invalidBlocks(0), connectLatency(0.0), blockRate(0.0) { }
+
+    std::string     name;
+    bool            bConnected;
+    bool            bStalled;       // gets no new requests until it answers again
+    unsigned int    blocksInFlight;
+    unsigned int    blocksReceived;
+    uint64_t        bytesReceived;  // merkle block and transaction payloads
+    unsigned int    stalls;         // times its requests were reassigned
+    unsigned int    invalidBlocks;  // merkle blocks that did not match the header chain
+    double          connectLatency; // seconds to complete the handshake
+    double          blockRate;      // blocks/s while it had requests outstanding
+};
+
 class NetworkSync
 {
 public:
@@ -61,14 +92,24 @@ public:
 
     void enableCheckProofOfWork(bool bCheckProofOfWork = true) { m_bCheckProofOfWork = bCheckProofOfWork; }
 
-    void loadHeaders(const std::string& blockTreeFile, bool bCheckProofOfWork = true, CoinQBlockTreeMem::callback_t callback = nullptr);
+    // Keeps headers in a memory-mapped record file next to the blocktree file instead of in memory.
+    // Must be called before loadHeaders().
+    void enableMappedBlockTree(bool bMapped = true);
+    bool isMappedBlockTreeEnabled() const { return m_bMappedBlockTree; }
+
+    // Appends new best chain headers to a journal next to the blocktree file between full rewrites.
+    // Takes effect on the next loadHeaders().
+    void enableBlockTreeJournal(bool bEnable = true, unsigned int compactionSize = DEFAULT_BLOCKTREE_JOURNAL_COMPACTION_SIZE);
+    bool isBlockTreeJournalEnabled() const { return m_bBlockTreeJournal; }
+
+    void loadHeaders(const std::string& blockTreeFile, bool bCheckProofOfWork = true, ICoinQBlockTree::callback_t callback = nullptr);
     bool headersSynched() const { return m_bHeadersSynched; }
     int getBestHeight() const;
-    const bytes_t& getBestHash() const;
-    const ChainHeader& getBestHeader() const { return m_blockTree.getHeader(-1); }
-    const ChainHeader& getHeader(const bytes_t& hash) const { return m_blockTree.getHeader(hash); }
-    const ChainHeader& getHeader(int height) const { return m_blockTree.getHeader(height); }
-    const ChainHeader& getHeaderBefore(uint32_t timestamp) const { return m_blockTree.getHeaderBefore(timestamp); }
+    bytes_t getBestHash() const;
+    ChainHeader getBestHeader() const { return m_blockTree->getHeader(-1); }
+    ChainHeader getHeader(const bytes_t& hash) const { return m_blockTree->getHeader(hash); }
+    ChainHeader getHeader(int height) const { return m_blockTree->getHeader(height); }
+    ChainHeader getHeaderBefore(uint32_t timestamp) const { return m_blockTree->getHeaderBefore(timestamp); }
 
 /*
     void start();
@@ -80,13 +121,39 @@ public:
     void stop();
     bool connected() const { return m_bConnected; }
 
+    // Connects to an additional peer that shares filtered block downloads with the peer passed to start().
+    // Headers are fetched from whichever peer is fastest. Peers added before start() are connected by start().
+    void addSyncPeer(const std::string& host, const std::string& port = "");
+    std::vector<SyncPeerStats> getSyncPeerStats() const;
+
+    // Maximum number of consecutive blocks requested from one peer in a single getdata when using several peers.
+    void setBlockRangeSize(unsigned int blockRangeSize);
+    unsigned int getBlockRangeSize() const { return m_blockRangeSize; }
+
+    // Blocks a peer has not delivered within this many seconds of its last response are requested from other peers.
+    void setPeerStallTimeout(unsigned int seconds);
+    unsigned int getPeerStallTimeout() const { return m_peerStallTimeout; }
+
     void setBloomFilter(const Coin::BloomFilter& bloomFilter);
     void clearBloomFilter();
 
+    // Inserts elements into the current filter and sends them to the peer via filteradd so the filter need not be reloaded.
+    void addToBloomFilter(const std::vector<bytes_t>& elements);
+    bool isBloomFilterLoaded() const { return m_bBloomFilterLoaded; }
+
     void syncBlocks(const std::vector<bytes_t>& locatorHashes, uint32_t startTime);
     void syncBlocks(int startHeight);
     void stopSynchingBlocks(bool bClearFilter = true);
 
+    // Maximum number of MSG_FILTERED_BLOCK requests outstanding during block sync. With sync peers the window
+    // is at least one block range per peer. Blocks are still delivered to subscribers strictly in height order.
+    void setBlockWindowSize(unsigned int blockWindowSize);
+    unsigned int getBlockWindowSize() const { return m_blockWindowSize; }
+
+    // Blocks delivered since the last call to syncBlocks() and the resulting throughput.
+    unsigned int getBlocksSynchedCount() const;
+    double getBlockSyncRate() const; // blocks/s
+
     // TRANSACTIONS PUSHED OFF CHAIN MUST BE ADDED BACK TO MEMPOOL
     void addToMempool(const uchar_vector& txHash);
 
@@ -135,6 +202,9 @@ private:
     CoinQ::CoinParams m_coinParams;
     bool m_bCheckProofOfWork;
 
+    // Gives the block tree and peers the hash functions of m_coinParams, clearing the tree if they change.
+    void setHashFuncs();
+
     bool m_bStarted;
     boost::mutex m_startMutex;
 
@@ -149,6 +219,13 @@ private:
     bool m_bConnected;
     CoinQ::Peer m_peer;
 
+    // Additional block download peers share m_ioService with m_peer so all peer events are handled on one thread.
+    CoinQ::PeerManager m_syncPeers;
+    std::vector<std::pair<std::string, std::string>> m_syncPeerAddresses;
+    void connectSyncPeer(const std::string& host, const std::string& port);
+    std::shared_ptr<CoinQ::Peer> getPeer(const std::string& name);
+    void sendToAllPeers(Coin::CoinNodeStructure& message);
+
     bool m_bFlushingToFile;
     boost::mutex m_fileFlushMutex;
     boost::condition_variable m_fileFlushCond;
@@ -159,7 +236,10 @@ private:
 
     mutable boost::mutex m_syncMutex;
     std::string m_blockTreeFile;
-    CoinQBlockTreeMem m_blockTree;
+    std::unique_ptr<ICoinQBlockTree> m_blockTree;
+    bool m_bMappedBlockTree;
+    bool m_bBlockTreeJournal;
+    unsigned int m_blockTreeJournalCompactionSize;
     bool m_blockTreeLoaded;
     bool m_bHeadersSynched;
 
@@ -170,6 +250,7 @@ private:
     void do_syncBlocks(int startHeight);
 
     Coin::BloomFilter m_bloomFilter;
+    bool m_bBloomFilterLoaded;
 
     void initBlockFilter();
 
@@ -186,6 +267,75 @@ private:
     void processBlockTx(const Coin::Transaction& tx);
     void processMempoolConfirmations();
 
+    // Pipelined merkle block state - all members below are guarded by m_syncMutex
+    struct PendingMerkleBlock
+    {
+        PendingMerkleBlock() : bReceived(false), bMissingTxs(false) { }
+
+        bool                                    bReceived;
+        bool                                    bMissingTxs;
+        std::string                             peerName;   // peer the merkle block came from
+        ChainMerkleBlock                        merkleBlock;
+        std::vector<bytes_t>                    txHashes;
+        std::map<bytes_t, Coin::Transaction>    txs;
+    };
+
+    unsigned int m_blockWindowSize;
+    bool m_bPipelining;
+    int m_nextRequestHeight;
+    int m_nextDeliverHeight;
+    std::map<int, PendingMerkleBlock> m_pendingMerkleBlocks;    // reorder buffer keyed by height
+    std::map<bytes_t, int> m_pendingMerkleBlockHeights;         // block hash -> height
+    std::map<bytes_t, int> m_pendingMerkleTxHeights;            // tx hash -> height
+    std::set<int> m_unassignedHeights;                          // pending blocks taken back from stalled or closed peers
+
+    // Download peer state keyed by peer name, including m_peer - also guarded by m_syncMutex
+    struct SyncPeerState
+    {
+        SyncPeerState() : busyTime(0) { }
+
+        void updateBlockRate()
+        {
+            double seconds = std::chrono::duration<double>(busyTime).count();
+            stats.blockRate = seconds > 0.0 ? stats.blocksReceived / seconds : 0.0;
+        }
+
+        SyncPeerStats                           stats;
+        std::set<int>                           heights;    // requested blocks not yet received
+        std::chrono::steady_clock::time_point   startTime;
+        std::chrono::steady_clock::time_point   lastResponseTime;
+        std::chrono::steady_clock::duration     busyTime;   // time spent with requests outstanding
+    };
+
+    std::map<std::string, SyncPeerState> m_syncPeerStates;
+    unsigned int m_blockRangeSize;
+    unsigned int m_peerStallTimeout;
+    boost::asio::deadline_timer m_stallTimer;
+
+    unsigned int m_blocksSynched;
+    std::chrono::steady_clock::time_point m_blockSyncStartTime;
+    std::chrono::steady_clock::time_point m_blockSyncEndTime;
+
+    void clearPipeline();
+    void clearPipelineRequests();
+    void requestPipelinedBlocks();
+    bool isPipelinedBlockComplete(const PendingMerkleBlock& pending) const;
+    void requestPipelinedBlock(PendingMerkleBlock& pending);
+    void processPipelinedMerkleBlock(const std::string& peerName, const Coin::MerkleBlock& merkleBlock, const Coin::PartialMerkleTree& merkleTree, boost::unique_lock<boost::mutex>& syncLock);
+    void processPipelinedTx(const std::string& peerName, const Coin::Transaction& tx, boost::unique_lock<boost::mutex>& syncLock);
+    bool processPipelinedBlock(const Coin::CoinBlock& block, boost::unique_lock<boost::mutex>& syncLock);
+    void deliverPipelinedBlocks(boost::unique_lock<boost::mutex>& syncLock);
+
+    std::vector<std::string> getDownloadPeers() const; // fastest first
+    std::string getFastestPeer() const;
+    SyncPeerState* getSyncPeerState(const std::string& name);
+    void recordPeerResponse(SyncPeerState& state, uint64_t bytes);
+    void releasePeerHeights(SyncPeerState& state);
+    void openSyncPeer(const std::string& name);
+    void closeSyncPeer(const std::string& name);
+    void checkStalledPeers();
+    void startStallTimer();
+
     // Sync signals
     CoinQSignal<void> notifyStarted;
     CoinQSignal<void> notifyStopped;
@@ -50,10 +50,9 @@ void Peer::do_handshake()
 
 void Peer::do_read()
 {
-    LOGGER(trace) << "Peer::do_read() - waiting for " << min_read_bytes << " bytes..." << endl;
-    boost::asio::async_read(socket_, boost::asio::buffer(read_buffer, READ_BUFFER_SIZE),
-        //boost::asio::transfer_at_least(MIN_MESSAGE_HEADER_SIZE),
-        boost::asio::transfer_at_least(min_read_bytes),
+    LOGGER(trace) << "Peer::do_read() - waiting for " << framer_.minReadBytes() << " bytes..." << endl;
+    boost::asio::async_read(socket_, boost::asio::buffer(framer_.readBuffer(), framer_.readBufferSize()),
+        boost::asio::transfer_at_least(framer_.minReadBytes()),
     strand_.wrap([this](const boost::system::error_code& ec, std::size_t bytes_read) {
         if (!bRunning) return;
 
@@ -61,7 +60,7 @@ void Peer::do_read()
         {
             if (ec == boost::asio::error::operation_aborted) return;
 
-            read_message.clear();
+            framer_.clear();
             do_stop();
 
             stringstream err;
@@ -71,56 +70,20 @@ void Peer::do_read()
             return;
         }
 
-        read_message += uchar_vector(read_buffer, bytes_read);
+        framer_.commit(bytes_read);
 
         while (true)
         {
-            if (read_message.size() < MIN_MESSAGE_HEADER_SIZE)
-            {
-                min_read_bytes = MIN_MESSAGE_HEADER_SIZE - read_message.size();
-                break;
-            }
-
-            // Find the first occurrence of the magic bytes, discard anything before it.
-            // If magic bytes are not found, read new buffer. 
             // TODO: detect misbehaving node and disconnect.
-            uchar_vector::iterator it = std::search(read_message.begin(), read_message.end(), magic_bytes_vector_.begin(), magic_bytes_vector_.end());
-            if (it == read_message.end())
-            {
-                read_message.clear();
-                min_read_bytes = MIN_MESSAGE_HEADER_SIZE;
-                break;
-            }
-
-            read_message.assign(it, read_message.end());
-            if (read_message.size() < MIN_MESSAGE_HEADER_SIZE)
-            {
-                min_read_bytes = MIN_MESSAGE_HEADER_SIZE - read_message.size();
-                break;
-            }
-
-            // Get command
-            unsigned char command[13];
-            command[12] = 0;
-            uchar_vector(read_message.begin() + 4, read_message.begin() + 16).copyToArray(command);
-            LOGGER(debug) << "Peer read handler - command: " << command << endl;
-
-            // Get payload size
-            unsigned int payloadSize = vch_to_uint<uint32_t>(uchar_vector(read_message.begin() + 16, read_message.begin() + 20), LITTLE_ENDIAN_);
-            LOGGER(debug) << "Peer read handler - payload size: " << payloadSize << endl;
-            LOGGER(debug) << "Peer read handler - read_message size: " << read_message.size() << endl;
-
-            if (read_message.size() < MIN_MESSAGE_HEADER_SIZE  + payloadSize)
-            {
-                min_read_bytes = MIN_MESSAGE_HEADER_SIZE + payloadSize - read_message.size();
-                break;
-            }
-
+            MessageFramer::Message message;
             try
             {
-                Coin::CoinNodeMessage peerMessage(read_message);
+                if (!framer_.next(message)) break;
 
-                if (!peerMessage.isChecksumValid()) throw std::runtime_error("Invalid checksum.");
+                LOGGER(debug) << "Peer read handler - command: " << std::string(message.header.command, strnlen(message.header.command, 12)) << endl;
+                LOGGER(debug) << "Peer read handler - payload size: " << message.header.length << endl;
+
+                Coin::CoinNodeMessage peerMessage(message.header, message.payload);
 
                 std::string command = peerMessage.getCommand();
                 if (command == "verack") {
@@ -164,6 +127,7 @@ void Peer::do_read()
                     LOGGER(trace) << "Peer read handler - BLOCK" << std::endl;
 
                     Coin::CoinBlock* pBlock = static_cast<Coin::CoinBlock*>(peerMessage.getPayload());
+                    pBlock->blockHeader.setHashFuncs(hashFuncs_);
                     notifyBlock(*this, *pBlock);
                 }
                 else if (command == "merkleblock")
@@ -171,6 +135,7 @@ void Peer::do_read()
                     LOGGER(trace) << "Peer read handler - MERKLEBLOCK" << std::endl;
 
                     Coin::MerkleBlock* pMerkleBlock = static_cast<Coin::MerkleBlock*>(peerMessage.getPayload());
+                    pMerkleBlock->blockHeader.setHashFuncs(hashFuncs_);
                     notifyMerkleBlock(*this, *pMerkleBlock);
                 }
                 else if (command == "addr")
@@ -185,6 +150,7 @@ void Peer::do_read()
                     LOGGER(trace) << "Peer read handler - HEADERS" << std::endl;
 
                     Coin::HeadersMessage* pHeaders = static_cast<Coin::HeadersMessage*>(peerMessage.getPayload());
+                    for (auto& header: pHeaders->headers) { header.setHashFuncs(hashFuncs_); }
                     notifyHeaders(*this, *pHeaders);
                 }
                 else if (command == "ping")
@@ -213,11 +179,7 @@ void Peer::do_read()
                 err << "Message decode error: " << e.what();
                 LOGGER(error) << "Peer read handler error: " << err.str() << std::endl;
                 notifyProtocolError(*this, err.str(), -1);
-                min_read_bytes = MIN_MESSAGE_HEADER_SIZE;
             }
-
-            read_message.assign(read_message.begin() + MIN_MESSAGE_HEADER_SIZE + payloadSize, read_message.end());
-            LOGGER(debug) << "Peer read handler - remaining message bytes: " << read_message.size() << endl;
         }
 
         do_read();
@@ -315,8 +277,7 @@ void Peer::start()
     bRunning = true;
     bHandshakeComplete = false;
     bWriteReady = false;
-    read_message.clear();
-    min_read_bytes = MIN_MESSAGE_HEADER_SIZE;
+    framer_.clear();
 
     tcp::resolver::query query(host_, port_);
 
@@ -360,6 +321,7 @@ void Peer::stop()
         }
 
         socket_.close();
+        timer_.cancel();
         do_clearSendQueue();
         bHandshakeComplete = false;
         bWriteReady = false;
@@ -13,6 +13,7 @@
 
 #include "CoinQ_signals.h"
 #include "CoinQ_slots.h"
+#include "CoinQ_framer.h"
 
 #include <CoinCore/typedefs.h>
 #include <CoinCore/numericdata.h>
@@ -79,9 +80,10 @@ public:
         start_height_(start_height),
         relay_(relay),
         invFlags_(invFlags),
-        bRunning(false)
+        hashFuncs_(Coin::CoinBlockHeader::getDefaultHashFuncs()),
+        bRunning(false),
+        framer_(magic_bytes)
     {
-        magic_bytes_vector_ = uint_to_vch(magic_bytes_, LITTLE_ENDIAN_);
     }
 
     ~Peer() { stop(); }
@@ -97,11 +99,15 @@ public:
         start_height_ = start_height;
         relay_ = relay;
 
-        magic_bytes_vector_ = uint_to_vch(magic_bytes_, LITTLE_ENDIAN_);
+        framer_.setMagicBytes(magic_bytes_);
     }
 
     void setInvFlags(uint32_t invFlags) { invFlags_ = invFlags; }
 
+    // Hash functions given to the headers of received headers, block and merkleblock messages.
+    void setHashFuncs(const Coin::header_hashfuncs_t& hashFuncs) { hashFuncs_ = hashFuncs; }
+    const Coin::header_hashfuncs_t& getHashFuncs() const { return hashFuncs_; }
+
     void subscribeMessage(peer_message_slot_t slot) { notifyMessage.connect(slot); }
     void subscribeHeaders(peer_headers_slot_t slot) { notifyHeaders.connect(slot); }
     void subscribeBlock(peer_block_slot_t slot) { notifyBlock.connect(slot); }
@@ -210,6 +216,29 @@ public:
         send(getData);
     }
 
+    void getFilteredBlocks(const hashvector_t& blockhashes)
+    {
+        using namespace Coin;
+
+        if (blockhashes.empty()) return;
+        Inventory inv;
+        for (auto& hash: blockhashes)
+        {
+            if (hash.size() != 32)
+            {
+                std::stringstream err;
+                err << "Invalid block hash requested: " << uchar_vector(hash).getHex();
+                LOGGER(error) << "Peer::getFilteredBlocks() - " << err.str() << std::endl;
+                notifyProtocolError(*this, err.str(), -1);
+                return;
+            }
+
+            inv.addItem(InventoryItem(MSG_FILTERED_BLOCK | invFlags_, hash));
+        }
+        GetDataMessage getData(inv);
+        send(getData);
+    }
+
     void getHeaders(const std::vector<uchar_vector>& locatorHashes, const uchar_vector& hashStop = g_zero32bytes)
     {
         for (auto& hash: locatorHashes)
@@ -304,7 +333,6 @@ private:
     std::string port_;
 
     uint32_t magic_bytes_;
-    uchar_vector magic_bytes_vector_;
     uint32_t protocol_version_;
 
     std::string user_agent_;
@@ -314,6 +342,8 @@ private:
     // Protocol flags
     uint32_t invFlags_;
 
+    Coin::header_hashfuncs_t hashFuncs_;
+
     // State members
     boost::shared_mutex mutex;
     bool bRunning;
@@ -341,12 +371,8 @@ private:
 
     CoinQSignal<Peer&>                                  notifyTimeout;
 
-    static const unsigned int READ_BUFFER_SIZE = 262144;
-    unsigned char read_buffer[READ_BUFFER_SIZE];
-    std::size_t min_read_bytes;
+    MessageFramer framer_;
 
-    uchar_vector read_message;
-    uchar_vector write_message;
     std::queue<boost::shared_ptr<uchar_vector>> sendQueue;
     boost::mutex sendMutex;
 
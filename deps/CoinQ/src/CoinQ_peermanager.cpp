@@ -31,25 +31,31 @@ void PeerManager::createPeer(
         user_agent,
         start_height,
         relay));
+    peer->setHashFuncs(hashFuncs_);
 
     // TODO: use a separate thread with an event queue
-    peer->subscribeMessage([&](Peer& peer, const Coin::CoinNodeMessage& message) { notifyMessage(peer, message); });
-    peer->subscribeHeaders([&](Peer& peer, const Coin::HeadersMessage& headers) { notifyHeaders(peer, headers); });
-    peer->subscribeBlock([&](Peer& peer, const Coin::CoinBlock& block) { notifyBlock(peer, block); });
-    peer->subscribeMerkleBlock([&](Peer& peer, const Coin::MerkleBlock& merkleblock) { notifyMerkleBlock(peer, merkleblock); });
-    peer->subscribeTx([&](Peer& peer, const Coin::Transaction& tx) { notifyTx(peer, tx); });
-    peer->subscribeAddr([&](Peer& peer, const Coin::AddrMessage& addr) { notifyAddr(peer, addr); });
-    peer->subscribeInv([&](Peer& peer, const Coin::Inventory& inv) { notifyInv(peer, inv); });
-
-    peer->subscribeStart([&](Peer& peer) { notifyStart(peer); });
-    peer->subscribeStop([&](Peer& peer) { notifyStop(peer); });
-    peer->subscribeOpen([&](Peer& peer) { notifyOpen(peer); });
-    peer->subscribeTimeout([&](Peer& peer) { notifyTimeout(peer); deletePeer(peer.name()); });
-    peer->subscribeClose([&](Peer& peer, int code, const std::string& message) { notifyClose(peer, code, message); deletePeer(peer.name()); });
+    peer->subscribeMessage([this](Peer& peer, const Coin::CoinNodeMessage& message) { notifyMessage(peer, message); });
+    peer->subscribeHeaders([this](Peer& peer, const Coin::HeadersMessage& headers) { notifyHeaders(peer, headers); });
+    peer->subscribeBlock([this](Peer& peer, const Coin::CoinBlock& block) { notifyBlock(peer, block); });
+    peer->subscribeMerkleBlock([this](Peer& peer, const Coin::MerkleBlock& merkleblock) { notifyMerkleBlock(peer, merkleblock); });
+    peer->subscribeTx([this](Peer& peer, const Coin::Transaction& tx) { notifyTx(peer, tx); });
+    peer->subscribeAddr([this](Peer& peer, const Coin::AddrMessage& addr) { notifyAddr(peer, addr); });
+    peer->subscribeInv([this](Peer& peer, const Coin::Inventory& inv) { notifyInv(peer, inv); });
+    peer->subscribeProtocolError([this](Peer& peer, const std::string& error, int code) { notifyProtocolError(peer, error, code); });
+
+    // A peer cannot be deleted from inside its own handlers - remove it once the handler has returned.
+    std::string peername = host + ":" + port;
+    peer->subscribeStart([this](Peer& peer) { notifyStart(peer); });
+    peer->subscribeStop([this](Peer& peer) { notifyStop(peer); });
+    peer->subscribeOpen([this](Peer& peer) { notifyOpen(peer); });
+    peer->subscribeTimeout([this, peername](Peer& peer) { notifyTimeout(peer); io_service_.post([this, peername]() { deletePeer(peername); }); });
+    peer->subscribeClose([this, peername](Peer& peer) { notifyClose(peer); io_service_.post([this, peername]() { deletePeer(peername); }); });
+    peer->subscribeConnectionError([this](Peer& peer, const std::string& error, int code) { notifyConnectionError(peer, error, code); });
 
     {
         boost::lock_guard<boost::mutex> peermap_lock(peermap_mutex_);
-        peermap_[host + ":" + port] = peer; // TODO: Resolve the endpoint before adding to peermap (perhaps on notifyOpen).
+        if (peermap_.count(peername)) throw std::runtime_error("PeerManager::createPeer() - peer already exists.");
+        peermap_[peername] = peer; // TODO: Resolve the endpoint before adding to peermap (perhaps on notifyOpen).
     }
 
     peer->start();
@@ -57,8 +63,18 @@ void PeerManager::createPeer(
 
 bool PeerManager::deletePeer(const std::string& peername)
 {
-    boost::lock_guard<boost::mutex> peermap_lock(peermap_mutex_);
-    return (peermap_.erase(peername) == 1);
+    std::shared_ptr<Peer> peer;
+    {
+        boost::lock_guard<boost::mutex> peermap_lock(peermap_mutex_);
+        auto it = peermap_.find(peername);
+        if (it == peermap_.end()) return false;
+        peer = it->second;
+        peermap_.erase(it);
+    }
+
+    // Stopping the peer emits its close signal, so the map must not be locked here.
+    releasePeer(peer);
+    return true;
 }
 
 bool PeerManager::hasPeer(const std::string& peername) const
@@ -67,6 +83,22 @@ bool PeerManager::hasPeer(const std::string& peername) const
     return (peermap_.count(peername) != 0);
 }
 
+std::shared_ptr<Peer> PeerManager::getPeer(const std::string& peername) const
+{
+    boost::lock_guard<boost::mutex> peermap_lock(peermap_mutex_);
+    auto it = peermap_.find(peername);
+    if (it == peermap_.end()) return nullptr;
+    return it->second;
+}
+
+std::vector<std::shared_ptr<Peer>> PeerManager::getPeers() const
+{
+    std::vector<std::shared_ptr<Peer>> peers;
+    boost::lock_guard<boost::mutex> peermap_lock(peermap_mutex_);
+    for (auto& item: peermap_) { peers.push_back(item.second); }
+    return peers;
+}
+
 size_t PeerManager::peerCount() const
 {
     boost::lock_guard<boost::mutex> peermap_lock(peermap_mutex_);
@@ -81,6 +113,9 @@ void PeerManager::start()
 
     running_ = true;
 
+    // A shared io_service is run by its owner.
+    if (!own_io_service_) return;
+
     std::shared_ptr<boost::thread> thread(new boost::thread(boost::bind(&io_service_t::run, &io_service_)));
 
     boost::lock_guard<boost::mutex> threads_lock(threads_mutex_);
@@ -95,12 +130,27 @@ void PeerManager::stop()
 
     running_ = false;
 
+    peermap_t peermap;
+    {
+        boost::lock_guard<boost::mutex> peermap_lock(peermap_mutex_);
+        peermap.swap(peermap_);
+    }
+
+    for (auto& item: peermap) { releasePeer(item.second); }
+
+    if (!own_io_service_) return;
+
     io_service_.stop();
     for (auto& thread: threads_) { thread->join(); }
+    io_service_.reset();
 
     boost::lock_guard<boost::mutex> threads_lock(threads_mutex_);
     threads_.clear();
+}
 
-    boost::lock_guard<boost::mutex> peermap_lock(peermap_mutex_);
-    peermap_.clear();
+void PeerManager::releasePeer(std::shared_ptr<Peer> peer)
+{
+    // Handlers for the peer's aborted operations are already queued - keep it alive until they have run.
+    peer->stop();
+    io_service_.post([peer]() { });
 }
@@ -21,6 +21,8 @@
 #include "CoinQ_peer_io.h"
 
 #include <map>
+#include <memory>
+#include <vector>
 
 #include <boost/thread/mutex.hpp>
 
@@ -29,7 +31,11 @@ namespace CoinQ {
 class PeerManager
 {
 public:
-    PeerManager() : work_(io_service_), running_(false) { }
+    PeerManager() : own_io_service_(new io_service_t()), io_service_(*own_io_service_), work_(new io_service_t::work(io_service_)), hashFuncs_(Coin::CoinBlockHeader::getDefaultHashFuncs()), running_(false) { }
+
+    // Runs the peers on an io_service owned and run by the caller so their events are handled on the caller's thread.
+    explicit PeerManager(io_service_t& io_service) : io_service_(io_service), hashFuncs_(Coin::CoinBlockHeader::getDefaultHashFuncs()), running_(false) { }
+
     ~PeerManager() { stop(); }
 
     void subscribeMessage(peer_message_slot_t slot) { notifyMessage.connect(slot); }
@@ -44,7 +50,9 @@ public:
     void subscribeStop(peer_slot_t slot) { notifyStop.connect(slot); }
     void subscribeOpen(peer_slot_t slot) { notifyOpen.connect(slot); }
     void subscribeTimeout(peer_slot_t slot) { notifyTimeout.connect(slot); }
-    void subscribeClose(peer_closed_slot_t slot) { notifyClose.connect(slot); }
+    void subscribeClose(peer_slot_t slot) { notifyClose.connect(slot); }
+    void subscribeConnectionError(peer_error_slot_t slot) { notifyConnectionError.connect(slot); }
+    void subscribeProtocolError(peer_error_slot_t slot) { notifyProtocolError.connect(slot); }
 
     void createPeer(
         const std::string& host,
@@ -58,7 +66,12 @@ public:
 
     bool deletePeer(const std::string& peername);
 
+    // Hash functions for the block headers received by peers created afterwards, see Peer::setHashFuncs().
+    void setHashFuncs(const Coin::header_hashfuncs_t& hashFuncs) { hashFuncs_ = hashFuncs; }
+
     bool hasPeer(const std::string& peername) const;
+    std::shared_ptr<Peer> getPeer(const std::string& peername) const;
+    std::vector<std::shared_ptr<Peer>> getPeers() const;
 
     std::size_t peerCount() const;
 
@@ -67,8 +80,10 @@ public:
     bool isRunning() const { return running_; }
 
 private:
-    io_service_t io_service_;
-    io_service_t::work work_;
+    std::unique_ptr<io_service_t> own_io_service_;
+    io_service_t& io_service_;
+    std::unique_ptr<io_service_t::work> work_;
+    Coin::header_hashfuncs_t hashFuncs_;
     bool running_;
     mutable boost::mutex running_mutex_;
 
@@ -80,6 +95,8 @@ private:
     peermap_t peermap_;
     mutable boost::mutex peermap_mutex_;
 
+    void releasePeer(std::shared_ptr<Peer> peer);
+
     CoinQSignal<Peer&, const Coin::CoinNodeMessage&>    notifyMessage;
     CoinQSignal<Peer&, const Coin::HeadersMessage&>     notifyHeaders;
     CoinQSignal<Peer&, const Coin::CoinBlock&>          notifyBlock;
@@ -92,7 +109,9 @@ private:
     CoinQSignal<Peer&>                                  notifyStop;
     CoinQSignal<Peer&>                                  notifyOpen;
     CoinQSignal<Peer&>                                  notifyTimeout;
-    CoinQSignal<Peer&, int, const std::string&>         notifyClose;
+    CoinQSignal<Peer&>                                  notifyClose;
+    CoinQSignal<Peer&, const std::string&, int>         notifyConnectionError;
+    CoinQSignal<Peer&, const std::string&, int>         notifyProtocolError;
 };
 
 }
@@ -14,6 +14,9 @@
 #include <CoinCore/Base58Check.h>
 #include <CoinCore/secp256k1_openssl.h>
 
+#include <atomic>
+#include <thread>
+
 //#include <logger/logger.h>
 
 using namespace CoinCrypto;
@@ -21,6 +24,18 @@ using namespace CoinCrypto;
 namespace CoinQ {
 namespace Script {
 
+static bool verifySignature(const bytes_t& pubkey, const bytes_t& hash, const bytes_t& signature)
+{
+    secp256k1_key key;
+    key.setPubKey(pubkey);
+    return secp256k1_verify(key, hash, signature);
+}
+
+static bool checkSignature(SignatureVerifier* verifier, const bytes_t& pubkey, const bytes_t& hash, const bytes_t& signature)
+{
+    return verifier ? verifier->check(pubkey, hash, signature) : verifySignature(pubkey, hash, signature);
+}
+
 uchar_vector opPushData(uint32_t nBytes)
 {
     uchar_vector rval;
@@ -833,7 +848,7 @@ unsigned int Script::mergesigs(const Script& other)
 }
 
 
-void SignableTxIn::setTxIn(const Coin::Transaction& tx, std::size_t nIn, uint64_t outpointamount, const bytes_t& txoutscript)
+void SignableTxIn::setTxIn(const Coin::Transaction& tx, std::size_t nIn, uint64_t outpointamount, const bytes_t& txoutscript, SignatureVerifier* verifier, const Coin::SigHashContext* sighashcontext)
 {
 //LOGGER(trace) << "SignableTxIn::setTxIn(" << tx.getHashLittleEndian().getHex() << ", " << nIn << ", " << outpointamount << ", " << uchar_vector(txoutscript).getHex() << ")" << std::endl;
     redeemscript_.clear();
@@ -910,10 +925,8 @@ void SignableTxIn::setTxIn(const Coin::Transaction& tx, std::size_t nIn, uint64_
 //LOGGER(trace) << "SignableTxIn::setTxIn: Verify signature" << std::endl;
         uchar_vector txoutscript;
         txoutscript << OP_DUP << OP_HASH160 << pushStackItem(hash160(pubkeys_.back())) << OP_EQUALVERIFY << OP_CHECKSIG;
-        bytes_t sighash = tx.getSigHash(SIGHASH_ALL, nIn, txoutscript, outpointamount);
-        secp256k1_key key;
-        key.setPubKey(pubkeys_.back());
-        if (secp256k1_verify(key, sighash, signature))
+        bytes_t sighash = sighashcontext ? sighashcontext->getSigHash(SIGHASH_ALL, nIn, txoutscript, outpointamount) : tx.getSigHash(SIGHASH_ALL, nIn, txoutscript, outpointamount);
+        if (checkSignature(verifier, pubkeys_.back(), sighash, signature))
         {
             // Signature is valid. Keep it.
 //LOGGER(trace) << "SignableTxIn::setTxIn: Signature is valid. Keep it." << std::endl;
@@ -974,7 +987,24 @@ void SignableTxIn::setTxIn(const Coin::Transaction& tx, std::size_t nIn, uint64_
     if (sigs.size() > pubkeys_.size())
         throw std::runtime_error("Too many signatures.");
 
-    // Validate signatures.
+    // Validate signatures. All signatures commit to the same hash so only compute it once.
+    bytes_t sighash;
+
+    // While queueing, the walk below takes every signature as valid and so only visits one pairing of signatures with pubkeys.
+    // Queue every pubkey each signature could be paired with instead so that the real pass finds all its checks cached.
+    if (verifier && verifier->queueing())
+    {
+        for (std::size_t i = 0; i < pubkeys_.size(); i++)
+        {
+            for (std::size_t j = 0; j <= i && j < sigs.size(); j++)
+            {
+                if (sigs[j].empty() || sigs[j].back() != SIGHASH_ALL) continue;
+                if (sighash.empty()) { sighash = sighashcontext ? sighashcontext->getSigHash(SIGHASH_ALL, nIn, redeemscript_, outpointamount) : tx.getSigHash(SIGHASH_ALL, nIn, redeemscript_, outpointamount); }
+                verifier->queue(pubkeys_[i], sighash, bytes_t(sigs[j].begin(), sigs[j].end() - 1));
+            }
+        }
+    }
+
     unsigned int iSig = 0;
     unsigned int nValidSigs = 0;
     for (auto& pubkey: pubkeys_)
@@ -996,10 +1026,8 @@ void SignableTxIn::setTxIn(const Coin::Transaction& tx, std::size_t nIn, uint64_
             bytes_t signature(sigs[iSig].begin(), sigs[iSig].end() - 1);
 
             // Verify signature.
-            bytes_t sighash = tx.getSigHash(SIGHASH_ALL, nIn, redeemscript_, outpointamount);
-            secp256k1_key key;
-            key.setPubKey(pubkey);
-            if (secp256k1_verify(key, sighash, signature))
+            if (sighash.empty()) { sighash = sighashcontext ? sighashcontext->getSigHash(SIGHASH_ALL, nIn, redeemscript_, outpointamount) : tx.getSigHash(SIGHASH_ALL, nIn, redeemscript_, outpointamount); }
+            if (checkSignature(verifier, pubkey, sighash, signature))
             {
                 // Signature is valid. Keep it.
                 sigs_.push_back(sigs[iSig]);
@@ -1192,15 +1220,16 @@ unsigned int SignableTxIn::mergesigs(const SignableTxIn& other)
 }
 
 
-void Signer::setTx(const Coin::Transaction& tx, const std::vector<uint64_t>& outpointvalues)
+void Signer::setTx(const Coin::Transaction& tx, const std::vector<uint64_t>& outpointvalues, SignatureVerifier* verifier)
 {
     tx_ = tx;
     signabletxins_.clear();
 
+    Coin::SigHashContext sighashcontext(tx);
     for (std::size_t i = 0; i < tx.inputs.size(); i++)
     {
         uint64_t outpointvalue = (outpointvalues.size() > i ? outpointvalues[i] : 0);
-        signabletxins_.push_back(SignableTxIn(tx, i, outpointvalue));
+        signabletxins_.push_back(SignableTxIn(tx, i, outpointvalue, bytes_t(), verifier, &sighashcontext));
     }
 }
 
@@ -1294,5 +1323,97 @@ unsigned int mergesigs(const Signer& other)
 }
 
 
+
+void SignatureVerifier::queue(const Coin::Transaction& tx, const std::vector<uint64_t>& outpointvalues)
+{
+    // While queueing, check() records each check and reports it as valid so that parsing continues as if all signatures were good.
+    bQueueing_ = true;
+    Coin::SigHashContext sighashcontext(tx);
+    for (std::size_t i = 0; i < tx.inputs.size(); i++)
+    {
+        uint64_t outpointvalue = (outpointvalues.size() > i ? outpointvalues[i] : 0);
+        try
+        {
+            SignableTxIn(tx, i, outpointvalue, bytes_t(), this, &sighashcontext);
+        }
+        catch (const std::exception&)
+        {
+            // The error will be raised again when the input is parsed for real.
+        }
+    }
+    bQueueing_ = false;
+}
+
+void SignatureVerifier::queue(const bytes_t& pubkey, const bytes_t& hash, const bytes_t& signature)
+{
+    results_.insert(std::make_pair(check_t(pubkey, hash, signature), (int)PENDING));
+}
+
+void SignatureVerifier::verify(unsigned int nThreads)
+{
+    std::vector<std::map<check_t, int>::iterator> checks;
+    for (auto it = results_.begin(); it != results_.end(); ++it)
+    {
+        if (it->second == PENDING) { checks.push_back(it); }
+    }
+    if (checks.empty()) return;
+
+    // Each thread only writes the results of the checks it claims so no locking is needed.
+    std::atomic<std::size_t> next(0);
+    auto worker = [&]()
+    {
+        std::size_t i;
+        while ((i = next++) < checks.size())
+        {
+            const check_t& check = checks[i]->first;
+            try
+            {
+                checks[i]->second = verifySignature(std::get<0>(check), std::get<1>(check), std::get<2>(check)) ? VALID : INVALID;
+            }
+            catch (const std::exception&)
+            {
+                // Leave as pending so check() raises the error in the caller.
+            }
+        }
+    };
+
+    if (nThreads == 0) { nThreads = std::thread::hardware_concurrency(); }
+    if (nThreads > checks.size()) { nThreads = checks.size(); }
+    if (nThreads <= 1 || checks.size() < MIN_PARALLEL_BATCH)
+    {
+        worker();
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < nThreads; i++) { threads.push_back(std::thread(worker)); }
+    worker();
+    for (auto& thread: threads) { thread.join(); }
+}
+
+bool SignatureVerifier::check(const bytes_t& pubkey, const bytes_t& hash, const bytes_t& signature)
+{
+    if (bQueueing_)
+    {
+        queue(pubkey, hash, signature);
+        return true;
+    }
+
+    check_t key(pubkey, hash, signature);
+    auto it = results_.find(key);
+    if (it != results_.end() && it->second != PENDING) return it->second == VALID;
+
+    bool bValid = verifySignature(pubkey, hash, signature);
+    results_[key] = bValid ? VALID : INVALID;
+    return bValid;
+}
+
+std::size_t SignatureVerifier::pending() const
+{
+    std::size_t count = 0;
+    for (auto& result: results_) { if (result.second == PENDING) count++; }
+    return count;
+}
+
 }
 }
@@ -20,6 +20,8 @@
 
 #include <algorithm>
 #include <deque>
+#include <map>
+#include <tuple>
 #include <utility>
 
 namespace CoinQ {
@@ -435,6 +437,8 @@ private:
 typedef std::vector<Script> scripts_t;
 
 
+class SignatureVerifier;
+
 class SignableTxIn
 {
 public:
@@ -473,9 +477,11 @@ public:
         sigs_(other.sigs_),
         redeemscript_(other.redeemscript_) { }
 
-    SignableTxIn(const Coin::Transaction& tx, std::size_t nIn, uint64_t outpointamount = 0, const bytes_t& txoutscript = bytes_t()) { setTxIn(tx, nIn, outpointamount); }
+    SignableTxIn(const Coin::Transaction& tx, std::size_t nIn, uint64_t outpointamount = 0, const bytes_t& txoutscript = bytes_t(), SignatureVerifier* verifier = nullptr, const Coin::SigHashContext* sighashcontext = nullptr) { setTxIn(tx, nIn, outpointamount, txoutscript, verifier, sighashcontext); }
 
-    void setTxIn(const Coin::Transaction& tx, std::size_t nIn, uint64_t outpointamount = 0, const bytes_t& txoutscript = bytes_t());
+    // If verifier is given signatures are checked through it so results already computed in a batch are reused.
+    // If a sighash context is passed it must have been constructed from tx.
+    void setTxIn(const Coin::Transaction& tx, std::size_t nIn, uint64_t outpointamount = 0, const bytes_t& txoutscript = bytes_t(), SignatureVerifier* verifier = nullptr, const Coin::SigHashContext* sighashcontext = nullptr);
 
     unsigned int minsigs() const { return minsigs_; }
     const std::vector<bytes_t>& pubkeys() const { return pubkeys_; }
@@ -509,9 +515,9 @@ class Signer
 {
 public:
     Signer() { }
-    explicit Signer(const Coin::Transaction& tx, const std::vector<uint64_t>& outpointvalues = std::vector<uint64_t>()) { setTx(tx, outpointvalues); }
+    explicit Signer(const Coin::Transaction& tx, const std::vector<uint64_t>& outpointvalues = std::vector<uint64_t>(), SignatureVerifier* verifier = nullptr) { setTx(tx, outpointvalues, verifier); }
 
-    void setTx(const Coin::Transaction& tx, const std::vector<uint64_t>& outpointvalues = std::vector<uint64_t>());
+    void setTx(const Coin::Transaction& tx, const std::vector<uint64_t>& outpointvalues = std::vector<uint64_t>(), SignatureVerifier* verifier = nullptr);
 
     const Coin::Transaction& getTx() const { return tx_; }
 
@@ -546,6 +552,43 @@ private:
     signabletxins_t signabletxins_;
 };
 
+
+// Verifies (pubkey, hash, signature) triples and caches the results.
+// Typical use is to queue() one or more transactions, call verify() to check all their signatures
+// across a thread pool and then pass the verifier to Signer or SignableTxIn, which will find the results cached.
+class SignatureVerifier
+{
+public:
+    SignatureVerifier() : bQueueing_(false) { }
+
+    // Queues the checks SignableTxIn would perform if all signatures are valid. Inputs that cannot be parsed are skipped.
+    void queue(const Coin::Transaction& tx, const std::vector<uint64_t>& outpointvalues = std::vector<uint64_t>());
+    void queue(const bytes_t& pubkey, const bytes_t& hash, const bytes_t& signature);
+
+    // Verifies all queued checks using up to nThreads threads. Uses one thread per core if nThreads is 0.
+    void verify(unsigned int nThreads = 0);
+
+    // Returns the cached result or verifies now if there is none.
+    bool check(const bytes_t& pubkey, const bytes_t& hash, const bytes_t& signature);
+
+    // True while queue(tx) is collecting checks.
+    bool queueing() const { return bQueueing_; }
+
+    std::size_t pending() const;
+    std::size_t size() const { return results_.size(); }
+    void clear() { results_.clear(); }
+
+    // Batches smaller than this are verified in the calling thread.
+    static const std::size_t MIN_PARALLEL_BATCH = 8;
+
+private:
+    typedef std::tuple<bytes_t, bytes_t, bytes_t> check_t;
+
+    enum result_t { PENDING = -1, INVALID = 0, VALID = 1 };
+    std::map<check_t, int> results_;
+    bool bQueueing_;
+};
+
 }
 }
 
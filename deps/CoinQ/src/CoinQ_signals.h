@@ -24,6 +24,7 @@ private:
 public:
     void connect(std::function<void(Values...)> fn) { fns.push_back(fn); }
     void clear() { fns.clear(); }
+    bool empty() const { return fns.empty(); }
     void operator()(Values... values) { for (auto fn : fns) fn(values...); }
 };
 
@@ -36,6 +37,7 @@ private:
 public:
     void connect(std::function<void()> fn) { fns.push_back(fn); }
     void clear() { fns.clear(); }
+    bool empty() const { return fns.empty(); }
     void operator()() { for (auto fn : fns) fn(); }
 };
 
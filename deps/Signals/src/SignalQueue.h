@@ -11,47 +11,225 @@
 
 #pragma once
 
+#include <atomic>
+#include <deque>
 #include <functional>
-#include <queue>
+#include <iterator>
 #include <mutex>
 
 namespace Signals
 {
 
+// Multiple producer, single consumer queue of pending signal emissions.
+//
+// push() never blocks: it links a node onto the head with a single atomic exchange. Callbacks run one at a
+// time, in the order pushed, with no lock held, so they may push or flush themselves. Only one flush drains
+// the queue at a time. A flush that finds another one draining, on any thread or from within a callback,
+// returns at once and leaves its callbacks to that drainer, which keeps going until the queue is empty.
+// So callbacks pushed before a flush are run by the time the drain it joined ends, not necessarily by the
+// time it returns.
+//
+// A callback that throws stops the drain. It and the callbacks after it stay queued, ahead of any pushed
+// since, and the next flush starts with it.
 class SignalQueue
 {
 public:
+    SignalQueue();
+    ~SignalQueue();
+
     void push(std::function<void()> f);
     void flush();
     void clear();
 
 private:
-    std::mutex mutex_;
-    std::queue<std::function<void()>> queue_;
+    struct Node
+    {
+        Node() : next(nullptr) { }
+        explicit Node(std::function<void()>&& f_) : next(nullptr), f(std::move(f_)) { }
+
+        std::atomic<Node*> next;
+        std::function<void()> f;
+    };
+
+    typedef std::deque<std::function<void()>> requeued_t;
+
+    // Takes the callbacks put back by a flush that threw, setting first to null, or if there are none unlinks
+    // all linked nodes. Then first is the old consumed node, the nodes after it up to and excluding last are
+    // owned by the caller, and last_f holds the function of last, which becomes the consumed node.
+    // Returns false if there are none.
+    bool pop(requeued_t& requeued, Node*& first, Node*& last, std::function<void()>& last_f);
+
+    // Deletes first and runs and deletes the nodes after it up to last, then runs last_f.
+    void run(Node* first, Node* last, std::function<void()>& last_f);
+    void run(requeued_t& requeued);
+
+    // Puts callbacks that did not run back at the front of the queue.
+    void requeue(requeued_t& requeued);
+
+    std::atomic<Node*> head_;   // most recently pushed node
+    Node* tail_;                // already consumed node before the oldest pending one
+    requeued_t requeued_;       // pending before the linked nodes
+
+    std::mutex consumer_mutex_;
+    std::atomic<unsigned int> flushes_; // flushes made since the current drain started, zero if none is running
 };
 
+inline SignalQueue::SignalQueue() : flushes_(0)
+{
+    tail_ = new Node();
+    head_.store(tail_);
+}
+
+inline SignalQueue::~SignalQueue()
+{
+    clear();
+    delete tail_;
+}
+
 inline void SignalQueue::push(std::function<void()> f)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(f);
+    Node* node = new Node(std::move(f));
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
+
+inline bool SignalQueue::pop(requeued_t& requeued, Node*& first, Node*& last, std::function<void()>& last_f)
+{
+    std::lock_guard<std::mutex> lock(consumer_mutex_);
+    if (!requeued_.empty())
+    {
+        requeued.swap(requeued_);
+        first = nullptr;
+        return true;
+    }
+
+    first = tail_;
+    last = nullptr;
+    for (Node* node = tail_->next.load(std::memory_order_acquire); node; node = node->next.load(std::memory_order_acquire)) { last = node; }
+    if (!last) return false;
+
+    last_f = std::move(last->f);
+    last->f = nullptr;
+    tail_ = last;
+    return true;
+}
+
+inline void SignalQueue::run(Node* first, Node* last, std::function<void()>& last_f)
+{
+    Node* node = first->next.load(std::memory_order_acquire);
+    delete first;
+    try
+    {
+        while (node != last)
+        {
+            Node* next = node->next.load(std::memory_order_acquire);
+            node->f();
+            delete node;
+            node = next;
+        }
+    }
+    catch (...)
+    {
+        requeued_t requeued;
+        while (node != last)
+        {
+            Node* next = node->next.load(std::memory_order_acquire);
+            requeued.push_back(std::move(node->f));
+            delete node;
+            node = next;
+        }
+        requeued.push_back(std::move(last_f));
+        requeue(requeued);
+        throw;
+    }
+
+    try
+    {
+        last_f();
+    }
+    catch (...)
+    {
+        requeued_t requeued(1, std::move(last_f));
+        requeue(requeued);
+        throw;
+    }
+}
+
+inline void SignalQueue::run(requeued_t& requeued)
+{
+    try
+    {
+        while (!requeued.empty())
+        {
+            requeued.front()();
+            requeued.pop_front();
+        }
+    }
+    catch (...)
+    {
+        requeue(requeued);
+        throw;
+    }
+}
+
+inline void SignalQueue::requeue(requeued_t& requeued)
+{
+    std::lock_guard<std::mutex> lock(consumer_mutex_);
+    requeued_.insert(requeued_.begin(), std::make_move_iterator(requeued.begin()), std::make_move_iterator(requeued.end()));
 }
 
 inline void SignalQueue::flush()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    while (!queue_.empty())
+    // Whoever finds no drain running becomes the drainer. Each flush made meanwhile pushed before counting
+    // itself, so the drainer sees its callbacks when it takes the count back.
+    if (flushes_.fetch_add(1) != 0) return;
+
+    unsigned int flushes = 1;
+    try
+    {
+        do
+        {
+            requeued_t requeued;
+            Node* first;
+            Node* last;
+            std::function<void()> last_f;
+            while (pop(requeued, first, last, last_f))
+            {
+                if (first) { run(first, last, last_f); }
+                else       { run(requeued); }
+            }
+            flushes = flushes_.fetch_sub(flushes) - flushes;
+        } while (flushes != 0);
+    }
+    catch (...)
     {
-        queue_.front()();
-        queue_.pop();
-    } 
+        // The callbacks left are kept for the next flush.
+        flushes_.store(0);
+        throw;
+    }
 }
 
 inline void SignalQueue::clear()
 {
-    std::queue<std::function<void()>> empty;
+    requeued_t requeued;
+    Node* first;
+    Node* last;
+    std::function<void()> last_f;
+    while (pop(requeued, first, last, last_f))
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        std::swap(queue_, empty);
+        if (!first)
+        {
+            requeued.clear();
+            continue;
+        }
+
+        Node* node = first;
+        while (node != last)
+        {
+            Node* next = node->next.load(std::memory_order_acquire);
+            delete node;
+            node = next;
+        }
     }
 }
 
@@ -11,30 +11,47 @@
 
 #pragma once
 
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <set>
-#include <map>
 #include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef SIGNALS_TEST
+#include <sstream>
+#include <string>
+#endif
 
 namespace Signals
 {
 
 typedef uint64_t Connection;
 
-template<typename... Values>
-class Signal
+// Connected slots, kept in an immutable list that connect, disconnect and clear replace rather than modify.
+// Emission walks whatever list is current without holding a lock, so slots run concurrently with each other
+// and with connection changes, and a slot may connect, disconnect or emit. Replaced lists are freed once no
+// emission is in progress, by the connection change or emission that finds none.
+//
+// Once disconnect or clear returns, the slots removed are not running and will not be called, except by
+// emissions in progress on the calling thread, such as a slot disconnecting itself. They wait for calls in
+// progress on other threads to finish, so two slots each disconnecting the other from different threads
+// deadlock, as any connection change from a slot did when emission held the lock.
+template<typename Slot>
+class SlotList
 {
 public:
-    typedef std::function<void(Values...)> Slot;
-
-    Signal();
-    ~Signal();
+    SlotList();
+    ~SlotList();
 
     Connection connect(Slot slot);
     bool disconnect(Connection connection);
     void clear();
-    std::function<void()> bind(Values... values) const;
-    void operator()(Values... values) const { exec(values...); }
+
+    template<typename... Values>
+    void exec(Values&&... values) const;
 
 #ifdef SIGNALS_TEST
     std::string getTextualState()
@@ -44,34 +61,80 @@ public:
         ss << "next_: " << next_ << std::endl << "available_:";
         for (auto n: available_) ss << " " << n;
         ss << std::endl << "slots_:";
-        for (auto& slot: slots_) ss << " " << slot.first;
+        for (auto& slot: *slots_.load()) ss << " " << slot.first;
         ss << std::endl;
         return ss.str(); 
     }
 #endif
 
 private:
-    void exec(Values... values) const;
+    struct State
+    {
+        explicit State(Slot&& slot_) : slot(std::move(slot_)), connected(true), calls(0) { }
+
+        Slot slot;
+        std::atomic<bool> connected;
+        std::atomic<unsigned int> calls;
+    };
+
+    // Registers a call in progress, on the state and on the calling thread.
+    class Call
+    {
+    public:
+        explicit Call(State& state) : state_(state), prev_(top()) { state_.calls++; top() = this; }
+        ~Call() { top() = prev_; state_.calls--; }
+
+        // Calls of state in progress on the calling thread.
+        static unsigned int count(const State& state);
+
+    private:
+        static const Call*& top() { static thread_local const Call* top = nullptr; return top; }
+
+        State& state_;
+        const Call* prev_;
+    };
+
+    typedef std::vector<std::pair<Connection, std::shared_ptr<State>>> slots_t;
+
+    // Called with mutex_ held.
+    void replace(const slots_t* slots);
+    void reclaim() const;
+
+    // Marks the state disconnected and waits for its calls on other threads to finish.
+    static void disconnected(State& state);
 
     mutable std::mutex mutex_;
     Connection next_;
     std::set<Connection> available_;
-    std::map<Connection, Slot> slots_;
+    mutable std::vector<const slots_t*> retired_;
+
+    std::atomic<const slots_t*> slots_;
+    mutable std::atomic<unsigned int> executing_;
+    mutable std::atomic<bool> retiring_;    // retired_ is not empty
 };
 
-template<typename... Values>
-inline Signal<Values...>::Signal() : next_(0)
+template<typename Slot>
+inline unsigned int SlotList<Slot>::Call::count(const State& state)
 {
+    unsigned int n = 0;
+    for (const Call* call = top(); call; call = call->prev_) { if (&call->state_ == &state) n++; }
+    return n;
 }
 
-template<typename... Values>
-inline Signal<Values...>::~Signal()
+template<typename Slot>
+inline SlotList<Slot>::SlotList() : next_(0), slots_(new slots_t()), executing_(0), retiring_(false)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
 }
 
-template<typename... Values>
-inline Connection Signal<Values...>::connect(Slot slot)
+template<typename Slot>
+inline SlotList<Slot>::~SlotList()
+{
+    for (auto slots: retired_) delete slots;
+    delete slots_.load();
+}
+
+template<typename Slot>
+inline Connection SlotList<Slot>::connect(Slot slot)
 {
     std::lock_guard<std::mutex> lock(mutex_);
     Connection connection;
@@ -85,154 +148,166 @@ inline Connection Signal<Values...>::connect(Slot slot)
         connection = *it;
         available_.erase(it);
     }
-    slots_.insert(std::pair<Connection, Slot>(connection, slot));
+
+    // Kept in connection order, as slots are called.
+    slots_t* slots = new slots_t(*slots_.load());
+    auto pos = slots->begin();
+    while (pos != slots->end() && pos->first < connection) ++pos;
+    slots->insert(pos, std::make_pair(connection, std::make_shared<State>(std::move(slot))));
+    replace(slots);
     return connection;
 }
 
-template<typename... Values>
-inline bool Signal<Values...>::disconnect(Connection connection)
+template<typename Slot>
+inline bool SlotList<Slot>::disconnect(Connection connection)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    const auto& it = slots_.find(connection);
-    if (it == slots_.end()) return false;
-
-    slots_.erase(it);
-    available_.insert(connection);
+    std::shared_ptr<State> state;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const slots_t* current = slots_.load();
+        auto it = current->begin();
+        while (it != current->end() && it->first != connection) ++it;
+        if (it == current->end()) return false;
+
+        state = it->second;
+        slots_t* slots = new slots_t(current->begin(), it);
+        slots->insert(slots->end(), it + 1, current->end());
+        replace(slots);
+        available_.insert(connection);
+
+        // remove contiguous available connections from end
+        auto rit = available_.rbegin();
+        for (; rit != available_.rend() && *rit == next_ - 1; ++rit, --next_);
+        available_.erase(rit.base(), available_.end());
+    }
 
-    // remove contiguous available connections from end
-    auto rit = available_.rbegin();
-    for (; rit != available_.rend() && *rit == next_ - 1; ++rit, --next_);
-    available_.erase(rit.base(), available_.end());
+    // Without the lock, so the slots being waited for can change connections.
+    disconnected(*state);
     return true;
 }
 
-template<typename... Values>
-inline void Signal<Values...>::clear()
+template<typename Slot>
+inline void SlotList<Slot>::clear()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    slots_.clear();
-    available_.clear();
-    next_ = 0;
-}
+    slots_t states;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        states = *slots_.load();
+        replace(new slots_t());
+        available_.clear();
+        next_ = 0;
+    }
 
-template<typename... Values>
-inline void Signal<Values...>::exec(Values... values) const
-{
-    std::lock_guard<std::mutex> lock(mutex_);
-    for (auto slot: slots_) slot.second(values...); 
+    for (auto& slot: states) disconnected(*slot.second);
 }
 
-template<typename... Values>
-inline std::function<void()> Signal<Values...>::bind(Values... values) const
+template<typename Slot>
+inline void SlotList<Slot>::replace(const slots_t* slots)
 {
-    return std::bind([this](Values... values) { exec(values...); }, values...);
+    retired_.push_back(slots_.exchange(slots));
+    retiring_.store(true);
+    reclaim();
 }
 
-template<>
-class Signal<void>
+template<typename Slot>
+inline void SlotList<Slot>::reclaim() const
 {
-public:
-    typedef std::function<void()> Slot;
-
-    Signal();
-    ~Signal();
-
-    Connection connect(Slot slot);
-    bool disconnect(Connection connection);
-    void clear();
-    std::function<void()> bind() const;
-    void operator()() const { exec(); }
-
-#ifdef SIGNALS_TEST
-    std::string getTextualState()
+    // An emission registers before loading the list, so with none registered after the exchange no one
+    // can still be walking a retired list. Otherwise the last of them to finish calls this again.
+    if (executing_.load() == 0)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        std::stringstream ss;
-        ss << "next_: " << next_ << std::endl << "available_:";
-        for (auto n: available_) ss << " " << n;
-        ss << std::endl << "slots_:";
-        for (auto& slot: slots_) ss << " " << slot.first;
-        ss << std::endl;
-        return ss.str(); 
+        for (auto retired: retired_) delete retired;
+        retired_.clear();
+        retiring_.store(false);
     }
-#endif
-
-private:
-    void exec() const;
-
-    mutable std::mutex mutex_;
-    Connection next_;
-    std::set<Connection> available_;
-    std::map<Connection, Slot> slots_;
-};
-
-template<>
-inline Signal<>::Signal() : next_(0)
-{
 }
 
-template<>
-inline Signal<>::~Signal()
+template<typename Slot>
+inline void SlotList<Slot>::disconnected(State& state)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    // Either a call registered after this store sees it cleared, or it is counted below.
+    state.connected.store(false);
+    unsigned int own = Call::count(state);
+    while (state.calls.load() > own) std::this_thread::yield();
 }
 
-template<>
-inline Connection Signal<>::connect(Slot slot)
+template<typename Slot>
+template<typename... Values>
+inline void SlotList<Slot>::exec(Values&&... values) const
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    Connection connection;
-    auto it = available_.begin();
-    if (it == available_.end())
+    struct Executing
     {
-        connection = next_++;
-    }
-    else
+        explicit Executing(const SlotList& list) : list_(list) { list_.executing_++; }
+        ~Executing()
+        {
+            // The last emission to finish frees the lists replaced while any were in progress.
+            if (--list_.executing_ == 0 && list_.retiring_.load())
+            {
+                std::lock_guard<std::mutex> lock(list_.mutex_);
+                list_.reclaim();
+            }
+        }
+        const SlotList& list_;
+    } executing(*this);
+
+    for (auto& slot: *slots_.load())
     {
-        connection = *it;
-        available_.erase(it);
+        State& state = *slot.second;
+        if (!state.connected.load()) continue;
+
+        Call call(state);
+        if (state.connected.load()) state.slot(values...);
     }
-    slots_.insert(std::pair<Connection, Slot>(connection, slot));
-    return connection;
 }
 
-template<>
-inline bool Signal<>::disconnect(Connection connection)
+template<typename... Values>
+class Signal
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    const auto& it = slots_.find(connection);
-    if (it == slots_.end()) return false;
+public:
+    typedef std::function<void(Values...)> Slot;
 
-    slots_.erase(it);
-    available_.insert(connection);
+    Connection connect(Slot slot) { return slots_.connect(slot); }
+    bool disconnect(Connection connection) { return slots_.disconnect(connection); }
+    void clear() { slots_.clear(); }
+    std::function<void()> bind(Values... values) const;
+    void operator()(Values... values) const { exec(values...); }
 
-    // remove contiguous available connections from end
-    auto rit = available_.rbegin();
-    for (; rit != available_.rend() && *rit == next_ - 1; ++rit, --next_);
-    available_.erase(rit.base(), available_.end());
-    return true;
-}
+#ifdef SIGNALS_TEST
+    std::string getTextualState() { return slots_.getTextualState(); }
+#endif
 
-template<>
-inline void Signal<>::clear()
-{
-    std::lock_guard<std::mutex> lock(mutex_);
-    slots_.clear();
-    available_.clear();
-    next_ = 0;
-}
+private:
+    void exec(Values... values) const { slots_.exec(values...); }
 
-template<>
-inline void Signal<>::exec() const
+    SlotList<Slot> slots_;
+};
+
+template<typename... Values>
+inline std::function<void()> Signal<Values...>::bind(Values... values) const
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    for (auto slot: slots_) slot.second(); 
+    return std::bind([this](Values... values) { exec(values...); }, values...);
 }
 
 template<>
-inline std::function<void()> Signal<>::bind() const
+class Signal<void>
 {
-    return [this]() { exec(); };
-}
+public:
+    typedef std::function<void()> Slot;
+
+    Connection connect(Slot slot) { return slots_.connect(slot); }
+    bool disconnect(Connection connection) { return slots_.disconnect(connection); }
+    void clear() { slots_.clear(); }
+    std::function<void()> bind() const { return [this]() { exec(); }; }
+    void operator()() const { exec(); }
+
+#ifdef SIGNALS_TEST
+    std::string getTextualState() { return slots_.getTextualState(); }
+#endif
+
+private:
+    void exec() const { slots_.exec(); }
+
+    SlotList<Slot> slots_;
+};
 
 }
@@ -0,0 +1,163 @@
+#include <Signals.h>
+#include <SignalQueue.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Signals;
+using namespace std;
+
+// Previous implementations: a mutex around a std::queue held while flushing, and a mutex around a std::map
+// held while emitting.
+class LockedSignalQueue
+{
+public:
+    void push(function<void()> f)
+    {
+        lock_guard<mutex> lock(mutex_);
+        queue_.push(f);
+    }
+
+    void flush()
+    {
+        lock_guard<mutex> lock(mutex_);
+        while (!queue_.empty())
+        {
+            queue_.front()();
+            queue_.pop();
+        }
+    }
+
+private:
+    mutex mutex_;
+    queue<function<void()>> queue_;
+};
+
+template<typename... Values>
+class LockedSignal
+{
+public:
+    typedef function<void(Values...)> Slot;
+
+    void connect(Slot slot)
+    {
+        lock_guard<mutex> lock(mutex_);
+        slots_.insert(make_pair(next_++, slot));
+    }
+
+    void operator()(Values... values) const
+    {
+        lock_guard<mutex> lock(mutex_);
+        for (auto slot: slots_) slot.second(values...);
+    }
+
+private:
+    mutable mutex mutex_;
+    Connection next_ = 0;
+    map<Connection, Slot> slots_;
+};
+
+double rate(uint64_t count, chrono::steady_clock::time_point start)
+{
+    return count / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Producers push emissions while one consumer flushes until it has run them all.
+template<typename Queue>
+double bench_queue(int producers, int per_producer)
+{
+    Queue queue;
+    atomic<uint64_t> received(0);
+    uint64_t total = (uint64_t)producers * per_producer;
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int i = 0; i < producers; i++)
+    {
+        threads.push_back(thread([&]() {
+            for (int j = 0; j < per_producer; j++) { queue.push([&received]() { received.fetch_add(1, memory_order_relaxed); }); }
+        }));
+    }
+
+    while (received.load() < total) { queue.flush(); }
+    for (auto& t: threads) { t.join(); }
+
+    return rate(total, start);
+}
+
+// Emitters all emit the same signal, which has a few cheap slots.
+template<typename Sig>
+double bench_signal(int emitters, int per_emitter, int slots)
+{
+    Sig signal;
+    atomic<uint64_t> calls(0);
+    for (int i = 0; i < slots; i++) { signal.connect([&calls](int n) { calls.fetch_add(n, memory_order_relaxed); }); }
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int i = 0; i < emitters; i++)
+    {
+        threads.push_back(thread([&]() {
+            for (int j = 0; j < per_emitter; j++) { signal(1); }
+        }));
+    }
+    for (auto& t: threads) { t.join(); }
+
+    uint64_t total = (uint64_t)emitters * per_emitter;
+    if (calls.load() != total * slots) throw runtime_error("Slot call count mismatch. TEST FAILED");
+    return rate(total, start);
+}
+
+void print(int threads, double locked, double lockfree)
+{
+    cout << setw(8) << threads << fixed << setprecision(0) << setw(16) << locked << setw(16) << lockfree
+         << setprecision(2) << setw(10) << (lockfree / locked) << "x" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 3)
+    {
+        cerr << "# usage: " << argv[0] << " [emissions per thread = 200000] [max threads = 8]" << endl;
+        return -1;
+    }
+
+    try
+    {
+        int count = argc > 1 ? stoi(argv[1]) : 200000;
+        int max_threads = argc > 2 ? stoi(argv[2]) : 8;
+        if (count <= 0 || max_threads <= 0) throw runtime_error("Invalid parameters.");
+
+        cout << "SignalQueue push/flush, emissions/s" << endl;
+        cout << setw(8) << "threads" << setw(16) << "locked" << setw(16) << "lock-free" << setw(11) << "speedup" << endl;
+        for (int threads = 1; threads <= max_threads; threads *= 2)
+        {
+            print(threads, bench_queue<LockedSignalQueue>(threads, count), bench_queue<SignalQueue>(threads, count));
+        }
+
+        cout << endl << "Signal emission with 4 slots, emissions/s" << endl;
+        cout << setw(8) << "threads" << setw(16) << "locked" << setw(16) << "lock-free" << setw(11) << "speedup" << endl;
+        for (int threads = 1; threads <= max_threads; threads *= 2)
+        {
+            print(threads, bench_signal<LockedSignal<int>>(threads, count, 4), bench_signal<Signal<int>>(threads, count, 4));
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -2;
+    }
+
+    return 0;
+}
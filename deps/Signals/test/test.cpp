@@ -4,7 +4,13 @@
 #include <Signals.h>
 #include <SignalQueue.h>
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 using namespace Signals;
 using namespace std;
@@ -71,5 +77,76 @@ int main()
     signalQueue.flush();
     signalQueue.flush();
 
+    cout << endl << "Callback pushing while flushed:" << endl;
+    signalQueue.push([&]() { coutString("first"); signalQueue.push(std::bind(&coutString, "pushed by first")); });
+    signalQueue.push(std::bind(&coutString, "second"));
+    signalQueue.flush();
+
+    cout << endl << "Callback throwing while flushed:" << endl;
+    bool thrown = false;
+    signalQueue.push(std::bind(&coutString, "first"));
+    signalQueue.push([&]() { if (!thrown) { thrown = true; throw runtime_error("thrown by second"); } coutString("second"); });
+    signalQueue.push(std::bind(&coutString, "third"));
+    try
+    {
+        signalQueue.flush();
+    }
+    catch (const exception& e)
+    {
+        coutString(e.what());
+    }
+    signalQueue.push(std::bind(&coutString, "pushed after throwing"));
+    signalQueue.flush();
+
+    cout << endl << "Slot disconnecting itself while emitted:" << endl;
+    Signal<int> notifyOnce;
+    Connection once = notifyOnce.connect([&](int i) { coutInt(i); notifyOnce.disconnect(once); });
+    notifyOnce.connect(&coutInt);
+    notifyOnce(1);
+    notifyOnce(2);
+    cout << "notifyOnce state:" << endl << notifyOnce.getTextualState();
+
+    cout << endl << "Disconnecting while emitted on another thread:" << endl;
+    Signal<> notifyBusy;
+    atomic<int> calls(0);
+    atomic<bool> done(false);
+    Connection busy = notifyBusy.connect([&]() { this_thread::sleep_for(chrono::milliseconds(1)); calls++; });
+    thread emitter([&]() { while (!done) notifyBusy(); });
+    while (calls == 0) this_thread::yield();
+    notifyBusy.disconnect(busy);
+    int callsAtDisconnect = calls;
+    this_thread::sleep_for(chrono::milliseconds(10));
+    done = true;
+    emitter.join();
+    coutString(calls == callsAtDisconnect ? "no calls after disconnect" : "called after disconnect. TEST FAILED");
+
+    cout << endl << "Flushing from two threads:" << endl;
+    SignalQueue sharedQueue;
+    mutex pushMutex;
+    int pushed = 0;
+    vector<int> order;
+    atomic<int> running(0);
+    atomic<bool> overlapped(false);
+    auto pushAndFlush = [&]()
+    {
+        for (int i = 0; i < 10000; i++)
+        {
+            {
+                // Numbers the callbacks in the order they are linked.
+                lock_guard<mutex> lock(pushMutex);
+                int n = pushed++;
+                sharedQueue.push([&, n]() { if (running++ != 0) overlapped = true; order.push_back(n); running--; });
+            }
+            sharedQueue.flush();
+        }
+    };
+    thread flusher(pushAndFlush);
+    pushAndFlush();
+    flusher.join();
+    sharedQueue.flush();
+    bool inOrder = ((int)order.size() == pushed);
+    for (int i = 0; inOrder && i < (int)order.size(); i++) { inOrder = (order[i] == i); }
+    coutString(inOrder && !overlapped ? "run one at a time in push order" : "run out of order or concurrently. TEST FAILED");
+
     return 0;
 }
@@ -6,5 +6,11 @@ else
     INITIAL_CXX_FLAGS += -O3
 endif
 
+# Set USE_LIBSECP256K1 to use libsecp256k1 instead of OpenSSL for secp256k1 operations
+ifdef USE_LIBSECP256K1
+    INITIAL_CXX_FLAGS += -DUSE_LIBSECP256K1
+    SECP256K1_LIBS = -lsecp256k1
+endif
+
 CXX_FLAGS := $(INITIAL_CXX_FLAGS) $(CXX_FLAGS)
 
@@ -31,6 +31,12 @@ LIBS += \
     -llogger \
     -lqrencode
 
+# Build with CONFIG+=libsecp256k1 to use libsecp256k1 instead of OpenSSL for secp256k1 operations
+libsecp256k1 {
+    DEFINES += USE_LIBSECP256K1
+    LIBS += -lsecp256k1
+}
+
 CONFIG(debug, debug|release) {
     DESTDIR = build/debug
 } else {
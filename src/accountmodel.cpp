@@ -27,6 +27,8 @@
 #include <QStandardItemModel>
 #include <QFile>
 
+#include <set>
+
 #include "severitylogger.h"
 
 const bool USE_WITNESS_P2SH = true; // only used if segregated witness is enabled
@@ -45,14 +47,15 @@ AccountModel::AccountModel(CoinDB::SynchedVault& synchedVault)
 
 void AccountModel::setBase58Versions()
 {
-    base58_versions[0] = getCoinParams().pay_to_pubkey_hash_version();
+    const CoinQ::CoinParams& coinParams = m_synchedVault.getCoinParams();
+    base58_versions[0] = coinParams.pay_to_pubkey_hash_version();
 #ifdef SUPPORT_OLD_ADDRESS_VERSIONS
-    base58_versions[1] = getUseOldAddressVersions() ? getCoinParams().old_pay_to_script_hash_version() : getCoinParams().pay_to_script_hash_version();
+    base58_versions[1] = getUseOldAddressVersions() ? coinParams.old_pay_to_script_hash_version() : coinParams.pay_to_script_hash_version();
 #else
-    base58_versions[1] = getCoinParams().pay_to_script_hash_version();
+    base58_versions[1] = coinParams.pay_to_script_hash_version();
 #endif
-    base58_versions[2] = getCoinParams().pay_to_witness_pubkey_hash_version();
-    base58_versions[3] = getCoinParams().pay_to_witness_script_hash_version();
+    base58_versions[2] = coinParams.pay_to_witness_pubkey_hash_version();
+    base58_versions[3] = coinParams.pay_to_witness_script_hash_version();
 }
 
 void AccountModel::setColumns()
@@ -95,13 +98,6 @@ void AccountModel::update()
         QString policy = QString::number(account.minsigs()) + tr(" of ") + QString::fromStdString(stdutils::delimited_list(account.keychain_names(), ", "));
         //QString balance = QString::number(vault->getAccountBalance(account.name(), 0)/(1.0 * currency_divisor), 'g', 8);
 
-        uint64_t total = vault->getAccountBalance(account.name(), 0);
-        uint64_t confirmed = vault->getAccountBalance(account.name(), 1);
-        uint64_t pending = total - confirmed;
-        QString confirmedBalance = getFormattedCurrencyAmount(confirmed);
-        QString pendingBalance = tr("+") + getFormattedCurrencyAmount(pending);
-        QString totalBalance = getFormattedCurrencyAmount(total);
-
         QDateTime dateTime;
         dateTime.setTime_t(account.time_created());
         QString creationTime = dateTime.toString("yyyy-MM-dd hh:mm:ss");
@@ -122,19 +118,65 @@ void AccountModel::update()
         QList<QStandardItem*> row;
         row.append(new QStandardItem(accountName));
         row.append(segwitItem);
-        row.append(new QStandardItem(confirmedBalance));
-        row.append(new QStandardItem(pendingBalance));
-        row.append(new QStandardItem(totalBalance));
+        row.append(new QStandardItem());
+        row.append(new QStandardItem());
+        row.append(new QStandardItem());
         row.append(new QStandardItem(policy));
         row.append(new QStandardItem(creationTime));
         appendRow(row);
 
+        setBalances(rowCount() - 1);
     }
     numAccounts = accountNames.size();
 
     emit updated(accountNames);
 }
 
+void AccountModel::updateTx(unsigned long txId)
+{
+    CoinDB::Vault* vault = m_synchedVault.getVault();
+    if (!vault) return;
+
+    // A tx can also change the spent or confirmed state of older outputs, so the balances of the
+    // accounts it touches are requeried rather than adjusted by the tx's own amounts.
+    std::set<std::string> accountNames;
+    std::vector<TxOutView> views = vault->getTxOutViews(txId, "", TxOut::ROLE_BOTH, false);
+    if (views.empty())
+    {
+        // The tx is gone or we don't know which accounts it touched.
+        updateBalances();
+        return;
+    }
+
+    for (auto& view: views) { accountNames.insert(view.role_account()); }
+
+    for (int row = 0; row < rowCount(); row++)
+    {
+        if (accountNames.count(item(row, 0)->text().toStdString())) { setBalances(row); }
+    }
+}
+
+void AccountModel::updateBalances()
+{
+    CoinDB::Vault* vault = m_synchedVault.getVault();
+    if (!vault) return;
+
+    for (int row = 0; row < rowCount(); row++) { setBalances(row); }
+}
+
+void AccountModel::setBalances(int row)
+{
+    CoinDB::Vault* vault = m_synchedVault.getVault();
+    std::string accountName = item(row, 0)->text().toStdString();
+
+    uint64_t total = vault->getAccountBalance(accountName, 0);
+    uint64_t confirmed = vault->getAccountBalance(accountName, 1);
+    uint64_t pending = total - confirmed;
+    item(row, 2)->setText(getFormattedCurrencyAmount(confirmed));
+    item(row, 3)->setText(tr("+") + getFormattedCurrencyAmount(pending));
+    item(row, 4)->setText(getFormattedCurrencyAmount(total));
+}
+
 CoinDB::Vault* AccountModel::getVault() const
 {
     return m_synchedVault.getVault();
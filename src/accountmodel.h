@@ -86,6 +86,10 @@ public:
     //CoinDB::Vault* getVault() const { return vault; }
     int getNumAccounts() const { return numAccounts; }
 
+    // Refresh balances without rebuilding the rows.
+    void updateTx(unsigned long txId);
+    void updateBalances();
+
     // Overridden methods
     QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
     bool setData(const QModelIndex& index, const QVariant& value, int role = Qt::EditRole);
@@ -104,6 +108,7 @@ public slots:
 
 private:
     void setColumns();
+    void setBalances(int row);
 
     unsigned char base58_versions[4];
     QString currencySymbol;
@@ -94,6 +94,7 @@ MainWindow::MainWindow() :
     bQuitting(false),
     syncHeight(0),
     bestHeight(0),
+    vaultBlockHeight(0),
     networkState(NETWORK_STATE_STOPPED),
     accountModel(nullptr),
     keychainModel(nullptr),
@@ -173,12 +174,13 @@ MainWindow::MainWindow() :
     //synchedVault.subscribeVaultError([this](const std::string& error, int /*code*/) { emit signal_error(tr("Vault error: ") + QString::fromStdString(error)); });
     connect(this, SIGNAL(signal_error(const QString&)), this, SLOT(showError(const QString&)));
 
-    synchedVault.subscribeTxInserted([this](std::shared_ptr<CoinDB::Tx> /*tx*/) { if (isSynched()) emit signal_newTx(); });
-    synchedVault.subscribeTxUpdated([this](std::shared_ptr<CoinDB::Tx> /*tx*/) { if (isSynched()) emit signal_newTx(); });
-    synchedVault.subscribeMerkleBlockInserted([this](std::shared_ptr<CoinDB::MerkleBlock> /*merkleblock*/) { emit signal_newBlock(); });
+    synchedVault.subscribeTxInserted([this](std::shared_ptr<CoinDB::Tx> tx) { if (isSynched()) emit signal_newTx(tx->id()); });
+    synchedVault.subscribeTxUpdated([this](std::shared_ptr<CoinDB::Tx> tx) { if (isSynched()) emit signal_newTx(tx->id()); });
+    synchedVault.subscribeTxDeleted([this](std::shared_ptr<CoinDB::Tx> tx) { if (isSynched()) emit signal_newTx(tx->id()); });
+    synchedVault.subscribeMerkleBlockInserted([this](std::shared_ptr<CoinDB::MerkleBlock> merkleblock) { emit signal_newBlock(merkleblock->blockheader() ? (int)merkleblock->blockheader()->height() : 0); });
 
-    connect(this, SIGNAL(signal_newTx()), this, SLOT(newTx()));
-    connect(this, SIGNAL(signal_newBlock()), this, SLOT(newBlock()));
+    connect(this, SIGNAL(signal_newTx(qulonglong)), this, SLOT(newTx(qulonglong)));
+    connect(this, SIGNAL(signal_newBlock(int)), this, SLOT(newBlock(int)));
     connect(this, SIGNAL(signal_refreshAccounts()), this, SLOT(refreshAccounts()));
 
     accountSelectionModel = accountView->selectionModel();
@@ -280,7 +282,7 @@ MainWindow::MainWindow() :
 void MainWindow::loadHeaders()
 {
     synchedVault.loadHeaders(blockTreeFile.toStdString(), false,
-        [this](const CoinQBlockTreeMem& blockTree) {
+        [this](const ICoinQBlockTree& blockTree) {
             std::stringstream progress;
             progress << "Height: " << blockTree.getBestHeight() << " / " << "Total Work: " << blockTree.getTotalWork().getDec();
             emit headersLoadProgress(QString::fromStdString(progress.str()));
@@ -1826,7 +1828,7 @@ void MainWindow::createTx(const PaymentRequest& paymentRequest)
             if (!tx) throw std::runtime_error(tr("Error creating transaction.").toStdString());
 
             saved = true;
-            newTx();
+            newTx(tx->id());
 
             tabWidget->setCurrentWidget(txView);
 
@@ -1835,7 +1837,7 @@ void MainWindow::createTx(const PaymentRequest& paymentRequest)
                 // First try to sign with unlocked keychains
                 std::vector<std::string> keychains;
                 tx = accountModel->getVault()->signTx(tx->id(), keychains, true);
-                txModel->update();
+                txModel->updateTx(tx->id());
 
                 if (tx->status() == CoinDB::Tx::UNSIGNED)
                 {
@@ -1925,14 +1927,39 @@ void MainWindow::sendRawTx()
     }
 }
 
-void MainWindow::newTx()
+void MainWindow::newTx(qulonglong txId)
 {
-    refreshAccounts();
+    if (bQuitting) return;
+
+    if (!txId)
+    {
+        refreshAccounts();
+        return;
+    }
+
+    // Only the rows and balances touched by the tx are updated.
+    accountModel->updateTx(txId);
+    txModel->updateTx(txId);
 }
 
-void MainWindow::newBlock()
+void MainWindow::newBlock(int height)
 {
-    if (isSynched() || syncHeight % 10 == 0) { refreshAccounts(); }
+    if (bQuitting) return;
+
+    // A block that does not extend the last one means the vault reorganized, so reload everything.
+    bool reorg = height <= vaultBlockHeight;
+    vaultBlockHeight = height;
+
+    if (reorg || (!isSynched() && syncHeight % 10 == 0))
+    {
+        refreshAccounts();
+    }
+    else if (isSynched())
+    {
+        // Txs confirmed by the block arrive as tx updates, only confirmation counts and balances change here.
+        accountModel->updateBalances();
+        txModel->updateConfirmations();
+    }
 }
 
 void MainWindow::syncBlocks()
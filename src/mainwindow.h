@@ -92,8 +92,8 @@ signals:
     void signal_networkTimeout();
     void signal_networkDoneSync();
 
-    void signal_newTx();
-    void signal_newBlock();
+    void signal_newTx(qulonglong txId);
+    void signal_newBlock(int height);
     void signal_refreshAccounts();
 
     void signal_addBestChain(const chain_header_t& header);
@@ -190,7 +190,7 @@ private slots:
     void createRawTx();
     void createTx(const PaymentRequest& paymentRequest = PaymentRequest());
     void signRawTx();
-    void newTx();
+    void newTx(qulonglong txId = 0);
     void sendRawTx();
 
     //////////////////////////////
@@ -202,7 +202,7 @@ private slots:
     void blocksSynched();
     void addBestChain(const chain_header_t& header);
     void removeBestChain(const chain_header_t& header);
-    void newBlock();
+    void newBlock(int height);
 
     /////////////////////
     // NETWORK OPERATIONS
@@ -345,6 +345,7 @@ private:
     // network actions
     int syncHeight;
     int bestHeight;
+    int vaultBlockHeight; // height of the last merkle block inserted into the vault
     QLabel* syncLabel;
     QLabel* networkStateLabel;
     QString blockTreeFile;
@@ -19,17 +19,12 @@
 
 #include "severitylogger.h"
 
-// Select the network
-
-#define USE_BITCOIN
-//#define USE_LITECOIN
-//#define USE_QUARKCOIN
-#include <CoinQ_coinparams.h>
-
-NetworkSync::NetworkSync()
-    : work(io_service), io_service_thread(NULL), peer(io_service), blockFilter(&blockTree), resynching(false), isConnected_(false)
+NetworkSync::NetworkSync(const CoinQ::CoinParams& coinParams_)
+    : coinParams(coinParams_), work(io_service), io_service_thread(NULL), peer(io_service), blockFilter(&blockTree), resynching(false), isConnected_(false)
 {
-    Coin::CoinBlockHeader::setHashFunc(COIN_PARAMS::BLOCK_HEADER_HASH_FUNCTION);
+    // Headers are hashed with the network's functions rather than the process-wide defaults.
+    blockTree.setHashFuncs(coinParams.block_header_hash_funcs());
+    peer.setHashFuncs(coinParams.block_header_hash_funcs());
 
     io_service_thread = new boost::thread(boost::bind(&CoinQ::io_service_t::run, &io_service));
 
@@ -212,7 +207,7 @@ void NetworkSync::initBlockTree(const QString& blockTreeFile)
 
     blockTree.clear();
 
-    blockTree.setGenesisBlock(COIN_PARAMS::GENESIS_BLOCK);
+    blockTree.setGenesisBlock(coinParams.genesis_block());
     blockTreeFlushed = false;
     emit status(tr("Block tree file not found. A new one will be created."));
 }
@@ -355,7 +350,7 @@ void NetworkSync::start(const QString& host, int port)
         stop();
     }
 
-    peer.set(host.toStdString(), QString::number(port).toStdString(), COIN_PARAMS::MAGIC_BYTES, COIN_PARAMS::PROTOCOL_VERSION, "Wallet v0.1", 0, false);
+    peer.set(host.toStdString(), QString::number(port).toStdString(), coinParams.magic_bytes(), coinParams.protocol_version(), "Wallet v0.1", 0, false);
     peer.start();
     emit started();
 }
@@ -20,6 +20,7 @@
 #include <CoinQ_peer_io.h>
 #include <CoinQ_blocks.h>
 #include <CoinQ_filter.h>
+#include <CoinQ_coinparams.h>
 
 #include <CoinQ_signals.h>
 #include <CoinQ_slots.h>
@@ -43,7 +44,7 @@ class NetworkSync : public QObject
     Q_OBJECT
 
 public:
-    NetworkSync();
+    explicit NetworkSync(const CoinQ::CoinParams& coinParams = CoinQ::getBitcoinParams());
     ~NetworkSync();
 
     bool isConnected() const { return isConnected_; }
@@ -90,6 +91,8 @@ signals:
     void removeBestChain(const chain_header_t& header);
 
 private:
+    CoinQ::CoinParams coinParams;
+
     CoinQ::io_service_t io_service;
     CoinQ::io_service_t::work work;
     boost::thread* io_service_thread;
@@ -33,7 +33,7 @@ using namespace CoinQ::Script;
 using namespace std;
 
 TxModel::TxModel(QObject* parent)
-    : QStandardItemModel(parent)
+    : QStandardItemModel(parent), vault(nullptr), allFetched(true)
 {
     setBase58Versions();
     currencySymbol = getCurrencySymbol();
@@ -42,7 +42,7 @@ TxModel::TxModel(QObject* parent)
 }
 
 TxModel::TxModel(CoinDB::Vault* vault, const QString& accountName, QObject* parent)
-    : QStandardItemModel(parent)
+    : QStandardItemModel(parent), vault(nullptr), allFetched(true)
 {
     setBase58Versions();
     currencySymbol = getCurrencySymbol();
@@ -54,11 +54,13 @@ TxModel::TxModel(CoinDB::Vault* vault, const QString& accountName, QObject* pare
 
 void TxModel::setBase58Versions()
 {
-    base58_versions[0] = getCoinParams().pay_to_pubkey_hash_version();
+    // Use the vault's network, which need not be the one selected in the settings.
+    const CoinQ::CoinParams& coinParams = vault ? vault->getCoinParams() : getCoinParams();
+    base58_versions[0] = coinParams.pay_to_pubkey_hash_version();
 #ifdef SUPPORT_OLD_ADDRESS_VERSIONS
-    base58_versions[1] = getUseOldAddressVersions() ? getCoinParams().old_pay_to_script_hash_version() : getCoinParams().pay_to_script_hash_version();
+    base58_versions[1] = getUseOldAddressVersions() ? coinParams.old_pay_to_script_hash_version() : coinParams.pay_to_script_hash_version();
 #else
-    base58_versions[1] = getCoinParams().pay_to_script_hash_version();
+    base58_versions[1] = coinParams.pay_to_script_hash_version();
 #endif
 }
 
@@ -84,6 +86,8 @@ void TxModel::setVault(CoinDB::Vault* vault)
 {
     this->vault = vault;
     accountName.clear();
+    allFetched = true;
+    setBase58Versions();
 }
 
 void TxModel::setAccount(const QString& accountName)
@@ -100,27 +104,32 @@ void TxModel::setAccount(const QString& accountName)
     update();
 }
 
-class SortableRow
+// The history order of a row, see CoinDB::TxViewCursor. The keys are stored in the row items.
+static TxViewCursor getRowCursor(const QList<QStandardItem*>& row)
 {
-public:
-    SortableRow(const QList<QStandardItem*>& row, int status, uint32_t nConfirmations, int64_t value, uint32_t txindex) :
-        row_(row), status_(status), nConfirmations_(nConfirmations), value_(value), txindex_(txindex) { }
-
-    QList<QStandardItem*>& row() { return row_; }
+    TxViewCursor cursor;
+    cursor.started = true;
+    cursor.height = row[6]->data(Qt::UserRole + 2).toUInt();
+    cursor.confirmed = cursor.height != 0;
+    cursor.timestamp = row[0]->data(Qt::UserRole).toUInt();
+    cursor.tx_id = row[8]->data(Qt::UserRole + 1).toULongLong();
+    cursor.txindex = row[8]->data(Qt::UserRole).toUInt();
+    return cursor;
+}
 
-    int status() const { return status_; }
-    uint32_t nConfirmations() const { return nConfirmations_; }
-    int64_t value() const { return value_; }
-    uint32_t txindex() const { return txindex_; }
+static bool historyLessThan(const TxViewCursor& a, const TxViewCursor& b)
+{
+    // unconfirmed first
+    if (a.confirmed != b.confirmed) return b.confirmed;
 
-private:
-    QList<QStandardItem*> row_;
+    // then by descending height, timestamp and tx id
+    if (a.height != b.height) return a.height > b.height;
+    if (a.timestamp != b.timestamp) return a.timestamp > b.timestamp;
+    if (a.tx_id != b.tx_id) return a.tx_id > b.tx_id;
 
-    int status_;
-    uint32_t nConfirmations_;
-    int64_t value_;
-    uint32_t txindex_;
-};
+    // outputs of the same tx by ascending index
+    return a.txindex < b.txindex;
+}
 
 void TxModel::update()
 {
@@ -134,153 +143,245 @@ void TxModel::update()
     }
 
     removeRows(0, rowCount());
+    cursor = TxViewCursor();
+    lastTxHash.clear();
+    allFetched = true;
 
     if (!vault || accountName.isEmpty()) return;
 
+    allFetched = false;
+    fetchMore(QModelIndex());
+}
+
+bool TxModel::canFetchMore(const QModelIndex& parent) const
+{
+    return !parent.isValid() && !allFetched;
+}
+
+void TxModel::fetchMore(const QModelIndex& parent)
+{
+    if (parent.isValid() || allFetched) return;
+
+    // Seek past the last row fetched so each window costs the same regardless of how far down it is.
+    std::vector<TxOutView> txoutviews = vault->getTxOutViewsAfter(accountName.toStdString(), cursor, FETCH_SIZE, TxOut::ROLE_BOTH, true);
+    if (txoutviews.size() < (size_t)FETCH_SIZE) allFetched = true;
+    if (txoutviews.empty()) return;
+
     std::shared_ptr<BlockHeader> bestHeader = vault->getBestBlockHeader();
 
-    std::vector<TxOutView> txoutviews = vault->getTxOutViews(accountName.toStdString(), "", TxOut::ROLE_BOTH, TxOut::BOTH, Tx::ALL, true);
-    bytes_t last_txhash;
-    QList<SortableRow> rows;
+    int firstRow = rowCount();
     for (auto& item: txoutviews) {
-        QList<QStandardItem*> row;
-
-        QDateTime utc;
-        utc.setTime_t(item.tx_timestamp);
-        QString time = utc.toLocalTime().toString();
-
-        QString description = QString::fromStdString(item.role_label());
-
-        // The type stuff is just to test the new db schema. It's all wrong, we're not going to use TxOutViews for this.
-        TxType txType;
-        QString type;
-        QString amount;
-        QString fee;
-        int64_t value = 0;
-        bytes_t this_txhash = item.tx_status == Tx::UNSIGNED ? item.tx_unsigned_hash : item.tx_hash;
-        switch (item.role_flags) {
-        case TxOut::ROLE_NONE:
-            txType = NONE;
-            type = tr("None");
-            break;
-
-        case TxOut::ROLE_SENDER:
-            txType = SEND;
-            type = tr("Send");
-            amount = "-";
-            value -= item.value;
-            if (item.tx_has_all_outpoints && item.tx_fee() > 0) {
-                if (this_txhash != last_txhash) {
-                    fee = "-";
-                    //fee += QString::number(item.tx_fee()/(1.0 * currency_divisor), 'g', 8);
-                    fee += getFormattedCurrencyAmount(item.tx_fee());
-                    value -= item.tx_fee();
-                    last_txhash = this_txhash;
-                }
-                else {
-                    fee = "||";
-                }
-            }
-            break;
-
-        case TxOut::ROLE_RECEIVER:
-            txType = RECEIVE;
-            type = tr("Receive");
-            amount = "+";
-            value += item.value;
-            break;
-
-        default:
-            txType = UNKNOWN;
-            type = tr("Unknown");
-        }
+        appendRow(createRow(item, bestHeader, lastTxHash));
+    }
+    cursor = TxViewCursor(txoutviews.back());
 
-        //amount += QString::number(item.value/(1.0 * currency_divisor), 'g', 8);
-        amount += getFormattedCurrencyAmount(item.value);
+    updateBalances(firstRow);
+}
+
+void TxModel::updateTx(unsigned long txId)
+{
+    if (!vault || accountName.isEmpty()) return;
 
-        uint32_t nConfirmations = 0;
-        QString confirmations;
-        if (item.tx_status >= Tx::PROPAGATED) {
-            if (bestHeader && item.height) {
-                nConfirmations = bestHeader->height() + 1 - item.height;
-                confirmations = QString::number(nConfirmations);
+    for (int i = rowCount() - 1; i >= 0; i--) {
+        if (item(i, 8)->data(Qt::UserRole + 1).toULongLong() == txId) removeRow(i);
+    }
+
+    std::shared_ptr<BlockHeader> bestHeader = vault->getBestBlockHeader();
+
+    std::vector<TxOutView> txoutviews = vault->getTxOutViews(txId, accountName.toStdString(), TxOut::ROLE_BOTH, true);
+    bytes_t last_txhash;
+    for (auto& item: txoutviews) {
+        QList<QStandardItem*> row = createRow(item, bestHeader, last_txhash);
+        TxViewCursor rowCursor = getRowCursor(row);
+
+        // binary search for the first row that sorts after the new one
+        int lower = 0;
+        int upper = rowCount();
+        while (lower < upper) {
+            int middle = (lower + upper) / 2;
+            QList<QStandardItem*> middleRow;
+            for (int column = 0; column < columnCount(); column++) { middleRow.append(this->item(middle, column)); }
+            if (historyLessThan(rowCursor, getRowCursor(middleRow))) {
+                upper = middle;
             }
             else {
-                confirmations = "0";
+                lower = middle + 1;
             }
         }
-        else if (item.tx_status == Tx::UNSIGNED) {
-            confirmations = tr("Unsigned");
-        }
-        else if (item.tx_status == Tx::UNSENT) {
-            confirmations = tr("Unsent");
+
+        // Rows that sort after everything fetched so far will be fetched with a later window.
+        if (lower == rowCount() && !allFetched && historyLessThan(cursor, rowCursor)) {
+            qDeleteAll(row);
+            continue;
         }
-        QStandardItem* confirmationsItem = new QStandardItem(confirmations);
-        confirmationsItem->setData(item.tx_status, Qt::UserRole);
-        confirmationsItem->setData((int)nConfirmations, Qt::UserRole + 1);
 
-        QString address = QString::fromStdString(getAddressForTxOutScript(item.script, base58_versions));
-        QString hash = QString::fromStdString(uchar_vector(this_txhash).getHex());
+        insertRow(lower, row);
+    }
 
-        row.append(new QStandardItem(time));
-        row.append(new QStandardItem(description));
+    // The account balance anchoring the running balances might have changed too.
+    updateBalances(0);
+}
 
-        QStandardItem* typeItem = new QStandardItem(type);
-        typeItem->setData(txType, Qt::UserRole);
-        row.append(typeItem);
+void TxModel::updateConfirmations()
+{
+    if (!vault || accountName.isEmpty()) return;
 
-        row.append(new QStandardItem(amount));
-        row.append(new QStandardItem(fee));
-        row.append(new QStandardItem("")); // placeholder for balance, once sorted
-        row.append(confirmationsItem);
-        row.append(new QStandardItem(address));
+    std::shared_ptr<BlockHeader> bestHeader = vault->getBestBlockHeader();
+    if (!bestHeader) return;
 
-        // Store the tx hash and tx index to uniquely identify the output.
-        QStandardItem* hashItem = new QStandardItem(hash);
-        hashItem->setData(item.tx_index, Qt::UserRole);
-        row.append(hashItem);
+    // Confirmed rows all gain the same number of confirmations so their order is unchanged.
+    for (int i = 0; i < rowCount(); i++) {
+        QStandardItem* confirmationsItem = item(i, 6);
+        if (confirmationsItem->data(Qt::UserRole).toInt() < Tx::PROPAGATED) continue;
 
-        // Add size and vsize
-        std::shared_ptr<Tx> tx = vault->getTx(item.tx_id);
-        Coin::Transaction core_tx = tx->toCoinCore();
-LOGGER(trace) << "Size: " << core_tx.getSize(true) << endl;
-LOGGER(trace) << "VSize: " << core_tx.getVSize() << endl;
-        QStandardItem* sizeItem = new QStandardItem(QString::number(core_tx.getSize(true)));
-        QStandardItem* vsizeItem = new QStandardItem(QString::number(core_tx.getVSize()));
-        row.append(sizeItem);
-        row.append(vsizeItem);
+        uint32_t height = confirmationsItem->data(Qt::UserRole + 2).toUInt();
+        if (!height || height > bestHeader->height() + 1) continue;
 
-        rows.append(SortableRow(row, item.tx_status, nConfirmations, value, item.tx_index));
+        uint32_t nConfirmations = bestHeader->height() + 1 - height;
+        confirmationsItem->setText(QString::number(nConfirmations));
+        confirmationsItem->setData((int)nConfirmations, Qt::UserRole + 1);
     }
+}
 
-    qSort(rows.begin(), rows.end(), [](const SortableRow& a, const SortableRow& b) {
-        // order by status first (unsigned, then propagated, then confirmed)
-        if (a.status() < b.status()) return true;
-        if (a.status() > b.status()) return false;
+QList<QStandardItem*> TxModel::createRow(const TxOutView& item, std::shared_ptr<BlockHeader> bestHeader, bytes_t& last_txhash)
+{
+    QList<QStandardItem*> row;
+
+    QDateTime utc;
+    utc.setTime_t(item.tx_timestamp);
+    QString time = utc.toLocalTime().toString();
+
+    QString description = QString::fromStdString(item.role_label());
+
+    // The type stuff is just to test the new db schema. It's all wrong, we're not going to use TxOutViews for this.
+    TxType txType;
+    QString type;
+    QString amount;
+    QString fee;
+    int64_t value = 0;
+    bytes_t this_txhash = item.tx_status == Tx::UNSIGNED ? item.tx_unsigned_hash : item.tx_hash;
+    switch (item.role_flags) {
+    case TxOut::ROLE_NONE:
+        txType = NONE;
+        type = tr("None");
+        break;
+
+    case TxOut::ROLE_SENDER:
+        txType = SEND;
+        type = tr("Send");
+        amount = "-";
+        value -= item.value;
+        if (item.tx_has_all_outpoints && item.tx_fee() > 0) {
+            if (this_txhash != last_txhash) {
+                fee = "-";
+                //fee += QString::number(item.tx_fee()/(1.0 * currency_divisor), 'g', 8);
+                fee += getFormattedCurrencyAmount(item.tx_fee());
+                value -= item.tx_fee();
+                last_txhash = this_txhash;
+            }
+            else {
+                fee = "||";
+            }
+        }
+        break;
+
+    case TxOut::ROLE_RECEIVER:
+        txType = RECEIVE;
+        type = tr("Receive");
+        amount = "+";
+        value += item.value;
+        break;
+
+    default:
+        txType = UNKNOWN;
+        type = tr("Unknown");
+    }
 
-        // if confirmation counts are equal
-        if (a.nConfirmations() == b.nConfirmations()) {
-            // if one value is positive and the other is negative, sort so that running balance remains positive
-            if (a.value() < 0 && b.value() > 0) return true;
-            if (a.value() > 0 && b.value() < 0) return false;
+    //amount += QString::number(item.value/(1.0 * currency_divisor), 'g', 8);
+    amount += getFormattedCurrencyAmount(item.value);
 
-            // otherwise sort by ascending tx index
-            return (a.txindex() < b.txindex());
+    uint32_t nConfirmations = 0;
+    QString confirmations;
+    if (item.tx_status >= Tx::PROPAGATED) {
+        if (bestHeader && item.height) {
+            nConfirmations = bestHeader->height() + 1 - item.height;
+            confirmations = QString::number(nConfirmations);
         }
+        else {
+            confirmations = "0";
+        }
+    }
+    else if (item.tx_status == Tx::UNSIGNED) {
+        confirmations = tr("Unsigned");
+    }
+    else if (item.tx_status == Tx::UNSENT) {
+        confirmations = tr("Unsent");
+    }
+    QStandardItem* confirmationsItem = new QStandardItem(confirmations);
+    confirmationsItem->setData(item.tx_status, Qt::UserRole);
+    confirmationsItem->setData((int)nConfirmations, Qt::UserRole + 1);
+    confirmationsItem->setData((uint)item.height, Qt::UserRole + 2);
+
+    QString address = QString::fromStdString(getAddressForTxOutScript(item.script, base58_versions));
+    QString hash = QString::fromStdString(uchar_vector(this_txhash).getHex());
+
+    QStandardItem* timeItem = new QStandardItem(time);
+    timeItem->setData(item.tx_timestamp, Qt::UserRole);
+    row.append(timeItem);
+    row.append(new QStandardItem(description));
+
+    QStandardItem* typeItem = new QStandardItem(type);
+    typeItem->setData(txType, Qt::UserRole);
+    row.append(typeItem);
+
+    QStandardItem* amountItem = new QStandardItem(amount);
+    amountItem->setData((qlonglong)value, Qt::UserRole);
+    row.append(amountItem);
+
+    row.append(new QStandardItem(fee));
+    row.append(new QStandardItem("")); // placeholder for balance, once inserted
+    row.append(confirmationsItem);
+    row.append(new QStandardItem(address));
+
+    // Store the tx hash and tx index to uniquely identify the output, and the tx id to find the rows of a tx.
+    QStandardItem* hashItem = new QStandardItem(hash);
+    hashItem->setData(item.tx_index, Qt::UserRole);
+    hashItem->setData((qulonglong)item.tx_id, Qt::UserRole + 1);
+    row.append(hashItem);
+
+    // Add size and vsize
+    std::shared_ptr<Tx> tx = vault->getTx(item.tx_id);
+    Coin::Transaction core_tx = tx->toCoinCore();
+LOGGER(trace) << "Size: " << core_tx.getSize(true) << endl;
+LOGGER(trace) << "VSize: " << core_tx.getVSize() << endl;
+    QStandardItem* sizeItem = new QStandardItem(QString::number(core_tx.getSize(true)));
+    QStandardItem* vsizeItem = new QStandardItem(QString::number(core_tx.getVSize()));
+    row.append(sizeItem);
+    row.append(vsizeItem);
+
+    return row;
+}
 
-        // otherwise sort by ascending confirmation count
-        return (a.nConfirmations() < b.nConfirmations());
-    });
+void TxModel::updateBalances(int fromRow)
+{
+    if (fromRow >= rowCount()) return;
 
-    // iterate in reverse order to compute running balance
-    int64_t balance = 0;
-    for (int i = rows.size() - 1; i >= 0; i--) {
-        balance += rows[i].value();
-        (rows[i].row())[5]->setText(getFormattedCurrencyAmount(balance));
+    // Only a window of the history is loaded, so the running balance is computed downward from the
+    // account balance rather than accumulated upward from the oldest row.
+    int64_t balance;
+    if (fromRow == 0) {
+        balance = vault->getAccountBalance(accountName.toStdString(), 0, Tx::ALL);
+    }
+    else {
+        balance = item(fromRow - 1, 5)->data(Qt::UserRole).toLongLong() - item(fromRow - 1, 3)->data(Qt::UserRole).toLongLong();
     }
 
-    // iterate in forward order to display
-    for (auto& row: rows) appendRow(row.row());
+    for (int i = fromRow; i < rowCount(); i++) {
+        QStandardItem* balanceItem = item(i, 5);
+        balanceItem->setText(getFormattedCurrencyAmount(balance));
+        balanceItem->setData((qlonglong)balance, Qt::UserRole);
+        balance -= item(i, 3)->data(Qt::UserRole).toLongLong();
+    }
 }
 
 bytes_t TxModel::getTxHash(int row) const
@@ -348,7 +449,7 @@ void TxModel::signTx(int row)
     if (!tx) throw std::runtime_error(tr("No new signatures were added.").toStdString());
 
     LOGGER(trace) << "TxModel::signTx - signature(s) added. raw tx: " << uchar_vector(tx->raw()).getHex() << std::endl;
-    update();
+    updateTx(tx->id());
 
     QString msg;
     if (keychainNames.empty())
@@ -29,6 +29,9 @@ class TxModel : public QStandardItemModel
 public:
     enum TxType { NONE, SEND, RECEIVE, UNKNOWN };
 
+    // Rows are fetched from the vault a window at a time as the view scrolls.
+    enum { FETCH_SIZE = 256 };
+
     TxModel(QObject* parent = nullptr);
     TxModel(CoinDB::Vault* vault, const QString& accountName, QObject* parent = nullptr);
 
@@ -39,6 +42,10 @@ public:
     void setAccount(const QString& accountName);
     void update();
 
+    // Incremental updates that only touch the loaded rows of one tx, or only the confirmation counts.
+    void updateTx(unsigned long txId);
+    void updateConfirmations();
+
     bytes_t getTxHash(int row) const;
     int getTxStatus(int row) const;
     int getTxConfirmations(int row) const;
@@ -54,6 +61,8 @@ public:
     QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
     bool setData(const QModelIndex& index, const QVariant& value, int role = Qt::EditRole);
     Qt::ItemFlags flags(const QModelIndex& index) const;
+    bool canFetchMore(const QModelIndex& parent) const;
+    void fetchMore(const QModelIndex& parent);
  
 signals:
     void txSigned(const QString& keychainNames);
@@ -66,8 +75,16 @@ private:
 
     void setColumns();
 
+    QList<QStandardItem*> createRow(const CoinDB::TxOutView& item, std::shared_ptr<CoinDB::BlockHeader> bestHeader, bytes_t& last_txhash);
+    void updateBalances(int fromRow); // recomputes running balances from fromRow down
+
     CoinDB::Vault* vault;
     QString accountName; // empty when not loaded
+
+    CoinDB::TxViewCursor cursor; // last row fetched
+    bytes_t lastTxHash; // tx of the last row fetched, its fee is only shown once
+    bool allFetched;
+
     uint64_t confirmedBalance;
     uint64_t pendingBalance;
 };
@@ -0,0 +1,242 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// EventPublisher.cpp
+//
+// Copyright (c) 2013-2014 Eric Lombrozo
+//
+// All Rights Reserved.
+//
+// vaultd - headless daemon with WebSockets API
+//
+
+#include "EventPublisher.h"
+
+#include <stdexcept>
+#include <sstream>
+
+using namespace CoinDB;
+
+int EventPublisher::getTopics(const std::string& names)
+{
+    int topics = 0;
+    std::stringstream ss(names);
+    std::string name;
+    while (std::getline(ss, name, ','))
+    {
+        if (name == "tx")           { topics |= TX; }
+        else if (name == "block")   { topics |= BLOCK; }
+        else if (name == "status")  { topics |= STATUS; }
+        else if (name == "all")     { topics |= ALL; }
+        else throw std::runtime_error("Invalid topic: " + name);
+    }
+    if (!topics) throw std::runtime_error("No topics.");
+    return topics;
+}
+
+EventPublisher::EventPublisher(std::size_t max_queued, unsigned int flush_interval)
+    : max_queued_(max_queued ? max_queued : 1), flush_interval_(flush_interval), running_(false), pending_(false)
+{
+}
+
+EventPublisher::~EventPublisher()
+{
+    stop();
+}
+
+void EventPublisher::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) return;
+
+    running_ = true;
+    delivery_thread_ = std::thread(&EventPublisher::deliveryLoop, this);
+}
+
+void EventPublisher::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+    }
+    cond_.notify_all();
+    delivery_thread_.join();
+}
+
+void EventPublisher::connect(SynchedVault& synchedVault)
+{
+    synchedVault.subscribeTxInserted([this](std::shared_ptr<Tx> tx) { publishTx("inserted", tx); });
+    synchedVault.subscribeTxUpdated([this](std::shared_ptr<Tx> tx) { publishTx("updated", tx); });
+    synchedVault.subscribeTxDeleted([this](std::shared_ptr<Tx> tx) { publishTx("deleted", tx); });
+    synchedVault.subscribeBestHeaderChanged([this](uint32_t height, const bytes_t& hash) { publishHeader("bestheader", height, hash); });
+    synchedVault.subscribeSyncHeaderChanged([this](uint32_t height, const bytes_t& hash) { publishHeader("syncheader", height, hash); });
+    synchedVault.subscribeStatusChanged([this](SynchedVault::status_t status) { publishStatus(status); });
+}
+
+void EventPublisher::subscribe(websocketpp::connection_hdl hdl, int topics, send_t send)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Subscriber& subscriber = subscribers_[hdl];
+    subscriber.topics = topics;
+    subscriber.send = send;
+}
+
+bool EventPublisher::unsubscribe(websocketpp::connection_hdl hdl)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return subscribers_.erase(hdl) > 0;
+}
+
+std::size_t EventPublisher::subscribers() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return subscribers_.size();
+}
+
+void EventPublisher::publishTx(const std::string& type, std::shared_ptr<Tx> tx)
+{
+    // An update that confirms the transaction is reported as a confirmation.
+    bool bConfirmed = tx->status() == Tx::CONFIRMED && tx->blockheader();
+
+    // Unsigned transactions have no hash yet, so events for the same transaction coalesce by id.
+    std::stringstream fields;
+    fields << ",\"id\":" << tx->id()
+           << ",\"hash\":\"" << uchar_vector(tx->hash()).getHex() << "\""
+           << ",\"unsigned_hash\":\"" << uchar_vector(tx->unsigned_hash()).getHex() << "\""
+           << ",\"status\":\"" << Tx::getStatusString(tx->status(), true) << "\"";
+    if (bConfirmed) { fields << ",\"height\":" << tx->blockheader()->height(); }
+
+    Event event;
+    event.key = "tx:" + std::to_string(tx->id());
+    event.type = "tx" + (type == "updated" && bConfirmed ? std::string("confirmed") : type);
+    event.fields = fields.str();
+    publish(TX, event);
+}
+
+void EventPublisher::publishHeader(const std::string& type, uint32_t height, const bytes_t& hash)
+{
+    std::stringstream fields;
+    fields << ",\"height\":" << height << ",\"hash\":\"" << uchar_vector(hash).getHex() << "\"";
+
+    Event event;
+    event.key = type;
+    event.type = type;
+    event.fields = fields.str();
+    publish(BLOCK, event);
+}
+
+void EventPublisher::publishStatus(SynchedVault::status_t status)
+{
+    Event event;
+    event.key = "status";
+    event.type = "status";
+    event.fields = ",\"status\":\"" + SynchedVault::getStatusString(status) + "\"";
+    publish(STATUS, event);
+}
+
+void EventPublisher::publish(topic_t topic, const Event& event)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+
+        bool bQueued = false;
+        for (auto& item: subscribers_)
+        {
+            if (!(item.second.topics & topic)) continue;
+            enqueue(item.second, event);
+            bQueued = true;
+        }
+        if (!bQueued) return;
+        pending_ = true;
+    }
+    cond_.notify_one();
+}
+
+void EventPublisher::enqueue(Subscriber& subscriber, const Event& event)
+{
+    for (auto it = subscriber.events.begin(); it != subscriber.events.end(); ++it)
+    {
+        if (it->key != event.key) continue;
+
+        // A transaction the client has not heard of yet stays an insertion, and one deleted before the client
+        // heard of it is never mentioned.
+        if (it->type == "txinserted")
+        {
+            if (event.type == "txdeleted")  { subscriber.events.erase(it); }
+            else                            { it->fields = event.fields; }
+        }
+        else
+        {
+            *it = event;
+        }
+        return;
+    }
+
+    if (subscriber.events.size() >= max_queued_)
+    {
+        subscriber.dropped += subscriber.events.size() + 1;
+        subscriber.events.clear();
+        subscriber.overflowed = true;
+        return;
+    }
+
+    subscriber.events.push_back(event);
+}
+
+void EventPublisher::deliveryLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_)
+    {
+        cond_.wait(lock, [this]() { return !running_ || pending_; });
+        if (!running_) break;
+
+        // Let the rest of a burst arrive so it goes out in one message.
+        cond_.wait_for(lock, flush_interval_, [this]() { return !running_; });
+        if (!running_) break;
+        pending_ = false;
+
+        std::vector<std::pair<send_t, std::string>> messages;
+        for (auto& item: subscribers_)
+        {
+            Subscriber& subscriber = item.second;
+            if (subscriber.events.empty() && !subscriber.overflowed) continue;
+
+            std::stringstream ss;
+            ss << "[";
+            bool bFirst = true;
+            if (subscriber.overflowed)
+            {
+                ss << "{\"event\":\"overflow\",\"dropped\":" << subscriber.dropped << "}";
+                bFirst = false;
+            }
+            for (auto& event: subscriber.events)
+            {
+                if (!bFirst) { ss << ","; }
+                ss << "{\"event\":\"" << event.type << "\"" << event.fields << "}";
+                bFirst = false;
+            }
+            ss << "]";
+
+            messages.push_back(std::make_pair(subscriber.send, ss.str()));
+            subscriber.events.clear();
+            subscriber.overflowed = false;
+            subscriber.dropped = 0;
+        }
+
+        lock.unlock();
+        for (auto& message: messages)
+        {
+            try
+            {
+                message.first(message.second);
+            }
+            catch (...)
+            {
+                // The connection is going away. closeCallback unsubscribes it.
+            }
+        }
+        lock.lock();
+    }
+}
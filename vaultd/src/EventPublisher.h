@@ -0,0 +1,119 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// EventPublisher.h
+//
+// Copyright (c) 2013-2014 Eric Lombrozo
+//
+// All Rights Reserved.
+//
+// vaultd - headless daemon with WebSockets API
+//
+
+#pragma once
+
+#include <SynchedVault.h>
+
+#include <websocketpp/common/connection_hdl.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Pushes SynchedVault events to subscribed WebSocket connections.
+//
+// Events are formatted as JSON objects when they happen and queued per connection. A delivery thread
+// sends each connection's queue as a single JSON array at most once per flush interval, so a burst of
+// events during block sync costs a few messages rather than one per event. While queued, events
+// coalesce: a later event for the same transaction replaces the earlier one, and only the latest
+// status and headers are kept.
+//
+// Queues are bounded. A connection whose queue fills up loses its queued events and gets an overflow
+// event instead, after which it should poll once to catch up.
+class EventPublisher
+{
+public:
+    enum topic_t
+    {
+        TX      = 1 << 0,   // tx inserted, updated (including confirmed) and deleted
+        BLOCK   = 1 << 1,   // best header and sync header
+        STATUS  = 1 << 2,   // sync status
+        ALL     = (1 << 3) - 1
+    };
+
+    static int getTopics(const std::string& names); // comma separated tx, block, status or all. throws std::runtime_error
+
+    enum
+    {
+        DEFAULT_MAX_QUEUED = 256,           // events per connection
+        DEFAULT_FLUSH_INTERVAL = 100        // milliseconds
+    };
+
+    // Sends one message with a JSON array of events to a connection.
+    typedef std::function<void(const std::string& /*events*/)> send_t;
+
+    explicit EventPublisher(std::size_t max_queued = DEFAULT_MAX_QUEUED, unsigned int flush_interval = DEFAULT_FLUSH_INTERVAL);
+    ~EventPublisher();
+
+    void start();
+    void stop();
+
+    // Connects to synchedVault's signals. Call before synchedVault starts synching. The slots cannot be
+    // disconnected one by one, so clear synchedVault's slots before the publisher is destroyed.
+    void connect(CoinDB::SynchedVault& synchedVault);
+
+    // Replaces any previous subscription for the connection.
+    void subscribe(websocketpp::connection_hdl hdl, int topics, send_t send);
+    bool unsubscribe(websocketpp::connection_hdl hdl);
+    std::size_t subscribers() const;
+
+    void publishTx(const std::string& type, std::shared_ptr<CoinDB::Tx> tx);
+    void publishHeader(const std::string& type, uint32_t height, const bytes_t& hash);
+    void publishStatus(CoinDB::SynchedVault::status_t status);
+
+private:
+    struct Event
+    {
+        std::string key;    // events with the same key coalesce
+        std::string type;
+        std::string fields; // JSON members after the event type
+    };
+
+    struct Subscriber
+    {
+        Subscriber() : topics(0), overflowed(false), dropped(0) { }
+
+        int topics;
+        send_t send;
+        std::deque<Event> events;
+        bool overflowed;
+        uint64_t dropped;
+    };
+
+    // connection_hdl is a std or boost weak_ptr depending on how websocketpp is configured.
+    struct hdl_less
+    {
+        bool operator()(const websocketpp::connection_hdl& a, const websocketpp::connection_hdl& b) const { return a.owner_before(b); }
+    };
+
+    typedef std::map<websocketpp::connection_hdl, Subscriber, hdl_less> subscribers_t;
+
+    void publish(topic_t topic, const Event& event);
+    void enqueue(Subscriber& subscriber, const Event& event);
+    void deliveryLoop();
+
+    std::size_t max_queued_;
+    std::chrono::milliseconds flush_interval_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    bool running_;
+    bool pending_;
+    subscribers_t subscribers_;
+    std::thread delivery_thread_;
+};
@@ -0,0 +1,164 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// RequestDispatcher.cpp
+//
+// Copyright (c) 2013-2014 Eric Lombrozo
+//
+// All Rights Reserved.
+//
+// vaultd - headless daemon with WebSockets API
+//
+
+#include "RequestDispatcher.h"
+
+RequestDispatcher::RequestDispatcher(unsigned int worker_count, std::size_t max_pending, std::size_t max_pending_per_vault)
+    : worker_count_(worker_count ? worker_count : 1), max_pending_(max_pending), max_pending_per_vault_(max_pending_per_vault), running_(false), stopping_(false), pending_(0)
+{
+}
+
+RequestDispatcher::~RequestDispatcher()
+{
+    stop();
+}
+
+void RequestDispatcher::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) return;
+
+    running_ = true;
+    for (unsigned int i = 0; i < worker_count_; i++) { workers_.push_back(std::thread(&RequestDispatcher::workerLoop, this)); }
+}
+
+void RequestDispatcher::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_ || stopping_) return;
+        stopping_ = true;
+    }
+    cond_.notify_all();
+
+    for (auto& worker: workers_) { worker.join(); }
+    workers_.clear();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+    stopping_ = false;
+}
+
+bool RequestDispatcher::submit(const std::string& vault, access_t access, job_t job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_ || stopping_ || pending_ >= max_pending_) return false;
+
+        Job newjob;
+        newjob.access = access;
+        newjob.run = job;
+        if (access == NO_VAULT)
+        {
+            unbound_.push_back(newjob);
+        }
+        else
+        {
+            VaultQueue& queue = queues_[vault];
+            if (queue.jobs.size() >= max_pending_per_vault_) return false;
+            newjob.vault = vault;
+            queue.jobs.push_back(newjob);
+        }
+        pending_++;
+    }
+    cond_.notify_one();
+    return true;
+}
+
+std::size_t RequestDispatcher::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_;
+}
+
+void RequestDispatcher::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+        Job job;
+        if (next(job))
+        {
+            lock.unlock();
+            try
+            {
+                job.run();
+            }
+            catch (...)
+            {
+                // Jobs report their own errors. This only keeps a stray exception from taking down the worker.
+            }
+            lock.lock();
+            finished(job);
+            continue;
+        }
+
+        if (stopping_ && pending_ == 0) return;
+        cond_.wait(lock);
+    }
+}
+
+bool RequestDispatcher::next(Job& job)
+{
+    if (!unbound_.empty())
+    {
+        job = unbound_.front();
+        unbound_.pop_front();
+        return true;
+    }
+
+    if (queues_.empty()) return false;
+
+    // Start looking after the vault that went last so one busy vault cannot starve the others.
+    auto start = queues_.upper_bound(last_vault_);
+    if (start == queues_.end()) { start = queues_.begin(); }
+    auto it = start;
+    do
+    {
+        VaultQueue& queue = it->second;
+        if (!queue.jobs.empty() && !queue.writer)
+        {
+            const Job& head = queue.jobs.front();
+            if (head.access == READ || queue.readers == 0)
+            {
+                if (head.access == READ)    { queue.readers++; }
+                else                        { queue.writer = true; }
+
+                job = head;
+                queue.jobs.pop_front();
+                last_vault_ = it->first;
+                return true;
+            }
+        }
+
+        if (++it == queues_.end()) { it = queues_.begin(); }
+    } while (it != start);
+
+    return false;
+}
+
+void RequestDispatcher::finished(const Job& job)
+{
+    pending_--;
+
+    if (job.access != NO_VAULT)
+    {
+        auto it = queues_.find(job.vault);
+        VaultQueue& queue = it->second;
+        if (job.access == READ) { queue.readers--; }
+        else                    { queue.writer = false; }
+
+        if (queue.jobs.empty() && queue.readers == 0 && !queue.writer) { queues_.erase(it); }
+    }
+
+    // A finished write can let several reads start, and stop() waits for the last job.
+    cond_.notify_all();
+}
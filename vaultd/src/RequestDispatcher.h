@@ -0,0 +1,101 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// RequestDispatcher.h
+//
+// Copyright (c) 2013-2014 Eric Lombrozo
+//
+// All Rights Reserved.
+//
+// vaultd - headless daemon with WebSockets API
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs requests on a pool of worker threads.
+//
+// Requests are queued per vault and start in the order they were submitted for that vault. Reads on
+// the same vault run alongside each other. A write waits for everything before it on its vault to
+// finish, and holds up everything after it. Requests on different vaults, and requests with no vault,
+// never wait for each other beyond the number of workers.
+//
+// Queues are bounded. submit() refuses requests rather than letting a burst of slow requests grow the
+// queue without limit, so the caller can tell the client to retry.
+class RequestDispatcher
+{
+public:
+    typedef std::function<void()> job_t;
+
+    enum access_t
+    {
+        NO_VAULT,
+        READ,
+        WRITE
+    };
+
+    enum
+    {
+        DEFAULT_MAX_PENDING = 1024,
+        DEFAULT_MAX_PENDING_PER_VAULT = 128
+    };
+
+    explicit RequestDispatcher(unsigned int worker_count, std::size_t max_pending = DEFAULT_MAX_PENDING, std::size_t max_pending_per_vault = DEFAULT_MAX_PENDING_PER_VAULT);
+    ~RequestDispatcher();
+
+    void start();
+
+    // Waits for all queued requests to finish, then stops the workers.
+    void stop();
+
+    // vault is a VaultPool key and is ignored for NO_VAULT. Returns false if the job was not queued
+    // because the dispatcher is stopped or a queue is full.
+    bool submit(const std::string& vault, access_t access, job_t job);
+
+    std::size_t pending() const;
+    unsigned int worker_count() const { return worker_count_; }
+
+private:
+    struct Job
+    {
+        std::string vault;
+        access_t access;
+        job_t run;
+    };
+
+    struct VaultQueue
+    {
+        VaultQueue() : readers(0), writer(false) { }
+
+        std::deque<Job> jobs;
+        unsigned int readers;
+        bool writer;
+    };
+
+    void workerLoop();
+    bool next(Job& job);
+    void finished(const Job& job);
+
+    unsigned int worker_count_;
+    std::size_t max_pending_;
+    std::size_t max_pending_per_vault_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    bool running_;
+    bool stopping_;
+    std::size_t pending_;
+
+    std::deque<Job> unbound_;
+    std::map<std::string, VaultQueue> queues_;
+    std::string last_vault_;    // vault whose job started last, for round robin
+
+    std::vector<std::thread> workers_;
+};
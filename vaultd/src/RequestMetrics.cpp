@@ -0,0 +1,67 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// RequestMetrics.cpp
+//
+// Copyright (c) 2013-2014 Eric Lombrozo
+//
+// All Rights Reserved.
+//
+// vaultd - headless daemon with WebSockets API
+//
+
+#include "RequestMetrics.h"
+
+#include <iomanip>
+#include <sstream>
+
+void RequestMetrics::record(const std::string& command, duration_t queued, duration_t elapsed, bool error)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_t& stats = stats_[command];
+    stats.count++;
+    if (error) { stats.errors++; }
+    stats.total += elapsed;
+    if (elapsed > stats.max) { stats.max = elapsed; }
+    stats.queued_total += queued;
+    if (queued > stats.queued_max) { stats.queued_max = queued; }
+}
+
+void RequestMetrics::recordRejected(const std::string& command)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_[command].rejected++;
+}
+
+void RequestMetrics::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.clear();
+}
+
+std::map<std::string, RequestMetrics::stats_t> RequestMetrics::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+std::string RequestMetrics::toString() const
+{
+    typedef std::chrono::duration<double, std::milli> ms_t;
+
+    std::stringstream ss;
+    ss << std::left << std::setw(24) << "command" << std::right << std::setw(10) << "count" << std::setw(10) << "errors" << std::setw(10) << "rejected"
+       << std::setw(12) << "wait ms" << std::setw(12) << "max wait" << std::setw(12) << "mean ms" << std::setw(12) << "max ms";
+
+    for (auto& item: getStats())
+    {
+        const stats_t& stats = item.second;
+        uint64_t count = stats.count ? stats.count : 1;
+        ss << std::endl << std::left << std::setw(24) << item.first << std::right << std::fixed << std::setprecision(3)
+           << std::setw(10) << stats.count << std::setw(10) << stats.errors << std::setw(10) << stats.rejected
+           << std::setw(12) << (ms_t(stats.queued_total).count() / count)
+           << std::setw(12) << ms_t(stats.queued_max).count()
+           << std::setw(12) << (ms_t(stats.total).count() / count)
+           << std::setw(12) << ms_t(stats.max).count();
+    }
+    return ss.str();
+}
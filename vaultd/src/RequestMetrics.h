@@ -0,0 +1,51 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// RequestMetrics.h
+//
+// Copyright (c) 2013-2014 Eric Lombrozo
+//
+// All Rights Reserved.
+//
+// vaultd - headless daemon with WebSockets API
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Request counts and latencies per command.
+class RequestMetrics
+{
+public:
+    typedef std::chrono::steady_clock::duration duration_t;
+
+    struct stats_t
+    {
+        stats_t() : count(0), errors(0), rejected(0), total(duration_t::zero()), max(duration_t::zero()), queued_total(duration_t::zero()), queued_max(duration_t::zero()) { }
+
+        uint64_t count;
+        uint64_t errors;
+        uint64_t rejected;          // refused because the queues were full, not included in count
+        duration_t total;
+        duration_t max;
+        duration_t queued_total;    // time between arrival and the start of execution
+        duration_t queued_max;
+    };
+
+    void record(const std::string& command, duration_t queued, duration_t elapsed, bool error);
+    void recordRejected(const std::string& command);
+    void reset();
+
+    std::map<std::string, stats_t> getStats() const;
+
+    // One line per command with counts and mean and max queue wait and execution time in milliseconds.
+    std::string toString() const;
+
+private:
+    mutable std::mutex mutex_;
+    std::map<std::string, stats_t> stats_;
+};
@@ -0,0 +1,215 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// VaultPool.cpp
+//
+// Copyright (c) 2013-2014 Eric Lombrozo
+//
+// All Rights Reserved.
+//
+// vaultd - headless daemon with WebSockets API
+//
+
+#include "VaultPool.h"
+
+#include <boost/filesystem.hpp>
+
+#include <stdexcept>
+#include <vector>
+
+using namespace CoinDB;
+
+/*
+ * class VaultPool::Handle
+*/
+VaultPool::Handle::Handle(VaultPool* pool, std::shared_ptr<Entry> entry, boost::unique_lock<boost::shared_mutex>&& lock)
+    : pool_(pool), entry_(entry), exclusive_lock_(std::move(lock))
+{
+    if (entry_->synched) { vault_lock_.reset(new VaultLock(*entry_->synched)); }
+}
+
+VaultPool::Handle::Handle(VaultPool* pool, std::shared_ptr<Entry> entry, boost::shared_lock<boost::shared_mutex>&& lock)
+    : pool_(pool), entry_(entry), shared_lock_(std::move(lock))
+{
+    if (entry_->synched) { vault_lock_.reset(new VaultLock(*entry_->synched)); }
+}
+
+VaultPool::Handle::Handle(Handle&& other)
+    : pool_(other.pool_), entry_(std::move(other.entry_)), exclusive_lock_(std::move(other.exclusive_lock_)), shared_lock_(std::move(other.shared_lock_)), vault_lock_(std::move(other.vault_lock_))
+{
+    other.pool_ = nullptr;
+}
+
+VaultPool::Handle::~Handle()
+{
+    if (!pool_) return;
+
+    if (exclusive_lock_.owns_lock())
+    {
+        try
+        {
+            entry_->vault->lockAllKeychains();
+        }
+        catch (...)
+        {
+            // The vault could be left with unlocked keychains, so it is dropped and reopened on next use.
+            if (!entry_->synched)
+            {
+                entry_->owned.reset();
+                entry_->vault = nullptr;
+            }
+        }
+        vault_lock_.reset();
+        exclusive_lock_.unlock();
+    }
+    else
+    {
+        vault_lock_.reset();
+        shared_lock_.unlock();
+    }
+
+    pool_->release(entry_);
+}
+
+/*
+ * class VaultPool
+*/
+VaultPool::VaultPool(std::chrono::seconds idle_timeout)
+    : idle_timeout_(idle_timeout)
+{
+}
+
+VaultPool::~VaultPool()
+{
+    clear();
+}
+
+void VaultPool::setCoinParams(const CoinQ::CoinParams& coinParams)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    coinParams_ = coinParams;
+}
+
+std::string VaultPool::getKey(const std::string& dbname)
+{
+    boost::filesystem::path path(dbname);
+    return (boost::filesystem::exists(path) ? boost::filesystem::canonical(path) : boost::filesystem::absolute(path)).string();
+}
+
+VaultPool::Handle VaultPool::acquire(const std::string& dbname, access_t access)
+{
+    std::string key = getKey(dbname);
+
+    std::shared_ptr<Entry> entry;
+    CoinQ::CoinParams coinParams;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        coinParams = coinParams_;
+        std::shared_ptr<Entry>& slot = entries_[key];
+        if (!slot) { slot = std::make_shared<Entry>(); }
+        slot->refs++;
+        entry = slot;
+    }
+
+    // Opening happens under the exclusive lock so concurrent requests for the same vault open it only once.
+    for (;;)
+    {
+        if (access == SHARED)
+        {
+            boost::shared_lock<boost::shared_mutex> shared_lock(entry->request_mutex);
+            if (entry->vault) return Handle(this, entry, std::move(shared_lock));
+        }
+
+        boost::unique_lock<boost::shared_mutex> exclusive_lock(entry->request_mutex);
+        try
+        {
+            if (!entry->vault)
+            {
+                entry->owned.reset(new Vault(dbname, false));
+                entry->owned->setCoinParams(coinParams);
+                entry->vault = entry->owned.get();
+            }
+        }
+        catch (...)
+        {
+            exclusive_lock.unlock();
+            release(entry);
+            throw;
+        }
+
+        if (access == EXCLUSIVE) return Handle(this, entry, std::move(exclusive_lock));
+    }
+}
+
+void VaultPool::attach(const std::string& dbname, SynchedVault& synchedVault)
+{
+    if (!synchedVault.isVaultOpen()) throw std::runtime_error("VaultPool::attach() - vault is not open.");
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_ptr<Entry>& slot = entries_[getKey(dbname)];
+    if (slot && slot->refs > 0) throw std::runtime_error("VaultPool::attach() - vault is in use.");
+
+    // Any vault opened here before is closed when the old entry goes.
+    slot = std::make_shared<Entry>();
+    slot->vault = synchedVault.getVault();
+    slot->synched = &synchedVault;
+}
+
+void VaultPool::detach(const std::string& dbname)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(getKey(dbname));
+    if (it == entries_.end() || !it->second->synched) return;
+    if (it->second->refs > 0) throw std::runtime_error("VaultPool::detach() - vault is in use.");
+    entries_.erase(it);
+}
+
+void VaultPool::release(const std::shared_ptr<Entry>& entry)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entry->refs--;
+    entry->last_used = std::chrono::steady_clock::now();
+}
+
+std::size_t VaultPool::evictIdle()
+{
+    return evict(idle_timeout_);
+}
+
+void VaultPool::clear()
+{
+    evict(std::chrono::steady_clock::duration::zero());
+}
+
+std::size_t VaultPool::evict(std::chrono::steady_clock::duration max_idle)
+{
+    // Vaults are closed after the pool lock is released so closing one does not hold up requests on others.
+    std::vector<std::shared_ptr<Entry>> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = std::chrono::steady_clock::now();
+        auto it = entries_.begin();
+        while (it != entries_.end())
+        {
+            const Entry& entry = *it->second;
+            if (entry.refs == 0 && !entry.synched && (!entry.vault || now - entry.last_used >= max_idle))
+            {
+                evicted.push_back(it->second);
+                it = entries_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    std::size_t count = 0;
+    for (auto& entry: evicted) { if (entry->vault) count++; }
+    return count;
+}
+
+std::size_t VaultPool::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
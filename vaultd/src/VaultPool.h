@@ -0,0 +1,122 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// VaultPool.h
+//
+// Copyright (c) 2013-2014 Eric Lombrozo
+//
+// All Rights Reserved.
+//
+// vaultd - headless daemon with WebSockets API
+//
+
+#pragma once
+
+#include <Vault.h>
+#include <SynchedVault.h>
+
+#include <boost/thread/shared_mutex.hpp>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Keeps vaults open between requests so each command does not have to reopen the database and check the schema.
+//
+// A Handle holds a reference to an open vault and that vault's request lock. Shared handles can be held
+// together, for requests that only read from the vault. An exclusive handle has the vault to itself, and
+// locks all keychains on release so unlock keys never outlive the request that supplied them. Requests on
+// different vaults do not block each other. Vaults with no handles are closed once they have been idle
+// for longer than the idle timeout.
+//
+// The vault of a running SynchedVault can be attached so requests use it rather than opening a second
+// Vault on the same database, whose in-memory state would go stale as the sync writes. Handles to an
+// attached vault also hold a VaultLock. Attached vaults are never evicted.
+//
+// Vaults are assumed not to be written by other processes while they are open here. Idle eviction bounds
+// how long any in-memory state can go stale if they are.
+class VaultPool
+{
+private:
+    struct Entry
+    {
+        Entry() : vault(nullptr), synched(nullptr), refs(0) { }
+
+        CoinDB::Vault* vault;                   // null until opened
+        std::unique_ptr<CoinDB::Vault> owned;   // the opened vault, unless attached
+        CoinDB::SynchedVault* synched;          // set if attached
+        boost::shared_mutex request_mutex;
+        unsigned int refs;
+        std::chrono::steady_clock::time_point last_used;
+    };
+
+public:
+    enum access_t
+    {
+        SHARED,
+        EXCLUSIVE
+    };
+
+    class Handle
+    {
+    public:
+        Handle(Handle&& other);
+        ~Handle();
+
+        CoinDB::Vault& operator*() const { return *entry_->vault; }
+        CoinDB::Vault* operator->() const { return entry_->vault; }
+
+    private:
+        friend class VaultPool;
+        Handle(VaultPool* pool, std::shared_ptr<Entry> entry, boost::unique_lock<boost::shared_mutex>&& lock);
+        Handle(VaultPool* pool, std::shared_ptr<Entry> entry, boost::shared_lock<boost::shared_mutex>&& lock);
+
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+
+        VaultPool* pool_;
+        std::shared_ptr<Entry> entry_;
+        boost::unique_lock<boost::shared_mutex> exclusive_lock_;
+        boost::shared_lock<boost::shared_mutex> shared_lock_;
+        std::unique_ptr<CoinDB::VaultLock> vault_lock_;
+    };
+
+    explicit VaultPool(std::chrono::seconds idle_timeout = std::chrono::seconds(DEFAULT_IDLE_TIMEOUT));
+    ~VaultPool();
+
+    enum { DEFAULT_IDLE_TIMEOUT = 300 };
+
+    // Network parameters given to vaults opened afterwards. Defaults to bitcoin.
+    void setCoinParams(const CoinQ::CoinParams& coinParams);
+
+    // Opens the vault if it is not already open. Blocks while a conflicting handle is held.
+    // Throws whatever the Vault constructor throws.
+    Handle acquire(const std::string& dbname, access_t access = EXCLUSIVE);
+
+    // Uses synchedVault's open vault for dbname until detached. Throws std::runtime_error if dbname is in use.
+    void attach(const std::string& dbname, CoinDB::SynchedVault& synchedVault);
+    void detach(const std::string& dbname);
+
+    // Pool key for a database path. Different spellings of the same path have the same key.
+    static std::string getKey(const std::string& dbname);
+
+    // Closes vaults that have no handles and have been idle longer than the idle timeout. Returns the number closed.
+    std::size_t evictIdle();
+
+    // Closes all vaults that have no handles and are not attached.
+    void clear();
+
+    std::size_t size() const;
+    std::chrono::seconds idle_timeout() const { return idle_timeout_; }
+
+private:
+    void release(const std::shared_ptr<Entry>& entry);
+    std::size_t evict(std::chrono::steady_clock::duration max_idle);
+
+    std::chrono::seconds idle_timeout_;
+    CoinQ::CoinParams coinParams_;
+
+    mutable std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<Entry>> entries_;
+};
@@ -15,21 +15,34 @@
 #include <formatting.h>
 
 #include <Vault.h>
+#include <SynchedVault.h>
 #include <Schema-odb.hxx>
 
+#include <CoinQ_coinparams.h>
+
 #include <random.h>
 
 #include <logger.h>
 
 #include <Base58Check.h>
 
+#include "VaultPool.h"
+#include "RequestDispatcher.h"
+#include "RequestMetrics.h"
+#include "EventPublisher.h"
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+
 #include <thread>
 #include <chrono>
 
 #include <iostream>
 #include <sstream>
 #include <ctime>
+#include <iomanip>
 #include <functional>
+#include <set>
 
 #include <signal.h>
 
@@ -38,14 +51,24 @@ using namespace odb::core;
 using namespace CoinDB;
 
 const string WS_PORT = "12345";
+const unsigned int WORKER_THREADS = 8;
+const unsigned int EVICTION_INTERVAL = 60; // seconds
 
-bool g_bShutdown = false;
+VaultPool g_vaultPool;
+RequestDispatcher g_dispatcher(WORKER_THREADS);
+RequestMetrics g_requestMetrics;
 
-void finish(int sig)
-{
-    LOGGER(debug) << "Stopping..." << endl;
-    g_bShutdown = true;
-}
+// Set while vaultd is synching a vault, whose events connections can subscribe to.
+string g_synchedDbName;
+EventPublisher g_eventPublisher;
+
+// Commands that only read from the vault run alongside each other and take shared vault handles.
+// Any other command with a db file gets the vault to itself.
+const set<string> READ_COMMANDS = {
+    "info", "keychainexists", "keychaininfo", "keychains", "exportkeychain", "accountexists", "accountinfo", "listaccounts",
+    "listbins", "listscripts", "history", "txinfo", "signingrequest", "bestheight", "horizonheight", "horizontimestamp", "blockinfo" };
+
+const set<string> NO_VAULT_COMMANDS = { "rawblockheader", "rawmerkleblock", "randombytes", "stats" };
 
 // Global operations
 cli::result_t cmd_create(const cli::params_t& params)
@@ -59,9 +82,9 @@ cli::result_t cmd_create(const cli::params_t& params)
 
 cli::result_t cmd_info(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    uint32_t schema_version = vault.getSchemaVersion();
-    uint32_t horizon_timestamp = vault.getHorizonTimestamp();
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    uint32_t schema_version = vault->getSchemaVersion();
+    uint32_t horizon_timestamp = vault->getHorizonTimestamp();
 
     stringstream ss;
     ss << "filename:            " << params[0] << endl
@@ -73,8 +96,8 @@ cli::result_t cmd_info(const cli::params_t& params)
 // Keychain operations
 cli::result_t cmd_keychainexists(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    bool bExists = vault.keychainExists(params[1]);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    bool bExists = vault->keychainExists(params[1]);
 
     stringstream ss;
     ss << (bExists ? "true" : "false");
@@ -83,8 +106,8 @@ cli::result_t cmd_keychainexists(const cli::params_t& params)
 
 cli::result_t cmd_newkeychain(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    vault.newKeychain(params[1], random_bytes(32));
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    vault->newKeychain(params[1], random_bytes(32));
 
     stringstream ss;
     ss << "Added keychain " << params[1] << " to vault " << params[0] << ".";
@@ -97,11 +120,11 @@ cli::result_t cmd_erasekeychain(bool bHelp, const cli::params_t& params)
         return "erasekeychain <db file> <keychain_name> - erase a keychain.";
     }
 
-    Vault vault(params[0], false);
-    if (!vault.keychainExists(params[1]))
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    if (!vault->keychainExists(params[1]))
         throw runtime_error("Keychain not found.");
 
-    vault.eraseKeychain(params[1]);
+    vault->eraseKeychain(params[1]);
 
     stringstream ss;
     ss << "Keychain " << params[1] << " erased.";
@@ -110,8 +133,8 @@ cli::result_t cmd_erasekeychain(bool bHelp, const cli::params_t& params)
 */
 cli::result_t cmd_renamekeychain(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    vault.renameKeychain(params[1], params[2]);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    vault->renameKeychain(params[1], params[2]);
 
     stringstream ss;
     ss << "Keychain " << params[1] << " renamed to " << params[2] << ".";
@@ -120,8 +143,8 @@ cli::result_t cmd_renamekeychain(const cli::params_t& params)
 
 cli::result_t cmd_keychaininfo(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    shared_ptr<Keychain> keychain = vault.getKeychain(params[1]);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    shared_ptr<Keychain> keychain = vault->getKeychain(params[1]);
 
     stringstream ss;
     ss << "id:        " << keychain->id() << endl
@@ -141,8 +164,8 @@ cli::result_t cmd_keychains(const cli::params_t& params)
 
     bool show_hidden = params.size() > 2 && params[2] == "true";
 
-    Vault vault(params[0], false);
-    vector<KeychainView> views = vault.getRootKeychainViews(account_name, show_hidden);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    vector<KeychainView> views = vault->getRootKeychainViews(account_name, show_hidden);
 
     stringstream ss;
     ss << formattedKeychainViewHeader();
@@ -158,8 +181,8 @@ cli::result_t cmd_listkeychains(bool bHelp, const cli::params_t& params)
 
     bool root_only = params.size() > 1 ? (params[1] == "true") : false;
 
-    Vault vault(params[0], false);
-    vector<shared_ptr<Keychain>> keychains = vault.getAllKeychains(root_only);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    vector<shared_ptr<Keychain>> keychains = vault->getAllKeychains(root_only);
 
     stringstream ss;
     ss << formattedKeychainHeader();
@@ -177,8 +200,8 @@ cli::result_t cmd_exportkeychain(const cli::params_t& params)
     if (params.size() > 3)  { output_file = params[3]; }
     else                    { output_file = params[1] + (export_privkey ? ".priv" : ".pub"); }
 
-    Vault vault(params[0], false);
-    vault.exportKeychain(params[1], output_file, export_privkey);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    vault->exportKeychain(params[1], output_file, export_privkey);
 
     stringstream ss;
     ss << (export_privkey ? "Private" : "Public") << " keychain " << params[1] << " exported to " << output_file << ".";
@@ -189,8 +212,8 @@ cli::result_t cmd_importkeychain(const cli::params_t& params)
 {
     bool import_privkey = params.size() > 2 ? (params[2] == "true") : true;
 
-    Vault vault(params[0], false);
-    std::shared_ptr<Keychain> keychain = vault.importKeychain(params[1], import_privkey);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    std::shared_ptr<Keychain> keychain = vault->importKeychain(params[1], import_privkey);
 
     stringstream ss;
     ss << (import_privkey ? "Private" : "Public") << " keychain " << keychain->name() << " imported from " << params[1] << ".";
@@ -201,14 +224,14 @@ cli::result_t cmd_exportbip32(const cli::params_t& params)
 {
     bool export_privkey = params.size() > 2;
 
-    Vault vault(params[0], false);
-    vault.unlockChainCodes(uchar_vector("1234"));
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    vault->unlockChainCodes(uchar_vector("1234"));
     if (export_privkey)
     {
         secure_bytes_t unlock_key = sha256_2(params[2]);
-        vault.unlockKeychain(params[1], unlock_key);
+        vault->unlockKeychain(params[1], unlock_key);
     }
-    secure_bytes_t extkey = vault.getKeychainExtendedKey(params[1], export_privkey);
+    secure_bytes_t extkey = vault->getKeychainExtendedKey(params[1], export_privkey);
 
     stringstream ss;
     ss << toBase58Check(extkey);
@@ -229,8 +252,8 @@ cli::result_t cmd_importbip32(const cli::params_t& params)
     secure_bytes_t extkey;
     if (!fromBase58Check(params[2], extkey)) throw std::runtime_error("Invalid BIP32.");
 
-    Vault vault(params[0], false);
-    std::shared_ptr<Keychain> keychain = vault.importKeychainExtendedKey(params[1], extkey, import_privkey, lock_key);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    std::shared_ptr<Keychain> keychain = vault->importKeychainExtendedKey(params[1], extkey, import_privkey, lock_key);
 
     stringstream ss;
     ss << (keychain->isPrivate() ? "Private" : "Public") << " keychain " << keychain->name() << " imported from BIP32.";
@@ -240,8 +263,8 @@ cli::result_t cmd_importbip32(const cli::params_t& params)
 // Account operations
 cli::result_t cmd_accountexists(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    bool bExists = vault.accountExists(params[1]);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    bool bExists = vault->accountExists(params[1]);
 
     stringstream ss;
     ss << (bExists ? "true" : "false");
@@ -259,9 +282,9 @@ cli::result_t cmd_newaccount(const cli::params_t& params)
     for (size_t i = 3; i < params.size(); i++)
         keychain_names.push_back(params[i]);
 
-    Vault vault(params[0], false);
-    vault.unlockChainCodes(secure_bytes_t());
-    vault.newAccount(params[1], minsigs, keychain_names);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    vault->unlockChainCodes(secure_bytes_t());
+    vault->newAccount(params[1], minsigs, keychain_names);
 
     stringstream ss;
     ss << "Added account " << params[1] << " to vault " << params[0] << ".";
@@ -270,8 +293,8 @@ cli::result_t cmd_newaccount(const cli::params_t& params)
 
 cli::result_t cmd_renameaccount(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    vault.renameAccount(params[1], params[2]);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    vault->renameAccount(params[1], params[2]);
 
     stringstream ss;
     ss << "Renamed account " << params[1] << " to " << params[2] << ".";
@@ -280,10 +303,10 @@ cli::result_t cmd_renameaccount(const cli::params_t& params)
 
 cli::result_t cmd_accountinfo(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    AccountInfo accountInfo = vault.getAccountInfo(params[1]);
-    uint64_t balance = vault.getAccountBalance(params[1], 0);
-    uint64_t confirmed_balance = vault.getAccountBalance(params[1], 1);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    AccountInfo accountInfo = vault->getAccountInfo(params[1]);
+    uint64_t balance = vault->getAccountBalance(params[1], 0);
+    uint64_t confirmed_balance = vault->getAccountBalance(params[1], 1);
 
     using namespace stdutils;
     stringstream ss;
@@ -301,8 +324,8 @@ cli::result_t cmd_accountinfo(const cli::params_t& params)
 
 cli::result_t cmd_listaccounts(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    vector<AccountInfo> accounts = vault.getAllAccountInfo();
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    vector<AccountInfo> accounts = vault->getAllAccountInfo();
 
     stringstream ss;
     ss << formattedAccountHeader();
@@ -313,17 +336,17 @@ cli::result_t cmd_listaccounts(const cli::params_t& params)
 
 cli::result_t cmd_exportaccount(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
 
     secure_bytes_t exportChainCodeUnlockKey;
     if (params.size() > 2 && !params[2].empty())
         exportChainCodeUnlockKey = sha256_2(params[2]);
 
     if (params.size() > 3 && !params[3].empty())
-        vault.unlockChainCodes(sha256_2(params[3]));
+        vault->unlockChainCodes(sha256_2(params[3]));
 
     std::string output_file = params.size() > 4 ? params[4] : (params[1] + ".account");
-    vault.exportAccount(params[1], output_file, true, exportChainCodeUnlockKey);
+    vault->exportAccount(params[1], output_file, true, exportChainCodeUnlockKey);
 
     stringstream ss;
     ss << "Account " << params[1] << " exported to " << output_file << ".";
@@ -332,7 +355,7 @@ cli::result_t cmd_exportaccount(const cli::params_t& params)
 
 cli::result_t cmd_importaccount(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
 
     unsigned int privkeycount = 1;
 
@@ -341,9 +364,9 @@ cli::result_t cmd_importaccount(const cli::params_t& params)
         chainCodeUnlockKey = sha256_2(params[2]);
 
     if (params.size() > 3 && !params[3].empty())
-        vault.unlockChainCodes(sha256_2(params[3]));
+        vault->unlockChainCodes(sha256_2(params[3]));
 
-    std::shared_ptr<Account> account = vault.importAccount(params[1], privkeycount, chainCodeUnlockKey);
+    std::shared_ptr<Account> account = vault->importAccount(params[1], privkeycount, chainCodeUnlockKey);
 
     stringstream ss;
     ss << "Account " << account->name() << " imported from " << params[1] << ".";
@@ -352,10 +375,10 @@ cli::result_t cmd_importaccount(const cli::params_t& params)
 
 cli::result_t cmd_newaccountbin(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    AccountInfo accountInfo = vault.getAccountInfo(params[1]);
-    vault.unlockChainCodes(secure_bytes_t());
-    vault.addAccountBin(params[1], params[2]);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    AccountInfo accountInfo = vault->getAccountInfo(params[1]);
+    vault->unlockChainCodes(secure_bytes_t());
+    vault->addAccountBin(params[1], params[2]);
 
     stringstream ss;
     ss << "Account bin " << params[2] << " added to account " << params[1] << ".";
@@ -364,8 +387,8 @@ cli::result_t cmd_newaccountbin(const cli::params_t& params)
 
 cli::result_t cmd_listbins(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    vector<AccountBinView> bins = vault.getAllAccountBinViews();
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    vector<AccountBinView> bins = vault->getAllAccountBinViews();
 
     stringstream ss;
     ss << formattedAccountBinViewHeader();
@@ -376,12 +399,12 @@ cli::result_t cmd_listbins(const cli::params_t& params)
 
 cli::result_t cmd_issuescript(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
     std::string account_name;
     if (params[1] != "@null") account_name = params[1];
     std::string bin_name = params.size() > 2 ? params[2] : std::string(DEFAULT_BIN_NAME);
     std::string label = params.size() > 3 ? params[3] : std::string("");
-    std::shared_ptr<SigningScript> script = vault.issueSigningScript(account_name, bin_name, label);
+    std::shared_ptr<SigningScript> script = vault->issueSigningScript(account_name, bin_name, label);
 
     std::string address = getAddressFromScript(script->txoutscript());
 
@@ -404,8 +427,8 @@ cli::result_t cmd_listscripts(const cli::params_t& params)
 
     int flags = params.size() > 3 ? (int)strtoul(params[3].c_str(), NULL, 0) : ((int)SigningScript::ISSUED | (int)SigningScript::USED);
     
-    Vault vault(params[0], false);
-    vector<SigningScriptView> scriptViews = vault.getSigningScriptViews(account_name, bin_name, flags);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    vector<SigningScriptView> scriptViews = vault->getSigningScriptViews(account_name, bin_name, flags);
 
     stringstream ss;
     ss << formattedScriptHeader();
@@ -424,9 +447,9 @@ cli::result_t cmd_history(const cli::params_t& params)
 
     bool hide_change = params.size() > 3 ? params[3] == "true" : true;
     
-    Vault vault(params[0], false);
-    uint32_t best_height = vault.getBestHeight();
-    vector<TxOutView> txOutViews = vault.getTxOutViews(account_name, bin_name, TxOut::ROLE_BOTH, TxOut::BOTH, Tx::ALL, hide_change);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    uint32_t best_height = vault->getBestHeight();
+    vector<TxOutView> txOutViews = vault->getTxOutViews(account_name, bin_name, TxOut::ROLE_BOTH, TxOut::BOTH, Tx::ALL, hide_change);
     stringstream ss;
     ss << formattedTxOutViewHeader();
     for (auto& txOutView: txOutViews)
@@ -436,30 +459,32 @@ cli::result_t cmd_history(const cli::params_t& params)
 
 cli::result_t cmd_refillaccountpool(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    AccountInfo accountInfo = vault.getAccountInfo(params[1]);
-    vault.unlockChainCodes(secure_bytes_t());
-    vault.refillAccountPool(params[1]);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    AccountInfo accountInfo = vault->getAccountInfo(params[1]);
+    vault->unlockChainCodes(secure_bytes_t());
+    auto start = chrono::steady_clock::now();
+    uint32_t count = vault->refillAccountPool(params[1]);
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
 
     stringstream ss;
-    ss << "Refilled account pool for account " << params[1] << ".";
+    ss << "Refilled account pool for account " << params[1] << ". Created " << count << " signing scripts in " << fixed << setprecision(1) << elapsed.count() << " ms.";
     return ss.str();
 }
 
 // Account bin operations
 cli::result_t cmd_exportbin(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
 
     string export_name = params.size() > 3 ? params[3] : (params[1].empty() ? params[2] : params[1] + "-" + params[2]);
     secure_bytes_t exportChainCodeUnlockKey;
     if (params.size() > 4 && !params[4].empty())
         exportChainCodeUnlockKey = sha256_2(params[4]);
 
-    vault.unlockChainCodes(secure_bytes_t());
+    vault->unlockChainCodes(secure_bytes_t());
 
     string output_file = params.size() > 5 ? params[5] : (export_name + ".bin");
-    vault.exportAccountBin(params[1], params[2], export_name, output_file, exportChainCodeUnlockKey);
+    vault->exportAccountBin(params[1], params[2], export_name, output_file, exportChainCodeUnlockKey);
 
     stringstream ss;
     ss << "Account bin " << export_name << " exported to " << output_file << ".";
@@ -468,15 +493,15 @@ cli::result_t cmd_exportbin(const cli::params_t& params)
 
 cli::result_t cmd_importbin(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
 
     secure_bytes_t importChainCodeUnlockKey;
     if (params.size() > 2 && !params[2].empty())
         importChainCodeUnlockKey = sha256_2(params[2]);
 
-    vault.unlockChainCodes(uchar_vector("1234"));
+    vault->unlockChainCodes(uchar_vector("1234"));
 
-    std::shared_ptr<AccountBin> bin = vault.importAccountBin(params[1], importChainCodeUnlockKey);
+    std::shared_ptr<AccountBin> bin = vault->importAccountBin(params[1], importChainCodeUnlockKey);
 
     stringstream ss;
     ss << "Account bin " << bin->name() << " imported from " << params[1] << ".";
@@ -488,8 +513,8 @@ cli::result_t cmd_txinfo(const cli::params_t& params)
 {
     bool raw = params.size() > 2 ? params[2] == "true" : false;
 
-    Vault vault(params[0], false);
-    std::shared_ptr<Tx> tx = vault.getTx(uchar_vector(params[1]));
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    std::shared_ptr<Tx> tx = vault->getTx(uchar_vector(params[1]));
 
     if (raw) return uchar_vector(tx->raw()).getHex();
 
@@ -515,11 +540,11 @@ cli::result_t cmd_txinfo(const cli::params_t& params)
 
 cli::result_t cmd_insertrawtx(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
 
     std::shared_ptr<Tx> tx(new Tx());
     tx->set(uchar_vector(params[1]));
-    tx = vault.insertTx(tx);
+    tx = vault->insertTx(tx);
 
     stringstream ss;
     if (tx)
@@ -540,7 +565,7 @@ cli::result_t cmd_newrawtx(const cli::params_t& params)
     using namespace CoinQ::Script;
     const size_t MAX_VERSION_LEN = 2;
 
-    Vault vault(params[0], false);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
 
     // Get outputs
     size_t i = 2;
@@ -554,19 +579,20 @@ cli::result_t cmd_newrawtx(const cli::params_t& params)
          
     } while (i < (params.size() - 1) && params[i].size() > MAX_VERSION_LEN);
 
-    uint64_t fee = i < params.size() ? strtoull(params[i++].c_str(), NULL, 0) : 0;
+    string fee = i < params.size() ? params[i++] : "0";
     uint32_t version = i < params.size() ? strtoul(params[i++].c_str(), NULL, 0) : 1;
     uint32_t locktime = i < params.size() ? strtoul(params[i++].c_str(), NULL, 0) : 0;
+    string strategy = i < params.size() ? params[i++] : "bnb";
 
-    std::shared_ptr<Tx> tx = vault.createTx(params[1], version, locktime, txouts, fee, 1, true);
+    std::shared_ptr<Tx> tx = vault->createTx(params[1], version, locktime, ids_t(), txouts, getCoinSelectionParams(fee, strategy), true);
     return uchar_vector(tx->raw()).getHex();
 }
 
 cli::result_t cmd_deletetx(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
     uchar_vector hash(params[1]);
-    vault.deleteTx(hash);
+    vault->deleteTx(hash);
 
     stringstream ss;
     ss << "Tx deleted. hash: " << hash.getHex();
@@ -575,10 +601,10 @@ cli::result_t cmd_deletetx(const cli::params_t& params)
 
 cli::result_t cmd_signingrequest(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
     uchar_vector hash(params[1]);
 
-    SigningRequest req = vault.getSigningRequest(hash, true);
+    SigningRequest req = vault->getSigningRequest(hash, true);
     vector<string>keychain_names;
     vector<string>keychain_hashes;
     for (auto& keychain_pair: req.keychain_info())
@@ -599,14 +625,14 @@ cli::result_t cmd_signingrequest(const cli::params_t& params)
 // TODO: do something with passphrase
 cli::result_t cmd_signtx(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    vault.unlockChainCodes(uchar_vector("1234"));
-    vault.unlockKeychain(params[2], secure_bytes_t());
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    vault->unlockChainCodes(uchar_vector("1234"));
+    vault->unlockKeychain(params[2], secure_bytes_t());
 
     stringstream ss;
     std::vector<std::string> keychain_names;
     keychain_names.push_back(params[2]);
-    if (vault.signTx(uchar_vector(params[1]), keychain_names, true))
+    if (vault->signTx(uchar_vector(params[1]), keychain_names, true))
     {
         ss << "Signatures added.";
     }
@@ -620,8 +646,8 @@ cli::result_t cmd_signtx(const cli::params_t& params)
 // Blockchain operations
 cli::result_t cmd_bestheight(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    uint32_t best_height = vault.getBestHeight();
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    uint32_t best_height = vault->getBestHeight();
 
     stringstream ss;
     ss << best_height;
@@ -630,8 +656,8 @@ cli::result_t cmd_bestheight(const cli::params_t& params)
 
 cli::result_t cmd_horizonheight(const cli::params_t& params)
 {
-    Vault vault(params[0], false);
-    uint32_t horizon_height = vault.getHorizonHeight();
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    uint32_t horizon_height = vault->getHorizonHeight();
 
     stringstream ss;
     ss << horizon_height;
@@ -642,8 +668,8 @@ cli::result_t cmd_horizontimestamp(const cli::params_t& params)
 {
     bool use_gmt = params.size() > 1 && params[1] == "true";
 
-    Vault vault(params[0], false);
-    long timestamp = vault.getHorizonTimestamp();
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    long timestamp = vault->getHorizonTimestamp();
 
     std::function<struct tm*(const time_t*)> fConvert = use_gmt ? &gmtime : &localtime;
     string formatted_timestamp = asctime(fConvert((const time_t*)&timestamp));
@@ -658,8 +684,8 @@ cli::result_t cmd_blockinfo(const cli::params_t& params)
 {
     uint32_t height = strtoul(params[1].c_str(), NULL, 0);
 
-    Vault vault(params[0], false);
-    std::shared_ptr<BlockHeader> blockheader = vault.getBlockHeader(height);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0], VaultPool::SHARED);
+    std::shared_ptr<BlockHeader> blockheader = vault->getBlockHeader(height);
 
     return blockheader->toCoinClasses().toIndentedString();
 }
@@ -709,8 +735,8 @@ cli::result_t cmd_insertrawmerkleblock(const cli::params_t& params)
     std::shared_ptr<MerkleBlock> merkleblock(new MerkleBlock());
     merkleblock->fromCoinClasses(rawmerkleblock, height);
 
-    Vault vault(params[0], false);
-    bool rval = (bool)vault.insertMerkleBlock(merkleblock);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    bool rval = (bool)vault->insertMerkleBlock(merkleblock);
 
     stringstream ss;
     ss << "Merkle block " << uchar_vector(merkleblock->blockheader()->hash()).getHex() << (rval ? " " : " not ") << "inserted.";
@@ -720,8 +746,8 @@ cli::result_t cmd_insertrawmerkleblock(const cli::params_t& params)
 cli::result_t cmd_deleteblock(const cli::params_t& params)
 {
     uint32_t height = strtoull(params[1].c_str(), NULL, 0);
-    Vault vault(params[0], false);
-    unsigned int count = vault.deleteMerkleBlock(height);
+    VaultPool::Handle vault = g_vaultPool.acquire(params[0]);
+    unsigned int count = vault->deleteMerkleBlock(height);
 
     stringstream ss;
     ss << count << " merkle blocks deleted.";
@@ -734,6 +760,20 @@ cli::result_t cmd_randombytes(const cli::params_t& params)
     return bytes.getHex();
 }
 
+cli::result_t cmd_stats(const cli::params_t& params)
+{
+    bool bReset = params.size() > 0 && params[0] == "true";
+
+    stringstream ss;
+    ss << "open vaults:      " << g_vaultPool.size() << endl
+       << "pending requests: " << g_dispatcher.pending() << endl
+       << "worker threads:   " << g_dispatcher.worker_count() << endl
+       << "subscribers:      " << g_eventPublisher.subscribers() << endl << endl
+       << g_requestMetrics.toString();
+    if (bReset) { g_requestMetrics.reset(); }
+    return ss.str();
+}
+
 // WebSocket callbacks
 void openCallback(WebSocket::Server& server, websocketpp::connection_hdl hdl)
 {
@@ -742,37 +782,131 @@ void openCallback(WebSocket::Server& server, websocketpp::connection_hdl hdl)
 
 void closeCallback(WebSocket::Server& server, websocketpp::connection_hdl hdl)
 {
+    g_eventPublisher.unsubscribe(hdl);
     LOGGER(debug) << "Client " << hdl.lock().get() << " disconnected." << endl;
 }
 
 using namespace cli;
 Shell shell("vaultd by Eric Lombrozo v0.0.1");
 
-void requestCallback(WebSocket::Server& server, const WebSocket::Server::client_request_t& req)
+// Subscriptions belong to the connection rather than a vault, so they are handled here instead of in the shell.
+// Events are pushed as results carrying the id of the subscribe request.
+void subscriptionRequest(WebSocket::Server& server, const WebSocket::Server::client_request_t& req, const string& cmdname, const params_t& params)
 {
     JsonRpc::Response response;
+    try
+    {
+        if (cmdname == "subscribe")
+        {
+            if (g_synchedDbName.empty()) throw runtime_error("vaultd is not synching a vault.");
+
+            int topics = EventPublisher::getTopics(params.size() > 0 ? params[0] : string("all"));
+            websocketpp::connection_hdl hdl = req.first;
+            auto id = req.second.getId();
+            g_eventPublisher.subscribe(hdl, topics, [&server, hdl, id](const string& events)
+            {
+                JsonRpc::Response event;
+                event.setResult(events, id);
+                server.send(hdl, event);
+            });
+
+            stringstream ss;
+            ss << "Subscribed to events for " << g_synchedDbName << ".";
+            response.setResult(ss.str(), req.second.getId());
+        }
+        else
+        {
+            bool bUnsubscribed = g_eventPublisher.unsubscribe(req.first);
+            response.setResult(bUnsubscribed ? "Unsubscribed." : "Not subscribed.", req.second.getId());
+        }
+    }
+    catch (const std::exception& e)
+    {
+        response.setError(e.what(), req.second.getId());
+    }
+
+    server.send(req.first, response);
+}
+
+void requestCallback(WebSocket::Server& server, const WebSocket::Server::client_request_t& req)
+{
+    auto received = std::chrono::steady_clock::now();
 
     const string& cmdname = req.second.getMethod();
     params_t params;
     for (auto& param: req.second.getParams()) { params.push_back(param.get_str()); }
-    try
+
+    if (cmdname == "subscribe" || cmdname == "unsubscribe")
     {
-        result_t result = shell.exec(cmdname, params);
-        response.setResult(result, req.second.getId());
+        subscriptionRequest(server, req, cmdname, params);
+        return;
     }
-    catch (const std::exception& e)
+
+    RequestDispatcher::access_t access;
+    if (NO_VAULT_COMMANDS.count(cmdname) || params.empty()) { access = RequestDispatcher::NO_VAULT; }
+    else if (READ_COMMANDS.count(cmdname))                  { access = RequestDispatcher::READ; }
+    else                                                    { access = RequestDispatcher::WRITE; }
+
+    string vault;
+    if (access != RequestDispatcher::NO_VAULT)
     {
-        response.setError(e.what(), req.second.getId());        
+        try
+        {
+            vault = VaultPool::getKey(params[0]);
+        }
+        catch (const std::exception&)
+        {
+            // Let the command report the bad path.
+            vault = params[0];
+        }
     }
 
-    server.send(req.first, response);
+    bool bQueued = g_dispatcher.submit(vault, access, [&server, req, cmdname, params, received]()
+    {
+        JsonRpc::Response response;
+
+        auto start = std::chrono::steady_clock::now();
+        bool bError = false;
+        try
+        {
+            result_t result = shell.exec(cmdname, params);
+            response.setResult(result, req.second.getId());
+        }
+        catch (const std::exception& e)
+        {
+            response.setError(e.what(), req.second.getId());        
+            bError = true;
+        }
+
+        auto finish = std::chrono::steady_clock::now();
+        g_requestMetrics.record(cmdname, start - received, finish - start, bError);
+        LOGGER(debug) << "Request " << cmdname << " waited " << std::chrono::duration_cast<std::chrono::microseconds>(start - received).count()
+                      << "us and took " << std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() << "us." << endl;
+
+        server.send(req.first, response);
+    });
+
+    if (!bQueued)
+    {
+        g_requestMetrics.recordRejected(cmdname);
+        LOGGER(debug) << "Rejected request " << cmdname << ": request queue full." << endl;
+
+        JsonRpc::Response response;
+        response.setError("Server busy. Try again later.", req.second.getId());
+        server.send(req.first, response);
+    }
 }
 
 int main(int argc, char* argv[])
 {
-    INIT_LOGGER("vaultd.log");
+    if (argc == 2 || argc == 3 || argc > 5)
+    {
+        cerr << "# Usage: " << argv[0] << " [<network> <db file> <host> [port]]" << endl
+             << "# With a network, keeps the vault in db file synched through host so clients can subscribe to its events." << endl;
+        return -1;
+    }
 
-    signal(SIGINT, &finish);
+    INIT_LOGGER("vaultd.log");
 
     // Global operations
     shell.add(command(&cmd_create, "create", "create a new vault", command::params(1, "db file")));
@@ -812,7 +946,7 @@ int main(int argc, char* argv[])
     // Tx operations
     shell.add(command(&cmd_txinfo, "txinfo", "display transaction information", command::params(2, "db file", "tx hash"), command::params(1, "raw hex = false")));
     shell.add(command(&cmd_insertrawtx, "insertrawtx", "insert a raw hex transaction into database", command::params(2, "db file", "tx raw hex")));
-    shell.add(command(&cmd_newrawtx, "newrawtx", "create a new raw transaction", command::params(4, "db file", "account name", "address 1", "value 1"), command::params(6, "address 2", "value 2", "...", "fee = 0", "version = 1", "locktime = 0")));
+    shell.add(command(&cmd_newrawtx, "newrawtx", "create a new raw transaction", command::params(4, "db file", "account name", "address 1", "value 1"), command::params(7, "address 2", "value 2", "...", "fee or fee rate/kb = 0", "version = 1", "locktime = 0", "selection = bnb|largest|consolidate")));
     shell.add(command(&cmd_deletetx, "deletetx", "delete a transaction", command::params(2, "db file", "tx hash")));
     shell.add(command(&cmd_signingrequest, "signingrequest", "gets signing request for transaction with missing signatures", command::params(2, "db file", "tx hash")));
     shell.add(command(&cmd_signtx, "signtx", "add signatures to transaction for specified keychain", command::params(4, "db file", "tx hash", "keychain name", "passphrase")));
@@ -829,12 +963,54 @@ int main(int argc, char* argv[])
 
     // Miscellaneous
     shell.add(command(&cmd_randombytes, "randombytes", "output random bytes in hex", command::params(1, "length")));
+    shell.add(command(&cmd_stats, "stats", "display open vaults and request latencies per command", command::params(0), command::params(1, "reset = false")));
 
     WebSocket::Server wsServer(WS_PORT);
     wsServer.setOpenCallback(&openCallback);
     wsServer.setCloseCallback(&closeCallback);
     wsServer.setRequestCallback(&requestCallback);
 
+    g_dispatcher.start();
+
+    CoinQ::NetworkSelector networkSelector;
+    std::unique_ptr<SynchedVault> synchedVault;
+    if (argc > 1)
+    {
+        try
+        {
+            networkSelector.select(argv[1]);
+            const CoinQ::CoinParams& coinParams = networkSelector.getCoinParams();
+            g_vaultPool.setCoinParams(coinParams);
+
+            string dbname = argv[2];
+            string host = argv[3];
+            string port = argc > 4 ? argv[4] : coinParams.default_port();
+            string blocktreefile = (boost::filesystem::path(dbname).parent_path() / (string(coinParams.network_name()) + "_headers.dat")).string();
+
+            synchedVault.reset(new SynchedVault(coinParams));
+            g_eventPublisher.connect(*synchedVault);
+            g_eventPublisher.start();
+
+            LOGGER(debug) << "Opening vault " << dbname << "..." << endl;
+            synchedVault->openVault(dbname);
+            LOGGER(debug) << "Loading block tree " << blocktreefile << "..." << endl;
+            synchedVault->loadHeaders(blocktreefile);
+
+            // Requests for this vault share the synched vault's connection so they see what the sync writes.
+            g_vaultPool.attach(dbname, *synchedVault);
+            g_synchedDbName = dbname;
+
+            LOGGER(debug) << "Connecting to " << host << ":" << port << "..." << endl;
+            synchedVault->startSync(host, port);
+        }
+        catch (const std::exception& e)
+        {
+            LOGGER(error) << "Error starting sync: " << e.what() << endl;
+            cerr << "Error starting sync: " << e.what() << endl;
+            return 1;
+        }
+    }
+
     try 
     {
         LOGGER(debug) << "Starting websocket server on port " << WS_PORT << "..." << endl;
@@ -847,7 +1023,45 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    while (!g_bShutdown) { std::this_thread::sleep_for(std::chrono::microseconds(200)); }
+    // Sleep until a signal arrives, waking up now and then to close idle vaults.
+    boost::asio::io_service io;
+    boost::asio::signal_set signals(io, SIGINT, SIGTERM);
+    boost::asio::deadline_timer evictionTimer(io);
+
+    std::function<void(const boost::system::error_code&)> evictIdleVaults = [&](const boost::system::error_code& ec)
+    {
+        if (ec) return;
+
+        std::size_t evicted = g_vaultPool.evictIdle();
+        if (evicted) { LOGGER(debug) << "Closed " << evicted << " idle vault(s)." << endl; }
+
+        evictionTimer.expires_from_now(boost::posix_time::seconds(EVICTION_INTERVAL));
+        evictionTimer.async_wait(evictIdleVaults);
+    };
+    evictionTimer.expires_from_now(boost::posix_time::seconds(EVICTION_INTERVAL));
+    evictionTimer.async_wait(evictIdleVaults);
+
+    signals.async_wait([&](const boost::system::error_code&, int)
+    {
+        LOGGER(debug) << "Stopping..." << endl;
+        evictionTimer.cancel();
+    });
+
+    io.run();
+
+    // Requests arriving from here on are refused as busy.
+    LOGGER(debug) << "Waiting for pending requests..." << endl;
+    g_dispatcher.stop();
+
+    if (synchedVault)
+    {
+        LOGGER(debug) << "Stopping sync..." << endl;
+        synchedVault->stopSync();
+        synchedVault->clearAllSlots();
+        g_eventPublisher.stop();
+        g_vaultPool.detach(g_synchedDbName);
+        synchedVault->closeVault();
+    }
 
     try
     {
@@ -861,6 +1075,8 @@ int main(int argc, char* argv[])
         return 2;
     }
 
+    g_vaultPool.clear();
+
     return 0;
 }
 